@@ -1,4 +1,10 @@
 #version 330 core
+
+// Material variants (see GetProgramVariant) only define the features their materials use:
+#ifndef MATERIAL_VARIANT
+    #define MATERIAL_VERTEX_COLOR
+#endif
+
 layout (location = 0) in vec3 aPosition;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec4 aTangent;
@@ -7,41 +13,75 @@ layout (location = 4) in vec2 aTexcoord1;
 layout (location = 5) in vec3 aColor;
 layout (location = 6) in vec3 aJoints;
 layout (location = 7) in vec3 aWeights;
+// Per-instance model matrices. Non-instanced meshes get these through glVertexAttrib.
+layout (location = 8)  in mat4 aInstanceModel;
+layout (location = 12) in mat4 aInstanceModelLast;
 
-uniform vec4 uDiffuse;
+struct MaterialData {
+    vec4 diffuse;
+    float metallic;
+    float roughness;
+    float occlusion;
+    int stipple;
+    float stippleHardCutoff;
+    float stippleSoftCutoff;
+    ivec4 layers0; // texture array layers: diffuse, occlusion/roughness/metallic, occlusion, metallic
+    ivec2 layers1; // roughness, normal
+};
+layout(std140) uniform MaterialUniforms {
+    MaterialData uMaterials [MATERIAL_PAGE_SIZE];
+};
 
 out vec4 FragPos;
 out vec4 LastFragPos;
+flat out int vMaterial;
 out vec4 VertexColor;
 out vec2 TexCoord0;
 out vec2 TexCoord1;
 out mat3 TBN;
+// Computed exactly as in depth.vert, so depth prepass depths pass the G-buffer's equal test:
+invariant gl_Position;
 
-// FIXME: If we actually use the last model matrix, there's a bug where the computed velocity of each object is
-//   completely bogus. It's probably because we're not updating the last model matrix correctly, but I wasted half an
-//   hour tracking it down and completely failed. Let's just assume objects never move, for now.
-// uniform mat4 uMVPLast;
-uniform mat4 uModelMatrix;
-uniform mat4 uMVP;
-uniform mat4 uVPLast;
+layout(std140) uniform ViewUniforms {
+    mat4 uViewMatrix;
+    mat4 uProjMatrix;
+    mat4 uInvViewMatrix;
+    mat4 uInvProjMatrix;
+    mat4 uLastViewMatrix;
+    mat4 uLastProjMatrix;
+    mat4 uVP;
+    mat4 uVPInv;
+    mat4 uVPLast;
+    vec3 uCameraPos;
+    vec3 uCameraPosLast;
+};
 
 void main() {
-    vec4 PclipThis = uMVP * vec4(aPosition, 1.0);
-    vec4 PclipLast = uVPLast * uModelMatrix * vec4(aPosition, 1.0);
+    // The bottom row of the model matrix carries the material's index into uMaterials (see InstanceData):
+    mat4 model = aInstanceModel;
+    vMaterial = int(model[0][3]);
+    model[0][3] = 0.0;
+
+    vec4 PclipThis = uVP * model * vec4(aPosition, 1.0);
+    vec4 PclipLast = uVPLast * aInstanceModelLast * vec4(aPosition, 1.0);
     gl_Position = PclipThis;
     FragPos     = PclipThis;
     LastFragPos = PclipLast;
     TexCoord0 = aTexcoord0;
     TexCoord1 = aTexcoord1;
+    #ifdef MATERIAL_VERTEX_COLOR
     // TODO: set aColor to (1,1,1) by default, apparently OpenGL has this function
     if (aColor != vec3(0)) {
-        VertexColor = uDiffuse * vec4(aColor, 1.0);
+        VertexColor = uMaterials[vMaterial].diffuse * vec4(aColor, 1.0);
     } else {
-        VertexColor = uDiffuse;
+        VertexColor = uMaterials[vMaterial].diffuse;
     }
+    #else
+    VertexColor = uMaterials[vMaterial].diffuse;
+    #endif
     #if 0
-    mat4 worldToObject = inverse(uModelMatrix);
-    mat4 objectToWorld = uModelMatrix;
+    mat4 worldToObject = inverse(model);
+    mat4 objectToWorld = model;
     vec3 normalWorld = normalize(vec4(aNormal, 1.0) * worldToObject).xyz;
     vec3 tangentWorld = normalize(objectToWorld * aTangent).xyz;
     vec3 binormalWorld = normalize(cross(normalWorld, tangentWorld) * aTangent.w);
@@ -51,8 +91,8 @@ void main() {
     // FIXME: aTangent.w is a "sign value (-1 or +1) indicating handedness of the tangent basis"
     //   for GLTF models. I'm not sure whether multiplication or division is appropriate, or if I
     //   even have to do something here in the first place.
-    vec3 T = normalize((uModelMatrix * vec4(aTangent.xyz, 0.0) / aTangent.w).xyz);
-    vec3 N = normalize((uModelMatrix * vec4(aNormal, 0.0)).xyz);
+    vec3 T = normalize((model * vec4(aTangent.xyz, 0.0) / aTangent.w).xyz);
+    vec3 N = normalize((model * vec4(aNormal, 0.0)).xyz);
     T = normalize(T - dot(T, N) * N);
     vec3 B = cross(N, T);
     TBN = mat3(T, B, N);
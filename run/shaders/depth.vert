@@ -0,0 +1,27 @@
+#version 330 core
+// Depth-only draws (see GetDepthOnlyMaterial). Reads nothing but positions and the model matrix.
+layout (location = 0) in vec3 aPosition;
+layout (location = 8) in mat4 aInstanceModel;
+// Depth prepass depths have to match default.vert's exactly (see RenderState.depthPrepass):
+invariant gl_Position;
+
+layout(std140) uniform ViewUniforms {
+    mat4 uViewMatrix;
+    mat4 uProjMatrix;
+    mat4 uInvViewMatrix;
+    mat4 uInvProjMatrix;
+    mat4 uLastViewMatrix;
+    mat4 uLastProjMatrix;
+    mat4 uVP;
+    mat4 uVPInv;
+    mat4 uVPLast;
+    vec3 uCameraPos;
+    vec3 uCameraPosLast;
+};
+
+void main() {
+    // The bottom row of the model matrix carries a material index (see InstanceData), which isn't needed here:
+    mat4 model = aInstanceModel;
+    model[0][3] = 0.0;
+    gl_Position = uVP * model * vec4(aPosition, 1.0);
+}
@@ -2,7 +2,13 @@
 out vec4 outColor;
 in vec2 fragCoord;
 in vec2 fragCoord01;
-uniform ivec2 iResolution;
+layout(std140) uniform FrameUniforms {
+    ivec2 iResolution;
+    float iTime;
+    int iFrame;
+    vec2 uJitter;
+    vec2 uJitterLast;
+};
 
 uniform sampler2D gDepth;
 uniform sampler2D gColorLDR;
@@ -1,20 +1,27 @@
 #version 330 core
 layout(location = 0) out vec4 outColorHDR;
 
-uniform ivec2 iResolution;
-uniform float iTime;
-uniform int iFrame;
-
-uniform mat4 uViewMatrix;
-uniform mat4 uProjMatrix;
-uniform mat4 uInvViewMatrix;
-uniform mat4 uInvProjMatrix;
-uniform mat4 uLastViewMatrix;
-uniform mat4 uLastProjMatrix;
-uniform mat4 uVP;
-uniform mat4 uVPInv;
-uniform mat4 uVPLast;
-uniform vec3 uCameraPos;
+layout(std140) uniform FrameUniforms {
+    ivec2 iResolution;
+    float iTime;
+    int iFrame;
+    vec2 uJitter;
+    vec2 uJitterLast;
+};
+
+layout(std140) uniform ViewUniforms {
+    mat4 uViewMatrix;
+    mat4 uProjMatrix;
+    mat4 uInvViewMatrix;
+    mat4 uInvProjMatrix;
+    mat4 uLastViewMatrix;
+    mat4 uLastProjMatrix;
+    mat4 uVP;
+    mat4 uVPInv;
+    mat4 uVPLast;
+    vec3 uCameraPos;
+    vec3 uCameraPosLast;
+};
 
 uniform vec3 uPointLightPosition;
 uniform vec3 uPointLightColor;
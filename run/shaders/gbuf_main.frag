@@ -1,6 +1,17 @@
 #version 330 core
+
+// Material variants (see GetProgramVariant) only define the features their materials use:
+#ifndef MATERIAL_VARIANT
+    #define MATERIAL_DIFFUSE_MAP
+    #define MATERIAL_NORMAL_MAP
+    #define MATERIAL_OCC_RGH_MET_MAP
+    #define MATERIAL_SEPARATE_MAPS
+    #define MATERIAL_ALPHA_MASK
+#endif
+
 in vec4 FragPos;
 in vec4 LastFragPos;
+flat in int vMaterial;
 in vec4 VertexColor;
 in vec2 TexCoord0;
 in vec2 TexCoord1;
@@ -11,31 +22,48 @@ layout(location = 1) out vec3 outNormal;
 layout(location = 2) out vec4 outAux1;
 layout(location = 3) out vec3 outAuxHDR16;
 
-uniform vec2 iResolution;
-uniform int uStipple;
-uniform float uStippleHardCutoff;
-uniform float uStippleSoftCutoff;
-
-uniform mat4 uInvViewMatrix;
-uniform mat4 uInvProjMatrix;
-uniform mat4 uLastModelMatrix;
-uniform mat4 uLastViewMatrix;
-uniform mat4 uLastProjMatrix;
-uniform mat4 uVP;
-uniform mat4 uVPInv;
-uniform mat4 uVPLast;
-uniform vec3 uCameraPos;
-uniform vec3 uCameraPosLast;
-
-uniform float uMetallic;
-uniform float uRoughness;
-uniform float uOcclusion;
-uniform sampler2D texDiffuse;
-uniform sampler2D texNormal;
-uniform sampler2D texOccRghMet;
-uniform sampler2D texOcclusion;
-uniform sampler2D texMetallic;
-uniform sampler2D texRoughness;
+layout(std140) uniform FrameUniforms {
+    ivec2 iResolution;
+    float iTime;
+    int iFrame;
+    vec2 uJitter;
+    vec2 uJitterLast;
+};
+struct MaterialData {
+    vec4 diffuse;
+    float metallic;
+    float roughness;
+    float occlusion;
+    int stipple;
+    float stippleHardCutoff;
+    float stippleSoftCutoff;
+    ivec4 layers0; // texture array layers: diffuse, occlusion/roughness/metallic, occlusion, metallic
+    ivec2 layers1; // roughness, normal
+};
+layout(std140) uniform MaterialUniforms {
+    MaterialData uMaterials [MATERIAL_PAGE_SIZE];
+};
+
+layout(std140) uniform ViewUniforms {
+    mat4 uViewMatrix;
+    mat4 uProjMatrix;
+    mat4 uInvViewMatrix;
+    mat4 uInvProjMatrix;
+    mat4 uLastViewMatrix;
+    mat4 uLastProjMatrix;
+    mat4 uVP;
+    mat4 uVPInv;
+    mat4 uVPLast;
+    vec3 uCameraPos;
+    vec3 uCameraPosLast;
+};
+
+uniform sampler2DArray texDiffuse;
+uniform sampler2DArray texNormal;
+uniform sampler2DArray texOccRghMet;
+uniform sampler2DArray texOcclusion;
+uniform sampler2DArray texMetallic;
+uniform sampler2DArray texRoughness;
 
 uniform sampler2D gDepth;
 uniform sampler2D gColorLDR;
@@ -154,15 +182,22 @@ vec4 srgbToLinear (vec4 sRGB) {
 // Main shader:
 
 void main() {
+    MaterialData m = uMaterials[vMaterial];
+
     // NOTE: GLSL spec says all diffuse colour values are stored as sRGB
-    vec4 diffuse = srgbToLinear(VertexColor * texture(texDiffuse, TexCoord0));
+    vec4 diffuse = VertexColor;
+    #ifdef MATERIAL_DIFFUSE_MAP
+        diffuse *= texture(texDiffuse, vec3(TexCoord0, m.layers0.x));
+    #endif
+    diffuse = srgbToLinear(diffuse);
 
-    if (uStipple != 0) {
-        if (diffuse.a < uStippleHardCutoff) {
+    #ifdef MATERIAL_ALPHA_MASK
+    if (m.stipple != 0) {
+        if (diffuse.a < m.stippleHardCutoff) {
             discard;
         }
-        if (diffuse.a < uStippleSoftCutoff) {
-            float a = (diffuse.a - uStippleHardCutoff) / (uStippleSoftCutoff - uStippleHardCutoff);
+        if (diffuse.a < m.stippleSoftCutoff) {
+            float a = (diffuse.a - m.stippleHardCutoff) / (m.stippleSoftCutoff - m.stippleHardCutoff);
             #if 0
                 int xm = int(mod(gl_FragCoord.x, 4));
                 int ym = int(mod(gl_FragCoord.y, 4));
@@ -178,15 +213,27 @@ void main() {
             // diffuse = vec4(treshold);
         }
     }
+    #endif
 
     // We don't support occlusion yet.
-    // float occlusion = uOcclusion * texture(texOccRghMet, TexCoord0).r * texture(texOcclusion, TexCoord0).r;
+    // float occlusion = m.occlusion * texture(texOccRghMet, vec3(TexCoord0, m.layers0.y)).r *
+    //     texture(texOcclusion, vec3(TexCoord0, m.layers0.z)).r;
 
-    float roughness = uRoughness * texture(texOccRghMet, TexCoord0).g * texture(texRoughness, TexCoord0).r;
-    float metallic  = uMetallic  * texture(texOccRghMet, TexCoord0).b * texture(texMetallic,  TexCoord0).r;
+    float roughness = m.roughness;
+    float metallic  = m.metallic;
+    #ifdef MATERIAL_OCC_RGH_MET_MAP
+        vec3 occRghMet = texture(texOccRghMet, vec3(TexCoord0, m.layers0.y)).rgb;
+        roughness *= occRghMet.g;
+        metallic  *= occRghMet.b;
+    #endif
+    #ifdef MATERIAL_SEPARATE_MAPS
+        roughness *= texture(texRoughness, vec3(TexCoord0, m.layers1.x)).r;
+        metallic  *= texture(texMetallic,  vec3(TexCoord0, m.layers0.w)).r;
+    #endif
 
     vec3 Nvertex = TBN[2];
-    vec3 Ntexture = texture(texNormal, TexCoord0).rgb;
+    #ifdef MATERIAL_NORMAL_MAP
+    vec3 Ntexture = texture(texNormal, vec3(TexCoord0, m.layers1.y)).rgb;
     // NOTE: For models with no normal texture, we end up reading from a 1x1 white texture. If this
     //   is the case here, just use the vertex normal we generate in default.vert -- which is a
     //   world-space normal and not a tangent-space one -- instead of going through the whole
@@ -196,6 +243,9 @@ void main() {
     } else {
         outNormal = normalize(TBN * normalize(Ntexture * 2.0 - 1.0));
     }
+    #else
+    outNormal = Nvertex;
+    #endif
 
     // Compute velocity in UV space:
     // https://john-chapman-graphics.blogspot.com/2013/01/per-object-motion-blur.html
@@ -2,7 +2,13 @@
 in vec2 fragCoordClip;
 in vec2 fragCoord01;
 layout(location = 0) out vec4 outColor;
-uniform vec2 iResolution;
+layout(std140) uniform FrameUniforms {
+    ivec2 iResolution;
+    float iTime;
+    int iFrame;
+    vec2 uJitter;
+    vec2 uJitterLast;
+};
 uniform sampler2D texEnvmap;
 uniform mat4 uEnvmapDirection;
 
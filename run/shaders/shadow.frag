@@ -1,13 +1,31 @@
 #version 330 core
+
+// Material variants (see GetProgramVariant) only define the features their materials use:
+#ifndef MATERIAL_VARIANT
+    #define MATERIAL_DIFFUSE_MAP
+    #define MATERIAL_ALPHA_MASK
+#endif
+
 in vec4 FragPos;
 in vec2 TexCoord0;
+flat in int vMaterial;
 
-uniform int uStipple;
-uniform float uStippleHardCutoff;
-uniform float uStippleSoftCutoff;
-uniform vec4 uDiffuse;
+struct MaterialData {
+    vec4 diffuse;
+    float metallic;
+    float roughness;
+    float occlusion;
+    int stipple;
+    float stippleHardCutoff;
+    float stippleSoftCutoff;
+    ivec4 layers0; // texture array layers: diffuse, occlusion/roughness/metallic, occlusion, metallic
+    ivec2 layers1; // roughness, normal
+};
+layout(std140) uniform MaterialUniforms {
+    MaterialData uMaterials [MATERIAL_PAGE_SIZE];
+};
 
-uniform sampler2D texDiffuse;
+uniform sampler2DArray texDiffuse;
 
 // https://github.com/hughsk/glsl-dither/blob/master/2x2.glsl
 
@@ -28,16 +46,22 @@ float dither2x2(vec2 position, float brightness) {
 }
 
 void main() {
-    vec4 diffuse = uDiffuse * texture(texDiffuse, TexCoord0);
-    if (uStipple != 0) {
-        if (diffuse.a < uStippleHardCutoff) {
+    #ifdef MATERIAL_ALPHA_MASK
+    MaterialData m = uMaterials[vMaterial];
+    vec4 diffuse = m.diffuse;
+    #ifdef MATERIAL_DIFFUSE_MAP
+        diffuse *= texture(texDiffuse, vec3(TexCoord0, m.layers0.x));
+    #endif
+    if (m.stipple != 0) {
+        if (diffuse.a < m.stippleHardCutoff) {
             discard;
         }
-        if (diffuse.a < uStippleSoftCutoff) {
-            float a = (diffuse.a - uStippleHardCutoff) / (uStippleSoftCutoff - uStippleHardCutoff);
+        if (diffuse.a < m.stippleSoftCutoff) {
+            float a = (diffuse.a - m.stippleHardCutoff) / (m.stippleSoftCutoff - m.stippleHardCutoff);
             if (dither2x2(gl_FragCoord.xy, a) < 0.5) {
                 discard;
             }
         }
     }
+    #endif
 }
\ No newline at end of file
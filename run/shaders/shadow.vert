@@ -1,16 +1,33 @@
 #version 330 core
 layout (location = 0) in vec3 aPosition;
 layout (location = 3) in vec2 aTexcoord0;
+layout (location = 8) in mat4 aInstanceModel;
 
 out vec4 FragPos;
 out vec2 TexCoord0;
+flat out int vMaterial;
 
-uniform mat4 uModelMatrix;
-uniform mat4 uViewMatrix;
-uniform mat4 uProjMatrix;
+layout(std140) uniform ViewUniforms {
+    mat4 uViewMatrix;
+    mat4 uProjMatrix;
+    mat4 uInvViewMatrix;
+    mat4 uInvProjMatrix;
+    mat4 uLastViewMatrix;
+    mat4 uLastProjMatrix;
+    mat4 uVP;
+    mat4 uVPInv;
+    mat4 uVPLast;
+    vec3 uCameraPos;
+    vec3 uCameraPosLast;
+};
 
 void main() {
-    vec4 PclipThis = uProjMatrix * uViewMatrix * uModelMatrix * vec4(aPosition, 1.0);
+    // The bottom row of the model matrix carries the material's index into uMaterials (see InstanceData):
+    mat4 model = aInstanceModel;
+    vMaterial = int(model[0][3]);
+    model[0][3] = 0.0;
+
+    vec4 PclipThis = uProjMatrix * uViewMatrix * model * vec4(aPosition, 1.0);
     gl_Position = PclipThis;
     TexCoord0 = aTexcoord0;
 }
\ No newline at end of file
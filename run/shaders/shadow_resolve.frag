@@ -3,11 +3,13 @@ out vec4 outAux1;
 in vec2 fragCoordClip;
 in vec2 fragCoord01;
 
-uniform ivec2 iResolution;
-uniform float iTime;
-uniform int iFrame;
-uniform vec2 uJitter;
-uniform vec2 uJitterLast;
+layout(std140) uniform FrameUniforms {
+    ivec2 iResolution;
+    float iTime;
+    int iFrame;
+    vec2 uJitter;
+    vec2 uJitterLast;
+};
 
 uniform sampler2D gColorLDR;
 uniform sampler2D gColorHDR;
@@ -19,15 +21,19 @@ uniform sampler2D gDepth;
 uniform sampler2D gShadow;
 
 uniform vec3 uSunPosition;
-uniform mat4 uInvViewMatrix;
-uniform mat4 uInvProjMatrix;
-uniform mat4 uLastViewMatrix;
-uniform mat4 uLastProjMatrix;
-uniform mat4 uVP;
-uniform mat4 uVPInv;
-uniform mat4 uVPLast;
-uniform vec3 uCameraPos;
-uniform vec3 uCameraPosLast;
+layout(std140) uniform ViewUniforms {
+    mat4 uViewMatrix;
+    mat4 uProjMatrix;
+    mat4 uInvViewMatrix;
+    mat4 uInvProjMatrix;
+    mat4 uLastViewMatrix;
+    mat4 uLastProjMatrix;
+    mat4 uVP;
+    mat4 uVPInv;
+    mat4 uVPLast;
+    vec3 uCameraPos;
+    vec3 uCameraPosLast;
+};
 
 uniform mat4 uShadowVPMatrix;
 uniform float uShadowBiasMin;
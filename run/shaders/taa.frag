@@ -3,7 +3,13 @@ out vec4 outColorHDR;
 in vec2 fragCoordClip;
 in vec2 fragCoord01;
 
-uniform ivec2 iResolution;
+layout(std140) uniform FrameUniforms {
+    ivec2 iResolution;
+    float iTime;
+    int iFrame;
+    vec2 uJitter;
+    vec2 uJitterLast;
+};
 
 uniform sampler2D gDepth;
 uniform sampler2D gColorLDR;
@@ -17,8 +23,6 @@ uniform sampler2D gAuxDepth;
 uniform sampler2D gShadow;
 
 // Add 0.5*uJitter to UV coordinates to unjitter (well, somewhat).
-uniform vec2 uJitter;
-uniform vec2 uJitterLast;
 
 uniform float kClampSampleDist;
 uniform float kFeedbackFactor;
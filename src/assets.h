@@ -12,15 +12,34 @@
     X(GL_FRAGMENT_SHADER,   FSH_SHADOW,             "shaders/shadow.frag") \
     X(GL_FRAGMENT_SHADER,   FSH_SHADOW_RESOLVE,     "shaders/shadow_resolve.frag") \
     X(GL_FRAGMENT_SHADER,   FSH_TAA,                "shaders/taa.frag") \
+    X(GL_VERTEX_SHADER,     VSH_DEPTH,              "shaders/depth.vert") \
+    X(GL_FRAGMENT_SHADER,   FSH_DEPTH,              "shaders/depth.frag") \
+
+// Syntax for programs:
+// X(program global name, vertex shader, fragment shader, material features the program has variants for)
+// See GetProgramVariant in render/program.h.
 
 #define XM_PROGRAMS \
-    X(PROG_GBUF_MAIN,           VSH_DEFAULT,            FSH_GBUF_MAIN) \
-    X(PROG_SHADOW,              VSH_SHADOW,             FSH_SHADOW) \
-    X(PROG_GBUF_LIGHT_MAIN,     VSH_FULLSCREEN_PASS,    FSH_GBUF_LIGHT_MAIN) \
-    X(PROG_GBUF_LIGHT_POINT,    VSH_DEFAULT,            FSH_GBUF_LIGHT_POINT) \
-    X(PROG_SHADOW_RESOLVE,      VSH_FULLSCREEN_PASS,    FSH_SHADOW_RESOLVE) \
-    X(PROG_FINAL,               VSH_FULLSCREEN_PASS,    FSH_FINAL) \
-    X(PROG_TAA,                 VSH_FULLSCREEN_PASS,    FSH_TAA) \
+    X(PROG_GBUF_MAIN,           VSH_DEFAULT,            FSH_GBUF_MAIN,         MATFEAT_ALL) \
+    X(PROG_SHADOW,              VSH_SHADOW,             FSH_SHADOW,            MATFEAT_DIFFUSE_MAP|MATFEAT_ALPHA_MASK) \
+    X(PROG_GBUF_LIGHT_MAIN,     VSH_FULLSCREEN_PASS,    FSH_GBUF_LIGHT_MAIN,   0) \
+    X(PROG_GBUF_LIGHT_POINT,    VSH_DEFAULT,            FSH_GBUF_LIGHT_POINT,  0) \
+    X(PROG_SHADOW_RESOLVE,      VSH_FULLSCREEN_PASS,    FSH_SHADOW_RESOLVE,    0) \
+    X(PROG_FINAL,               VSH_FULLSCREEN_PASS,    FSH_FINAL,             0) \
+    X(PROG_TAA,                 VSH_FULLSCREEN_PASS,    FSH_TAA,               0) \
+    X(PROG_DEPTH,               VSH_DEPTH,              FSH_DEPTH,             0) \
+
+// Syntax for material features:
+// X(feature global name, bit, GLSL define)
+// Shaders written for material variants include a feature's code only if its define is set, see GetProgramVariant.
+
+#define XM_MATERIAL_FEATURES \
+    X(MATFEAT_DIFFUSE_MAP,      0x01, "MATERIAL_DIFFUSE_MAP")     \
+    X(MATFEAT_NORMAL_MAP,       0x02, "MATERIAL_NORMAL_MAP")      \
+    X(MATFEAT_OCC_RGH_MET_MAP,  0x04, "MATERIAL_OCC_RGH_MET_MAP") \
+    X(MATFEAT_SEPARATE_MAPS,    0x08, "MATERIAL_SEPARATE_MAPS")   \
+    X(MATFEAT_ALPHA_MASK,       0x10, "MATERIAL_ALPHA_MASK")      \
+    X(MATFEAT_VERTEX_COLOR,     0x20, "MATERIAL_VERTEX_COLOR")    \
 
 // Syntax for attributes:
 // X(location global name, layout location index, GLSL name, GLTF name)
@@ -37,6 +56,23 @@
     X(ATTR_JOINTS,      6, "aJoints",    "JOINTS_0")    \
     X(ATTR_WEIGHTS,     7, "aWeights",   "WEIGHTS_0")   \
 
+// Syntax for per-instance attributes:
+// X(location global name, layout location index, GLSL name)
+// These are read from the instance buffer (see InstanceData in render.h). Matrices take up four locations each.
+
+#define XM_PROGRAM_INSTANCE_ATTRIBUTES \
+    X(ATTR_INSTANCE_MODEL,      8,  "aInstanceModel")     \
+    X(ATTR_INSTANCE_MODEL_LAST, 12, "aInstanceModelLast") \
+
+// Syntax for uniform blocks:
+// X(binding point global name, binding point index, GLSL block name)
+// Their contents are filled from the std140 structs in render.h (FrameUniforms etc.), not through XM_PROGRAM_UNIFORMS.
+
+#define XM_PROGRAM_UNIFORM_BLOCKS \
+    X(UBO_FRAME,     0, "FrameUniforms")    \
+    X(UBO_VIEW,      1, "ViewUniforms")     \
+    X(UBO_MATERIALS, 2, "MaterialUniforms") \
+
 // Syntax for uniforms:
 // X(location global name, GLSL name)
 // NOTE: the UNIF_RT uniform variable names should match the render target names defined below
@@ -53,14 +89,7 @@
     X(UNIF_RT_AUX_DEPTH,    "gAuxDepth") \
     X(UNIF_RT_SHADOW_DEPTH, "gShadow") \
 \
-    X(UNIF_IRESOLUTION,  "iResolution") \
-    X(UNIF_ITIME,        "iTime") \
-    X(UNIF_IFRAME,       "iFrame") \
     X(UNIF_BLUENOISE_64, "texBlueNoise64") \
-\
-    X(UNIF_STIPPLE,             "uStipple") \
-    X(UNIF_STIPPLE_HARD_CUTOFF, "uStippleHardCutoff") \
-    X(UNIF_STIPPLE_SOFT_CUTOFF, "uStippleSoftCutoff") \
 \
     X(UNIF_AMBIENT_CUBE,         "uAmbientCube") \
     X(UNIF_SUN_POSITION,         "uSunPosition") \
@@ -68,26 +97,6 @@
     X(UNIF_POINTLIGHT_POSITION,  "uPointLightPosition") \
     X(UNIF_POINTLIGHT_COLOR,     "uPointLightColor") \
 \
-    X(UNIF_MODEL_MATRIX,    "uModelMatrix") \
-    X(UNIF_VIEW_MATRIX,     "uViewMatrix") \
-    X(UNIF_PROJ_MATRIX,     "uProjMatrix") \
-    X(UNIF_INV_VIEW_MATRIX, "uInvViewMatrix") \
-    X(UNIF_INV_PROJ_MATRIX, "uInvProjMatrix") \
-    X(UNIF_LAST_MODEL_MATRIX, "uLastModelMatrix") \
-    X(UNIF_LAST_VIEW_MATRIX,  "uLastViewMatrix") \
-    X(UNIF_LAST_PROJ_MATRIX,  "uLastProjMatrix") \
-\
-    X(UNIF_MVP,      "uMVP") \
-    X(UNIF_MVP_LAST, "uMVPLast") \
-    X(UNIF_VP,       "uVP") \
-    X(UNIF_VP_INV,   "uVPInv") \
-    X(UNIF_VP_LAST,  "uVPLast") \
-\
-    X(UNIF_CAMERA_POS,      "uCameraPos") \
-    X(UNIF_CAMERA_POS_LAST, "uCameraPosLast") \
-\
-    X(UNIF_JITTER,               "uJitter") \
-    X(UNIF_JITTER_LAST,          "uJitterLast") \
     X(UNIF_JITTER_MATRIX,        "uJitterMatrix") \
     X(UNIF_LAST_JITTER_MATRIX,   "uLastJitterMatrix") \
     X(UNIF_UNJITTER_MATRIX,      "uUnjitterMatrix") \
@@ -97,10 +106,6 @@
     X(UNIF_SHADOW_BIAS_MAX,   "uShadowBiasMax") \
     X(UNIF_SHADOW_VP_MATRIX,  "uShadowVPMatrix") \
 \
-    X(UNIF_CONST_DIFFUSE,   "uDiffuse") \
-    X(UNIF_CONST_OCCLUSION, "uOcclusion") \
-    X(UNIF_CONST_METALLIC,  "uMetallic") \
-    X(UNIF_CONST_ROUGHNESS, "uRoughness") \
     X(UNIF_TEX_DIFFUSE,     "texDiffuse") \
     X(UNIF_TEX_OCC_RGH_MET, "texOccRghMet") \
     X(UNIF_TEX_OCCLUSION,   "texOcclusion") \
@@ -161,6 +166,8 @@
 // Syntax for render targets:
 // X(name, format)
 // NOTE: render target names should match their corresponding UNIF_RT uniform variable names
+// Screen and shadow targets are declared to the render graph every frame (see render/graph.h). These tables give the
+// formats and texture units (TEXUNIT_*) they're read through; which texture backs them is up to the graph.
 
 #define XM_RENDERTARGETS_SCREEN \
     X(RT_DEPTH,         GL_DEPTH_COMPONENT32F) \
@@ -180,68 +187,4 @@
     X(RT_ENVMAP_DEPTH, GL_DEPTH_COMPONENT16) \
     X(RT_ENVMAP_COLOR, GL_RGB16F) \
 
-// Syntax for framebuffers:
-// [BEGIN|END](framebuffer name)
-// [COLOR|DEPTH](attachment point, render target name)
-// Framebuffers can only have one depth attachment.
-
-#define XM_FRAMEBUFFERS \
-    BEGIN(FB_ALL) \
-        DEPTH(GL_DEPTH_ATTACHMENT, RT_DEPTH) \
-        COLOR(GL_COLOR_ATTACHMENT0, RT_COLOR_LDR) \
-        COLOR(GL_COLOR_ATTACHMENT1, RT_COLOR_HDR) \
-        COLOR(GL_COLOR_ATTACHMENT2, RT_NORMAL) \
-        COLOR(GL_COLOR_ATTACHMENT3, RT_AUX_HDR11) \
-        COLOR(GL_COLOR_ATTACHMENT4, RT_AUX_HDR16) \
-        COLOR(GL_COLOR_ATTACHMENT5, RT_AUX1) \
-        COLOR(GL_COLOR_ATTACHMENT6, RT_AUX2) \
-    END(FB_ALL) \
-\
-    BEGIN(FB_GBUFFER) \
-        DEPTH(GL_DEPTH_ATTACHMENT, RT_DEPTH) \
-        COLOR(GL_COLOR_ATTACHMENT0, RT_COLOR_LDR) \
-        COLOR(GL_COLOR_ATTACHMENT1, RT_NORMAL) \
-        COLOR(GL_COLOR_ATTACHMENT2, RT_AUX1) \
-        COLOR(GL_COLOR_ATTACHMENT3, RT_AUX_HDR16) \
-        COLOR(GL_COLOR_ATTACHMENT4, RT_AUX2) \
-    END(FB_GBUFFER) \
-\
-    BEGIN(FB_AUX1_ONLY) \
-        COLOR(GL_COLOR_ATTACHMENT0, RT_AUX1) \
-    END(FB_AUX1_ONLY) \
-\
-    BEGIN(FB_AUX2_ONLY) \
-        COLOR(GL_COLOR_ATTACHMENT0, RT_AUX2) \
-    END(FB_AUX2_ONLY) \
-\
-    BEGIN(FB_ONLY_COLOR_HDR) \
-        DEPTH(GL_DEPTH_ATTACHMENT, RT_DEPTH) \
-        COLOR(GL_COLOR_ATTACHMENT0, RT_COLOR_HDR) \
-        COLOR(GL_COLOR_ATTACHMENT1, RT_AUX2) \
-    END(FB_ONLY_COLOR_HDR) \
-\
-    BEGIN(FB_ONLY_COLOR_HDR_NO_AUX) \
-        DEPTH(GL_DEPTH_ATTACHMENT, RT_DEPTH) \
-        COLOR(GL_COLOR_ATTACHMENT0, RT_COLOR_HDR) \
-    END(FB_ONLY_COLOR_HDR_NO_AUX) \
-\
-    BEGIN(FB_ONLY_COLOR_LDR) \
-        DEPTH(GL_DEPTH_ATTACHMENT, RT_DEPTH) \
-        COLOR(GL_COLOR_ATTACHMENT0, RT_COLOR_LDR) \
-        COLOR(GL_COLOR_ATTACHMENT1, RT_AUX2) \
-    END(FB_ONLY_COLOR_LDR) \
-\
-    BEGIN(FB_TAA) \
-        DEPTH(GL_DEPTH_ATTACHMENT, RT_DEPTH) \
-        COLOR(GL_COLOR_ATTACHMENT0, RT_COLOR_HDR) \
-    END(FB_TAA) \
-\
-    BEGIN(FB_TAA_COPY) \
-        COLOR(GL_COLOR_ATTACHMENT0, RT_AUX_HDR11) \
-    END(FB_TAA_COPY) \
-\
-    BEGIN(FB_SHADOW) \
-        DEPTH(GL_DEPTH_ATTACHMENT, RT_SHADOW_DEPTH) \
-    END(FB_SHADOW) \
-
 // Previous line intentionally left blank.
\ No newline at end of file
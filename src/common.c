@@ -12,7 +12,12 @@
     #include <malloc/malloc.h>
     #include <sys/stat.h>
     #include <sys/types.h>
+    #include <sys/mman.h>
+    #include <fcntl.h>
     #include <dirent.h>
+    #include <unistd.h>
+    #include <pthread.h>
+    #include <sched.h>
     // #include <mach-o/dyld.h>
     // #include <copyfile.h>
 #else
@@ -20,7 +25,11 @@
     #include <unistd.h>
     #include <sys/stat.h>
     #include <sys/types.h>
+    #include <sys/mman.h>
+    #include <fcntl.h>
     #include <dirent.h>
+    #include <pthread.h>
+    #include <sched.h>
     // #include <dlfcn.h>
 #endif
 
@@ -99,12 +108,24 @@ void vxEnableLogBuffer() {
     vxLogBufEnabled = true;
 }
 
+// Background threads log too, so printing and the frame log buffer are guarded by a spinlock. Messages are rare and
+// short, so it's never held for long.
+static volatile int32_t vxLogLock = 0;
+static void vxi_LockLog() {
+    while (vxAtomicExchange32(&vxLogLock, 1) != 0) {}
+}
+static void vxi_UnlockLog() {
+    vxAtomicStore32(&vxLogLock, 0);
+}
+
 // Sets the current log destination to stdout.
 void vxDisableLogBuffer() {
+    vxi_LockLog();
     vxLogBufPrint();
     vxLogBufEnabled = false;
     vxLogBufUsed = 0;
     vxLogBuf[0] = 0;
+    vxi_UnlockLog();
 }
 
 // Prints a message to the current log destination (either stdout or the frame log buffer).
@@ -121,6 +142,7 @@ void vxLogPrint (const char* location, const char* fmt, ...) {
     s = strstr(location, "include\\"); if (s != NULL) { location = s + 8; };
     va_list va;
     va_start(va, fmt);
+    vxi_LockLog();
     if (vxLogBufEnabled) {
         // Log message to buffer:
         vxLogBufUsed += (size_t) stbsp_snprintf (vxLogBuf + vxLogBufUsed,
@@ -140,6 +162,7 @@ void vxLogPrint (const char* location, const char* fmt, ...) {
         buf[written] = 0;
         vxPutStrLn(buf);
     }
+    vxi_UnlockLog();
     va_end(va);
 }
 
@@ -213,6 +236,80 @@ char* vxReadFile (const char* filename, const char* mode, size_t* outLength) {
     return buf;
 }
 
+// Maps a file into memory for reading, without copying it. Returns false (and logs a warning) if the file can't be
+// opened or mapped. Empty files map successfully, with NULL data. Release the mapping with vxUnmapFile.
+bool vxMapFile (const char* filename, vxMappedFile* file) {
+    memset(file, 0, sizeof(vxMappedFile));
+    #ifdef _WIN32
+        HANDLE handle = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (handle == INVALID_HANDLE_VALUE) {
+            vxLog("Warning: couldn't open file %s (error %lu)", filename, GetLastError());
+            return false;
+        }
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(handle, &size)) {
+            vxLog("Warning: couldn't get size of file %s (error %lu)", filename, GetLastError());
+            CloseHandle(handle);
+            return false;
+        }
+        file->size = (size_t) size.QuadPart;
+        if (file->size > 0) {
+            HANDLE mapping = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+            if (mapping != NULL) {
+                file->data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+                CloseHandle(mapping); // the view keeps the mapping alive
+            }
+            if (file->data == NULL) {
+                vxLog("Warning: couldn't map file %s (error %lu)", filename, GetLastError());
+                CloseHandle(handle);
+                return false;
+            }
+        }
+        file->handle = handle;
+    #else
+        int fd = open(filename, O_RDONLY);
+        if (fd < 0) {
+            vxLog("Warning: couldn't open file %s (%s)", filename, strerror(errno));
+            return false;
+        }
+        struct stat statbuf;
+        if (fstat(fd, &statbuf) != 0) {
+            vxLog("Warning: couldn't get size of file %s (%s)", filename, strerror(errno));
+            close(fd);
+            return false;
+        }
+        file->size = (size_t) statbuf.st_size;
+        if (file->size > 0) {
+            void* data = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data == MAP_FAILED) {
+                vxLog("Warning: couldn't map file %s (%s)", filename, strerror(errno));
+                close(fd);
+                return false;
+            }
+            file->data = data;
+        }
+        close(fd); // the mapping stays valid
+    #endif
+    return true;
+}
+
+void vxUnmapFile (vxMappedFile* file) {
+    #ifdef _WIN32
+        if (file->data != NULL) {
+            UnmapViewOfFile(file->data);
+        }
+        if (file->handle != NULL) {
+            CloseHandle((HANDLE) file->handle);
+        }
+    #else
+        if (file->data != NULL) {
+            munmap((void*) file->data, file->size);
+        }
+    #endif
+    memset(file, 0, sizeof(vxMappedFile));
+}
+
 // Creates a directory. Does not create intermediate directories.
 // TODO: Error handling, Mac/Linux implementation.
 void vxCreateDirectory (const char* path) {
@@ -223,6 +320,22 @@ void vxCreateDirectory (const char* path) {
     #endif
 }
 
+// Renames a file, replacing the destination if it exists. Returns false (and logs a warning) on failure.
+bool vxReplaceFile (const char* from, const char* to) {
+    #ifdef _WIN32
+        if (!MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+            vxLog("Warning: couldn't move %s to %s (error %lu)", from, to, GetLastError());
+            return false;
+        }
+    #else
+        if (rename(from, to) != 0) {
+            vxLog("Warning: couldn't move %s to %s (%s)", from, to, strerror(errno));
+            return false;
+        }
+    #endif
+    return true;
+}
+
 // Returns the last modification time for the given file or directory, or 0 if the given path does
 // not point to a valid filesystem object.
 uint64_t vxGetFileMtime (const char* path) {
@@ -324,6 +437,654 @@ static bool vxi_ListFiles_NameMatchesPattern (const char* name, const char* patt
     return strstr(name, pattern) != NULL;
 }
 
+// Threads are started with a small heap-allocated trampoline, since the platform entry points have different
+// signatures than vxThreadFunc.
+typedef struct vxi_ThreadStart {
+    vxThreadFunc func;
+    void* user;
+    #ifdef _WIN32
+        HANDLE handle;
+    #else
+        pthread_t handle;
+    #endif
+} vxi_ThreadStart;
+
+#ifdef _WIN32
+    static DWORD WINAPI vxi_ThreadMain (LPVOID param) {
+        vxi_ThreadStart* start = (vxi_ThreadStart*) param;
+        start->func(start->user);
+        return 0;
+    }
+#else
+    static void* vxi_ThreadMain (void* param) {
+        vxi_ThreadStart* start = (vxi_ThreadStart*) param;
+        start->func(start->user);
+        return NULL;
+    }
+#endif
+
+// Starts a thread running func(user). Returns false (and logs a warning) if the thread can't be created. Every
+// started thread has to be joined with vxJoinThread.
+bool vxStartThread (vxThread* thread, vxThreadFunc func, void* user) {
+    vxi_ThreadStart* start = (vxi_ThreadStart*) malloc(sizeof(vxi_ThreadStart));
+    start->func = func;
+    start->user = user;
+    thread->handle = NULL;
+    #ifdef _WIN32
+        start->handle = CreateThread(NULL, 0, vxi_ThreadMain, start, 0, NULL);
+        if (start->handle == NULL) {
+            vxLog("Warning: couldn't start thread (error %lu)", GetLastError());
+            free(start);
+            return false;
+        }
+    #else
+        int err = pthread_create(&start->handle, NULL, vxi_ThreadMain, start);
+        if (err != 0) {
+            vxLog("Warning: couldn't start thread (%s)", strerror(err));
+            free(start);
+            return false;
+        }
+    #endif
+    thread->handle = start;
+    return true;
+}
+
+// Waits for a thread to finish. Does nothing for threads that failed to start or were already joined.
+void vxJoinThread (vxThread* thread) {
+    vxi_ThreadStart* start = (vxi_ThreadStart*) thread->handle;
+    if (start == NULL) { return; }
+    #ifdef _WIN32
+        WaitForSingleObject(start->handle, INFINITE);
+        CloseHandle(start->handle);
+    #else
+        pthread_join(start->handle, NULL);
+    #endif
+    free(start);
+    thread->handle = NULL;
+}
+
+int32_t vxAtomicLoad32 (volatile int32_t* value) {
+    #ifdef _WIN32
+        return (int32_t) InterlockedCompareExchange((volatile LONG*) value, 0, 0);
+    #else
+        return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+    #endif
+}
+
+void vxAtomicStore32 (volatile int32_t* value, int32_t x) {
+    #ifdef _WIN32
+        InterlockedExchange((volatile LONG*) value, (LONG) x);
+    #else
+        __atomic_store_n(value, x, __ATOMIC_RELEASE);
+    #endif
+}
+
+int32_t vxAtomicExchange32 (volatile int32_t* value, int32_t x) {
+    #ifdef _WIN32
+        return (int32_t) InterlockedExchange((volatile LONG*) value, (LONG) x);
+    #else
+        return __atomic_exchange_n(value, x, __ATOMIC_ACQ_REL);
+    #endif
+}
+
+int32_t vxAtomicAdd32 (volatile int32_t* value, int32_t x) {
+    #ifdef _WIN32
+        return (int32_t) InterlockedAdd((volatile LONG*) value, (LONG) x);
+    #else
+        return __atomic_add_fetch(value, x, __ATOMIC_SEQ_CST);
+    #endif
+}
+
+int vxCoreCount () {
+    #ifdef _WIN32
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        return (int) info.dwNumberOfProcessors;
+    #else
+        return (int) sysconf(_SC_NPROCESSORS_ONLN);
+    #endif
+}
+
+// Job system. Every pool thread owns a spinlocked queue: the owner pushes and pops at the bottom, so it keeps working
+// on its most recent (cache-warm) jobs, while thieves take the oldest jobs from the top. Idle workers yield for a
+// while and then sleep until jobs are queued. Main thread jobs have a queue of their own that only the main thread
+// looks at, and they don't count towards vxi_Jobs.queued, so they never wake up the workers.
+//
+// Background jobs go into a list of their own, which workers only look at when there's nothing else to do. Threads
+// waiting in vxWaitForJobs never take them, except for jobs of the counter they're waiting for, so a frame that waits
+// for its own short jobs can't end up running a long file read.
+
+#define VXI_JOB_QUEUE_SIZE 4096
+#define VXI_JOB_IDLE_SPINS 256
+
+typedef struct vxi_JobQueue {
+    volatile int32_t lock;
+    uint32_t top;    // jobs [top, bottom) are queued, wrapping around the ring
+    uint32_t bottom;
+    vxJob jobs [VXI_JOB_QUEUE_SIZE];
+} vxi_JobQueue;
+
+typedef struct vxi_WaitingJob {
+    vxJob job;
+    struct vxi_WaitingJob* next;
+} vxi_WaitingJob;
+
+static struct {
+    volatile int32_t running;
+    int threadCount;            // main thread and workers
+    vxi_JobQueue* queues;       // one per thread, queues[0] belongs to the main thread
+    vxi_JobQueue mainQueue;
+    volatile int32_t backgroundLock;
+    vxi_WaitingJob* backgroundFirst; // background jobs, oldest first
+    vxi_WaitingJob* backgroundLast;
+    volatile int32_t backgroundQueued;
+    vxThread* threads;          // threads[0] is unused
+    volatile int32_t queued;    // jobs in all queues but mainQueue, can briefly go negative
+    volatile int32_t mainQueued;
+    volatile int32_t sleeping;
+    volatile int32_t quit;
+    volatile int32_t nextQueue; // round robin for jobs submitted from threads outside the pool
+    vxJobHook hook;
+    #ifdef _WIN32
+        SRWLOCK mutex;
+        CONDITION_VARIABLE wake;
+        CONDITION_VARIABLE mainWake;
+    #else
+        pthread_mutex_t mutex;
+        pthread_cond_t wake;
+        pthread_cond_t mainWake;
+    #endif
+} vxi_Jobs;
+
+// Index of the current thread in the pool, -1 for threads outside of it.
+#ifdef _MSC_VER
+    static __declspec(thread) int vxi_JobThread = -1;
+#else
+    static _Thread_local int vxi_JobThread = -1;
+#endif
+
+static void vxi_ExecuteJob (const vxJob* job);
+
+static void vxi_Lock (volatile int32_t* lock) {
+    while (vxAtomicExchange32(lock, 1) != 0) {}
+}
+
+static void vxi_Unlock (volatile int32_t* lock) {
+    vxAtomicStore32(lock, 0);
+}
+
+static void vxi_Yield () {
+    #ifdef _WIN32
+        SwitchToThread();
+    #else
+        sched_yield();
+    #endif
+}
+
+static bool vxi_PushJob (vxi_JobQueue* q, const vxJob* job) {
+    vxi_Lock(&q->lock);
+    bool ok = q->bottom - q->top < VXI_JOB_QUEUE_SIZE;
+    if (ok) {
+        q->jobs[q->bottom % VXI_JOB_QUEUE_SIZE] = *job;
+        q->bottom++;
+    }
+    vxi_Unlock(&q->lock);
+    return ok;
+}
+
+// Takes the newest job (bottom) or the oldest one.
+static bool vxi_PopJob (vxi_JobQueue* q, vxJob* job, bool bottom) {
+    vxi_Lock(&q->lock);
+    bool ok = q->top != q->bottom;
+    if (ok && bottom) {
+        q->bottom--;
+        *job = q->jobs[q->bottom % VXI_JOB_QUEUE_SIZE];
+    } else if (ok) {
+        *job = q->jobs[q->top % VXI_JOB_QUEUE_SIZE];
+        q->top++;
+    }
+    vxi_Unlock(&q->lock);
+    return ok;
+}
+
+static void vxi_WakeWorkers (bool all);
+
+// Without workers there's nobody to run background jobs later, so they run right away.
+static void vxi_PushBackgroundJob (const vxJob* job) {
+    if (vxi_Jobs.threadCount <= 1) {
+        vxi_ExecuteJob(job);
+        return;
+    }
+    vxi_WaitingJob* node = vxAlloc(1, vxi_WaitingJob);
+    node->job = *job;
+    node->next = NULL;
+    vxi_Lock(&vxi_Jobs.backgroundLock);
+    if (vxi_Jobs.backgroundLast != NULL) {
+        vxi_Jobs.backgroundLast->next = node;
+    } else {
+        vxi_Jobs.backgroundFirst = node;
+    }
+    vxi_Jobs.backgroundLast = node;
+    vxi_Unlock(&vxi_Jobs.backgroundLock);
+    vxAtomicAdd32(&vxi_Jobs.backgroundQueued, 1);
+    if (vxAtomicLoad32(&vxi_Jobs.sleeping) > 0) {
+        vxi_WakeWorkers(false);
+    }
+}
+
+// Takes the oldest background job, or the oldest one of [counter] if it isn't NULL.
+static bool vxi_PopBackgroundJob (vxJob* job, vxJobCounter* counter) {
+    if (vxAtomicLoad32(&vxi_Jobs.backgroundQueued) <= 0) {
+        return false;
+    }
+    vxi_Lock(&vxi_Jobs.backgroundLock);
+    vxi_WaitingJob* prev = NULL;
+    vxi_WaitingJob* node = vxi_Jobs.backgroundFirst;
+    while (node != NULL && counter != NULL && node->job.counter != counter) {
+        prev = node;
+        node = node->next;
+    }
+    if (node != NULL) {
+        if (prev != NULL) {
+            prev->next = node->next;
+        } else {
+            vxi_Jobs.backgroundFirst = node->next;
+        }
+        if (vxi_Jobs.backgroundLast == node) {
+            vxi_Jobs.backgroundLast = prev;
+        }
+        vxAtomicAdd32(&vxi_Jobs.backgroundQueued, -1);
+    }
+    vxi_Unlock(&vxi_Jobs.backgroundLock);
+    if (node == NULL) {
+        return false;
+    }
+    *job = node->job;
+    vxFree(node);
+    return true;
+}
+
+static void vxi_WakeMainThread () {
+    #ifdef _WIN32
+        AcquireSRWLockExclusive(&vxi_Jobs.mutex);
+        WakeAllConditionVariable(&vxi_Jobs.mainWake);
+        ReleaseSRWLockExclusive(&vxi_Jobs.mutex);
+    #else
+        pthread_mutex_lock(&vxi_Jobs.mutex);
+        pthread_cond_broadcast(&vxi_Jobs.mainWake);
+        pthread_mutex_unlock(&vxi_Jobs.mutex);
+    #endif
+}
+
+static void vxi_WakeWorkers (bool all) {
+    #ifdef _WIN32
+        AcquireSRWLockExclusive(&vxi_Jobs.mutex);
+        if (all) { WakeAllConditionVariable(&vxi_Jobs.wake); } else { WakeConditionVariable(&vxi_Jobs.wake); }
+        ReleaseSRWLockExclusive(&vxi_Jobs.mutex);
+    #else
+        pthread_mutex_lock(&vxi_Jobs.mutex);
+        if (all) { pthread_cond_broadcast(&vxi_Jobs.wake); } else { pthread_cond_signal(&vxi_Jobs.wake); }
+        pthread_mutex_unlock(&vxi_Jobs.mutex);
+    #endif
+}
+
+// Jobs are counted before workers check for sleepers, and workers count themselves as sleeping before checking for
+// jobs, so one of the two always sees the other.
+static void vxi_SleepUntilJobs () {
+    #ifdef _WIN32
+        AcquireSRWLockExclusive(&vxi_Jobs.mutex);
+        vxAtomicAdd32(&vxi_Jobs.sleeping, 1);
+        while (vxAtomicLoad32(&vxi_Jobs.queued) <= 0 && vxAtomicLoad32(&vxi_Jobs.backgroundQueued) <= 0 &&
+               vxAtomicLoad32(&vxi_Jobs.quit) == 0) {
+            SleepConditionVariableSRW(&vxi_Jobs.wake, &vxi_Jobs.mutex, INFINITE, 0);
+        }
+        vxAtomicAdd32(&vxi_Jobs.sleeping, -1);
+        ReleaseSRWLockExclusive(&vxi_Jobs.mutex);
+    #else
+        pthread_mutex_lock(&vxi_Jobs.mutex);
+        vxAtomicAdd32(&vxi_Jobs.sleeping, 1);
+        while (vxAtomicLoad32(&vxi_Jobs.queued) <= 0 && vxAtomicLoad32(&vxi_Jobs.backgroundQueued) <= 0 &&
+               vxAtomicLoad32(&vxi_Jobs.quit) == 0) {
+            pthread_cond_wait(&vxi_Jobs.wake, &vxi_Jobs.mutex);
+        }
+        vxAtomicAdd32(&vxi_Jobs.sleeping, -1);
+        pthread_mutex_unlock(&vxi_Jobs.mutex);
+    #endif
+}
+
+// Queues a job whose dependency is done.
+static void vxi_EnqueueJob (const vxJob* job) {
+    if (vxAtomicLoad32(&vxi_Jobs.running) == 0) {
+        vxi_ExecuteJob(job);
+        return;
+    }
+    if (job->background) {
+        vxi_PushBackgroundJob(job);
+        return;
+    }
+    vxi_JobQueue* q;
+    if (job->mainThread) {
+        q = &vxi_Jobs.mainQueue;
+    } else if (vxi_JobThread >= 0) {
+        q = &vxi_Jobs.queues[vxi_JobThread];
+    } else {
+        q = &vxi_Jobs.queues[(uint32_t) vxAtomicAdd32(&vxi_Jobs.nextQueue, 1) % (uint32_t) vxi_Jobs.threadCount];
+    }
+    while (!vxi_PushJob(q, job)) {
+        // The queue is full. Run the job right away if this thread is allowed to, otherwise wait for the main thread:
+        if (!job->mainThread || vxi_JobThread == 0) {
+            vxi_ExecuteJob(job);
+            return;
+        }
+        vxi_Yield();
+    }
+    if (job->mainThread) {
+        vxAtomicAdd32(&vxi_Jobs.mainQueued, 1);
+        vxi_WakeMainThread();
+    } else {
+        vxAtomicAdd32(&vxi_Jobs.queued, 1);
+        if (vxAtomicLoad32(&vxi_Jobs.sleeping) > 0) {
+            vxi_WakeWorkers(false);
+        }
+    }
+}
+
+// Decrements a counter, and queues the jobs that were waiting for it once it drops to zero. The lock is held while the
+// counter changes, so vxWaitForJobs can tell when the counter isn't touched anymore.
+static void vxi_FinishJob (vxJobCounter* counter) {
+    vxi_WaitingJob* waiting = NULL;
+    vxi_Lock(&counter->lock);
+    if (vxAtomicAdd32(&counter->pending, -1) == 0) {
+        waiting = (vxi_WaitingJob*) counter->waiting;
+        counter->waiting = NULL;
+    }
+    vxi_Unlock(&counter->lock);
+    while (waiting != NULL) {
+        vxi_WaitingJob* next = waiting->next;
+        vxi_EnqueueJob(&waiting->job);
+        vxFree(waiting);
+        waiting = next;
+    }
+}
+
+static void vxi_ExecuteJob (const vxJob* job) {
+    vxJobHook hook = vxi_Jobs.hook;
+    const char* name = (job->name != NULL) ? job->name : "Job";
+    if (hook != NULL) { hook(name, vxi_JobThread, true); }
+    TimedBlock(name, job->func(job->user));
+    if (hook != NULL) { hook(name, vxi_JobThread, false); }
+    if (job->counter != NULL) {
+        vxi_FinishJob(job->counter);
+    }
+}
+
+// Looks for a job to run: main thread jobs first (on the main thread), then this thread's own queue, then the others.
+static bool vxi_FindJob (vxJob* job) {
+    int self = vxi_JobThread;
+    if (self == 0 && vxi_PopJob(&vxi_Jobs.mainQueue, job, false)) {
+        vxAtomicAdd32(&vxi_Jobs.mainQueued, -1);
+        return true;
+    }
+    if (vxAtomicLoad32(&vxi_Jobs.queued) <= 0) {
+        return false;
+    }
+    if (self >= 0 && vxi_PopJob(&vxi_Jobs.queues[self], job, true)) {
+        vxAtomicAdd32(&vxi_Jobs.queued, -1);
+        return true;
+    }
+    int n = vxi_Jobs.threadCount;
+    for (int i = 1; i <= n; i++) {
+        int victim = (vxMax(self, 0) + i) % n;
+        if (victim != self && vxi_PopJob(&vxi_Jobs.queues[victim], job, false)) {
+            vxAtomicAdd32(&vxi_Jobs.queued, -1);
+            return true;
+        }
+    }
+    return false;
+}
+
+static void vxi_JobWorker (void* user) {
+    vxi_JobThread = (int)(intptr_t) user;
+    char name [32];
+    stbsp_snprintf(name, (int) sizeof(name), "Job Worker %d", vxi_JobThread);
+    rmt_SetCurrentThreadName(name);
+    int idle = 0;
+    while (vxAtomicLoad32(&vxi_Jobs.quit) == 0) {
+        vxJob job;
+        if (vxi_FindJob(&job) || vxi_PopBackgroundJob(&job, NULL)) {
+            vxi_ExecuteJob(&job);
+            idle = 0;
+        } else if (++idle < VXI_JOB_IDLE_SPINS) {
+            vxi_Yield();
+        } else {
+            vxi_SleepUntilJobs();
+            idle = 0;
+        }
+    }
+}
+
+void vxStartJobs (int workerCount) {
+    vxCheck(vxAtomicLoad32(&vxi_Jobs.running) == 0);
+    if (workerCount < 0) {
+        workerCount = vxCoreCount() - 1;
+    }
+    workerCount = vxClamp(workerCount, 0, 255);
+    vxi_Jobs.threadCount = workerCount + 1;
+    vxi_Jobs.queues = vxAlloc(vxi_Jobs.threadCount, vxi_JobQueue);
+    vxi_Jobs.threads = vxAlloc(vxi_Jobs.threadCount, vxThread);
+    memset(vxi_Jobs.queues, 0, vxi_Jobs.threadCount * sizeof(vxi_JobQueue));
+    memset(vxi_Jobs.threads, 0, vxi_Jobs.threadCount * sizeof(vxThread));
+    vxi_Jobs.mainQueue.top = vxi_Jobs.mainQueue.bottom = 0;
+    vxi_Jobs.queued = 0;
+    vxi_Jobs.mainQueued = 0;
+    vxi_Jobs.backgroundFirst = vxi_Jobs.backgroundLast = NULL;
+    vxi_Jobs.backgroundQueued = 0;
+    vxi_Jobs.sleeping = 0;
+    vxi_Jobs.quit = 0;
+    #ifdef _WIN32
+        InitializeSRWLock(&vxi_Jobs.mutex);
+        InitializeConditionVariable(&vxi_Jobs.wake);
+        InitializeConditionVariable(&vxi_Jobs.mainWake);
+    #else
+        pthread_mutex_init(&vxi_Jobs.mutex, NULL);
+        pthread_cond_init(&vxi_Jobs.wake, NULL);
+        pthread_cond_init(&vxi_Jobs.mainWake, NULL);
+    #endif
+    vxi_JobThread = 0;
+    vxAtomicStore32(&vxi_Jobs.running, 1);
+    // If a worker fails to start, the jobs in its queue are still picked up by the others:
+    for (int i = 1; i < vxi_Jobs.threadCount; i++) {
+        vxStartThread(&vxi_Jobs.threads[i], vxi_JobWorker, (void*)(intptr_t) i);
+    }
+    vxLog("Started the job system with %d workers.", workerCount);
+}
+
+void vxStopJobs () {
+    if (vxAtomicLoad32(&vxi_Jobs.running) == 0) { return; }
+    vxCheck(vxi_JobThread == 0);
+    vxAtomicStore32(&vxi_Jobs.quit, 1);
+    vxi_WakeWorkers(true);
+    for (int i = 1; i < vxi_Jobs.threadCount; i++) {
+        vxJoinThread(&vxi_Jobs.threads[i]);
+    }
+    // From here on jobs run as they're submitted, including the ones left in the queues:
+    vxAtomicStore32(&vxi_Jobs.running, 0);
+    vxJob job;
+    while (vxi_PopJob(&vxi_Jobs.mainQueue, &job, false)) {
+        vxi_ExecuteJob(&job);
+    }
+    for (int i = 0; i < vxi_Jobs.threadCount; i++) {
+        while (vxi_PopJob(&vxi_Jobs.queues[i], &job, false)) {
+            vxi_ExecuteJob(&job);
+        }
+    }
+    while (vxi_PopBackgroundJob(&job, NULL)) {
+        vxi_ExecuteJob(&job);
+    }
+    #ifndef _WIN32
+        pthread_mutex_destroy(&vxi_Jobs.mutex);
+        pthread_cond_destroy(&vxi_Jobs.wake);
+        pthread_cond_destroy(&vxi_Jobs.mainWake);
+    #endif
+    vxFree(vxi_Jobs.queues);
+    vxFree(vxi_Jobs.threads);
+    vxi_Jobs.queues = NULL;
+    vxi_Jobs.threads = NULL;
+    vxi_Jobs.threadCount = 0;
+    vxi_JobThread = -1;
+}
+
+int vxJobThreadCount () {
+    return (vxAtomicLoad32(&vxi_Jobs.running) != 0) ? vxi_Jobs.threadCount : 1;
+}
+
+// The hook is read without synchronization, set it while no jobs are running.
+void vxSetJobHook (vxJobHook hook) {
+    vxi_Jobs.hook = hook;
+}
+
+void vxSubmitJob (const vxJob* job) {
+    vxCheck(job->func != NULL);
+    if (job->counter != NULL) {
+        vxAtomicAdd32(&job->counter->pending, 1);
+    }
+    if (job->after != NULL) {
+        vxi_Lock(&job->after->lock);
+        if (vxAtomicLoad32(&job->after->pending) > 0) {
+            vxi_WaitingJob* waiting = vxAlloc(1, vxi_WaitingJob);
+            waiting->job = *job;
+            waiting->next = (vxi_WaitingJob*) job->after->waiting;
+            job->after->waiting = waiting;
+            vxi_Unlock(&job->after->lock);
+            return;
+        }
+        vxi_Unlock(&job->after->lock);
+    }
+    vxi_EnqueueJob(job);
+}
+
+void vxRunJob (const char* name, vxJobFunc func, void* user, vxJobCounter* counter) {
+    vxJob job = {0};
+    job.name = name;
+    job.func = func;
+    job.user = user;
+    job.counter = counter;
+    vxSubmitJob(&job);
+}
+
+void vxRunBackgroundJob (const char* name, vxJobFunc func, void* user, vxJobCounter* counter) {
+    vxJob job = {0};
+    job.name = name;
+    job.func = func;
+    job.user = user;
+    job.counter = counter;
+    job.background = true;
+    vxSubmitJob(&job);
+}
+
+void vxWaitForJobs (vxJobCounter* counter) {
+    if (counter == NULL) { return; }
+    while (vxAtomicLoad32(&counter->pending) > 0) {
+        vxJob job;
+        bool found = vxAtomicLoad32(&vxi_Jobs.running) != 0 &&
+                     (vxi_FindJob(&job) || vxi_PopBackgroundJob(&job, counter));
+        if (found) {
+            vxi_ExecuteJob(&job);
+        } else {
+            vxi_Yield();
+        }
+    }
+    // The thread that finished the last job may still hold the lock, after which it won't touch the counter again:
+    vxi_Lock(&counter->lock);
+    vxi_Unlock(&counter->lock);
+}
+
+void vxRunMainThreadJobs () {
+    if (vxAtomicLoad32(&vxi_Jobs.running) == 0) { return; }
+    vxCheck(vxi_JobThread == 0);
+    vxJob job;
+    while (vxi_PopJob(&vxi_Jobs.mainQueue, &job, false)) {
+        vxAtomicAdd32(&vxi_Jobs.mainQueued, -1);
+        vxi_ExecuteJob(&job);
+    }
+}
+
+void vxWaitForMainThreadJobs () {
+    if (vxAtomicLoad32(&vxi_Jobs.running) == 0) { return; }
+    vxCheck(vxi_JobThread == 0);
+    #ifdef _WIN32
+        AcquireSRWLockExclusive(&vxi_Jobs.mutex);
+        while (vxAtomicLoad32(&vxi_Jobs.mainQueued) <= 0) {
+            SleepConditionVariableSRW(&vxi_Jobs.mainWake, &vxi_Jobs.mutex, INFINITE, 0);
+        }
+        ReleaseSRWLockExclusive(&vxi_Jobs.mutex);
+    #else
+        pthread_mutex_lock(&vxi_Jobs.mutex);
+        while (vxAtomicLoad32(&vxi_Jobs.mainQueued) <= 0) {
+            pthread_cond_wait(&vxi_Jobs.mainWake, &vxi_Jobs.mutex);
+        }
+        pthread_mutex_unlock(&vxi_Jobs.mutex);
+    #endif
+}
+
+void vxRunOnMainThread (const char* name, vxJobFunc func, void* user) {
+    if (vxAtomicLoad32(&vxi_Jobs.running) == 0 || vxi_JobThread == 0) {
+        TimedBlock(name, func(user));
+        return;
+    }
+    vxJobCounter counter = {0};
+    vxJob job = {0};
+    job.name = name;
+    job.func = func;
+    job.user = user;
+    job.counter = &counter;
+    job.mainThread = true;
+    vxSubmitJob(&job);
+    vxWaitForJobs(&counter);
+}
+
+typedef struct vxi_ParallelFor {
+    vxParallelForFunc func;
+    void* user;
+    size_t count;
+    size_t batchSize;
+    int32_t batchCount;
+    volatile int32_t nextBatch;
+} vxi_ParallelFor;
+
+// Every job keeps taking batches until there are none left, so threads that get to the work late just do less of it.
+static void vxi_ParallelForJob (void* user) {
+    vxi_ParallelFor* pf = (vxi_ParallelFor*) user;
+    while (true) {
+        int32_t batch = vxAtomicAdd32(&pf->nextBatch, 1) - 1;
+        if (batch >= pf->batchCount) { break; }
+        size_t begin = (size_t) batch * pf->batchSize;
+        pf->func(pf->user, begin, vxMin(begin + pf->batchSize, pf->count));
+    }
+}
+
+void vxParallelFor (const char* name, size_t count, size_t batchSize, vxParallelForFunc func, void* user) {
+    if (count == 0) { return; }
+    batchSize = vxMax(batchSize, 1);
+    size_t batchCount = (count + batchSize - 1) / batchSize;
+    if (batchCount == 1 || vxAtomicLoad32(&vxi_Jobs.running) == 0) {
+        func(user, 0, count);
+        return;
+    }
+    if (batchCount > INT32_MAX) {
+        batchSize = (count + INT32_MAX - 1) / INT32_MAX;
+        batchCount = (count + batchSize - 1) / batchSize;
+    }
+    vxi_ParallelFor pf = {func, user, count, batchSize, (int32_t) batchCount, 0};
+    vxJobCounter counter = {0};
+    size_t helpers = vxMin(batchCount, (size_t) vxi_Jobs.threadCount) - 1;
+    for (size_t i = 0; i < helpers; i++) {
+        vxRunJob(name, vxi_ParallelForJob, &pf, &counter);
+    }
+    vxi_ParallelForJob(&pf);
+    vxWaitForJobs(&counter);
+}
+
 // Generic aligned_alloc, malloc_size and free functions.
 static inline void* vxAlignedAlloc (size_t size, size_t alignment) {
     #if defined(_MSC_VER)
@@ -11,6 +11,7 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <limits.h>
+#include <float.h>
 #include <errno.h>
 #define _USE_MATH_DEFINES
 #include <math.h>
@@ -130,9 +131,19 @@ VX_EXPORT void vxEnableSignalHandlers();
 // File IO:
 
 VX_EXPORT char* vxReadFile (const char* filename, const char* mode, size_t* outLength);
+
+typedef struct vxMappedFile {
+    const void* data;
+    size_t size;
+    void* handle; // platform-specific
+} vxMappedFile;
+
+VX_EXPORT bool vxMapFile (const char* filename, vxMappedFile* file);
+VX_EXPORT void vxUnmapFile (vxMappedFile* file);
 VX_EXPORT uint64_t vxGetFileMtime (const char* path);
 VX_EXPORT char** vxListFiles (const char* directory, const char* pattern);
 VX_EXPORT void vxCreateDirectory (const char* path);
+VX_EXPORT bool vxReplaceFile (const char* from, const char* to);
 
 // Memory management:
 
@@ -147,6 +158,80 @@ VX_EXPORT void* vxAlignedRealloc (void* block, size_t count, size_t itemsize, si
 #define vxAlloc(count, type) (type*) vxAlignedRealloc(NULL, count, sizeof(type), vxAlignOf(type));
 #define vxFree(block) vxAlignedRealloc(block, 0, 0, 0);
 
+// Threads and atomics:
+
+typedef void (*vxThreadFunc) (void* user);
+
+typedef struct vxThread {
+    void* handle; // platform-specific
+} vxThread;
+
+VX_EXPORT bool vxStartThread (vxThread* thread, vxThreadFunc func, void* user);
+VX_EXPORT void vxJoinThread (vxThread* thread);
+VX_EXPORT int32_t vxAtomicLoad32 (volatile int32_t* value);
+VX_EXPORT void vxAtomicStore32 (volatile int32_t* value, int32_t x);
+VX_EXPORT int32_t vxAtomicExchange32 (volatile int32_t* value, int32_t x);
+VX_EXPORT int32_t vxAtomicAdd32 (volatile int32_t* value, int32_t x); // returns the new value
+VX_EXPORT int vxCoreCount ();
+
+// Job system:
+// A pool of worker threads that take jobs from per-thread queues and steal from each other when their own queue runs
+// dry. Jobs submitted from a pool thread go into that thread's queue. Jobs can be tracked with a counter, which also
+// lets other jobs wait for them (vxJob.after). Threads that wait for a counter run queued jobs in the meantime, so
+// jobs may wait for other jobs. Jobs marked mainThread only run on the thread that called vxStartJobs, inside
+// vxWaitForJobs or vxRunMainThreadJobs; use those for anything that touches GL. Jobs marked background (file reads
+// and writes, anything that takes longer than a frame) are only run by idle workers, and by threads waiting for their
+// own counter.
+//
+// Until vxStartJobs is called (and after vxStopJobs) jobs run right away on the submitting thread, so code using jobs
+// works unchanged in single-threaded tools.
+
+typedef void (*vxJobFunc) (void* user);
+typedef void (*vxParallelForFunc) (void* user, size_t begin, size_t end);
+// Called before (begin = true) and after each job, on the thread running it. Thread 0 is the main thread, 1 and up
+// are the workers, -1 is any other thread helping out in vxWaitForJobs.
+typedef void (*vxJobHook) (const char* name, int thread, bool begin);
+
+typedef struct vxJobCounter {
+    volatile int32_t pending; // jobs submitted with this counter that haven't finished yet
+    volatile int32_t lock;
+    void* waiting;            // jobs whose vxJob.after is this counter, submitted once pending drops to zero
+} vxJobCounter; // zero-initialize
+
+typedef struct vxJob {
+    const char* name;       // shown in the profiler and passed to the hook
+    vxJobFunc func;
+    void* user;
+    vxJobCounter* counter;  // incremented on submission, decremented once the job has run, may be NULL
+    vxJobCounter* after;    // the job isn't started before this counter drops to zero, may be NULL
+    bool mainThread;        // only run on the main thread
+    bool background;        // only run by idle workers, see above
+} vxJob;
+
+// Starts the given number of workers, -1 for one less than the number of cores. The calling thread becomes the main
+// thread of the job system.
+VX_EXPORT void vxStartJobs (int workerCount);
+// Waits for the workers to finish their current jobs and stops them. Queued jobs are run on the calling thread.
+VX_EXPORT void vxStopJobs ();
+VX_EXPORT int vxJobThreadCount (); // workers plus the main thread, 1 while the job system isn't running
+VX_EXPORT void vxSetJobHook (vxJobHook hook);
+VX_EXPORT void vxSubmitJob (const vxJob* job);
+VX_EXPORT void vxRunJob (const char* name, vxJobFunc func, void* user, vxJobCounter* counter);
+VX_EXPORT void vxRunBackgroundJob (const char* name, vxJobFunc func, void* user, vxJobCounter* counter);
+// Returns once the counter has dropped to zero, running queued jobs while waiting.
+VX_EXPORT void vxWaitForJobs (vxJobCounter* counter);
+// Runs the queued main thread jobs. Call from the main thread once per frame.
+VX_EXPORT void vxRunMainThreadJobs ();
+// Sleeps until main thread jobs are queued. For a main thread that has nothing else to do, like a render thread
+// waiting for its next frame.
+VX_EXPORT void vxWaitForMainThreadJobs ();
+// Runs func on the main thread and returns once it's done. Calls it right away on the main thread itself, and while
+// the job system isn't running.
+VX_EXPORT void vxRunOnMainThread (const char* name, vxJobFunc func, void* user);
+// Calls func for consecutive ranges of [0, count) of at most batchSize items, spread over the pool, and returns once
+// all of them are done. The calling thread takes part.
+VX_EXPORT void vxParallelFor (const char* name, size_t count, size_t batchSize, vxParallelForFunc func, void* user);
+
 // Profiler instrumentation:
 // We're using Remotery now, but that can change at any time.
 
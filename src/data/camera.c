@@ -77,6 +77,41 @@ void Camera_Update (Camera* camera, int w, int h, mat4 viewMatrix) {
     }
 }
 
+// Extracts the camera's world space frustum planes (left, right, bottom, top, near, far) from its current matrices.
+// Planes are normalized and face inwards, so a point P is inside the frustum if dot(N, P) + D >= 0 for all of them.
+// The far plane of an infinite perspective projection comes out with a zero normal and a positive D, which makes it
+// accept every point.
+// See Gribb & Hartmann, "Fast Extraction of Viewing Frustum Planes from the World-View-Projection Matrix".
+void Camera_GetFrustumPlanes (Camera* camera, vec4 planes[6]) {
+    mat4 vp;
+    glm_mat4_mul(camera->proj_matrix, camera->view_matrix, vp);
+    vec4 rows [4];
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            rows[i][j] = vp[j][i];
+        }
+    }
+    glm_vec4_add(rows[3], rows[0], planes[0]);
+    glm_vec4_sub(rows[3], rows[0], planes[1]);
+    glm_vec4_add(rows[3], rows[1], planes[2]);
+    glm_vec4_sub(rows[3], rows[1], planes[3]);
+    if (camera->projection == CAMERA_PERSPECTIVE) {
+        // Reverse-Z: clip space depth goes from w at the near plane to 0 at the far plane.
+        glm_vec4_sub(rows[3], rows[2], planes[4]);
+        glm_vec4_copy(rows[2], planes[5]);
+    } else {
+        // Orthographic cameras use glm_ortho, which maps depth to [-w, w].
+        glm_vec4_add(rows[3], rows[2], planes[4]);
+        glm_vec4_sub(rows[3], rows[2], planes[5]);
+    }
+    for (int i = 0; i < 6; i++) {
+        float len = glm_vec3_norm(planes[i]);
+        if (len > 0.0f) {
+            glm_vec4_scale(planes[i], 1.0f / len, planes[i]);
+        }
+    }
+}
+
 #if 0
 void UpdateCameraMatrices (Camera* camera, int w, int h) {
     glm_mat4_copy(camera->proj_matrix, camera->last_proj_matrix);
@@ -32,4 +32,5 @@ typedef struct {
 
 void Camera_InitPerspective (Camera* camera, float zn, float zf, float fov);
 void Camera_InitOrtho (Camera* camera, float zoom, float zn, float zf);
-void Camera_Update (Camera* camera, int w, int h, mat4 viewMatrix);
\ No newline at end of file
+void Camera_Update (Camera* camera, int w, int h, mat4 viewMatrix);
+void Camera_GetFrustumPlanes (Camera* camera, vec4 planes[6]);
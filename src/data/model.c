@@ -2,6 +2,8 @@
 #include "main.h"
 #include "texture.h"
 #include "render/render.h"
+#include "render/glstate.h"
+#include "scene/bvh.h"
 #include <stb_sprintf.h>
 #include <parson/parson.h>
 #include <glad/glad.h>
@@ -11,32 +13,132 @@
 XM_ASSETS_MODELS_GLTF
 #undef X
 
+bool ModelGeometryOnly = false;
+bool ModelStreaming = false;
 size_t ModelCount = 0;
-char** ModelNames = NULL;
+const char** ModelNames = NULL;
 Model** Models = NULL;
+uint32_t ModelResidencyVersion = 0;
+
+// Sets up a model that hasn't been read yet, so it can be found by name and loaded later.
+static void sRegisterModel (const char* name, Model* model, const char* dir, const char* file) {
+    static char path [4096];
+    stbsp_snprintf(path, vxSize(path), "%s/%s", dir, file);
+    // The name may be the model's own, so copy it before freeing anything:
+    char* newName = strdup(name);
+    char* newPath = strdup(path);
+    if (model->name != NULL) { free(model->name); }
+    if (model->sourceFilePath != NULL) { free(model->sourceFilePath); }
+    memset(model, 0, sizeof(Model));
+    model->name = newName;
+    model->sourceFilePath = newPath;
+    model->sourceDirectory = dir;
+    model->sourceFile = file;
+}
 
 void LoadModels() {
     ModelCount = 0;
     #define X(name, dir, file) \
         ModelCount++; \
-        ReadModelFromDisk(#name, &name, dir, file);
+        if (ModelStreaming) { \
+            sRegisterModel(#name, &name, dir, file); \
+        } else { \
+            ReadModelFromDisk(#name, &name, dir, file); \
+        }
     XM_ASSETS_MODELS_GLTF
     #undef X
 
     if (Models != NULL) { free(Models); }
+    if (ModelNames != NULL) { free(ModelNames); }
     Models = (Model**) calloc(ModelCount, sizeof(Model*));
+    ModelNames = (const char**) calloc(ModelCount, sizeof(const char*));
 
     size_t i = 0;
     #define X(name, dir, file) { \
         Models[i] = &name; \
+        ModelNames[i] = #name; \
         i++; \
     }
     XM_ASSETS_MODELS_GLTF
     #undef X
 }
 
+// Reads a registered or unloaded model from disk. Does nothing if it's already resident.
+void LoadModel (Model* model) {
+    if (model->resident || model->sourceDirectory == NULL) { return; }
+    ModelStaging staging;
+    ReadModelStaging(&staging, model->sourceDirectory, model->sourceFile);
+    UploadModel(model, &staging);
+}
+
+// Releases a model's GPU objects and CPU copies. Its name and source stay, so it can be loaded again with LoadModel.
+// Render lists, draw lists and static batches that still refer to the model's meshes or materials must be rebuilt
+// before they are used again.
+void UnloadModel (Model* model) {
+    if (!model->resident) { return; }
+    for (size_t i = 0; i < model->geometryCount; i++) {
+        ModelGeometry* geometry = &model->geometry[i];
+        glDeleteVertexArrays(1, &geometry->vertexArray);
+        glDeleteVertexArrays(1, &geometry->depthVertexArray);
+        glDeleteVertexArrays(1, &geometry->maskedVertexArray);
+        glDeleteBuffers(1, &geometry->elementArray);
+        glDeleteBuffers(MESH_ATTRIBUTE_SLOTS, geometry->vertexBuffers);
+    }
+    for (size_t i = 0; i < model->meshCount; i++) {
+        Mesh* mesh = &model->meshes[i];
+        for (int a = 0; a < MESH_ATTRIBUTE_SLOTS; a++) {
+            if (mesh->cpu_attributes[a] != NULL) { vxFree(mesh->cpu_attributes[a]); }
+        }
+        if (mesh->cpu_indices != NULL) { vxFree(mesh->cpu_indices); }
+    }
+    for (size_t i = 0; i < model->materialCount; i++) {
+        ReleaseMaterial(&model->materials[i]);
+    }
+    if (!ModelGeometryOnly) {
+        glDeleteTextures((GLsizei) model->textureCount, model->textures);
+        glDeleteSamplers((GLsizei) model->samplerCount, model->samplers);
+    }
+    if (model->textures != NULL) { vxFree(model->textures); }
+    if (model->samplers != NULL) { vxFree(model->samplers); }
+    if (model->materials != NULL) { vxFree(model->materials); }
+    if (model->meshTransforms != NULL) { vxFree(model->meshTransforms); }
+    if (model->meshMaterials != NULL) { vxFree(model->meshMaterials); }
+    if (model->meshes != NULL) { vxFree(model->meshes); }
+    if (model->geometry != NULL) { vxFree(model->geometry); }
+    vxLog("Unloaded model %s (%ju KiB)", model->name, model->memoryBytes / VX_KiB);
+    ModelResidencyVersion++;
+
+    char* name = model->name;
+    char* sourceFilePath = model->sourceFilePath;
+    const char* sourceDirectory = model->sourceDirectory;
+    const char* sourceFile = model->sourceFile;
+    memset(model, 0, sizeof(Model));
+    model->name = name;
+    model->sourceFilePath = sourceFilePath;
+    model->sourceDirectory = sourceDirectory;
+    model->sourceFile = sourceFile;
+}
+
+// Estimates the GPU memory of a texture from its first level, plus a third for mipmaps.
+static size_t sTextureBytes (GLuint texture) {
+    if (texture == 0) { return 0; }
+    GLint w = 0, h = 0, compressed = 0, size = 0;
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &w);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &h);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_COMPRESSED, &compressed);
+    if (compressed) {
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &size);
+    } else {
+        size = w * h * 4;
+    }
+    return (size_t) size * 4 / 3;
+}
+
 void InitMaterial (Material* m) {
+    static volatile int32_t lastMaterialId = 0; // models can be read on job workers
     memset(m, 0, sizeof(Material));
+    m->id = (uint32_t) vxAtomicAdd32(&lastMaterialId, 1);
     m->blend = false;
     m->blend_srcf = GL_SRC_ALPHA;           // suitable for back-to-front transparency
     m->blend_dstf = GL_ONE_MINUS_SRC_ALPHA; // suitable for back-to-front transparency
@@ -60,18 +162,139 @@ void InitMaterial (Material* m) {
     m->const_occlusion = 0.0f; // not in GLTF spec
     m->const_metallic  = 1.0f;
     m->const_roughness = 1.0f;
-    m->tex_diffuse = TEX_WHITE_1x1;
-    m->smp_diffuse = SMP_NEAREST;
-    m->tex_normal = TEX_WHITE_1x1;
-    m->smp_normal = TEX_WHITE_1x1;
-    m->tex_occ_rgh_met = TEX_WHITE_1x1;
-    m->smp_occ_rgh_met = SMP_NEAREST;
-    m->tex_occlusion = TEX_WHITE_1x1;
-    m->smp_occlusion = SMP_NEAREST;
-    m->tex_metallic = TEX_WHITE_1x1;
-    m->smp_metallic = SMP_NEAREST;
-    m->tex_roughness = TEX_WHITE_1x1;
-    m->smp_roughness = SMP_NEAREST;
+    for (int t = 0; t < MATERIAL_TEXTURE_SLOTS; t++) {
+        m->textures[t] = (MaterialTexture){TEX_WHITE_1x1_ARRAY, SMP_NEAREST, 0};
+    }
+    m->features = MATFEAT_ALL;
+    m->tableIndex = -1;
+}
+
+// Reads a GLTF texture reference of a material. Sets the image and sampler indices, which only become GL objects once
+// the model is uploaded (see UploadModel and sPackMaterialTextures).
+static void sReadMaterialTexture (JSON_Object* jtexinfo, JSON_Array* jtextures, int* image, int* sampler) {
+    if (jtexinfo == NULL) { return; }
+    int itex = (int) json_object_get_number(jtexinfo, "index");
+    JSON_Object* jtex = json_array_get_object(jtextures, itex);
+    if (jtex && json_object_has_value(jtex, "source") && json_object_has_value(jtex, "sampler")) {
+        *image = (int) json_object_get_number(jtex, "source");
+        *sampler = (int) json_object_get_number(jtex, "sampler");
+    }
+}
+
+// Images of one size, format and mip count, as the layers of one texture array.
+typedef struct TextureBucket {
+    GLint w;
+    GLint h;
+    GLint levels;
+    GLint format;
+    int32_t layers;
+    GLuint array;
+} TextureBucket;
+
+// Copies a model's images into texture arrays, one per size, format and mip count, and points the materials at their
+// layers. Materials of the same model then mostly bind the same arrays, so switching between them doesn't change any
+// texture bindings. The images are deleted, and the arrays returned to replace them as the model's textures.
+// [materialImages] has MATERIAL_TEXTURE_SLOTS image indices per material, -1 for none. Adds the GPU memory of the
+// images to [bytes].
+static GLuint* sPackMaterialTextures (GLuint* images, size_t imageCount, Material* materials, size_t materialCount,
+    const int* materialImages, size_t* arrayCount, size_t* bytes)
+{
+    TextureBucket* buckets = vxAlloc(vxMax(imageCount, 1), TextureBucket);
+    int* imageBuckets = vxAlloc(vxMax(imageCount, 1), int);
+    int32_t* imageLayers = vxAlloc(vxMax(imageCount, 1), int32_t);
+    size_t bucketCount = 0;
+    for (size_t i = 0; i < imageCount; i++) {
+        imageBuckets[i] = -1;
+        if (images[i] == 0) { continue; }
+        *bytes += sTextureBytes(images[i]);
+        TextureBucket key = {0};
+        glBindTexture(GL_TEXTURE_2D, images[i]);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &key.w);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &key.h);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &key.format);
+        // Images have either one level or a full chain. Levels past the last one read as 0x0:
+        for (GLint levelw = key.w; levelw > 0 && key.levels < 16; ) {
+            key.levels++;
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, key.levels, GL_TEXTURE_WIDTH, &levelw);
+        }
+        size_t b = 0;
+        while (b < bucketCount && (buckets[b].w != key.w || buckets[b].h != key.h || buckets[b].levels != key.levels ||
+            buckets[b].format != key.format)) {
+            b++;
+        }
+        if (b == bucketCount) {
+            buckets[bucketCount++] = key;
+        }
+        imageBuckets[i] = (int) b;
+        imageLayers[i] = buckets[b].layers++;
+    }
+
+    // Copy every level of every image into its layer. Without ARB_copy_image, the images make a round trip through
+    // CPU memory instead:
+    GLuint* arrays = vxAlloc(vxMax(bucketCount, 1), GLuint);
+    for (size_t b = 0; b < bucketCount; b++) {
+        TextureBucket* bucket = &buckets[b];
+        glGenTextures(1, &bucket->array);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, bucket->array);
+        glTexStorage3D(GL_TEXTURE_2D_ARRAY, bucket->levels, (GLenum) bucket->format, bucket->w, bucket->h,
+            bucket->layers);
+        arrays[b] = bucket->array;
+    }
+    for (size_t i = 0; i < imageCount; i++) {
+        if (imageBuckets[i] == -1) { continue; }
+        TextureBucket* bucket = &buckets[imageBuckets[i]];
+        glBindTexture(GL_TEXTURE_2D, images[i]);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, bucket->array);
+        for (GLint level = 0; level < bucket->levels; level++) {
+            GLint levelw = vxMax(bucket->w >> level, 1);
+            GLint levelh = vxMax(bucket->h >> level, 1);
+            if (vxglSupportsCopyImage) {
+                glCopyImageSubData(images[i], GL_TEXTURE_2D, level, 0, 0, 0, bucket->array, GL_TEXTURE_2D_ARRAY, level,
+                    0, 0, imageLayers[i], levelw, levelh, 1);
+                continue;
+            }
+            GLint compressed = 0, size = 0;
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_COMPRESSED, &compressed);
+            if (compressed) {
+                glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &size);
+            } else {
+                size = levelw * levelh * 4;
+            }
+            void* pixels = vxAlloc(size, uint8_t);
+            if (compressed) {
+                glGetCompressedTexImage(GL_TEXTURE_2D, level, pixels);
+                glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, imageLayers[i], levelw, levelh, 1,
+                    (GLenum) bucket->format, size, pixels);
+            } else {
+                glGetTexImage(GL_TEXTURE_2D, level, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+                glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, imageLayers[i], levelw, levelh, 1, GL_RGBA,
+                    GL_UNSIGNED_BYTE, pixels);
+            }
+            vxFree(pixels);
+        }
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    glDeleteTextures((GLsizei) imageCount, images);
+
+    for (size_t imat = 0; imat < materialCount; imat++) {
+        for (int t = 0; t < MATERIAL_TEXTURE_SLOTS; t++) {
+            int image = materialImages[imat * MATERIAL_TEXTURE_SLOTS + t];
+            if (image >= 0 && (size_t) image < imageCount && imageBuckets[image] != -1) {
+                materials[imat].textures[t].array = buckets[imageBuckets[image]].array;
+                materials[imat].textures[t].layer = imageLayers[image];
+            } else {
+                materials[imat].textures[t] = (MaterialTexture){TEX_WHITE_1x1_ARRAY, SMP_NEAREST, 0};
+            }
+        }
+    }
+
+    vxLog("Packed %ju textures into %ju texture arrays", imageCount, bucketCount);
+    vxFree(buckets);
+    vxFree(imageBuckets);
+    vxFree(imageLayers);
+    *arrayCount = bucketCount;
+    return arrays;
 }
 
 typedef struct GLTFNode {
@@ -80,17 +303,155 @@ typedef struct GLTFNode {
     struct GLTFNode* parent; // optional - may be a root node
 } GLTFNode;
 
-void ReadModelFromDisk (const char* name, Model* model, const char* gltfDirectory, const char* gltfFilename) {
-    memset(model, 0, sizeof(Model)); // mark as invalid
-    model->name = strdup(name);
+// Reads the bounds of a mesh from its POSITION accessor. GLTF requires min and max to be present for positions, but
+// we fall back to computing them from the vertex data for files that don't follow the spec.
+static void sReadMeshBounds (Mesh* mesh, JSON_Object* jacc, FAccessor* acc) {
+    JSON_Array* jmin = json_object_get_array(jacc, "min");
+    JSON_Array* jmax = json_object_get_array(jacc, "max");
+    if (json_array_get_count(jmin) >= 3 && json_array_get_count(jmax) >= 3) {
+        for (int i = 0; i < 3; i++) {
+            mesh->aabbMin[i] = (float) json_array_get_number(jmin, i);
+            mesh->aabbMax[i] = (float) json_array_get_number(jmax, i);
+        }
+        return;
+    }
+    glm_vec3_broadcast(FLT_MAX, mesh->aabbMin);
+    glm_vec3_broadcast(-FLT_MAX, mesh->aabbMax);
+    if (acc->type != FACCESSOR_FLOAT32_VEC3 || acc->count == 0) {
+        glm_vec3_zero(mesh->aabbMin);
+        glm_vec3_zero(mesh->aabbMax);
+        return;
+    }
+    for (size_t v = 0; v < acc->count; v++) {
+        float* p = (float*) FAccessorElement(acc, v, 0);
+        glm_vec3_minv(mesh->aabbMin, p, mesh->aabbMin);
+        glm_vec3_maxv(mesh->aabbMax, p, mesh->aabbMax);
+    }
+}
+
+// Keeps a copy of a float attribute, with the accessor's stride removed.
+static void sCopyMeshAttribute (Mesh* mesh, int location, FAccessor* acc) {
+    if (acc->component_size != 4 || acc->type % FACCESSOR_UINT8_VEC2 != FACCESSOR_FLOAT32) {
+        return;
+    }
+    size_t n = acc->component_count;
+    float* data = vxAlloc(acc->count * n, float);
+    for (size_t v = 0; v < acc->count; v++) {
+        memcpy(&data[v * n], FAccessorElement(acc, v, 0), n * sizeof(float));
+    }
+    mesh->cpu_attributes[location] = data;
+    mesh->cpu_attribute_components[location] = (uint8_t) n;
+}
+
+// Keeps a copy of the indices, widened to 32 bits.
+static void sCopyMeshIndices (Mesh* mesh, FAccessor* acc) {
+    size_t count = acc->count * acc->component_count;
+    uint32_t* data = vxAlloc(count, uint32_t);
+    for (size_t i = 0; i < count; i++) {
+        char* p = FAccessorElement(acc, i / acc->component_count, i % acc->component_count);
+        switch (acc->component_size) {
+            case 1:  data[i] = *(uint8_t*) p; break;
+            case 2:  data[i] = *(uint16_t*) p; break;
+            default: data[i] = *(uint32_t*) p; break;
+        }
+    }
+    mesh->cpu_indices = data;
+    mesh->cpu_index_count = count;
+}
+
+// Uploads the CPU copies of the meshes' geometry, packing meshes with the same attributes into shared buffers.
+// Meshes without indices or positions can't be drawn and get no buffers. Returns the buffers, to be freed with the
+// model.
+static ModelGeometry* sUploadModelGeometry (Mesh* meshes, size_t meshCount, size_t* geometryCount) {
+    ModelGeometry* geometry = vxAlloc(vxMax(meshCount, 1), ModelGeometry);
+    int* meshGeometry = vxAlloc(vxMax(meshCount, 1), int);
+    size_t count = 0;
+    for (size_t i = 0; i < meshCount; i++) {
+        Mesh* mesh = &meshes[i];
+        meshGeometry[i] = -1;
+        if (mesh->cpu_indices == NULL || mesh->cpu_attributes[ATTR_POSITION] == NULL) { continue; }
+        for (size_t j = 0; j < i && meshGeometry[i] == -1; j++) {
+            if (meshGeometry[j] != -1 && memcmp(mesh->cpu_attribute_components, meshes[j].cpu_attribute_components,
+                sizeof(mesh->cpu_attribute_components)) == 0) {
+                meshGeometry[i] = meshGeometry[j];
+            }
+        }
+        if (meshGeometry[i] == -1) {
+            meshGeometry[i] = (int) count++;
+        }
+    }
+
+    for (size_t g = 0; g < count; g++) {
+        ModelGeometry* geo = &geometry[g];
+        memset(geo, 0, sizeof(ModelGeometry));
+        uint8_t* components = NULL;
+        size_t vertexCount = 0;
+        size_t indexCount = 0;
+        for (size_t i = 0; i < meshCount; i++) {
+            if (meshGeometry[i] != (int) g) { continue; }
+            components = meshes[i].cpu_attribute_components;
+            meshes[i].gl_base_vertex = (int32_t) vertexCount;
+            meshes[i].gl_first_index = indexCount;
+            vertexCount += meshes[i].gl_vertex_count;
+            indexCount += meshes[i].cpu_index_count;
+        }
 
+        glGenVertexArrays(1, &geo->vertexArray);
+        BindGLVertexArray(geo->vertexArray);
+        for (int a = 0; a < MESH_ATTRIBUTE_SLOTS; a++) {
+            if (components[a] == 0) { continue; }
+            size_t vertexBytes = components[a] * sizeof(float);
+            glGenBuffers(1, &geo->vertexBuffers[a]);
+            glBindBuffer(GL_ARRAY_BUFFER, geo->vertexBuffers[a]);
+            glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)(vertexCount * vertexBytes), NULL, GL_STATIC_DRAW);
+            for (size_t i = 0; i < meshCount; i++) {
+                if (meshGeometry[i] != (int) g) { continue; }
+                glBufferSubData(GL_ARRAY_BUFFER, (GLintptr)(meshes[i].gl_base_vertex * vertexBytes),
+                    (GLsizeiptr)(meshes[i].gl_vertex_count * vertexBytes), meshes[i].cpu_attributes[a]);
+            }
+            glEnableVertexAttribArray(a);
+            glVertexAttribPointer(a, components[a], GL_FLOAT, false, (GLsizei) vertexBytes, NULL);
+        }
+        // Depth-only passes read the position (and texture coordinate) buffers with VAOs of their own:
+        CreateDepthVertexArrays(geo->vertexBuffers[ATTR_POSITION], geo->vertexBuffers[ATTR_TEXCOORD0],
+            &geo->depthVertexArray, &geo->maskedVertexArray);
+        BindGLVertexArray(geo->vertexArray);
+        glGenBuffers(1, &geo->elementArray);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, geo->elementArray);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, (GLsizeiptr)(indexCount * sizeof(uint32_t)), NULL, GL_STATIC_DRAW);
+        Mesh* first = NULL;
+        for (size_t i = 0; i < meshCount; i++) {
+            if (meshGeometry[i] != (int) g) { continue; }
+            Mesh* mesh = &meshes[i];
+            glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, (GLintptr)(mesh->gl_first_index * sizeof(uint32_t)),
+                (GLsizeiptr)(mesh->cpu_index_count * sizeof(uint32_t)), mesh->cpu_indices);
+            mesh->gl_vertex_array = geo->vertexArray;
+            mesh->gl_depth_vertex_array = geo->depthVertexArray;
+            mesh->gl_masked_vertex_array = geo->maskedVertexArray;
+            mesh->gl_element_array = geo->elementArray;
+            mesh->gl_element_count = mesh->cpu_index_count;
+            mesh->gl_element_type = FACCESSOR_UINT32;
+            if (first == NULL) {
+                first = mesh;
+                EnableInstanceAttributes(mesh); // sets up the shared VAO for all of them
+            }
+            mesh->gl_instance_attribs = true;
+        }
+    }
+
+    vxFree(meshGeometry);
+    *geometryCount = count;
+    return geometry;
+}
+
+void ReadModelStaging (ModelStaging* staging, const char* gltfDirectory, const char* gltfFilename) {
+    memset(staging, 0, sizeof(ModelStaging));
     double tStart = glfwGetTime();
-    static char gltfPath [4096]; // path to GLTF file
-    static char filePath [4096]; // buffer for storing other filenames
+    char gltfPath [4096]; // path to GLTF file
+    char filePath [4096]; // buffer for storing other filenames
     stbsp_snprintf(gltfPath, vxSize(gltfPath), "%s/%s", gltfDirectory, gltfFilename);
-    model->sourceFilePath = strdup(gltfPath);
 
-    vxLog("Reading GLTF model from %s into 0x%jx...", gltfPath, model);
+    vxLog("Reading GLTF model from %s...", gltfPath);
     JSON_Value* rootval = json_parse_file_with_comments(gltfPath);
     if (rootval == NULL) {
         vxLog("Failed to parse JSON file (unknown error in parson - does file exist?)");
@@ -155,14 +516,11 @@ void ReadModelFromDisk (const char* name, Model* model, const char* gltfDirector
         }
     }
 
-    // Extract samplers:
+    // Extract samplers (created by UploadModel):
     JSON_Array* jsamplers  = json_object_get_array(root, "samplers");
     size_t samplerCount    = json_array_get_count(jsamplers);
-    GLuint* samplers       = vxAlloc(samplerCount, GLuint);
+    GLint* samplerParams   = vxAlloc(vxMax(samplerCount, 1) * 4, GLint);
     bool* samplerNeedsMips = vxAlloc(samplerCount, bool);
-    // Create GL sampler objects:
-    glGenSamplers((GLsizei) samplerCount, samplers);
-    // Set sampler parameters:
     for (size_t ismp = 0; ismp < samplerCount; ismp++) {
         JSON_Object* jsmp = json_array_get_object(jsamplers, ismp);
         // Retrieve:
@@ -175,11 +533,11 @@ void ReadModelFromDisk (const char* name, Model* model, const char* gltfDirector
         if (magfilter == 0) { magfilter = GL_LINEAR; }
         if (wrapS == 0) { wrapS = GL_REPEAT; }
         if (wrapT == 0) { wrapT = GL_REPEAT; }
-        // Set: (GLTF uses OpenGL enums so we don't have to translate anything)
-        glSamplerParameteri(samplers[ismp], GL_TEXTURE_MIN_FILTER, minfilter);
-        glSamplerParameteri(samplers[ismp], GL_TEXTURE_MAG_FILTER, magfilter);
-        glSamplerParameteri(samplers[ismp], GL_TEXTURE_WRAP_S, wrapS);
-        glSamplerParameteri(samplers[ismp], GL_TEXTURE_WRAP_T, wrapT);
+        // Store: (GLTF uses OpenGL enums so we don't have to translate anything)
+        samplerParams[ismp * 4 + 0] = minfilter;
+        samplerParams[ismp * 4 + 1] = magfilter;
+        samplerParams[ismp * 4 + 2] = wrapS;
+        samplerParams[ismp * 4 + 3] = wrapT;
         // Determine whether this sampler needs mips:
         samplerNeedsMips[ismp] = false;
         if (minfilter == GL_NEAREST_MIPMAP_NEAREST ||
@@ -190,19 +548,14 @@ void ReadModelFromDisk (const char* name, Model* model, const char* gltfDirector
         }
     }
 
-    // Extract textures (i.e. GLTF images):
-    double tTexLoadStart = glfwGetTime();
+    // Extract textures (i.e. GLTF images), read and decoded here and uploaded by UploadModel:
     JSON_Array* jimages = json_object_get_array(root, "images");
     JSON_Array* jtextures = json_object_get_array(root, "textures");
-    size_t textureCount = json_array_get_count(jimages);
+    size_t imageCount = json_array_get_count(jimages);
     size_t gltfTextureCount = json_array_get_count(jtextures);
-    GLuint* textures = vxAlloc(textureCount, GLuint);
-    #if 0
-    // Create GL texture objects:
-    glGenTextures(textureCount, textures);
-    #endif
-    // Queue textures for read and upload:
-    for (size_t iimg = 0; iimg < textureCount; iimg++) {
+    TextureData* images = vxAlloc(vxMax(imageCount, 1), TextureData);
+    memset(images, 0, imageCount * sizeof(TextureData));
+    for (size_t iimg = 0; iimg < imageCount; iimg++) {
         JSON_Object* jimg = json_array_get_object(jimages, iimg);
         // Determine whether or not the texture needs mipmaps:
         bool needsMips = false;
@@ -218,29 +571,27 @@ void ReadModelFromDisk (const char* name, Model* model, const char* gltfDirector
                 }
             }
         }
-        // Queue texture:
+        // Read texture (images without data become texture 0):
         const char* uri = json_object_get_string(jimg, "uri");
-        if (uri) {
+        if (ModelGeometryOnly) {
+            continue;
+        } else if (uri) {
             // TODO: We should probably make this work with URIs like "../x.png" too.
             stbsp_snprintf(filePath, vxSize(filePath), "%s/%s", gltfDirectory, uri);
-            // FIXME: Implement asset queues
-            #if 0
-                QueueTextureLoad(textures[iimg], filePath, needsMips);
-            #else
-                textures[iimg] = LoadTextureFromDisk(filePath, needsMips);
-            #endif
+            ReadTextureData(&images[iimg], filePath, needsMips);
         } else {
             // TODO: Support reading images from buffers.
             vxLog("Warning: GLTF images stored in buffers are not supported.");
             vxLog("         Unable to load image %ju from model.", iimg);
         }
     }
-    double tTexLoadEnd = glfwGetTime();
 
     // Extract materials:
     JSON_Array* jmaterials = json_object_get_array(root, "materials");
     size_t materialCount   = json_array_get_count(jmaterials);
     Material* materials    = vxAlloc(materialCount, Material);
+    int* materialImages    = vxAlloc(vxMax(materialCount, 1) * MATERIAL_TEXTURE_SLOTS, int);
+    int* materialSamplers  = vxAlloc(vxMax(materialCount, 1) * MATERIAL_TEXTURE_SLOTS, int);
     for (size_t imat = 0; imat < materialCount; imat++) {
         Material* m = &materials[imat];
         InitMaterial(m);
@@ -261,50 +612,20 @@ void ReadModelFromDisk (const char* name, Model* model, const char* gltfDirector
             m->const_roughness = (float) json_object_get_number(jmr, "roughnessFactor");
         }
         // Extract material textures:
-        JSON_Object* jdiffusetex = json_object_get_object(jmr, "baseColorTexture");
-        JSON_Object* jmetrghtex  = json_object_get_object(jmr, "metallicRoughnessTexture");
-        JSON_Object* jnormaltex  = json_object_get_object(jmat, "normalTexture");
-        JSON_Object* jocctex     = json_object_get_object(jmat, "occlusionTexture");
-        if (jdiffusetex) {
-            int itex = (int) json_object_get_number(jdiffusetex, "index");
-            JSON_Object* jtex = json_array_get_object(jtextures, itex);
-            if (jtex && json_object_has_value(jtex, "source") && json_object_has_value(jtex, "sampler")) {
-                int iimg = (int) json_object_get_number(jtex, "source");
-                int ismp = (int) json_object_get_number(jtex, "sampler");
-                m->tex_diffuse = textures[iimg];
-                m->smp_diffuse = samplers[ismp];
-            }
-        }
-        if (jmetrghtex) {
-            int itex = (int) json_object_get_number(jmetrghtex, "index");
-            JSON_Object* jtex = json_array_get_object(jtextures, itex);
-            if (jtex && json_object_has_value(jtex, "source") && json_object_has_value(jtex, "sampler")) {
-                int iimg = (int) json_object_get_number(jtex, "source");
-                int ismp = (int) json_object_get_number(jtex, "sampler");
-                m->tex_occ_rgh_met = textures[iimg];
-                m->smp_occ_rgh_met = samplers[ismp];
-            }
-        }
-        if (jnormaltex) {
-            int itex = (int) json_object_get_number(jnormaltex, "index");
-            JSON_Object* jtex = json_array_get_object(jtextures, itex);
-            if (jtex && json_object_has_value(jtex, "source") && json_object_has_value(jtex, "sampler")) {
-                int iimg = (int) json_object_get_number(jtex, "source");
-                int ismp = (int) json_object_get_number(jtex, "sampler");
-                m->tex_normal = textures[iimg];
-                m->smp_normal = samplers[ismp];
-            }
-        }
-        if (jocctex) {
-            int itex = (int) json_object_get_number(jocctex, "index");
-            JSON_Object* jtex = json_array_get_object(jtextures, itex);
-            if (jtex && json_object_has_value(jtex, "source") && json_object_has_value(jtex, "sampler")) {
-                int iimg = (int) json_object_get_number(jtex, "source");
-                int ismp = (int) json_object_get_number(jtex, "sampler");
-                m->tex_occlusion = textures[iimg];
-                m->smp_occlusion = samplers[ismp];
-            }
+        int* images = &materialImages[imat * MATERIAL_TEXTURE_SLOTS];
+        int* smps = &materialSamplers[imat * MATERIAL_TEXTURE_SLOTS];
+        for (int t = 0; t < MATERIAL_TEXTURE_SLOTS; t++) {
+            images[t] = -1;
+            smps[t] = -1;
         }
+        sReadMaterialTexture(json_object_get_object(jmr, "baseColorTexture"), jtextures,
+            &images[MATTEX_DIFFUSE], &smps[MATTEX_DIFFUSE]);
+        sReadMaterialTexture(json_object_get_object(jmr, "metallicRoughnessTexture"), jtextures,
+            &images[MATTEX_OCC_RGH_MET], &smps[MATTEX_OCC_RGH_MET]);
+        sReadMaterialTexture(json_object_get_object(jmat, "normalTexture"), jtextures,
+            &images[MATTEX_NORMAL], &smps[MATTEX_NORMAL]);
+        sReadMaterialTexture(json_object_get_object(jmat, "occlusionTexture"), jtextures,
+            &images[MATTEX_OCCLUSION], &smps[MATTEX_OCCLUSION]);
         // Extract alpha mode: (default is OPAQUE, i.e. no blending or stippling)
         const char* jalphamode = json_object_get_string(jmat, "alphaMode");
         if (json_object_has_value(jmat, "alphaCutoff")) {
@@ -319,6 +640,13 @@ void ReadModelFromDisk (const char* name, Model* model, const char* gltfDirector
         // Extract cull mode:
         bool jdoublesided = json_object_get_boolean(jmat, "doubleSided");
         if (jdoublesided) { m->cull = false; }
+        // Work out which shader features the material uses (vertex colors are added with the meshes):
+        m->features = 0;
+        if (images[MATTEX_DIFFUSE] >= 0)     { m->features |= MATFEAT_DIFFUSE_MAP; }
+        if (images[MATTEX_NORMAL] >= 0)      { m->features |= MATFEAT_NORMAL_MAP; }
+        if (images[MATTEX_OCC_RGH_MET] >= 0) { m->features |= MATFEAT_OCC_RGH_MET_MAP; }
+        if (images[MATTEX_METALLIC] >= 0 || images[MATTEX_ROUGHNESS] >= 0) { m->features |= MATFEAT_SEPARATE_MAPS; }
+        if (m->stipple)                      { m->features |= MATFEAT_ALPHA_MASK; }
     }
 
     // Extract nodes and count meshes (GLTF primitives):
@@ -418,7 +746,7 @@ void ReadModelFromDisk (const char* name, Model* model, const char* gltfDirector
                 JSON_Object* jprim = json_array_get_object(jprims, iprim);
                 JSON_Object* jattr = json_object_get_object(jprim, "attributes");
                 Mesh* mesh = &meshes[imesh];
-                glGenVertexArrays(1, &mesh->gl_vertex_array);
+                memset(mesh, 0, sizeof(Mesh));
                 glm_mat4_copy(node->scene, meshTransforms[imesh]);
                 // Debug:
                 size_t meshVertexCount = 0;
@@ -432,40 +760,36 @@ void ReadModelFromDisk (const char* name, Model* model, const char* gltfDirector
                 if (json_object_has_value(jprim, "material")) {
                     int imat = (int) json_object_get_number(jprim, "material");
                     meshMaterials[imesh] = &materials[imat];
+                    if (json_object_has_value(jattr, "COLOR_0")) {
+                        materials[imat].features |= MATFEAT_VERTEX_COLOR;
+                    }
                 }
-                // Read and upload indices:
+                // Read indices (uploaded with the other meshes' by sUploadModelGeometry):
                 if (json_object_has_value(jprim, "indices")) {
                     int iacc = (int) json_object_get_number(jprim, "indices");
                     FAccessor* acc = &accessors[iacc];
-                    glGenBuffers(1, &mesh->gl_element_array);
-                    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->gl_element_array);
-                    glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-                        (GLsizei)(acc->count * acc->stride), acc->buffer, GL_STATIC_DRAW);
                     mesh->gl_element_count = acc->count;
                     mesh->gl_element_type  = acc->type;
                     meshIndexCount += acc->count;
+                    sCopyMeshIndices(mesh, acc);
                 }
-                // Read and upload attributes:
-                // FIXME: allow uploading something other than GL_FLOATs
-                glBindVertexArray(mesh->gl_vertex_array);
+                // Read attributes (uploaded from the CPU copies, so only float attributes are supported):
                 #define X(name, location, glslName, gltfName) { \
                     if (json_object_has_value(jattr, gltfName)) { \
                         int iacc = (int) json_object_get_number(jattr, gltfName); \
                         FAccessor* acc = &accessors[iacc]; \
-                        GLuint vbo; \
-                        glGenBuffers(1, &vbo); \
-                        glBindBuffer(GL_ARRAY_BUFFER, vbo); \
-                        glBufferData(GL_ARRAY_BUFFER, \
-                            (GLsizei)(acc->count * acc->stride), acc->buffer, GL_STATIC_DRAW); \
-                        glEnableVertexAttribArray(location); \
-                        glVertexAttribPointer(location, FAccessorComponentCount(acc->type), \
-                            GL_FLOAT, false, acc->stride, NULL); \
+                        sCopyMeshAttribute(mesh, location, acc); \
                         if (location == 0) { meshVertexCount += acc->count; } \
                     } \
                 }
                 XM_PROGRAM_ATTRIBUTES
                 #undef X
                 mesh->gl_vertex_count = meshVertexCount;
+                // Read bounds:
+                if (json_object_has_value(jattr, "POSITION")) {
+                    int iacc = (int) json_object_get_number(jattr, "POSITION");
+                    sReadMeshBounds(mesh, json_array_get_object(jaccessors, iacc), &accessors[iacc]);
+                }
                 // vxLog("* Read mesh 0x%jx with %lu vertices, %lu indices, VAO %u, EBO %u", mesh,
                 //     meshVertexCount, meshIndexCount, mesh->gl_vertex_array, mesh->gl_element_array);
                 imesh++;
@@ -474,6 +798,21 @@ void ReadModelFromDisk (const char* name, Model* model, const char* gltfDirector
     }
     meshCount = imesh;
 
+    // Compute model bounds:
+    glm_vec3_zero(staging->aabbMin);
+    glm_vec3_zero(staging->aabbMax);
+    for (size_t i = 0; i < meshCount; i++) {
+        vec3 mmin, mmax;
+        TransformAABB(meshTransforms[i], meshes[i].aabbMin, meshes[i].aabbMax, mmin, mmax);
+        if (i == 0) {
+            glm_vec3_copy(mmin, staging->aabbMin);
+            glm_vec3_copy(mmax, staging->aabbMax);
+        } else {
+            glm_vec3_minv(staging->aabbMin, mmin, staging->aabbMin);
+            glm_vec3_maxv(staging->aabbMax, mmax, staging->aabbMax);
+        }
+    }
+
     // Free temporary storage:
     for (size_t i = 0; i < bufferCount; i++) {
         free(buffers[i]); // allocated by vxReadFile using malloc
@@ -481,23 +820,151 @@ void ReadModelFromDisk (const char* name, Model* model, const char* gltfDirector
     vxFree(accessors);
     vxFree(buffers);
     vxFree(bufferSizes);
-    vxFree(samplers);
     vxFree(samplerNeedsMips);
     vxFree(nodes);
+    json_value_free(rootval);
+
+    staging->ok = true;
+    staging->bufferCount = bufferCount;
+    staging->samplerCount = samplerCount;
+    staging->samplerParams = samplerParams;
+    staging->imageCount = imageCount;
+    staging->images = images;
+    staging->materialCount = materialCount;
+    staging->materials = materials;
+    staging->materialImages = materialImages;
+    staging->materialSamplers = materialSamplers;
+    staging->meshCount = meshCount;
+    staging->meshes = meshes;
+    staging->meshTransforms = meshTransforms;
+    staging->meshMaterials = meshMaterials;
+    staging->tRead = (glfwGetTime() - tStart) * 1000.0;
+}
+
+void DiscardModelStaging (ModelStaging* staging) {
+    if (staging->ok) {
+        for (size_t i = 0; i < staging->imageCount; i++) {
+            FreeTextureData(&staging->images[i]);
+        }
+        for (size_t i = 0; i < staging->meshCount; i++) {
+            Mesh* mesh = &staging->meshes[i];
+            for (int a = 0; a < MESH_ATTRIBUTE_SLOTS; a++) {
+                if (mesh->cpu_attributes[a] != NULL) { vxFree(mesh->cpu_attributes[a]); }
+            }
+            if (mesh->cpu_indices != NULL) { vxFree(mesh->cpu_indices); }
+        }
+        vxFree(staging->samplerParams);
+        vxFree(staging->images);
+        vxFree(staging->materials);
+        vxFree(staging->materialImages);
+        vxFree(staging->materialSamplers);
+        vxFree(staging->meshes);
+        vxFree(staging->meshTransforms);
+        vxFree(staging->meshMaterials);
+    }
+    memset(staging, 0, sizeof(ModelStaging));
+}
+
+void UploadModel (Model* model, ModelStaging* staging) {
+    if (!staging->ok) {
+        model->failed = true;
+        return;
+    }
+    double tStart = glfwGetTime();
+    size_t materialCount = staging->materialCount;
+    Material* materials = staging->materials;
+    size_t meshCount = staging->meshCount;
+    Mesh* meshes = staging->meshes;
+
+    // Create GL sampler objects, and point the materials at them:
+    size_t samplerCount = staging->samplerCount;
+    GLuint* samplers = vxAlloc(samplerCount, GLuint);
+    memset(samplers, 0, samplerCount * sizeof(GLuint));
+    if (!ModelGeometryOnly) {
+        glGenSamplers((GLsizei) samplerCount, samplers);
+        for (size_t ismp = 0; ismp < samplerCount; ismp++) {
+            glSamplerParameteri(samplers[ismp], GL_TEXTURE_MIN_FILTER, staging->samplerParams[ismp * 4 + 0]);
+            glSamplerParameteri(samplers[ismp], GL_TEXTURE_MAG_FILTER, staging->samplerParams[ismp * 4 + 1]);
+            glSamplerParameteri(samplers[ismp], GL_TEXTURE_WRAP_S, staging->samplerParams[ismp * 4 + 2]);
+            glSamplerParameteri(samplers[ismp], GL_TEXTURE_WRAP_T, staging->samplerParams[ismp * 4 + 3]);
+        }
+    }
+    for (size_t i = 0; i < materialCount * MATERIAL_TEXTURE_SLOTS; i++) {
+        int ismp = staging->materialSamplers[i];
+        if (ismp >= 0 && (size_t) ismp < samplerCount) {
+            materials[i / MATERIAL_TEXTURE_SLOTS].textures[i % MATERIAL_TEXTURE_SLOTS].sampler = samplers[ismp];
+        }
+    }
+
+    // Upload the images and pack them into texture arrays:
+    size_t textureCount = 0;
+    GLuint* textures = NULL;
+    size_t textureBytes = 0;
+    if (!ModelGeometryOnly) {
+        GLuint* images = vxAlloc(vxMax(staging->imageCount, 1), GLuint);
+        for (size_t iimg = 0; iimg < staging->imageCount; iimg++) {
+            images[iimg] = (staging->images[iimg].data != NULL) ? UploadTextureData(&staging->images[iimg]) : 0;
+        }
+        textures = sPackMaterialTextures(images, staging->imageCount, materials, materialCount,
+            staging->materialImages, &textureCount, &textureBytes);
+        vxFree(images);
+    }
 
-    // Fill out model fields:
-    // TODO: Add an atomic lock to the model so we can load it on another thread.
+    ModelGeometry* geometry = NULL;
+    size_t geometryCount = 0;
+    if (!ModelGeometryOnly) {
+        geometry = sUploadModelGeometry(meshes, meshCount, &geometryCount);
+        // Now that their features are known, add the materials to the material table:
+        for (size_t imat = 0; imat < materialCount; imat++) {
+            UpdateMaterial(&materials[imat]);
+        }
+    }
+
+    // Fill out model fields. Materials, meshes and their CPU copies move over from the staging:
+    glm_vec3_copy(staging->aabbMin, model->aabbMin);
+    glm_vec3_copy(staging->aabbMax, model->aabbMax);
     model->textureCount = textureCount;
     model->textures = textures;
+    model->samplerCount = samplerCount;
+    model->samplers = samplers;
     model->materialCount = materialCount;
     model->materials = materials;
     model->meshCount = meshCount;
-    model->meshTransforms = meshTransforms;
-    model->meshMaterials = meshMaterials;
+    model->meshTransforms = staging->meshTransforms;
+    model->meshMaterials = staging->meshMaterials;
     model->meshes = meshes;
+    model->geometryCount = geometryCount;
+    model->geometry = geometry;
 
-    double t1 = (glfwGetTime() - tStart) * 1000.0;
-    double t2 = t1 - ((tTexLoadEnd - tTexLoadStart) * 1000.0);
-    vxLog("Uploaded model with %ju buffers, %ju materials and %ju meshes (%.02lf ms total, %.02lf ms w/o textures)",
-        bufferCount, materialCount, meshCount, t1, t2);
-}
\ No newline at end of file
+    // Estimate memory use. Geometry is kept both on the GPU and in the CPU copies:
+    model->memoryBytes = 0;
+    for (size_t i = 0; i < meshCount; i++) {
+        Mesh* mesh = &meshes[i];
+        for (int a = 0; a < MESH_ATTRIBUTE_SLOTS; a++) {
+            model->memoryBytes += 2 * mesh->gl_vertex_count * mesh->cpu_attribute_components[a] * sizeof(float);
+        }
+        model->memoryBytes += 2 * mesh->cpu_index_count * sizeof(uint32_t);
+    }
+    model->memoryBytes += textureBytes;
+    model->failed = false;
+    model->resident = true;
+    ModelResidencyVersion++;
+
+    double tUpload = (glfwGetTime() - tStart) * 1000.0;
+    vxLog("Uploaded model %s with %ju buffers, %ju materials and %ju meshes (%.02lf ms reading, %.02lf ms uploading)",
+        model->name, staging->bufferCount, materialCount, meshCount, staging->tRead, tUpload);
+
+    vxFree(staging->samplerParams);
+    vxFree(staging->images);
+    vxFree(staging->materialImages);
+    vxFree(staging->materialSamplers);
+    memset(staging, 0, sizeof(ModelStaging));
+}
+
+void ReadModelFromDisk (const char* name, Model* model, const char* gltfDirectory, const char* gltfFilename) {
+    sRegisterModel(name, model, gltfDirectory, gltfFilename); // mark as invalid
+    model->failed = true;
+    ModelStaging staging;
+    ReadModelStaging(&staging, gltfDirectory, gltfFilename);
+    UploadModel(model, &staging);
+}
@@ -3,7 +3,40 @@
 #include "assets.h"
 #include "flib/accessor.h"
 
+// Texture slots of a material. Shaders sample each slot from a sampler2DArray uniform (UNIF_TEX_*), at the layer given
+// by the material's MaterialData (see render.h).
+typedef enum MaterialTextureSlot {
+    MATTEX_DIFFUSE,
+    MATTEX_OCC_RGH_MET,
+    MATTEX_OCCLUSION,
+    MATTEX_METALLIC,
+    MATTEX_ROUGHNESS,
+    MATTEX_NORMAL,
+    MATERIAL_TEXTURE_SLOTS
+} MaterialTextureSlot;
+
+// A material texture, as one layer of a texture array. Models pack their textures into arrays by size and format when
+// they're loaded, so materials of the same model usually share their arrays and only differ in the layers they use.
+typedef struct MaterialTexture {
+    GLuint array;   // GL_TEXTURE_2D_ARRAY
+    GLuint sampler;
+    int32_t layer;
+} MaterialTexture;
+
+// Optional parts of material shading, as bits of Material.features. Programs are specialized on them, so materials
+// don't pay for features they don't use (see GetProgramVariant).
+#define X(name, bit, glslName) name = bit,
+typedef enum MaterialFeature {
+    XM_MATERIAL_FEATURES
+} MaterialFeature;
+#undef X
+
+#define X(name, bit, glslName) | name
+enum { MATFEAT_ALL = 0 XM_MATERIAL_FEATURES };
+#undef X
+
 typedef struct Material {
+    uint32_t id; // unique per material, assigned by InitMaterial
     bool blend;
     GLenum blend_srcf;
     GLenum blend_dstf;
@@ -20,51 +53,128 @@ typedef struct Material {
     float const_occlusion;
     float const_metallic;
     float const_roughness;
-    GLuint tex_diffuse;
-    GLuint smp_diffuse;
-    GLuint tex_occ_rgh_met;
-    GLuint smp_occ_rgh_met;
-    GLuint tex_occlusion;
-    GLuint smp_occlusion;
-    GLuint tex_metallic;
-    GLuint smp_metallic;
-    GLuint tex_roughness;
-    GLuint smp_roughness;
-    GLuint tex_normal;
-    GLuint smp_normal;
+    MaterialTexture textures [MATERIAL_TEXTURE_SLOTS];
+    uint32_t features;   // MaterialFeature bits, MATFEAT_ALL for materials that can use anything
+    // Set by UpdateMaterial (see render.h):
+    int32_t tableIndex;  // slot of the material's MaterialData in the material table, -1 if it has none yet
+    uint32_t bindSet;    // materials with the same bind set bind the same textures and GL state
 } Material;
 
 void InitMaterial (Material* m);
 
+// Number of vertex attribute locations, one per entry in XM_PROGRAM_ATTRIBUTES.
+#define MESH_ATTRIBUTE_SLOTS 8
+
 typedef struct Mesh {
     GLenum type; // GL_TRIANGLES, etc.
     GLuint gl_vertex_array;
     GLuint gl_element_array;
+    size_t gl_first_index;   // where the mesh's indices start in gl_element_array, in indices
+    int32_t gl_base_vertex;  // added to the mesh's indices, where its vertices start in the vertex buffers
     size_t gl_element_count;
     FAccessorType gl_element_type;
     size_t gl_vertex_count;
+    bool gl_instance_attribs; // VAO reads the ATTR_INSTANCE_* attributes from the instance buffer
+    // VAOs for depth-only draws, reading the same buffers (see CreateDepthVertexArrays). 0 if the mesh has none.
+    GLuint gl_depth_vertex_array;  // positions only
+    GLuint gl_masked_vertex_array; // positions and texture coordinates, for alpha masks
+    vec3 aabbMin; // object space bounds
+    vec3 aabbMax;
+    // CPU copies of the geometry, used by passes that process it on the CPU (e.g. static batching).
+    // Attributes are tightly packed floats indexed by attribute location, NULL if the mesh doesn't have them.
+    float* cpu_attributes [MESH_ATTRIBUTE_SLOTS];
+    uint8_t cpu_attribute_components [MESH_ATTRIBUTE_SLOTS];
+    uint32_t* cpu_indices;
+    size_t cpu_index_count;
 } Mesh;
 
-// NOTE: Models with mesh count 0 are considered invalid and should not be displayed in the UI.
+// Vertex and index buffers shared by all meshes of a model that have the same attributes, so that draws of different
+// meshes can be merged into one call (see RENDERCMD_MULTI_DRAW). Meshes find their part through gl_first_index and
+// gl_base_vertex. Indices are stored as 32 bits.
+typedef struct ModelGeometry {
+    GLuint vertexArray;
+    GLuint depthVertexArray;
+    GLuint maskedVertexArray;
+    GLuint elementArray;
+    GLuint vertexBuffers [MESH_ATTRIBUTE_SLOTS]; // 0 for missing attributes
+} ModelGeometry;
+
+// NOTE: Models with mesh count 0 are either not loaded (see ModelStreaming) or failed to load. Failed models should not
+// be displayed in the UI.
 typedef struct Model {
     char* name;
     char* sourceFilePath;
+    const char* sourceDirectory; // as passed to ReadModelFromDisk, kept while the model is unloaded
+    const char* sourceFile;
+    bool resident;       // read from disk and uploaded
+    bool failed;         // the last read failed
+    size_t memoryBytes;  // estimated CPU and GPU memory used while resident
     size_t textureCount;
     GLuint* textures;
+    size_t samplerCount;
+    GLuint* samplers;
     size_t materialCount;
     Material* materials;
     size_t meshCount;
     mat4* meshTransforms;
     Material** meshMaterials;
     Mesh* meshes;
+    size_t geometryCount;
+    ModelGeometry* geometry;
+    vec3 aabbMin; // bounds of all meshes after applying meshTransforms
+    vec3 aabbMax;
 } Model;
 
 #define X(name, dir, file) extern Model name;
 XM_ASSETS_MODELS_GLTF
 #undef X
 
+// Set before loading models to read only their geometry, bounds and material flags, without touching OpenGL. Used by
+// offline tools that run without a GL context.
+extern bool ModelGeometryOnly;
+// Set before loading models to only register their names and paths. Models are then read on demand with LoadModel,
+// e.g. by world streaming (see scene/stream.h).
+extern bool ModelStreaming;
 VX_EXPORT size_t ModelCount;
 VX_EXPORT Model** Models;
+// Model names in the same order as Models. These never change, so unlike Models[i]->name they can be read on any thread
+// while models are being loaded and unloaded.
+VX_EXPORT const char** ModelNames;
+// Incremented whenever a model is read or unloaded. Caches built from model data (e.g. static batches) compare it to
+// know when to rebuild.
+VX_EXPORT uint32_t ModelResidencyVersion;
+
+// A model read from disk and decoded, but without any GL objects yet. Reading doesn't touch GL or the Model, so it can
+// run on any thread, while uploading needs the GL context. World streaming reads models on job workers and only
+// uploads them on the render thread (see scene/stream.h).
+typedef struct ModelStaging {
+    bool ok;                   // false if the model couldn't be read
+    double tRead;              // ms
+    size_t bufferCount;
+    size_t samplerCount;
+    GLint* samplerParams;      // min filter, mag filter, wrap S and wrap T of each sampler
+    size_t imageCount;
+    struct TextureData* images; // no data for images that couldn't be read
+    size_t materialCount;
+    Material* materials;
+    int* materialImages;       // MATERIAL_TEXTURE_SLOTS image indices per material, -1 for none
+    int* materialSamplers;     // same for sampler indices
+    size_t meshCount;
+    Mesh* meshes;              // with their CPU copies
+    mat4* meshTransforms;
+    Material** meshMaterials;  // into materials
+    vec3 aabbMin;
+    vec3 aabbMax;
+} ModelStaging;
 
 VX_EXPORT void LoadModels();
-VX_EXPORT void ReadModelFromDisk (const char* name, Model* model, const char* dir, const char* file);
\ No newline at end of file
+VX_EXPORT void ReadModelFromDisk (const char* name, Model* model, const char* dir, const char* file);
+// Reads a model's files into a staging area. Safe on any thread.
+VX_EXPORT void ReadModelStaging (ModelStaging* staging, const char* dir, const char* file);
+// Creates the GL objects of a staged model and makes it resident, taking over the staging's memory. Marks the model
+// as failed if the staging couldn't be read.
+VX_EXPORT void UploadModel (Model* model, ModelStaging* staging);
+VX_EXPORT void DiscardModelStaging (ModelStaging* staging);
+// Reads and uploads a registered or unloaded model on the calling thread.
+VX_EXPORT void LoadModel (Model* model);
+VX_EXPORT void UnloadModel (Model* model);
\ No newline at end of file
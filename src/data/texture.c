@@ -11,27 +11,16 @@ XM_ASSETS_TEXTURES
 #undef X
 
 #define X(name, format) GLuint name = 0;
-XM_RENDERTARGETS_SCREEN
-XM_RENDERTARGETS_SHADOW
 XM_RENDERTARGETS_ENVMAP
 #undef X
 
-#define BEGIN(name) GLuint name = 0;
-#define DEPTH(point, name)
-#define COLOR(point, name)
-#define END(name)
-XM_FRAMEBUFFERS
-#undef BEGIN
-#undef DEPTH
-#undef COLOR
-#undef END
-
 GLuint VXGL_SAMPLER [VXGL_SAMPLER_COUNT];
 
 // GLuint ENVMAP_BASE = 0;
 // GLuint ENVMAP_CUBE = 0;
 
 GLuint TEX_WHITE_1x1;
+GLuint TEX_WHITE_1x1_ARRAY;
 GLuint SMP_NEAREST;
 GLuint SMP_NEAREST_REPEAT;
 GLuint SMP_LINEAR;
@@ -41,6 +30,10 @@ void InitTextureSystem() {
     glGenTextures(1, &TEX_WHITE_1x1);
     glBindTexture(GL_TEXTURE_2D, TEX_WHITE_1x1);
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, (GLubyte[]){ 255, 255, 255, 255 });
+    glGenTextures(1, &TEX_WHITE_1x1_ARRAY);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, TEX_WHITE_1x1_ARRAY);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA, 1, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+        (GLubyte[]){ 255, 255, 255, 255 });
     glGenSamplers(1, &SMP_NEAREST);
     glSamplerParameteri(SMP_NEAREST, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glSamplerParameteri(SMP_NEAREST, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
@@ -160,38 +153,13 @@ static void sUpdateRenderTarget (const char* name, const char* fmtname, GLuint*
     glBindTexture(GL_TEXTURE_2D, 0);
 }
 
-// Updates all render targets and framebuffers, if required.
+// Updates the environment map render targets, if required. Screen and shadow map targets belong to the render graph.
 // Returns a bitfield containing one UPDATED_*_TARGETS flag for each type of render target that was updated.
 uint8_t UpdateRenderTargets (vxConfig* conf) {
-    static int lastScreenW = 0;
-    static int lastScreenH = 0;
-    static int lastShadowSize = 0;
     static int lastEnvmapSize = 0;
-    int screenW = conf->displayW;
-    int screenH = conf->displayH;
-    int shadowSize = conf->shadowSize;
     int envmapSize = conf->envmapSize;
     uint8_t updated = 0;
 
-    if (screenW == 0 || screenH == 0) {
-        // Trying to generate a 0x0 framebuffer does not go well.
-        return 0;
-    }
-
-    if (screenW != lastScreenW || screenH != lastScreenH) {
-        updated |= UPDATED_SCREEN_TARGETS;
-        #define X(name, format) sUpdateRenderTarget(#name, #format, &name, format, screenW, screenH);
-        XM_RENDERTARGETS_SCREEN
-        #undef X
-    }
-
-    if (shadowSize != lastShadowSize) {
-        updated |= UPDATED_SHADOW_TARGETS;
-        #define X(name, format) sUpdateRenderTarget(#name, #format, &name, format, shadowSize, shadowSize);
-        XM_RENDERTARGETS_SHADOW
-        #undef X
-    }
-
     if (envmapSize != lastEnvmapSize) {
         updated |= UPDATED_ENVMAP_TARGETS;
         #define X(name, format) sUpdateRenderTarget(#name, #format, &name, format, envmapSize, envmapSize);
@@ -199,42 +167,25 @@ uint8_t UpdateRenderTargets (vxConfig* conf) {
         #undef X
     }
 
-    if (updated) {
-        GLenum status;
-        #define BEGIN(name) \
-            if (name != 0) { glDeleteFramebuffers(1, &name); } \
-            glGenFramebuffers(1, &name); \
-            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, name);
-        #define DEPTH(point, name) \
-            glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, point, GL_TEXTURE_2D, name, 0);
-        #define COLOR(point, name) \
-            glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, point, GL_TEXTURE_2D, name, 0);
-        #define END(name) \
-            status = glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER); \
-            if (status != GL_FRAMEBUFFER_COMPLETE) { \
-                vxPanic("Couldn't create framebuffer " #name ": error %d", status); \
-            }
-        XM_FRAMEBUFFERS
-        #undef BEGIN
-        #undef DEPTH
-        #undef COLOR
-        #undef END
-        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
-    }
-
-    lastScreenW = screenW;
-    lastScreenH = screenH;
-    lastShadowSize = shadowSize;
     lastEnvmapSize = envmapSize;
     return updated;
 }
 
-// Loads a texture from disk and uploads it to the GPU. Returns its OpenGL ID.
-GLuint LoadTextureFromDisk (const char* path, bool mips) {
+static void sTextureFormats (TextureData* tex, GLenum* internalformat, GLenum* format) {
+    switch (tex->c) {
+        case 1: { *internalformat = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;  *format = GL_RED;  break; }
+        case 2: { *internalformat = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;  *format = GL_RG;   break; }
+        case 3: { *internalformat = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;  *format = GL_RGB;  break; }
+        case 4: { *internalformat = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT; *format = GL_RGBA; break; }
+        default: { vxPanic("Unknown channel count %u for %s (%s)", tex->c, tex->path, tex->cachePath); }
+    }
+}
+
+void ReadTextureData (TextureData* tex, const char* path, bool mips) {
     double tStart = glfwGetTime();
-    GLuint texture;
-    glGenTextures(1, &texture);
-    glBindTexture(GL_TEXTURE_2D, texture);
+    memset(tex, 0, sizeof(TextureData));
+    stbsp_snprintf(tex->path, (int) sizeof(tex->path), "%s", path);
+    tex->mips = mips;
 
     // Generate hash of texture filename and mtime:
     uint64_t mtime = vxGetFileMtime(path);
@@ -243,33 +194,63 @@ GLuint LoadTextureFromDisk (const char* path, bool mips) {
     hash ^= stbds_hash_bytes(&mtime, sizeof(mtime), VX_SEED);
 
     // Look for cached texture:
-    static char cachedTexturePath [128];
-    stbsp_snprintf(cachedTexturePath, 128, "userdata/texturecache/%jx.dat", hash);
-    if (vxGetFileMtime(cachedTexturePath) != 0) {
-        size_t size;
-        char* data = vxReadFile(cachedTexturePath, "rb", &size);
-        uint32_t w = ((uint32_t*) data)[0];
-        uint32_t h = ((uint32_t*) data)[1];
-        uint32_t c = ((uint32_t*) data)[2]; // channels
-        uint32_t l = ((uint32_t*) data)[3]; // mip levels
+    stbsp_snprintf(tex->cachePath, (int) sizeof(tex->cachePath), "userdata/texturecache/%jx.dat", hash);
+    if (vxGetFileMtime(tex->cachePath) != 0) {
+        tex->cached = true;
+        tex->data = vxReadFile(tex->cachePath, "rb", &tex->size);
+        tex->w = ((uint32_t*) tex->data)[0];
+        tex->h = ((uint32_t*) tex->data)[1];
+        tex->c = ((uint32_t*) tex->data)[2]; // channels
+        tex->levels = ((uint32_t*) tex->data)[3];
+        tex->tRead = (glfwGetTime() - tStart) * 1000.0;
+        return;
+    }
+
+    // Read from disk:
+    int w, h, c;
+    tex->data = (char*) stbi_load(path, &w, &h, &c, 0);
+    if (!tex->data) {
+        vxPanic("Failed to load %s: %s", path, stbi_failure_reason());
+    }
+    tex->w = (uint32_t) w;
+    tex->h = (uint32_t) h;
+    tex->c = (uint32_t) c;
+
+    // Compute mip level count (no way to query it):
+    // https://www.khronos.org/registry/OpenGL/extensions/ARB/ARB_texture_non_power_of_two.txt
+    tex->levels = 1;
+    if (mips) {
+        tex->levels += (uint32_t) floor(log2(vxMax(vxMax(w, h), 2)));
+    }
+    tex->tRead = (glfwGetTime() - tStart) * 1000.0;
+}
+
+void FreeTextureData (TextureData* tex) {
+    if (tex->data != NULL) {
+        free(tex->data); // allocated by vxReadFile or stbi_load using malloc
+    }
+    tex->data = NULL;
+}
+
+GLuint UploadTextureData (TextureData* tex) {
+    double tStart = glfwGetTime();
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    GLenum internalformat, format;
+    sTextureFormats(tex, &internalformat, &format);
+
+    if (tex->cached) {
+        int levelw = (int) tex->w;
+        int levelh = (int) tex->h;
         size_t idata = 4 * sizeof(uint32_t);
-        GLenum internalformat, format;
-        switch (c) {
-            case 1: { internalformat = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;  format = GL_RED;  break; }
-            case 2: { internalformat = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;  format = GL_RG;   break; }
-            case 3: { internalformat = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;  format = GL_RGB;  break; }
-            case 4: { internalformat = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT; format = GL_RGBA; break; }
-            default: { vxPanic("Unknown channel count %d for %s (%s)", c, path, cachedTexturePath); }
-        }
-        int levelw = w;
-        int levelh = h;
-        for (int ilevel = 0; ilevel < (int) l; ilevel++) {
-            int levelsize = *(int*)(&data[idata]);
+        for (int ilevel = 0; ilevel < (int) tex->levels; ilevel++) {
+            int levelsize = *(int*)(&tex->data[idata]);
             idata += sizeof(int);
             // if ((size - idata) < levelw * levelh * c) {
             //     vxPanic("%s has wrong size %ju for parameters %ux%ux%ux%u", size, w, h, c, l);
             // }
-            char* leveldata = data + idata;
+            char* leveldata = tex->data + idata;
             // idata += levelw * levelh * c;
             idata += levelsize;
             // glTexImage2D(GL_TEXTURE_2D, ilevel, internalformat, levelw, levelh, 0, format,
@@ -279,51 +260,31 @@ GLuint LoadTextureFromDisk (const char* path, bool mips) {
             levelw /= 2;
             levelh /= 2;
         }
-        free(data);
+        FreeTextureData(tex);
         double t = (glfwGetTime() - tStart) * 1000.0;
-        vxLog("Read from cache: %s (FBO %u, %ux%ux%ux%u, %.02lf ms)", path, texture, w, h, c, l, t);
+        vxLog("Read from cache: %s (FBO %u, %ux%ux%ux%u, %.02lf ms read, %.02lf ms upload)", tex->path, texture,
+            tex->w, tex->h, tex->c, tex->levels, tex->tRead, t);
         return texture;
     }
 
-    // Read from disk:
-    int w, h, c;
-    void* image = stbi_load(path, &w, &h, &c, 0);
-    if (!image) {
-        vxPanic("Failed to load %s: %s", path, stbi_failure_reason());
-    }
-
-    // Compute mip level count (no way to query it):
-    // https://www.khronos.org/registry/OpenGL/extensions/ARB/ARB_texture_non_power_of_two.txt
-    uint32_t l = 1;
-    if (mips) {
-        l += (uint32_t) floor(log2(vxMax(vxMax(w, h), 2)));
-    }
-
     // Upload:
-    GLenum internalformat, format;
-    switch (c) {
-        case 1: { internalformat = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;  format = GL_RED;  break; }
-        case 2: { internalformat = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;  format = GL_RG;   break; }
-        case 3: { internalformat = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;  format = GL_RGB;  break; }
-        case 4: { internalformat = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT; format = GL_RGBA; break; }
-        default: { vxPanic("Unknown channel count %d for %s (%s)", c, path, cachedTexturePath); }
-    }
-    glTexImage2D(GL_TEXTURE_2D, 0, internalformat, w, h, 0, format, GL_UNSIGNED_BYTE, image);
-    if (mips) {
+    glTexImage2D(GL_TEXTURE_2D, 0, internalformat, (GLsizei) tex->w, (GLsizei) tex->h, 0, format, GL_UNSIGNED_BYTE,
+        tex->data);
+    if (tex->mips) {
         glGenerateMipmap(GL_TEXTURE_2D);
     }
-    free(image);
+    FreeTextureData(tex);
 
     // Cache:
     vxCreateDirectory("userdata");
     vxCreateDirectory("userdata/texturecache");
-    FILE* cachedTextureFile = fopen(cachedTexturePath, "wb");
+    FILE* cachedTextureFile = fopen(tex->cachePath, "wb");
     if (cachedTextureFile == 0) {
-        vxLog("Warning: can't open %s for writing: %s", cachedTexturePath, strerror(errno));
+        vxLog("Warning: can't open %s for writing: %s", tex->cachePath, strerror(errno));
     } else {
-        uint32_t info[] = {(uint32_t) w, (uint32_t) h, (uint32_t) c, l};
+        uint32_t info[] = {tex->w, tex->h, tex->c, tex->levels};
         fwrite(info, sizeof(uint32_t), 4, cachedTextureFile);
-        for (int ilevel = 0; ilevel < (int) l; ilevel++) {
+        for (int ilevel = 0; ilevel < (int) tex->levels; ilevel++) {
             // FIXME: the docs for glGetTexImage mention GL_PACK_ALIGNMENT - what's that?
             GLint levelw, levelh, compressedSize;
             glGetTexLevelParameteriv(GL_TEXTURE_2D, ilevel, GL_TEXTURE_WIDTH,  &levelw);
@@ -342,7 +303,15 @@ GLuint LoadTextureFromDisk (const char* path, bool mips) {
     }
 
     double t = (glfwGetTime() - tStart) * 1000.0;
-    vxLog("Read from disk: %s (FBO %u, %dx%dx%dx%u, %.02lf ms)", path, texture, w, h, c, l, t);
+    vxLog("Read from disk: %s (FBO %u, %ux%ux%ux%u, %.02lf ms read, %.02lf ms upload)", tex->path, texture, tex->w,
+        tex->h, tex->c, tex->levels, tex->tRead, t);
 
     return texture;
 }
+
+// Loads a texture from disk and uploads it to the GPU. Returns its OpenGL ID.
+GLuint LoadTextureFromDisk (const char* path, bool mips) {
+    static TextureData tex;
+    ReadTextureData(&tex, path, mips);
+    return UploadTextureData(&tex);
+}
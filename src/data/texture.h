@@ -8,37 +8,17 @@ XM_ASSETS_TEXTURES
 #undef X
 
 #define X(name, _) extern GLuint name;
-XM_RENDERTARGETS_SCREEN
-XM_RENDERTARGETS_SHADOW
 XM_RENDERTARGETS_ENVMAP
 #undef X
 
 extern GLuint ENVMAP_BASE;
 extern GLuint ENVMAP_CUBE;
 
-#define BEGIN(name) \
-    extern GLuint name; \
-    static const GLenum name ## _BUFFERS [] = {
-#define DEPTH(point, name)
-// #define COLOR(point, name) VX ## point ,
-#define COLOR(point, name) point ,
-#define END(name) \
-    0 }; \
-    static const GLsizei name ## _BUFFER_COUNT = vxSize(name ## _BUFFERS) - 1;
-XM_FRAMEBUFFERS
-#undef BEGIN
-#undef DEPTH
-#undef COLOR
-#undef END
-
-#define BindFramebuffer(name) \
-    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, name); \
-    glDrawBuffers(name ## _BUFFER_COUNT, name ## _BUFFERS);
-
 #define VXGL_SAMPLER_COUNT 32
 extern GLuint VXGL_SAMPLER [VXGL_SAMPLER_COUNT];
 
 extern GLuint TEX_WHITE_1x1;
+extern GLuint TEX_WHITE_1x1_ARRAY; // single layer, for material texture slots without a texture
 extern GLuint SMP_NEAREST;
 extern GLuint SMP_NEAREST_REPEAT;
 extern GLuint SMP_LINEAR;
@@ -47,8 +27,6 @@ void InitTextureSystem();
 void LoadTextures();
 
 uint8_t UpdateRenderTargets (vxConfig* conf);
-static const int UPDATED_SCREEN_TARGETS = 1 << 0;
-static const int UPDATED_SHADOW_TARGETS = 1 << 1;
 static const int UPDATED_ENVMAP_TARGETS = 1 << 2;
 static const int UPDATED_SKYBOX_TARGETS = 1 << 3;
 
@@ -67,4 +45,21 @@ typedef struct Texture {
     TextureUsageHint usage;
 } Texture;
 
+// A texture read from disk (or from the texture cache) and decoded, but not uploaded yet. Reading works on any thread,
+// uploading needs the GL context, so models that are streamed in read their textures on job workers.
+typedef struct TextureData {
+    char path [4096];
+    char cachePath [128];
+    bool mips;
+    bool cached;     // data is the cache file, holding compressed levels, instead of pixels
+    uint32_t w, h, c, levels;
+    char* data;
+    size_t size;
+    double tRead;    // ms
+} TextureData;
+
+void ReadTextureData (TextureData* tex, const char* path, bool mips);
+// Creates the texture, writes the cache file for textures that weren't cached yet and frees the data.
+GLuint UploadTextureData (TextureData* tex);
+void FreeTextureData (TextureData* tex);
 GLuint LoadTextureFromDisk (const char* path, bool mips);
\ No newline at end of file
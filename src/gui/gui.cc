@@ -2,6 +2,8 @@
 #include "main.h"
 #include "scene/core.h"
 #include "scene/save.h"
+#include "scene/journal.h"
+#include "scene/stream.h"
 #include <glad/glad.h>
 #include <glfw/glfw3.h>
 #include <imgui.h>
@@ -54,6 +56,43 @@ VX_EXPORT void GUI_Render() {
     ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 }
 
+struct GUI_DrawData {
+    ImDrawData drawData;
+    ImVector<ImDrawList*> lists; // owned clones of the frame's draw lists
+};
+
+VX_EXPORT void GUI_EndFrame (GUI_DrawData** data) {
+    ImGui::Render();
+    if (*data == NULL) {
+        *data = IM_NEW(GUI_DrawData)();
+    }
+    GUI_DrawData* copy = *data;
+    for (int i = 0; i < copy->lists.Size; i++) {
+        IM_DELETE(copy->lists[i]);
+    }
+    copy->lists.resize(0);
+    ImDrawData* src = ImGui::GetDrawData();
+    for (int i = 0; i < src->CmdListsCount; i++) {
+        copy->lists.push_back(src->CmdLists[i]->CloneOutput());
+    }
+    copy->drawData = *src;
+    copy->drawData.CmdLists = copy->lists.Data;
+}
+
+VX_EXPORT void GUI_RenderDrawData (GUI_DrawData* data) {
+    if (data != NULL && data->drawData.Valid) {
+        ImGui_ImplOpenGL3_RenderDrawData(&data->drawData);
+    }
+}
+
+VX_EXPORT void GUI_DeleteDrawData (GUI_DrawData* data) {
+    if (data == NULL) { return; }
+    for (int i = 0; i < data->lists.Size; i++) {
+        IM_DELETE(data->lists[i]);
+    }
+    IM_DELETE(data);
+}
+
 // Returns true if ImGui received the current frame's mouse or keyboard inputs.
 // The engine should avoid doing anything with them in this case.
 VX_EXPORT bool GUI_InterfaceWantsInput() {
@@ -226,9 +265,26 @@ static void sDrawStats (vxFrame* frame) {
     ImGui::SameLine(200); ImGui::Text("%.2lf max ms", maxMsRender);
     #endif
 
+    // The G-buffer pass is averaged separately for frames with and without the depth prepass, to compare the two:
+    static double avgGBuffer [2] = {0, 0};
+    if (frame->tGBuffer > 0.0f) {
+        double* avg = &avgGBuffer[frame->gbufferPrepass ? 1 : 0];
+        *avg = (*avg == 0) ? (frame->tGBuffer * 1000.0f) :
+            (float(avgInterval - 1) * *avg + (frame->tGBuffer * 1000.0f)) / avgInterval;
+    }
+    ImGui::Text("GPU GBuffer:");
+    ImGui::SameLine(100); ImGui::Text("%.2lf ms prepass", avgGBuffer[1]);
+    ImGui::SameLine(200); ImGui::Text("%.2lf ms without", avgGBuffer[0]);
+    ImGui::Text("Overdraw: %.1fx", frame->perfOverdraw);
+    ImGui::SameLine(150); ImGui::Text("Depth prepass: %s", frame->gbufferPrepass ? "on" : "off");
+
     ImGui::Text("Tris: %.01fk", ((float) frame->perfTriangles) / 1000.0f);
     ImGui::SameLine(100); ImGui::Text("Verts: %.01fk", ((float) frame->perfVertices) / 1000.0f);
     ImGui::SameLine(200); ImGui::Text("Draws: %ju", frame->perfDrawCalls);
+    ImGui::Text("Portal culled: %ju", frame->perfPortalCulledDraws);
+    ImGui::SameLine(150); ImGui::Text("PVS culled: %ju", frame->perfPVSCulledDraws);
+    ImGui::Text("Occluded: %ju", frame->perfOccludedDraws);
+    ImGui::SameLine(150); ImGui::Text("Conditional: %ju", frame->perfConditionalDraws);
 
     static double avgPoll = 0;
     static double avgSwap = 0;
@@ -281,12 +337,28 @@ static const int SHOW_MODELS = 1 << 0;
 static const int SHOW_POINT_LIGHTS = 1 << 1;
 static const int SHOW_OTHER_LIGHTS = 1 << 2;
 
+// Index of the object last picked with the Scene Viewer's "Pick" menu, or -1 for none.
+static int UI_PickedObject = -1;
+static bool UI_ScrollToPickedObject = false;
+
 static void sDrawSceneViewerObjectList (vxConfig* conf, Scene* scene, int show) {
     const int sliderMarginLeft = 30;
     for (int i = 0; i < (int) scene->size; i++) {
         GameObject* obj = &scene->objects[i];
         ImGui::PushID(i);
 
+        // Highlights the header line of the picked object and scrolls it into view once.
+        #define HEADER_TEXT(...) \
+            if (i == UI_PickedObject) { \
+                ImGui::TextColored(ImColor(255, 220, 60), __VA_ARGS__); \
+                if (UI_ScrollToPickedObject) { \
+                    ImGui::SetScrollHereY(); \
+                    UI_ScrollToPickedObject = false; \
+                } \
+            } else { \
+                ImGui::Text(__VA_ARGS__); \
+            }
+
         #define PARENTED_VIEW() \
             if (obj->parent != NULL) { \
                 ImGui::Spacing(); ImGui::SameLine(sliderMarginLeft); \
@@ -307,9 +379,10 @@ static void sDrawSceneViewerObjectList (vxConfig* conf, Scene* scene, int show)
             }
         
         if (obj->type == GAMEOBJECT_MODEL && (show & SHOW_MODELS)) {
-            ImGui::Text("%d: Model %s", i, obj->model.model->name);
+            HEADER_TEXT("%d: Model %s", i, obj->model.model->name);
             ImGui::SameLine(300); if (ImGui::Button("Delete")) {
                 DeleteObjectFromScene(scene, obj);
+                UI_PickedObject = -1;
             }
             ImGui::Spacing(); ImGui::SameLine(sliderMarginLeft);
             ImGui::DragFloat3("Position", obj->localPosition, 0.05f, -100.0f, 100.0f);
@@ -320,10 +393,11 @@ static void sDrawSceneViewerObjectList (vxConfig* conf, Scene* scene, int show)
         }
         
         if (obj->type == GAMEOBJECT_POINT_LIGHT && (show & SHOW_POINT_LIGHTS)) {
-            ImGui::Text("%d: Point Light", i);
+            HEADER_TEXT("%d: Point Light", i);
             ImGui::SameLine(150); ImGui::Checkbox("Intensity Only", &obj->pointLight.editorIntensityMode);
             ImGui::SameLine(300); if (ImGui::Button("Delete")) {
                 DeleteObjectFromScene(scene, obj);
+                UI_PickedObject = -1;
             }
             if (obj->pointLight.editorIntensityMode) {
                 ImGui::Spacing(); ImGui::SameLine(sliderMarginLeft);
@@ -400,6 +474,7 @@ static void sDrawSceneViewerObjectList (vxConfig* conf, Scene* scene, int show)
         }
         
         #undef PARENTED_VIEW
+        #undef HEADER_TEXT
         ImGui::PopID();
     }
 }
@@ -410,7 +485,7 @@ static void sDrawSceneViewer (vxConfig* conf, GLFWwindow* window, Scene* scene)
     ImGui::BeginMenuBar();
     if (ImGui::BeginMenu("Add Object")) {
         for (size_t i = 0; i < ModelCount; i++) {
-            if (Models[i]->meshCount != 0) {
+            if (!Models[i]->failed) {
                 if (ImGui::MenuItem(Models[i]->name, NULL)) {
                     GameObject* obj = AddObject(scene, NULL, GAMEOBJECT_MODEL);
                     obj->model.model = Models[i];
@@ -430,7 +505,27 @@ static void sDrawSceneViewer (vxConfig* conf, GLFWwindow* window, Scene* scene)
         ImGui::EndMenu();
     }
 
+    if (ImGui::BeginMenu("Pick")) {
+        // Casts a ray from the main camera through the center of the screen:
+        if (ImGui::MenuItem("Object at screen center")) {
+            Camera* cam = &conf->camMain;
+            vec3 origin, dir;
+            glm_vec3_copy(cam->inv_view_matrix[3], origin);
+            glm_vec3_negate_to(cam->inv_view_matrix[2], dir);
+            GameObject* obj = PickObject(scene, origin, dir, 10000.0f);
+            UI_PickedObject = (obj != NULL) ? (int)(obj - scene->objects) : -1;
+            UI_ScrollToPickedObject = true;
+        }
+        if (UI_PickedObject >= 0) {
+            ImGui::Text("Picked object %d.", UI_PickedObject);
+        } else {
+            ImGui::TextColored(ImColor(200, 200, 200), "Nothing picked.");
+        }
+        ImGui::EndMenu();
+    }
+
     static bool justSaved = false;
+    static bool saveBinary = false;
     if (ImGui::BeginMenu("Save/Load Scene")) {
         static char filename[128];
         bool save = ImGui::InputTextWithHint("", "Scene Name", filename, 127, ImGuiInputTextFlags_EnterReturnsTrue);
@@ -439,9 +534,11 @@ static void sDrawSceneViewer (vxConfig* conf, GLFWwindow* window, Scene* scene)
             stbsp_snprintf(filenameFull, 192, "userdata/scenes/%s.vxscene", filename);
             vxCreateDirectory("userdata");
             vxCreateDirectory("userdata/scenes");
-            SaveScene(scene, filenameFull);
+            SaveSceneInBackground(scene, filenameFull, saveBinary);
             justSaved = true;
         }
+        ImGui::SameLine();
+        ImGui::Checkbox("Binary", &saveBinary);
         if (justSaved) {
             ImGui::SameLine(220); ImGui::Text("Saved.");
         }
@@ -454,7 +551,11 @@ static void sDrawSceneViewer (vxConfig* conf, GLFWwindow* window, Scene* scene)
             if (ImGui::MenuItem(filename, NULL)) {
                 static char filenameFull[192];
                 stbsp_snprintf(filenameFull, 192, "userdata/scenes/%s", filename);
+                if (scene->world != NULL) {
+                    CloseStreamingWorld(scene->world, scene);
+                }
                 LoadScene(scene, filenameFull);
+                UI_PickedObject = -1;
             }
             files++;
         }
@@ -463,6 +564,54 @@ static void sDrawSceneViewer (vxConfig* conf, GLFWwindow* window, Scene* scene)
     } else {
         justSaved = false;
     }
+
+    if (ImGui::BeginMenu("Worlds")) {
+        StreamingWorld* world = scene->world;
+        if (world != NULL && world->open) {
+            size_t loaded = 0;
+            for (size_t i = 0; i < world->chunkCount; i++) {
+                loaded += (world->chunks[i].state == STREAMCHUNK_LOADED);
+            }
+            ImGui::Text("Streaming, %ju of %ju chunks loaded.", loaded, world->chunkCount);
+            if (ImGui::Button("Stop Streaming")) {
+                CloseStreamingWorld(world, scene);
+            }
+        } else {
+            // Only makes sense for whole scenes, a streaming world would lose the chunks that aren't loaded:
+            static char worldName[128];
+            static float chunkSize = Stream_DefaultChunkSize;
+            bool save = ImGui::InputTextWithHint("", "World Name", worldName, 127,
+                ImGuiInputTextFlags_EnterReturnsTrue);
+            if ((ImGui::Button("Save Scene as World") || save) && worldName[0] != '\0') {
+                static char filenameFull[192];
+                stbsp_snprintf(filenameFull, 192, "userdata/worlds/%s.vxworld", worldName);
+                vxCreateDirectory("userdata");
+                vxCreateDirectory("userdata/worlds");
+                SaveSceneAsWorld(scene, filenameFull, chunkSize);
+            }
+            ImGui::SameLine();
+            ImGui::DragFloat("Chunk size", &chunkSize, 1.0f, 1.0f, 4096.0f, "%.0f");
+        }
+        if (world != NULL && ModelStreaming) {
+            ImGui::Text("Resident models: %.1f MiB", (double) world->residentBytes / VX_MiB);
+        }
+
+        ImGui::Separator();
+
+        char** files = vxListFiles("userdata/worlds", "vxworld");
+        while (world != NULL && files != NULL && files[0] != NULL) {
+            char* filename = files[0];
+            if (ImGui::MenuItem(filename, NULL)) {
+                static char filenameFull[192];
+                stbsp_snprintf(filenameFull, 192, "userdata/worlds/%s", filename);
+                OpenStreamingWorld(world, scene, filenameFull);
+                UI_PickedObject = -1;
+            }
+            files++;
+        }
+
+        ImGui::EndMenu();
+    }
     ImGui::EndMenuBar();
     
     ImGui::BeginTabBar("Object Types Tab Bar");
@@ -513,6 +662,62 @@ static void sDrawConfigurator (vxConfig* conf, GLFWwindow* window) {
     ImGui::SameLine(200);
     ImGui::Checkbox("Noisy sampling", &conf->shadowNoise);
 
+    ImGui::Checkbox("Static batching", &conf->enableStaticBatching);
+    ImGui::SameLine(200);
+    ImGui::DragFloat("Batch cell size", &conf->staticBatchCellSize, 0.5f, 1.0f, 1000.0f);
+
+    ImGui::Checkbox("Portal culling", &conf->enablePortalCulling);
+    ImGui::SameLine(200);
+    ImGui::Checkbox("Baked PVS", &conf->enablePVS);
+
+    ImGui::Checkbox("Occlusion culling", &conf->enableOcclusionCulling);
+    ImGui::InputInt("Occluder triangle budget", &conf->occlusionTriangleBudget, 1000, 10000);
+    conf->occlusionTriangleBudget = vxMax(conf->occlusionTriangleBudget, 0);
+    ImGui::DragFloat("Min occluder area", &conf->occlusionMinOccluderArea, 1.0f, 0.0f, 32768.0f, "%.0f px");
+
+    ImGui::Checkbox("Occlusion queries", &conf->enableOcclusionQueries);
+    ImGui::SameLine(200);
+    ImGui::SliderInt("Hysteresis", &conf->occlusionQueryHysteresis, 0, 60, "%d frames");
+    ImGui::InputInt("Query min triangles", &conf->occlusionQueryMinTriangles, 256, 4096);
+    conf->occlusionQueryMinTriangles = vxMax(conf->occlusionQueryMinTriangles, 0);
+
+    ImGui::Text("Depth prepass:");
+    ImGui::SameLine(); ImGui::RadioButton("Off",  &conf->depthPrepassMode, DEPTH_PREPASS_OFF);
+    ImGui::SameLine(); ImGui::RadioButton("On",   &conf->depthPrepassMode, DEPTH_PREPASS_ON);
+    ImGui::SameLine(); ImGui::RadioButton("Auto", &conf->depthPrepassMode, DEPTH_PREPASS_AUTO);
+    ImGui::DragFloat("Prepass on above", &conf->depthPrepassOverdraw, 0.05f, 0.0f, 100.0f, "%.2fx");
+    ImGui::DragFloat("Prepass off below", &conf->depthPrepassOverdrawOff, 0.05f, 0.0f, conf->depthPrepassOverdraw,
+        "%.2fx");
+
+    ImGui::Checkbox("Autosave", &conf->enableAutosave);
+    ImGui::SameLine(200);
+    ImGui::DragFloat("Interval", &conf->autosaveInterval, 1.0f, 1.0f, 3600.0f, "%.0f s");
+
+    ImGui::Checkbox("Model streaming", &conf->enableModelStreaming);
+    if (ImGui::IsItemHovered()) {
+        ImGui::BeginTooltip();
+        ImGui::Text("Takes effect on restart.");
+        ImGui::EndTooltip();
+    }
+    ImGui::SameLine(200);
+    ImGui::InputInt("Model budget (MiB)", &conf->streamingModelBudget, 64, 256);
+    conf->streamingModelBudget = vxMax(conf->streamingModelBudget, 0);
+    ImGui::DragFloat("Load radius", &conf->streamingLoadRadius, 1.0f, 0.0f, 10000.0f, "%.0f");
+    ImGui::DragFloat("Unload radius", &conf->streamingUnloadRadius, 1.0f, conf->streamingLoadRadius, 10000.0f, "%.0f");
+
+    ImGui::SliderInt("Job workers", &conf->jobWorkers, -1, 64, (conf->jobWorkers < 0) ? "cores - 1" : "%d");
+    if (ImGui::IsItemHovered()) {
+        ImGui::BeginTooltip();
+        ImGui::Text("Takes effect on restart. Running with %d threads.", vxJobThreadCount());
+        ImGui::EndTooltip();
+    }
+    ImGui::Checkbox("Render thread", &conf->enableRenderThread);
+    if (ImGui::IsItemHovered()) {
+        ImGui::BeginTooltip();
+        ImGui::Text("Takes effect on restart.");
+        ImGui::EndTooltip();
+    }
+
     ImGui::Checkbox("Visualize point lights", &conf->debugShowPointLights);
     ImGui::SameLine(200);
     ImGui::Checkbox("Visualize light volumes", &conf->debugShowLightVolumes);
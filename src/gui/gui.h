@@ -7,6 +7,7 @@ typedef struct ImFont ImFont;
 typedef struct vxConfig vxConfig;
 typedef struct vxFrame vxFrame;
 typedef struct Scene Scene;
+typedef struct GUI_DrawData GUI_DrawData; // copy of a frame's ImGui draw lists
 
 #define X(name, path, size) extern ImFont* name;
 XM_ASSETS_FONTS
@@ -15,6 +16,12 @@ XM_ASSETS_FONTS
 VX_EXPORT void GUI_Init (GLFWwindow* window);
 VX_EXPORT void GUI_StartFrame();
 VX_EXPORT void GUI_Render();
+// Finishes the ImGui frame and copies its draw lists into [*data] (allocated on first use), so they can be drawn on the
+// render thread while the next frame is built. The backend's GL objects are created by the first frame drawn, which is
+// the loading frame, so building later frames on another thread doesn't touch GL.
+VX_EXPORT void GUI_EndFrame (GUI_DrawData** data);
+VX_EXPORT void GUI_RenderDrawData (GUI_DrawData* data);
+VX_EXPORT void GUI_DeleteDrawData (GUI_DrawData* data);
 VX_EXPORT void GUI_RenderLoadingFrame (GLFWwindow* window,
     const char* text1, const char* text2,
     float bgr, float bgg, float bgb,
@@ -5,8 +5,16 @@
 #include "data/texture.h"
 #include "render/render.h"
 #include "render/program.h"
+#include "render/drawlist.h"
+#include "render/batch.h"
+#include "render/occlusion.h"
+#include "render/occlusionquery.h"
+#include "render/commands.h"
+#include "render/graph.h"
 #include "scene/core.h"
 #include "scene/save.h"
+#include "scene/journal.h"
+#include "scene/stream.h"
 #include <glad/glad.h>
 #include <glfw/glfw3.h>
 
@@ -106,6 +114,35 @@ void vxConfig_Init (vxConfig* c) {
     c->shadowTAA = false;
     c->shadowNoise = true;
 
+    c->enableStaticBatching = true;
+    c->staticBatchCellSize = 16.0f;
+
+    c->enablePortalCulling = true;
+    c->enablePVS = true;
+
+    c->enableOcclusionCulling = false;
+    c->occlusionTriangleBudget = 50000;
+    c->occlusionMinOccluderArea = 256.0f;
+    c->enableOcclusionQueries = false;
+    c->occlusionQueryMinTriangles = 4096;
+    c->occlusionQueryHysteresis = 8;
+
+    c->depthPrepassMode = DEPTH_PREPASS_AUTO;
+    c->depthPrepassOverdraw = 2.5f;
+    c->depthPrepassOverdrawOff = 2.0f;
+
+    c->enableAutosave = false;
+    c->recoverAutosave = false;
+    c->autosaveInterval = 60.0f;
+
+    c->enableModelStreaming = false;
+    c->streamingModelBudget = 1024;
+    c->streamingLoadRadius = 128.0f;
+    c->streamingUnloadRadius = 160.0f;
+
+    c->jobWorkers = -1;
+    c->enableRenderThread = true;
+
     c->enableTAA = true;
     c->taaHaltonJitter = true;
     c->taaSampleOffsetMul = 0.2f;
@@ -187,6 +224,7 @@ void GameReload (vxConfig* conf, GLFWwindow* window) {
     GUI_RenderLoadingFrame(window, "Loading...", "", 0.2f, 0.3f, 0.4f, 0.9f, 0.9f, 0.9f);
     InitProgramSystem(conf);
     LoadTextures();
+    ModelStreaming = conf->enableModelStreaming;
     LoadModels();
 }
 
@@ -246,48 +284,152 @@ static void LoadLegacyDefaultScene (Scene* scene) {
     glm_vec3_copy((vec3){mul*1.0f, mul*1.0f, mul*1.0f}, lp->lightProbe.colorZn);
 }
 
-// Loads the default scene.
-void GameLoadScene (Scene* scene) {
-    LoadScene(scene, "userdata/scenes/Default.vxscene");
-    if (scene->size == 0) {
-        LoadLegacyDefaultScene(scene);
+// Loads the default scene, or recovers the last one if the game didn't shut down cleanly and recovery was asked for.
+void GameLoadScene (vxConfig* conf, Scene* scene, SceneJournal* journal, StreamingWorld* world) {
+    if (!conf->recoverAutosave || !RecoverScene(scene, "userdata/autosave")) {
+        LoadScene(scene, "userdata/scenes/Default.vxscene");
+        if (scene->size == 0) {
+            LoadLegacyDefaultScene(scene);
+        }
     }
+    vxCreateDirectory("userdata");
+    InitSceneJournal(journal, scene, "userdata/autosave");
+    scene->world = world;
 }
 
-// Tick function for the game. Renders a single frame.
-void GameTick (vxConfig* conf, GLFWwindow* window, vxFrame* frame, vxFrame* lastFrame, Scene* scene) {
-    frame->t = (float) glfwGetTime();
-    frame->dt = frame->t - lastFrame->t;
+// Everything the render thread needs to draw a frame. The game thread fills one packet while the render thread draws
+// the other, and nothing in a packet changes once it's been handed over.
+typedef struct FramePacket {
+    vxJobCounter done;  // the render job drawing this packet
+    bool submitted;     // false until the packet is first handed to the render thread
+    GLFWwindow* window;
+    vxFrame frame;
+    vxConfig conf;
+    Camera camMainJittered;
+    float jitterX, jitterY, jitterLastX, jitterLastY;
+    RenderList rl;      // copy of the game thread's render list, the draw lists point into it
+    DrawList dlShadow;
+    DrawList dlDepth;   // depth prepass, the opaque part of dlMain
+    DrawList dlMain;
+    CommandBuffer cbShadow; // draw lists recorded on the game thread's job workers
+    CommandBuffer cbDepth;
+    CommandBuffer cbMain;
+    bool drawShadows;
+    bool depthPrepass;
+    Scene* scene;       // only compared against, the game thread keeps updating the scene during the render
+    uint32_t sceneVersion;
+    GUI_DrawData* gui;
+} FramePacket;
+
+static FramePacket Packets [2];
+// Changed on the render thread, read by BuildDrawList on the game thread. Updates go through vxRunOnMainThread, which
+// queues them after the render job of the last frame, so draw lists never refer to batches from a different update.
+static StaticBatchSet Batches;
+static OcclusionQuerySet Queries; // render thread only
+static RenderGraph Graph; // render thread only
+
+typedef struct RenderThread {
+    vxThread thread;
+    GLFWwindow* window;
+    int jobWorkers;
+    volatile int32_t ready; // set once the job system is running
+    bool quit;              // only touched on the render thread
+} RenderThread;
+
+static RenderThread Renderer;
+static bool RenderThreadRunning = false;
+
+// The render thread owns the GL context and is the job system's main thread, so GL jobs from anywhere end up on it.
+static void sRenderThread (void* user) {
+    RenderThread* rt = (RenderThread*) user;
+    rmt_SetCurrentThreadName("Render");
+    glfwMakeContextCurrent(rt->window);
+    vxStartJobs(rt->jobWorkers);
+    vxAtomicStore32(&rt->ready, 1);
+    while (!rt->quit) {
+        vxWaitForMainThreadJobs();
+        vxRunMainThreadJobs();
+    }
+    vxStopJobs();
+    glfwMakeContextCurrent(NULL);
+}
 
-    // Pause the game if it loses focus:
-    if (conf->pauseOnFocusLoss && !glfwGetWindowAttrib(window, GLFW_FOCUSED)) {
-        glfwWaitEvents();
-        glfwSetTime(frame->t);
-        return;
+static void sQuitRenderThreadJob (void* user) {
+    ((RenderThread*) user)->quit = true;
+}
+
+// Starts the render thread and hands it the GL context, or starts the job system on the calling thread if the render
+// thread is disabled.
+static void sStartRenderThread (vxConfig* conf, GLFWwindow* window) {
+    if (conf->enableRenderThread) {
+        Renderer.window = window;
+        Renderer.jobWorkers = conf->jobWorkers;
+        glfwMakeContextCurrent(NULL);
+        if (vxStartThread(&Renderer.thread, sRenderThread, &Renderer)) {
+            while (vxAtomicLoad32(&Renderer.ready) == 0) {}
+            RenderThreadRunning = true;
+            return;
+        }
+        vxLog("Failed to start the render thread, rendering on the main thread instead.");
+        glfwMakeContextCurrent(window);
     }
+    vxStartJobs(conf->jobWorkers);
+}
 
-    // Print the last frame's log:
-    vxAdvanceFrame();
-    frame->n = vxFrameNumber;
+// Waits for the frames in flight and stops the render thread, leaving the GL context current on the calling thread.
+static void sStopRenderThread (GLFWwindow* window) {
+    for (int i = 0; i < vxSize(Packets); i++) {
+        vxWaitForJobs(&Packets[i].done);
+    }
+    if (RenderThreadRunning) {
+        vxRunOnMainThread("Quit Render Thread", sQuitRenderThreadJob, &Renderer);
+        vxJoinThread(&Renderer.thread);
+        RenderThreadRunning = false;
+        glfwMakeContextCurrent(window);
+    } else {
+        vxStopJobs();
+    }
+    for (int i = 0; i < vxSize(Packets); i++) {
+        GUI_DeleteDrawData(Packets[i].gui);
+        Packets[i].gui = NULL;
+    }
+}
 
-    // *****************************************************************************************************************
-    // Update:
+typedef struct StaticBatchUpdate {
+    Scene* scene;
+    vxConfig* conf;
+    uint64_t frame;
+} StaticBatchUpdate;
 
-    StartBlock("Frame Update");
-    StartFrame(conf, window); // applies swap interval and clip-control settings
+static void sUpdateStaticBatchesJob (void* user) {
+    StaticBatchUpdate* update = (StaticBatchUpdate*) user;
+    UpdateStaticBatches(&Batches, update->scene, update->conf, update->frame);
+}
 
-    // Retrieve new framebuffer size and update framebuffers if required:
+// Game thread half of a frame: updates the scene, camera and GUI, then fills the packet with what GameRender needs.
+static void GameUpdate (vxConfig* conf, GLFWwindow* window, vxFrame* frame, vxFrame* lastFrame, Scene* scene,
+    FramePacket* packet)
+{
+    // Retrieve new framebuffer size, render targets are resized to match on the render thread:
     int w, h;
     glfwGetFramebufferSize(window, &w, &h);
     conf->displayW = w;
     conf->displayH = h;
-    StartGPUBlock("Update Render Targets");
-    uint8_t updatedTargets = UpdateRenderTargets(conf); // resizes framebuffer render targets
-    EndGPUBlock();
-    
+
     // Run subsystem tick functions:
-    TimedBlock("Update Programs",  UpdatePrograms(conf));
+    // Uses last frame's camera, the current one isn't known until after the GUI update:
+    TimedBlock("Streaming",        UpdateStreamingWorld(scene->world, scene, conf->camMain.inv_view_matrix[3],
+        conf->streamingLoadRadius, conf->streamingUnloadRadius, (size_t) conf->streamingModelBudget * VX_MiB));
     TimedBlock("Update Scene",     UpdateScene(scene));
+    // Object indices change whenever a chunk is streamed in or out, which the journal can't follow:
+    bool autosave = conf->enableAutosave && !scene->world->open;
+    TimedBlock("Scene Journal",    UpdateSceneJournal(scene->journal, scene, frame->t, autosave,
+        conf->autosaveInterval));
+    // Rebuilding batches needs GL, so only then do we wait for the render thread:
+    if (StaticBatchesNeedUpdate(&Batches, scene, conf, frame->n)) {
+        StaticBatchUpdate update = {scene, conf, frame->n};
+        vxRunOnMainThread("Static Batches", sUpdateStaticBatchesJob, &update);
+    }
     TimedBlock("ImGui StartFrame", GUI_StartFrame());
 
     // Debug user interface:
@@ -370,52 +512,18 @@ void GameTick (vxConfig* conf, GLFWwindow* window, vxFrame* frame, vxFrame* last
     frame->mouseDx = (float) dmx;
     frame->mouseDy = (float) dmy;
 
-    EndBlock();
-    
-    // *****************************************************************************************************************
-    // Render:
-
-    StartBlock("Frame Render");
-
-    double tRenderStart = glfwGetTime();
-    static RenderState rs;
-
-    // We can't time OpenGL calls if Remotery is already doing it!
-    #if !RMT_USE_OPENGL
-        // tRenderStart to tRenderEnd will just be the CPU time taken up by drawcall submission. To monitor GPU time we
-        // need to use an OpenGL query object: https://www.khronos.org/opengl/wiki/Query_Object
-        // We use multiple query objects in order to avoid stalling the renderer just to wait for a reply from the GPU.
-        static int rtqIndex = 0;
-        static GLuint rtq [4] = {0};
-        if (rtq[0] == 0) {
-            glGenQueries(4, &rtq);
-        }
-        glBeginQuery(GL_TIME_ELAPSED, rtq[rtqIndex]);
-    #endif
-
-    // Render lists contain abbreviated entries for game objects that affect the rendered image.
+    // Render lists contain abbreviated entries for game objects that affect the rendered image. Ours is updated
+    // incrementally, the packet gets a copy that stays put while the render thread draws it.
     static RenderList rl = {0};
     TimedBlock("UpdateRenderList", {
         UpdateRenderList(&rl, scene);
+        CopyRenderList(&packet->rl, &rl);
     });
 
-    if (updatedTargets & UPDATED_ENVMAP_TARGETS) {
-        // TODO: generate environment maps
-    }
-
-    // Don't forget to set the correct viewports!
-    glViewport(0, 0, conf->shadowSize, conf->shadowSize);
-
-    RenderPass(&rs, "Shadow Map Clear", {
-        BindFramebuffer(FB_SHADOW);
-        glClearDepth(0.0f);
-        glClear(GL_DEPTH_BUFFER_BIT);
-    })
-
     // Right now we only support one directional light.
-    RenderableDirectionalLight* directional = NULL;
-    if (rl.directionalLightCount > 0) {
-        directional = &rl.directionalLights[0];
+    packet->drawShadows = (rl.directionalLightCount > 0);
+    if (packet->drawShadows) {
+        RenderableDirectionalLight* directional = &rl.directionalLights[0];
         // Update shadow camera:
         vec3 camPos;
         // We discretize the player's position as seen by the camera in order to minimize shadow crawling.
@@ -428,45 +536,15 @@ void GameTick (vxConfig* conf, GLFWwindow* window, vxFrame* frame, vxFrame* last
         mat4 vmat;
         glm_lookat(camPos, playerPos, VX_UP, vmat);
         Camera_Update(&conf->camShadow, conf->shadowSize, conf->shadowSize, vmat);
-        // Render shadowmap:
-        StartRenderPass(&rs, "Shadow Map");
-        BindFramebuffer(FB_SHADOW);
-        SetRenderProgram(&rs, &PROG_SHADOW);
-        SetCamera(&rs, &conf->camShadow);
-        RenderState rsMesh = rs;
-        if (conf->shadowHoverFix) {
-            // This is supposed to mitigate the shadow "Peter Panning" effect, but I can't tell the difference.
-            rsMesh.forceCullFace = GL_FRONT;
-        }
-        for (size_t i = 0; i < rl.meshCount; i++) {
-            glm_mat4_copy(rl.meshes[i].worldMatrix, rsMesh.matModel);
-            RenderMesh(&rsMesh, conf, frame, &rl.meshes[i].mesh, rl.meshes[i].material);
-        }
-        EndRenderPass();
-    }
-
-    glViewport(0, 0, conf->displayW, conf->displayH);
-    
-    // The depth buffer needs to be cleared to 0 (since we use reverse depth). Other buffers can be ignored.
-    // We do have an option to clear them, but that's only really useful when debugging (e.g. with RenderDoc).
-    if (conf->clearColorBuffers) {
-        RenderPass(&rs, "GBuffer clear (LDR color+depth)", {
-            BindFramebuffer(FB_ONLY_COLOR_LDR);
-            glClearColor(0.1f, 0.2f, 0.5f, 1.0f); // HDR
-            glClearDepth(0.0f);
-            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        });
-    } else {
-        RenderPass(&rs, "GBuffer clear (depth-only)", {
-            BindFramebuffer(FB_GBUFFER);
-            glClearDepth(0.0f);
-            glClear(GL_DEPTH_BUFFER_BIT);
+        TimedBlock("BuildDrawList (Shadow)", {
+            BuildDrawList(&packet->dlShadow, &packet->rl, &Batches, &conf->camShadow, DRAWPASS_SHADOW, &PROG_SHADOW,
+                false);
         });
     }
 
     // Compute main camera jitter, for TAA:
-    static Camera camMainJittered;
-    memcpy(&camMainJittered, &conf->camMain, sizeof(Camera));
+    Camera* camMainJittered = &packet->camMainJittered;
+    memcpy(camMainJittered, &conf->camMain, sizeof(Camera));
     float jitterX = 0, jitterY = 0, jitterLastX = 0, jitterLastY = 0;
     if (conf->enableTAA) {
         if (conf->taaHaltonJitter) {
@@ -482,181 +560,414 @@ void GameTick (vxConfig* conf, GLFWwindow* window, vxFrame* frame, vxFrame* last
             jitterLastX = conf->taaSampleOffsetMul * ((-1) * (frame->n+0) % 2) / (float) w;
             jitterLastY = conf->taaSampleOffsetMul * ((-1) * (frame->n+0) % 2) / (float) h;
         }
-        static mat4 jitter, jitterLast;
+        mat4 jitter, jitterLast;
         glm_translate_make(jitter,     (vec3){jitterX,     jitterY,     0.0});
         glm_translate_make(jitterLast, (vec3){jitterLastX, jitterLastY, 0.0});
-        glm_mat4_mul(jitter,     camMainJittered.proj_matrix,      camMainJittered.proj_matrix);
-        glm_mat4_mul(jitterLast, camMainJittered.last_proj_matrix, camMainJittered.last_proj_matrix);
-        glm_mat4_inv(camMainJittered.proj_matrix, camMainJittered.inv_proj_matrix);
+        glm_mat4_mul(jitter,     camMainJittered->proj_matrix,      camMainJittered->proj_matrix);
+        glm_mat4_mul(jitterLast, camMainJittered->last_proj_matrix, camMainJittered->last_proj_matrix);
+        glm_mat4_inv(camMainJittered->proj_matrix, camMainJittered->inv_proj_matrix);
+    }
+    packet->jitterX = jitterX;
+    packet->jitterY = jitterY;
+    packet->jitterLastX = jitterLastX;
+    packet->jitterLastY = jitterLastY;
+
+    // Sorted by material and front-to-back, with objects outside the (unjittered) view culled:
+    DrawList* dlMain = &packet->dlMain;
+    TimedBlock("BuildDrawList", {
+        BuildDrawList(dlMain, &packet->rl, &Batches, &conf->camMain, DRAWPASS_GBUFFER, &PROG_GBUF_MAIN, true);
+    });
+    if (conf->enablePortalCulling && scene->cells.cellCount > 0) {
+        TimedBlock("Portal Culling", {
+            uint64_t visible = FindVisibleCells(&scene->cells, &conf->camMain);
+            frame->perfPortalCulledDraws = CullDrawsOutsideCells(dlMain, &scene->cells, visible);
+        });
+    }
+    if (conf->enablePVS && scene->pvs.cellCount > 0) {
+        TimedBlock("PVS Culling", {
+            const uint64_t* visible = UpdatePVS(&scene->pvs, scene, conf->camMain.inv_view_matrix[3]);
+            if (visible != NULL) {
+                frame->perfPVSCulledDraws = CullDrawsWithPVS(dlMain, &scene->pvs, visible);
+            }
+        });
+    }
+    if (conf->enableOcclusionCulling) {
+        static OcclusionBuffer occlusion;
+        TimedBlock("Occlusion Culling", {
+            RenderOccluders(&occlusion, dlMain, &conf->camMain, conf);
+            frame->perfOccludedDraws = CullOccludedDraws(&occlusion, dlMain);
+        });
+    }
+
+    // The prepass is another trip through the opaque geometry, which only pays for itself if it saves the G-buffer
+    // shader from enough hidden pixels:
+    frame->perfOverdraw = EstimateOverdraw(dlMain, &conf->camMain);
+    static bool autoPrepass = false;
+    float threshold = autoPrepass ? vxMin(conf->depthPrepassOverdrawOff, conf->depthPrepassOverdraw) :
+                                    conf->depthPrepassOverdraw;
+    autoPrepass = frame->perfOverdraw > threshold;
+    packet->depthPrepass = (conf->depthPrepassMode == DEPTH_PREPASS_ON) ||
+        (conf->depthPrepassMode == DEPTH_PREPASS_AUTO && autoPrepass);
+    if (packet->depthPrepass) {
+        TimedBlock("BuildDrawList (Depth Prepass)", {
+            BuildDepthPrepassList(&packet->dlDepth, dlMain, &conf->camMain);
+        });
+    }
+
+    // The render thread only replays these:
+    TimedBlock("Record Draws", {
+        if (packet->drawShadows) {
+            RecordDrawList(&packet->cbShadow, &packet->dlShadow);
+        }
+        if (packet->depthPrepass) {
+            RecordDrawList(&packet->cbDepth, &packet->dlDepth);
+        }
+        RecordDrawList(&packet->cbMain, dlMain);
+    });
+
+    TimedBlock("ImGui EndFrame", GUI_EndFrame(&packet->gui));
+
+    packet->window = window;
+    packet->frame = *frame;
+    packet->conf = *conf;
+    packet->scene = scene;
+    packet->sceneVersion = scene->structureVersion;
+}
+
+// Render thread half of a frame: draws a packet filled by GameUpdate and swaps buffers.
+static void GameRender (FramePacket* p) {
+    vxConfig* conf = &p->conf;
+    vxFrame* frame = &p->frame;
+    RenderList* rl = &p->rl;
+    Camera* camMainJittered = &p->camMainJittered;
+    int w = conf->displayW;
+    int h = conf->displayH;
+
+    double tRenderStart = glfwGetTime();
+    StartFrame(conf, p->window); // applies swap interval and clip-control settings
+    StartGPUBlock("Update Render Targets");
+    uint8_t updatedTargets = UpdateRenderTargets(conf); // resizes envmap render targets
+    EndGPUBlock();
+    TimedBlock("Update Programs", UpdatePrograms(conf));
+    // Uploads and deletes since the last frame went around the GL state cache:
+    InvalidateGLState();
+    BindNoiseTextures();
+    SetFrameUniforms(conf, frame, (vec2){p->jitterX, p->jitterY}, (vec2){p->jitterLastX, p->jitterLastY});
+
+    static RenderState rs;
+
+    // We can't time OpenGL calls if Remotery is already doing it!
+    #if !RMT_USE_OPENGL
+        // tRenderStart to tRenderEnd will just be the CPU time taken up by drawcall submission. To monitor GPU time we
+        // need to use an OpenGL query object: https://www.khronos.org/opengl/wiki/Query_Object
+        // We use multiple query objects in order to avoid stalling the renderer just to wait for a reply from the GPU.
+        static int rtqIndex = 0;
+        static GLuint rtq [4] = {0};
+        if (rtq[0] == 0) {
+            glGenQueries(4, &rtq);
+        }
+        glBeginQuery(GL_TIME_ELAPSED, rtq[rtqIndex]);
+        // Time elapsed queries can't be nested, so the G-buffer pass is timed with a pair of timestamps per frame:
+        static GLuint gbq [4][2] = {0};
+        static bool gbqPrepass [4] = {0};
+        if (gbq[0][0] == 0) {
+            glGenQueries(8, &gbq[0][0]);
+        }
+        gbqPrepass[rtqIndex] = p->depthPrepass;
+    #endif
+
+    if (updatedTargets & UPDATED_ENVMAP_TARGETS) {
+        // TODO: generate environment maps
+    }
+
+    // Declare the frame's render targets and passes. Render targets only get a texture if a pass that is kept uses
+    // them, and targets whose lifetimes don't overlap can share one.
+    BeginRenderGraph(&Graph, w, h);
+    #define ScreenTarget(name, rt, persistent) \
+        AddGraphTarget(&Graph, name, TEXUNIT_ ## rt, FORMAT_ ## rt, w, h, persistent)
+    GraphTarget depth    = ScreenTarget("Depth",     RT_DEPTH,     false);
+    GraphTarget albedo   = ScreenTarget("Color LDR", RT_COLOR_LDR, false);
+    GraphTarget normal   = ScreenTarget("Normal",    RT_NORMAL,    false);
+    GraphTarget velocity = ScreenTarget("Velocity",  RT_AUX_HDR16, false);
+    // Shadows in .r, which are accumulated over frames with shadow TAA:
+    GraphTarget aux1     = ScreenTarget("Aux1",      RT_AUX1,      conf->shadowTAA);
+    GraphTarget hdr      = ScreenTarget("Color HDR", RT_COLOR_HDR, false);
+    GraphTarget debug    = ScreenTarget("Debug",     RT_AUX2,      false); // read by final.frag with DEBUG_VIS
+    GraphTarget shadow = AddGraphTarget(&Graph, "Shadow Map", TEXUNIT_RT_SHADOW_DEPTH, FORMAT_RT_SHADOW_DEPTH,
+        conf->shadowSize, conf->shadowSize, false);
+
+    GraphPass passShadow = AddGraphPass(&Graph, "Shadow Map", false);
+    GraphPassWrites(&Graph, passShadow, shadow);
+
+    // The depth buffer needs to be cleared to 0 (since we use reverse depth). Other buffers can be ignored.
+    // We do have an option to clear them, but that's only really useful when debugging (e.g. with RenderDoc).
+    GraphPass passClear = AddGraphPass(&Graph,
+        conf->clearColorBuffers ? "GBuffer clear (LDR color+depth)" : "GBuffer clear (depth-only)", false);
+    GraphPassWrites(&Graph, passClear, depth);
+    if (conf->clearColorBuffers) {
+        GraphPassWrites(&Graph, passClear, albedo);
+    }
+
+    GraphPass passDepth = GRAPH_NONE;
+    if (p->depthPrepass) {
+        passDepth = AddGraphPass(&Graph, "GBuffer depth prepass", false);
+        GraphPassWrites(&Graph, passDepth, depth);
+    }
+
+    GraphPass passGBuffer = AddGraphPass(&Graph, "GBuffer main (opaque objects)", false);
+    GraphPassReads(&Graph, passGBuffer, aux1); // keeps the shadows in .r
+    GraphPassWrites(&Graph, passGBuffer, depth);
+    GraphPassWrites(&Graph, passGBuffer, albedo);
+    GraphPassWrites(&Graph, passGBuffer, normal);
+    GraphPassWrites(&Graph, passGBuffer, aux1);
+    GraphPassWrites(&Graph, passGBuffer, velocity);
+
+    GraphPass passQueries = GRAPH_NONE;
+    if (conf->enableOcclusionQueries) {
+        passQueries = AddGraphPass(&Graph, "GBuffer occlusion queries", true);
+        GraphPassReads(&Graph, passQueries, depth); // tested against
+        GraphPassWrites(&Graph, passQueries, depth);
+    }
+
+    GraphTarget shadowHistory = GRAPH_NONE;
+    if (conf->shadowTAA) {
+        // shadow_resolve.frag reads last frame's shadows from gAux2 while it overwrites gAux1:
+        shadowHistory = ScreenTarget("Shadow History", RT_AUX2, false);
+        AddGraphCopy(&Graph, aux1, shadowHistory);
+    }
+    GraphPass passShadowResolve = AddGraphPass(&Graph, "GBuffer shadow resolve", false);
+    if (shadowHistory != GRAPH_NONE) {
+        GraphPassReads(&Graph, passShadowResolve, shadowHistory);
+    }
+    GraphPassReads(&Graph, passShadowResolve, depth);
+    GraphPassReads(&Graph, passShadowResolve, normal);
+    GraphPassReads(&Graph, passShadowResolve, velocity);
+    GraphPassReads(&Graph, passShadowResolve, aux1);
+    GraphPassReads(&Graph, passShadowResolve, shadow);
+    GraphPassWrites(&Graph, passShadowResolve, aux1);
+
+    GraphPass passLight = AddGraphPass(&Graph, "GBuffer main lighting", false);
+    GraphPassReads(&Graph, passLight, depth);
+    GraphPassReads(&Graph, passLight, albedo);
+    GraphPassReads(&Graph, passLight, normal);
+    GraphPassReads(&Graph, passLight, velocity);
+    GraphPassReads(&Graph, passLight, aux1);
+    GraphPassWrites(&Graph, passLight, hdr);
+    GraphPassWrites(&Graph, passLight, debug);
+
+    GraphPass passPointLights = AddGraphPass(&Graph, "GBuffer point lighting", false);
+    GraphPassReads(&Graph, passPointLights, depth); // also tested against
+    GraphPassReads(&Graph, passPointLights, albedo);
+    GraphPassReads(&Graph, passPointLights, normal);
+    GraphPassReads(&Graph, passPointLights, aux1);
+    GraphPassWrites(&Graph, passPointLights, hdr);
+    GraphPassWrites(&Graph, passPointLights, depth);
+
+    GraphPass passTAA = GRAPH_NONE;
+    if (conf->enableTAA) {
+        GraphTarget history = ScreenTarget("TAA History", RT_AUX_HDR11, true);
+        passTAA = AddGraphPass(&Graph, "Temporal AA", false);
+        GraphPassReads(&Graph, passTAA, depth);
+        GraphPassReads(&Graph, passTAA, hdr);
+        GraphPassReads(&Graph, passTAA, history);
+        GraphPassReads(&Graph, passTAA, velocity);
+        GraphPassWrites(&Graph, passTAA, hdr);
+        // Writing directly to the history (and reading it instead of gColorHDR in the final shader) seems to work,
+        // but a) is undefined behaviour, and b) avoiding the copy doesn't seem to improve performance anyway.
+        AddGraphCopy(&Graph, hdr, history);
+    }
+
+    GraphPass passDebugLights = GRAPH_NONE;
+    if (conf->debugShowPointLights) {
+        passDebugLights = AddGraphPass(&Graph, "Debug: Point Light Positions", false);
+        GraphPassReads(&Graph, passDebugLights, depth); // tested against
+        GraphPassWrites(&Graph, passDebugLights, hdr);
+        GraphPassWrites(&Graph, passDebugLights, depth);
+    }
+    #undef ScreenTarget
+
+    GraphPass passFinal = AddGraphPass(&Graph, "Final output", false);
+    if (conf->debugVisMode == DEBUG_VIS_SHADOWMAP) {
+        GraphPassReads(&Graph, passFinal, shadow);
+    } else if (conf->debugVisMode != DEBUG_VIS_NONE) {
+        GraphPassReads(&Graph, passFinal, debug);
+    } else {
+        GraphPassReads(&Graph, passFinal, hdr);
+    }
+    GraphPassWrites(&Graph, passFinal, GRAPH_BACKBUFFER);
+
+    GraphPass passUI = AddGraphPass(&Graph, "User interface", false);
+    GraphPassWrites(&Graph, passUI, GRAPH_BACKBUFFER);
+
+    TimedBlock("Compile Render Graph", CompileRenderGraph(&Graph));
+
+    // Right now we only support one directional light.
+    RenderableDirectionalLight* directional = NULL;
+    if (StartGraphPass(&Graph, &rs, passShadow)) {
+        glClearDepth(0.0f);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        if (p->drawShadows) {
+            directional = &rl->directionalLights[0];
+            SetRenderProgram(&rs, &PROG_SHADOW);
+            SetCamera(&rs, &conf->camShadow);
+            RenderState rsMesh = rs;
+            if (conf->shadowHoverFix) {
+                // This is supposed to mitigate the shadow "Peter Panning" effect, but I can't tell the difference.
+                rsMesh.forceCullFace = GL_FRONT;
+            }
+            SubmitCommandBuffer(&rsMesh, conf, frame, &p->cbShadow, NULL);
+        }
+        EndGraphPass(&Graph);
+    }
+
+    if (StartGraphPass(&Graph, &rs, passClear)) {
+        glClearColor(0.1f, 0.2f, 0.5f, 1.0f); // HDR
+        glClearDepth(0.0f);
+        glClear(conf->clearColorBuffers ? (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT) : GL_DEPTH_BUFFER_BIT);
+        EndGraphPass(&Graph);
+    }
+
+    if (conf->enableOcclusionQueries) {
+        UpdateOcclusionQueries(&Queries, p->scene, p->sceneVersion, conf, frame);
+    } else if (Queries.scene != NULL) {
+        DeleteOcclusionQueries(&Queries);
+    }
+
+    #if !RMT_USE_OPENGL
+        glQueryCounter(gbq[rtqIndex][0], GL_TIMESTAMP);
+    #endif
+    if (passDepth != GRAPH_NONE && StartGraphPass(&Graph, &rs, passDepth)) {
+        // Same camera as the G-buffer pass, so that it finds the same depths again:
+        SetRenderProgram(&rs, &PROG_DEPTH);
+        RenderState rsDepth = rs;
+        SetCamera(&rsDepth, camMainJittered);
+        SubmitCommandBuffer(&rsDepth, conf, frame, &p->cbDepth, NULL);
+        EndGraphPass(&Graph);
     }
 
-    StartRenderPass(&rs, "GBuffer main (opaque objects)");
-    BindFramebuffer(FB_GBUFFER);
-    SetRenderProgram(&rs, &PROG_GBUF_MAIN);
     RenderState rsMesh = rs;
-    SetCamera(&rsMesh, &camMainJittered);
-    for (size_t i = 0; i < rl.meshCount; i++) {
-        // glm_mat4_copy(rl.meshes[i].worldMatrix,     rsMesh.matModel);
-        // glm_mat4_copy(rl.meshes[i].lastWorldMatrix, rsMesh.matModelLast);
-        SetModelMatrix(&rsMesh, rl.meshes[i].worldMatrix, rl.meshes[i].lastWorldMatrix);
-        // Timing every single mesh draw is probably a waste of time, despite being cool to look at in the profiler.
-        #if 0
-        static char blockName [128];
-        int written = stbsp_snprintf(blockName, 128, "RenderMesh %u (%ju tris)",
-            rl.meshes[i].mesh.gl_vertex_array,
-            rl.meshes[i].mesh.gl_element_count / 3);
-        blockName[written] = '\0';
-        StartGPUBlock(blockName);
-        #endif
-        RenderMesh(&rsMesh, conf, frame, &rl.meshes[i].mesh, rl.meshes[i].material);
-        #if 0
-        EndGPUBlock();
-        #endif
-    }
-    EndRenderPass();
+    if (StartGraphPass(&Graph, &rs, passGBuffer)) {
+        SetRenderProgram(&rs, &PROG_GBUF_MAIN);
+        rsMesh = rs;
+        rsMesh.depthPrepass = (passDepth != GRAPH_NONE);
+        SetCamera(&rsMesh, camMainJittered);
+        SubmitCommandBuffer(&rsMesh, conf, frame, &p->cbMain, conf->enableOcclusionQueries ? &Queries : NULL);
+        rsMesh.depthPrepass = false; // the occlusion queries below draw with it
+        EndGraphPass(&Graph);
+    }
+    #if !RMT_USE_OPENGL
+        glQueryCounter(gbq[rtqIndex][1], GL_TIMESTAMP);
+    #endif
 
+    if (passQueries != GRAPH_NONE && StartGraphPass(&Graph, &rs, passQueries)) {
+        SetRenderProgram(&rsMesh, &PROG_DEPTH);
+        IssueOcclusionQueries(&Queries, &rsMesh, conf, frame, &p->dlMain);
+        EndGraphPass(&Graph);
+    }
     // Generate shadow VP matrix:
     mat4 shadowSpaceMatrix;
     glm_mat4_mul(conf->camShadow.proj_matrix, conf->camShadow.view_matrix, shadowSpaceMatrix);
 
-    if (conf->shadowTAA) {
-        StartRenderPass(&rs, "Shadow TAA buffer copy");
-        glBindFramebuffer(GL_READ_FRAMEBUFFER, FB_AUX1_ONLY);
-        glReadBuffer(GL_COLOR_ATTACHMENT0); // copying from RT_AUX1
-        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, FB_AUX2_ONLY);
-        glDrawBuffer(GL_COLOR_ATTACHMENT0); // to RT_AUX2
-        glBlitFramebuffer(0, 0, w, h, 0, 0, w, h, GL_COLOR_BUFFER_BIT, GL_NEAREST);
-        glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
-        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
-        EndRenderPass();
-    }
-
-    StartRenderPass(&rs, "GBuffer shadow resolve");
-    BindFramebuffer(FB_AUX1_ONLY);
-    SetRenderProgram(&rs, &PROG_SHADOW_RESOLVE);
-    SetCamera(&rs, &conf->camMain);
-    glUniform2f(UNIF_JITTER, jitterX, jitterY);
-    glUniform2f(UNIF_JITTER_LAST, jitterLastX, jitterLastY);
-    // Send shadow uniforms:
-    glUniformMatrix4fv(UNIF_SHADOW_VP_MATRIX, 1, false, (float*) shadowSpaceMatrix);
-    glUniform1f(UNIF_SHADOW_BIAS_MIN, conf->shadowBiasMin);
-    glUniform1f(UNIF_SHADOW_BIAS_MIN, conf->shadowBiasMin);
-    glUniform3fv(UNIF_SUN_POSITION, 1, directional->position);
-    RenderMesh(&rs, conf, frame, &MESH_QUAD, &MAT_FULLSCREEN_QUAD);
-    EndRenderPass();
-
-    StartRenderPass(&rs, "GBuffer main lighting");
-    BindFramebuffer(FB_ONLY_COLOR_HDR);
-    SetRenderProgram(&rs, &PROG_GBUF_LIGHT_MAIN);
-    SetCamera(&rs, &conf->camMain);
-    // Send shadow uniforms:
-    glUniformMatrix4fv(UNIF_SHADOW_VP_MATRIX, 1, false, (float*) shadowSpaceMatrix);
-    glUniform1f(UNIF_SHADOW_BIAS_MIN, conf->shadowBiasMin);
-    glUniform1f(UNIF_SHADOW_BIAS_MIN, conf->shadowBiasMin);
-    // Extract light info from scene:
-    RenderableLightProbe* ambient = NULL;
-    if (rl.lightProbeCount > 0) {
-        ambient = &rl.lightProbes[0];
-    }
-    // Send light uniforms:
-    if (ambient) {
-        glUniform3fv(UNIF_AMBIENT_CUBE, 6, (float*) ambient->colors);
-    }
-    if (directional) {
-        glUniform3fv(UNIF_SUN_POSITION, 1, directional->position);
-        glUniform3fv(UNIF_SUN_COLOR, 1, directional->color);
-    }
-    RenderMesh(&rs, conf, frame, &MESH_QUAD, &MAT_FULLSCREEN_QUAD);
-    EndRenderPass();
-
-    StartRenderPass(&rs, "GBuffer point lighting");
-    SetRenderProgram(&rs, &PROG_GBUF_LIGHT_POINT);
-    BindFramebuffer(FB_ONLY_COLOR_HDR_NO_AUX);
-    SetCamera(&rs, &camMainJittered);
-    // Render a light volume, to limit the amount of pixels that have to be shaded, for each point light.
-    for (int i = 0; i < rl.pointLightCount; i++) {
-        glUniform3fv(UNIF_POINTLIGHT_POSITION, 1, (float*) rl.pointLights[i].position);
-        glUniform3fv(UNIF_POINTLIGHT_COLOR,    1, (float*) rl.pointLights[i].color);
-        const float threshold = 0.02; // intensity beyond which we don't render the light
-        float intensity = glm_vec3_max(rl.pointLights[i].color);
-        float radius = sqrtf(intensity / threshold);
-        RenderState lightRs = rs;
-        MulModelPosition(&lightRs, rl.pointLights[i].position, rl.pointLights[i].position);
-        MulModelScale(&lightRs, (vec3){radius, radius, radius}, (vec3){radius, radius, radius});
-        RenderMesh(&lightRs, conf, frame, &MESH_CUBE, &MAT_LIGHT_VOLUME);
-    }
-    EndRenderPass();
+    if (StartGraphPass(&Graph, &rs, passShadowResolve)) {
+        SetRenderProgram(&rs, &PROG_SHADOW_RESOLVE);
+        SetCamera(&rs, &conf->camMain);
+        // Send shadow uniforms:
+        SetUniformMatrix4fv(&rs, UNIF_SHADOW_VP_MATRIX, shadowSpaceMatrix);
+        SetUniform1f(&rs, UNIF_SHADOW_BIAS_MIN, conf->shadowBiasMin);
+        SetUniform1f(&rs, UNIF_SHADOW_BIAS_MIN, conf->shadowBiasMin);
+        SetUniform3fv(&rs, UNIF_SUN_POSITION, 1, directional->position);
+        RenderMesh(&rs, conf, frame, &MESH_QUAD, &MAT_FULLSCREEN_QUAD);
+        EndGraphPass(&Graph);
+    }
 
-    if (conf->enableTAA) {
-        StartRenderPass(&rs, "Temporal AA");
-        BindFramebuffer(FB_TAA);
+    if (StartGraphPass(&Graph, &rs, passLight)) {
+        SetRenderProgram(&rs, &PROG_GBUF_LIGHT_MAIN);
+        SetCamera(&rs, &conf->camMain);
+        // Send shadow uniforms:
+        SetUniformMatrix4fv(&rs, UNIF_SHADOW_VP_MATRIX, shadowSpaceMatrix);
+        SetUniform1f(&rs, UNIF_SHADOW_BIAS_MIN, conf->shadowBiasMin);
+        SetUniform1f(&rs, UNIF_SHADOW_BIAS_MIN, conf->shadowBiasMin);
+        // Extract light info from scene:
+        RenderableLightProbe* ambient = NULL;
+        if (rl->lightProbeCount > 0) {
+            ambient = &rl->lightProbes[0];
+        }
+        // Send light uniforms:
+        if (ambient) {
+            SetUniform3fv(&rs, UNIF_AMBIENT_CUBE, 6, (float*) ambient->colors);
+        }
+        if (directional) {
+            SetUniform3fv(&rs, UNIF_SUN_POSITION, 1, directional->position);
+            SetUniform3fv(&rs, UNIF_SUN_COLOR, 1, directional->color);
+        }
+        RenderMesh(&rs, conf, frame, &MESH_QUAD, &MAT_FULLSCREEN_QUAD);
+        EndGraphPass(&Graph);
+    }
+
+    if (StartGraphPass(&Graph, &rs, passPointLights)) {
+        SetRenderProgram(&rs, &PROG_GBUF_LIGHT_POINT);
+        SetCamera(&rs, camMainJittered);
+        // Render a light volume, to limit the amount of pixels that have to be shaded, for each point light.
+        for (int i = 0; i < rl->pointLightCount; i++) {
+            SetUniform3fv(&rs, UNIF_POINTLIGHT_POSITION, 1, (float*) rl->pointLights[i].position);
+            SetUniform3fv(&rs, UNIF_POINTLIGHT_COLOR,    1, (float*) rl->pointLights[i].color);
+            float radius = PointLightRadius(rl->pointLights[i].color);
+            RenderState lightRs = rs;
+            MulModelPosition(&lightRs, rl->pointLights[i].position, rl->pointLights[i].position);
+            MulModelScale(&lightRs, (vec3){radius, radius, radius}, (vec3){radius, radius, radius});
+            RenderMesh(&lightRs, conf, frame, &MESH_CUBE, &MAT_LIGHT_VOLUME);
+        }
+        EndGraphPass(&Graph);
+    }
+
+    if (passTAA != GRAPH_NONE && StartGraphPass(&Graph, &rs, passTAA)) {
         SetRenderProgram(&rs, &PROG_TAA);
-        SetCamera(&rs, &camMainJittered);
-        glUniform2f(UNIF_JITTER, jitterX, jitterY);
-        glUniform2f(UNIF_JITTER_LAST, jitterLastX, jitterLastY);
-        glUniform1f(UNIF_TAA_FEEDBACK_FACTOR, conf->taaFeedbackFactor);
-        glUniform1f(UNIF_TAA_CLAMP_SAMPLE_DIST, conf->taaClampSampleDist);
+        SetCamera(&rs, camMainJittered);
+        SetUniform1f(&rs, UNIF_TAA_FEEDBACK_FACTOR, conf->taaFeedbackFactor);
+        SetUniform1f(&rs, UNIF_TAA_CLAMP_SAMPLE_DIST, conf->taaClampSampleDist);
         RenderMesh(&rs, conf, frame, &MESH_QUAD, &MAT_FULLSCREEN_QUAD);
-        EndRenderPass();
-
-        // Writing directly to RT_AUX_HDR11 (and using gAuxHDR11 instead of gColorHDR in the final shader) seems to
-        // work, but a) is undefined behaviour, and b) avoiding the copy doesn't seem to improve performance anyway.
-        // TODO: Add a toggle for copy vs. no copy so we can test how it behaves on other hardware.
-        StartRenderPass(&rs, "Temporal AA Accumulation Buffer Copy");
-        glBindFramebuffer(GL_READ_FRAMEBUFFER, FB_TAA);
-        glReadBuffer(GL_COLOR_ATTACHMENT0); // copying from RT_COLOR_HDR
-        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, FB_TAA_COPY);
-        glDrawBuffer(GL_COLOR_ATTACHMENT0); // to RT_AUX_HDR11
-        glBlitFramebuffer(0, 0, w, h, 0, 0, w, h, GL_COLOR_BUFFER_BIT, GL_NEAREST);
-        glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
-        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
-        EndRenderPass();
+        EndGraphPass(&Graph);
     }
 
-    if (conf->debugShowPointLights) {
-        StartRenderPass(&rs, "Debug: Point Light Positions");
-        // We do the binding manually to avoid PROG_GBUF_MAIN wiping out any data in gAux2.
-        glBindFramebuffer(GL_FRAMEBUFFER, FB_ONLY_COLOR_HDR);
-        glDrawBuffer(GL_COLOR_ATTACHMENT0);
+    if (passDebugLights != GRAPH_NONE && StartGraphPass(&Graph, &rs, passDebugLights)) {
         // There should be a dedicated program for this kind of thing, but whatever, this works for now.
+        // Only gColorHDR is attached, so the other outputs of PROG_GBUF_MAIN go nowhere.
         SetRenderProgram(&rs, &PROG_GBUF_MAIN);
         SetCamera(&rs, &conf->camMain);
-        for (int i = 0; i < rl.pointLightCount; i++) {
+        for (int i = 0; i < rl->pointLightCount; i++) {
             const float scale = 0.2f;
             RenderState cubeRs = rs;
-            MulModelPosition(&cubeRs, rl.pointLights[i].position, rl.pointLights[i].position);
+            MulModelPosition(&cubeRs, rl->pointLights[i].position, rl->pointLights[i].position);
             MulModelScale(&cubeRs, (vec3){scale, scale, scale}, (vec3){scale, scale, scale});
             RenderMesh(&cubeRs, conf, frame, &MESH_CUBE, &MAT_DIFFUSE_WHITE);
         }
-        EndRenderPass();
+        EndGraphPass(&Graph);
     }
-    
-    StartRenderPass(&rs, "Final output");
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    glDrawBuffer(GL_BACK);
-    glEnable(GL_FRAMEBUFFER_SRGB);
-    SetRenderProgram(&rs, &PROG_FINAL);
-    SetCamera(&rs, &conf->camMain);
-    glUniform1f(UNIF_TONEMAP_EXPOSURE, conf->tonemapExposure);
-    if (conf->tonemapMode == TONEMAP_ACES) {
-        glUniform1f(UNIF_TONEMAP_ACES_PARAM_A, conf->tonemapACESParamA);
-        glUniform1f(UNIF_TONEMAP_ACES_PARAM_B, conf->tonemapACESParamB);
-        glUniform1f(UNIF_TONEMAP_ACES_PARAM_C, conf->tonemapACESParamC);
-        glUniform1f(UNIF_TONEMAP_ACES_PARAM_D, conf->tonemapACESParamD);
-        glUniform1f(UNIF_TONEMAP_ACES_PARAM_E, conf->tonemapACESParamE);
-    }
-    glUniform1f(UNIF_SHARPEN_STRENGTH, conf->sharpenStrength);
-    RenderMesh(&rs, conf, frame, &MESH_QUAD, &MAT_FULLSCREEN_QUAD);
-    glDisable(GL_FRAMEBUFFER_SRGB);
-    EndRenderPass();
-
-    RenderPass(&rs, "User interface", {
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-        glDrawBuffer(GL_BACK);
-        GUI_Render();
-    });
 
-    EndBlock();
+    if (StartGraphPass(&Graph, &rs, passFinal)) {
+        SetGLEnabled(GL_FRAMEBUFFER_SRGB, true);
+        SetRenderProgram(&rs, &PROG_FINAL);
+        SetCamera(&rs, &conf->camMain);
+        SetUniform1f(&rs, UNIF_TONEMAP_EXPOSURE, conf->tonemapExposure);
+        if (conf->tonemapMode == TONEMAP_ACES) {
+            SetUniform1f(&rs, UNIF_TONEMAP_ACES_PARAM_A, conf->tonemapACESParamA);
+            SetUniform1f(&rs, UNIF_TONEMAP_ACES_PARAM_B, conf->tonemapACESParamB);
+            SetUniform1f(&rs, UNIF_TONEMAP_ACES_PARAM_C, conf->tonemapACESParamC);
+            SetUniform1f(&rs, UNIF_TONEMAP_ACES_PARAM_D, conf->tonemapACESParamD);
+            SetUniform1f(&rs, UNIF_TONEMAP_ACES_PARAM_E, conf->tonemapACESParamE);
+        }
+        SetUniform1f(&rs, UNIF_SHARPEN_STRENGTH, conf->sharpenStrength);
+        RenderMesh(&rs, conf, frame, &MESH_QUAD, &MAT_FULLSCREEN_QUAD);
+        SetGLEnabled(GL_FRAMEBUFFER_SRGB, false);
+        EndGraphPass(&Graph);
+    }
+
+    if (StartGraphPass(&Graph, &rs, passUI)) {
+        GUI_RenderDrawData(p->gui);
+        InvalidateGLState(); // ImGui sets its own state
+        EndGraphPass(&Graph);
+    }
+    EndRenderGraph(&Graph);
 
     double tRenderEnd = glfwGetTime();
     // We can't time OpenGL calls if Remotery is already doing it!
@@ -667,40 +978,96 @@ void GameTick (vxConfig* conf, GLFWwindow* window, vxFrame* frame, vxFrame* last
         // glGetQueryObject will produce INVALID_OPERATION errors if called for queries that have never been started.
         // During the first frames, we'll just query the current frame's render time (synchronously). After all query
         // objects become valid, we can switch to asynchronous queries (N frames behind).
-        if (frame->n >= 4) {
-            rtqIndex = (rtqIndex + 1) % 4;
-            glGetQueryObjecti64v(rtq[rtqIndex], GL_QUERY_RESULT, &dtOpenGLRender);
-        } else {
-            glGetQueryObjecti64v(rtq[rtqIndex], GL_QUERY_RESULT, &dtOpenGLRender);
-            rtqIndex = (rtqIndex + 1) % 4;
-        }
+        int queryIndex = (frame->n >= 4) ? (rtqIndex + 1) % 4 : rtqIndex;
+        rtqIndex = (rtqIndex + 1) % 4;
+        glGetQueryObjecti64v(rtq[queryIndex], GL_QUERY_RESULT, &dtOpenGLRender);
+        int64_t tGBufferStart = 0, tGBufferEnd = 0;
+        glGetQueryObjecti64v(gbq[queryIndex][0], GL_QUERY_RESULT, &tGBufferStart);
+        glGetQueryObjecti64v(gbq[queryIndex][1], GL_QUERY_RESULT, &tGBufferEnd);
         EndBlock();
     #endif
 
-    // *****************************************************************************************************************
-    // Swap & poll:
-
     double tSwapStart = glfwGetTime();
     TimedGPUBlock("Swap buffers", {
-        glfwSwapBuffers(window);
-    });
-
-    double tPollStart = glfwGetTime();
-    TimedBlock("Poll events", {
-        glfwPollEvents();
+        glfwSwapBuffers(p->window);
     });
 
-    StartBlock("FrameTiming");
     // All of these values are supposed to be in seconds.
-    frame->tMain   = (float)(tRenderStart - frame->t);
     frame->tSubmit = (float)(tRenderEnd - tRenderStart);
     #if !RMT_USE_OPENGL
         frame->tRender = (float)(dtOpenGLRender) / 1000000000.0f; // nanoseconds
+        frame->tGBuffer = (float)(tGBufferEnd - tGBufferStart) / 1000000000.0f;
+        frame->gbufferPrepass = gbqPrepass[queryIndex];
     #else
         frame->tRender = 0.0f;
+        frame->tGBuffer = 0.0f;
     #endif
-    frame->tSwap   = (float)(tPollStart - tSwapStart);
-    frame->tPoll   = (float)(glfwGetTime() - tPollStart);
+    frame->tSwap   = (float)(glfwGetTime() - tSwapStart);
+}
+
+static void sGameRenderJob (void* user) {
+    GameRender((FramePacket*) user);
+}
+
+// Tick function for the game. Updates a single frame and hands it to the render thread, which draws it while the next
+// one is updated.
+void GameTick (vxConfig* conf, GLFWwindow* window, vxFrame* frame, vxFrame* lastFrame, Scene* scene) {
+    frame->t = (float) glfwGetTime();
+    frame->dt = frame->t - lastFrame->t;
+
+    // Pause the game if it loses focus:
+    if (conf->pauseOnFocusLoss && !glfwGetWindowAttrib(window, GLFW_FOCUSED)) {
+        glfwWaitEvents();
+        glfwSetTime(frame->t);
+        return;
+    }
+
+    // Print the last frame's log:
+    vxAdvanceFrame();
+    frame->n = vxFrameNumber;
+
+    // GL work queued by jobs since the last frame, the render thread runs it as it comes in:
+    if (!RenderThreadRunning) {
+        TimedBlock("Main Thread Jobs", vxRunMainThreadJobs());
+    }
+
+    // The packet is reused from the frame before last, which has to be drawn by now. Its render timings and stats are
+    // the most recent ones available, so they're shown in place of the last frame's:
+    FramePacket* packet = &Packets[frame->n % vxSize(Packets)];
+    TimedBlock("Wait For Render Thread", vxWaitForJobs(&packet->done));
+    if (packet->submitted) {
+        lastFrame->tSubmit = packet->frame.tSubmit;
+        lastFrame->tRender = packet->frame.tRender;
+        lastFrame->tSwap = packet->frame.tSwap;
+        lastFrame->tGBuffer = packet->frame.tGBuffer;
+        lastFrame->gbufferPrepass = packet->frame.gbufferPrepass;
+        lastFrame->perfTriangles = packet->frame.perfTriangles;
+        lastFrame->perfVertices = packet->frame.perfVertices;
+        lastFrame->perfDrawCalls = packet->frame.perfDrawCalls;
+        lastFrame->perfConditionalDraws = packet->frame.perfConditionalDraws;
+    }
+
+    TimedBlock("Frame Update", GameUpdate(conf, window, frame, lastFrame, scene, packet));
+    frame->tMain = (float)(glfwGetTime() - frame->t);
+
+    if (RenderThreadRunning) {
+        vxJob job = {0};
+        job.name = "Frame Render";
+        job.func = sGameRenderJob;
+        job.user = packet;
+        job.counter = &packet->done;
+        job.mainThread = true;
+        vxSubmitJob(&job);
+    } else {
+        TimedBlock("Frame Render", GameRender(packet));
+    }
+    packet->submitted = true;
+
+    double tPollStart = glfwGetTime();
+    TimedBlock("Poll events", {
+        glfwPollEvents();
+    });
+    frame->tPoll = (float)(glfwGetTime() - tPollStart);
 
     // PollEvents usually takes under 1ms, so if we exceed 100ms it's probably because the
     // window is moving. Ignore the frame for timing purposes if this happens.
@@ -708,7 +1075,6 @@ void GameTick (vxConfig* conf, GLFWwindow* window, vxFrame* frame, vxFrame* last
         frame->tPoll = 0.0f;
         glfwSetTime(tPollStart);
     }
-    EndBlock();
 }
 
 // Actual entry point for the game. Doesn't do much, just dispatches to the other functions in this file.
@@ -725,8 +1091,11 @@ int main() {
     TimedBlock("GameReload", GameReload(&conf, window));
 
     Scene scene = {0};
-    TimedBlock("GameLoadScene", GameLoadScene(&scene));
+    static SceneJournal journal;
+    static StreamingWorld world;
+    TimedBlock("GameLoadScene", GameLoadScene(&conf, &scene, &journal, &world));
 
+    sStartRenderThread(&conf, window);
     vxFrame frame = {0};
     vxFrame lastFrame = {0};
     while (!glfwWindowShouldClose(window)) {
@@ -736,7 +1105,10 @@ int main() {
             memset(&frame, 0, sizeof(frame));
         });
     }
+    sStopRenderThread(window);
 
+    CloseStreamingWorld(&world, &scene);
+    DeleteSceneJournal(&journal, &scene);
     rmt_UnbindOpenGL();
     rmt_DestroyGlobalInstance(rmt);
     return 0;
@@ -28,6 +28,12 @@ typedef enum DebugVisMode {
     DEBUG_VIS_SHADOWMAP,
 } DebugVisMode;
 
+typedef enum DepthPrepassMode {
+    DEPTH_PREPASS_OFF,
+    DEPTH_PREPASS_ON,
+    DEPTH_PREPASS_AUTO, // on when the estimated overdraw of the main view is high, see vxConfig.depthPrepassOverdraw
+} DepthPrepassMode;
+
 typedef struct vxConfig {
     int swapInterval; // passed to glfwSwapInterval, -1 is translated to 1 on machines without support for it
     int displayW;
@@ -69,6 +75,67 @@ typedef struct vxConfig {
     bool shadowTAA;
     bool shadowNoise;
 
+    // Merge meshes of objects that never move into world space buffers, one per material and grid cell, to cut down
+    // on draw calls. Batched objects that move fall back to regular rendering until the batches are rebuilt.
+    bool enableStaticBatching;
+    // Size of the grid cells used to split static batches, so that they can still be frustum culled.
+    float staticBatchCellSize;
+
+    // Skip draws outside the cells visible through portals from the camera's cell (see scene/cells.h).
+    bool enablePortalCulling;
+    // Skip draws of objects that aren't in the baked potentially visible set of the camera's cell (see scene/pvs.h).
+    bool enablePVS;
+
+    // Rasterize large occluders into a small CPU depth buffer and skip draws hidden behind them.
+    bool enableOcclusionCulling;
+    // Maximum number of occluder triangles rasterized per frame. Occluders are picked largest first.
+    int occlusionTriangleBudget;
+    // Minimum screen area of an occluder's bounding box, in occlusion buffer pixels (see OCCLUSION_WIDTH/HEIGHT).
+    float occlusionMinOccluderArea;
+    // Draw the bounding boxes of heavy meshes with GPU occlusion queries, and skip the meshes on the next frame with
+    // conditional rendering if their box was hidden.
+    bool enableOcclusionQueries;
+    // Meshes with fewer triangles than this are always drawn directly.
+    int occlusionQueryMinTriangles;
+    // Number of frames a mesh has to stay hidden before its draws become conditional. Avoids popping.
+    int occlusionQueryHysteresis;
+
+    // Draw the depth of opaque meshes with the depth-only program before the G-buffer pass, which then only shades the
+    // visible surface of each pixel (see DepthPrepassMode). Costs a second pass over the opaque geometry, so it only
+    // pays off with enough overdraw.
+    int depthPrepassMode;
+    // Overdraw above which DEPTH_PREPASS_AUTO turns the prepass on: the screen area covered by the bounding boxes of
+    // opaque draws, in screens. It's only turned off again below depthPrepassOverdrawOff, so views close to the
+    // threshold don't switch it on and off from one frame to the next.
+    float depthPrepassOverdraw;
+    float depthPrepassOverdrawOff;
+
+    // Journal scene edits and write snapshots in the background, so the scene can be recovered after a crash
+    // (see scene/journal.h).
+    bool enableAutosave;
+    // Load the autosave files at startup if the last session didn't shut down cleanly. Off by default, since it
+    // replaces the default scene without asking. The files are kept until autosave writes its first snapshot.
+    bool recoverAutosave;
+    // Seconds between snapshots. Edits in between are only in the journal.
+    float autosaveInterval;
+
+    // Read models when an object first refers to them instead of at startup, and unload unused ones once the resident
+    // models go over the budget (see scene/stream.h). Takes effect on restart.
+    bool enableModelStreaming;
+    // Memory budget for resident models, in MiB. Models that are in use are never unloaded, even over the budget.
+    int streamingModelBudget;
+    // Chunks of a streaming world are loaded once the camera is within the load radius, and unloaded once it's further
+    // away than the unload radius. The gap between the two keeps chunks near the border from reloading all the time.
+    float streamingLoadRadius;
+    float streamingUnloadRadius;
+
+    // Worker threads of the job system, besides the main thread. -1 for one less than the number of cores, 0 to run
+    // every job on the main thread. Takes effect on restart.
+    int jobWorkers;
+    // Submit GL from a dedicated render thread, which draws each frame while the game thread updates the next one.
+    // Takes effect on restart.
+    bool enableRenderThread;
+
     // Enable the Temporal Anti-Aliasing filter. Smooths the image at the cost of some blur.
     bool enableTAA;
     // If enabled, use a Halton pattern for the jitter. If disabled, use a simple 2-sample pattern.
@@ -98,9 +165,16 @@ typedef struct vxFrame {
     float tRender; // time taken by OpenGL on the GPU side (actual rendering)
     float tSwap;   // time taken by OpenGL on the CPU side (glfwSwapBuffers)
     float tPoll;   // time taken by the operating system (glfwPollEvents)
+    float tGBuffer; // time taken on the GPU by the G-buffer pass, including its depth prepass
+    bool gbufferPrepass; // whether tGBuffer was measured with the depth prepass
     uint64_t perfTriangles;
     uint64_t perfVertices;
     uint64_t perfDrawCalls;
+    uint64_t perfPortalCulledDraws;
+    uint64_t perfPVSCulledDraws;
+    uint64_t perfOccludedDraws;
+    uint64_t perfConditionalDraws;
+    float perfOverdraw; // estimated overdraw of opaque draws in the main view (see EstimateOverdraw)
     float mouseX;
     float mouseY;
     float mouseDx;
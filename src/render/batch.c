@@ -0,0 +1,386 @@
+#include "batch.h"
+#include "render/render.h"
+#include "scene/bvh.h"
+#include <GLFW/glfw3.h>
+
+typedef struct BatchSource {
+    Material* material;
+    int32_t cell [3];
+    int32_t object;
+    uint32_t mesh;
+} BatchSource;
+
+// Orders sources by the batch they go into.
+static int sCompareBatchKeys (const void* pa, const void* pb) {
+    const BatchSource* a = (const BatchSource*) pa;
+    const BatchSource* b = (const BatchSource*) pb;
+    if (a->material->id != b->material->id) { return (a->material->id < b->material->id) ? -1 : 1; }
+    for (int i = 0; i < 3; i++) {
+        if (a->cell[i] != b->cell[i]) { return (a->cell[i] < b->cell[i]) ? -1 : 1; }
+    }
+    return 0;
+}
+
+static int sCompareSources (const void* pa, const void* pb) {
+    int key = sCompareBatchKeys(pa, pb);
+    if (key != 0) { return key; }
+    const BatchSource* a = (const BatchSource*) pa;
+    const BatchSource* b = (const BatchSource*) pb;
+    if (a->object != b->object) { return (a->object < b->object) ? -1 : 1; }
+    return (a->mesh < b->mesh) ? -1 : (a->mesh > b->mesh);
+}
+
+static int sCompareObjects (const void* pa, const void* pb) {
+    int32_t a = *(const int32_t*) pa;
+    int32_t b = *(const int32_t*) pb;
+    return (a < b) ? -1 : (a > b);
+}
+
+bool IsStaticBatchable (Mesh* mesh, Material* material) {
+    return material != NULL && !material->blend && mesh->type == GL_TRIANGLES &&
+           mesh->cpu_attributes[ATTR_POSITION] != NULL && mesh->cpu_indices != NULL;
+}
+
+bool StaticBatchesUsable (StaticBatchSet* sb, Scene* scene) {
+    return sb != NULL && sb->scene == scene && sb->sceneVersion == scene->structureVersion &&
+           sb->modelVersion == ModelResidencyVersion;
+}
+
+static void sReleaseBatch (StaticBatch* batch) {
+    if (!batch->valid) { return; }
+    Mesh* mesh = &batch->rmesh.mesh;
+    glDeleteVertexArrays(1, &mesh->gl_vertex_array);
+    glDeleteVertexArrays(1, &mesh->gl_depth_vertex_array);
+    glDeleteVertexArrays(1, &mesh->gl_masked_vertex_array);
+    glDeleteBuffers(1, &mesh->gl_element_array);
+    glDeleteBuffers(MESH_ATTRIBUTE_SLOTS, batch->vbos);
+    if (mesh->cpu_attributes[ATTR_POSITION] != NULL) {
+        vxFree(mesh->cpu_attributes[ATTR_POSITION]);
+    }
+    if (mesh->cpu_indices != NULL) {
+        vxFree(mesh->cpu_indices);
+    }
+    if (batch->objects != NULL) {
+        vxFree(batch->objects);
+    }
+    memset(batch, 0, sizeof(StaticBatch));
+}
+
+void DeleteStaticBatches (StaticBatchSet* sb) {
+    for (size_t i = 0; i < sb->batchCount; i++) {
+        sReleaseBatch(&sb->batches[i]);
+    }
+    if (sb->batches != NULL) {
+        vxFree(sb->batches);
+    }
+    if (sb->scene != NULL) {
+        for (size_t i = 0; i < sb->scene->size; i++) {
+            sb->scene->objects[i].staticBatched = false;
+        }
+    }
+    memset(sb, 0, sizeof(StaticBatchSet));
+}
+
+// Merges a run of sources with the same material and cell into a single mesh, pre-transformed to world space.
+// Attributes that only some of the sources have are filled with the default generic attribute value (0,0,0,1).
+static void sBuildBatch (StaticBatch* batch, Scene* scene, BatchSource* sources, size_t count) {
+    static const float defaults [4] = {0.0f, 0.0f, 0.0f, 1.0f};
+    memset(batch, 0, sizeof(StaticBatch));
+
+    uint8_t components [MESH_ATTRIBUTE_SLOTS] = {0};
+    size_t vertexCount = 0;
+    size_t indexCount = 0;
+    for (size_t i = 0; i < count; i++) {
+        Mesh* src = &scene->objects[sources[i].object].model.model->meshes[sources[i].mesh];
+        for (int a = 0; a < MESH_ATTRIBUTE_SLOTS; a++) {
+            components[a] = vxMax(components[a], src->cpu_attribute_components[a]);
+        }
+        vertexCount += src->gl_vertex_count;
+        indexCount += src->cpu_index_count;
+    }
+
+    float* attributes [MESH_ATTRIBUTE_SLOTS] = {0};
+    for (int a = 0; a < MESH_ATTRIBUTE_SLOTS; a++) {
+        if (components[a] > 0) {
+            attributes[a] = vxAlloc(vertexCount * components[a], float);
+        }
+    }
+    uint32_t* indices = vxAlloc(indexCount, uint32_t);
+    batch->objects = vxAlloc(count, int32_t);
+
+    size_t baseVertex = 0;
+    size_t baseIndex = 0;
+    for (size_t i = 0; i < count; i++) {
+        GameObject* obj = &scene->objects[sources[i].object];
+        Model* model = obj->model.model;
+        Mesh* src = &model->meshes[sources[i].mesh];
+        mat4 m;
+        mat3 n;
+        glm_mat4_mul(obj->worldMatrix, model->meshTransforms[sources[i].mesh], m);
+        glm_mat4_pick3(m, n);
+
+        for (int a = 0; a < MESH_ATTRIBUTE_SLOTS; a++) {
+            size_t dstc = components[a];
+            size_t srcc = src->cpu_attribute_components[a];
+            if (dstc == 0) { continue; }
+            for (size_t v = 0; v < src->gl_vertex_count; v++) {
+                float* dst = &attributes[a][(baseVertex + v) * dstc];
+                for (size_t c = 0; c < dstc; c++) {
+                    dst[c] = (c < srcc) ? src->cpu_attributes[a][v * srcc + c] : defaults[vxMin(c, 3)];
+                }
+                if (srcc < 3) { continue; }
+                // Same transforms as the vertex shader applies to these attributes:
+                if (a == ATTR_POSITION) {
+                    glm_mat4_mulv3(m, dst, 1.0f, dst);
+                } else if (a == ATTR_NORMAL || a == ATTR_TANGENT) {
+                    glm_mat3_mulv(n, dst, dst);
+                    glm_vec3_normalize(dst);
+                }
+            }
+        }
+        for (size_t j = 0; j < src->cpu_index_count; j++) {
+            indices[baseIndex + j] = (uint32_t)(baseVertex + src->cpu_indices[j]);
+        }
+
+        vec3 min, max;
+        TransformAABB(m, src->aabbMin, src->aabbMax, min, max);
+        if (i == 0) {
+            glm_vec3_copy(min, batch->rmesh.aabbMin);
+            glm_vec3_copy(max, batch->rmesh.aabbMax);
+        } else {
+            glm_vec3_minv(batch->rmesh.aabbMin, min, batch->rmesh.aabbMin);
+            glm_vec3_maxv(batch->rmesh.aabbMax, max, batch->rmesh.aabbMax);
+        }
+        batch->objects[i] = sources[i].object;
+        baseVertex += src->gl_vertex_count;
+        baseIndex += src->cpu_index_count;
+    }
+
+    // Keep each object once:
+    qsort(batch->objects, count, sizeof(int32_t), sCompareObjects);
+    for (size_t i = 0; i < count; i++) {
+        if (batch->objectCount == 0 || batch->objects[batch->objectCount - 1] != batch->objects[i]) {
+            batch->objects[batch->objectCount++] = batch->objects[i];
+        }
+    }
+
+    // Upload:
+    Mesh* mesh = &batch->rmesh.mesh;
+    mesh->type = GL_TRIANGLES;
+    glGenVertexArrays(1, &mesh->gl_vertex_array);
+    BindGLVertexArray(mesh->gl_vertex_array);
+    for (int a = 0; a < MESH_ATTRIBUTE_SLOTS; a++) {
+        if (components[a] == 0) { continue; }
+        glGenBuffers(1, &batch->vbos[a]);
+        glBindBuffer(GL_ARRAY_BUFFER, batch->vbos[a]);
+        glBufferData(GL_ARRAY_BUFFER, (GLsizei)(vertexCount * components[a] * sizeof(float)), attributes[a],
+            GL_STATIC_DRAW);
+        glEnableVertexAttribArray(a);
+        glVertexAttribPointer(a, components[a], GL_FLOAT, false, 0, NULL);
+    }
+    glGenBuffers(1, &mesh->gl_element_array);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->gl_element_array);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, (GLsizei)(indexCount * sizeof(uint32_t)), indices, GL_STATIC_DRAW);
+    BindGLVertexArray(0);
+    mesh->gl_element_count = indexCount;
+    mesh->gl_element_type = FACCESSOR_UINT32;
+    mesh->gl_vertex_count = vertexCount;
+    glm_vec3_copy(batch->rmesh.aabbMin, mesh->aabbMin);
+    glm_vec3_copy(batch->rmesh.aabbMax, mesh->aabbMax);
+    EnableInstanceAttributes(mesh);
+    CreateDepthVertexArrays(batch->vbos[ATTR_POSITION], batch->vbos[ATTR_TEXCOORD0], &mesh->gl_depth_vertex_array,
+        &mesh->gl_masked_vertex_array);
+
+    // Positions and indices are kept for CPU-side users (e.g. occlusion culling), everything else can go:
+    for (int a = 0; a < MESH_ATTRIBUTE_SLOTS; a++) {
+        if (a == ATTR_POSITION) {
+            mesh->cpu_attributes[a] = attributes[a];
+            mesh->cpu_attribute_components[a] = components[a];
+        } else if (attributes[a] != NULL) {
+            vxFree(attributes[a]);
+        }
+    }
+    mesh->cpu_indices = indices;
+    mesh->cpu_index_count = indexCount;
+
+    glm_mat4_identity(batch->rmesh.worldMatrix);
+    glm_mat4_identity(batch->rmesh.lastWorldMatrix);
+    memcpy(batch->cell, sources[0].cell, sizeof(batch->cell));
+    batch->rmesh.material = sources[0].material;
+    batch->rmesh.object = -1;
+    batch->sourceMeshCount = count;
+    batch->valid = true;
+}
+
+// Appends the batchable meshes of an object, along with the cell they belong to.
+static void sAddObjectSources (BatchSource** sources, Scene* scene, int32_t object, float cellSize) {
+    GameObject* obj = &scene->objects[object];
+    if (obj->type != GAMEOBJECT_MODEL || obj->model.model == NULL) { return; }
+    Model* model = obj->model.model;
+    for (size_t imesh = 0; imesh < model->meshCount; imesh++) {
+        Mesh* mesh = &model->meshes[imesh];
+        if (!IsStaticBatchable(mesh, model->meshMaterials[imesh])) { continue; }
+        mat4 m;
+        vec3 min, max, center;
+        glm_mat4_mul(obj->worldMatrix, model->meshTransforms[imesh], m);
+        TransformAABB(m, mesh->aabbMin, mesh->aabbMax, min, max);
+        glm_vec3_center(min, max, center);
+        BatchSource src = {model->meshMaterials[imesh], {0}, object, (uint32_t) imesh};
+        for (int c = 0; c < 3; c++) {
+            src.cell[c] = (int32_t) floorf(center[c] / cellSize);
+        }
+        stbds_arrput(*sources, src);
+    }
+}
+
+// Objects that moved are left out of the batches until they've stayed put for StaticBatch_SettleFrames.
+static bool sSettled (GameObject* obj, uint64_t frame) {
+    if (obj->batchSettleFrame > frame) { return false; }
+    obj->batchSettleFrame = 0;
+    return true;
+}
+
+// Returns an unused batch, reusing the slots of dropped batches first.
+static StaticBatch* sAddBatch (StaticBatchSet* sb) {
+    for (size_t i = 0; i < sb->batchCount; i++) {
+        if (!sb->batches[i].valid) { return &sb->batches[i]; }
+    }
+    sb->batchCount++;
+    if (sb->batchCount > sb->batchSlots) {
+        sb->batchSlots = vxMax(sb->batchCount * 2, 64);
+        sb->batches = (StaticBatch*) vxAlignedRealloc(sb->batches, sb->batchSlots, sizeof(StaticBatch),
+            vxAlignOf(StaticBatch));
+    }
+    return &sb->batches[sb->batchCount - 1];
+}
+
+// Sorts the sources, and turns every run of them with the same material and cell into a batch. Returns the number of
+// batches built.
+static size_t sBuildBatches (StaticBatchSet* sb, Scene* scene, BatchSource* sources) {
+    size_t sourceCount = stbds_arrlenu(sources);
+    qsort(sources, sourceCount, sizeof(BatchSource), sCompareSources);
+    size_t built = 0;
+    size_t runStart = 0;
+    for (size_t i = 1; i <= sourceCount; i++) {
+        if (i < sourceCount && sCompareBatchKeys(&sources[i], &sources[runStart]) == 0) {
+            continue;
+        }
+        sBuildBatch(sAddBatch(sb), scene, &sources[runStart], i - runStart);
+        built++;
+        runStart = i;
+    }
+    return built;
+}
+
+void BuildStaticBatches (StaticBatchSet* sb, Scene* scene, float cellSize, uint64_t frame) {
+    double tStart = glfwGetTime();
+    DeleteStaticBatches(sb);
+    sb->scene = scene;
+    sb->sceneVersion = scene->structureVersion;
+    sb->modelVersion = ModelResidencyVersion;
+    sb->cellSize = cellSize;
+
+    // Gather the meshes of all model objects that aren't moving, along with the cell they belong to:
+    BatchSource* sources = NULL;
+    for (size_t i = 0; i < scene->size; i++) {
+        GameObject* obj = &scene->objects[i];
+        if (obj->type != GAMEOBJECT_MODEL || obj->model.model == NULL || !sSettled(obj, frame)) { continue; }
+        sAddObjectSources(&sources, scene, (int32_t) i, cellSize);
+        obj->staticBatched = true;
+    }
+    size_t sourceCount = stbds_arrlenu(sources);
+    sBuildBatches(sb, scene, sources);
+    stbds_arrfree(sources);
+
+    vxLog("Built %ju static batches from %ju meshes (%.02lf ms)", sb->batchCount, sourceCount,
+        (glfwGetTime() - tStart) * 1000.0);
+}
+
+bool StaticBatchesNeedUpdate (StaticBatchSet* sb, Scene* scene, vxConfig* conf, uint64_t frame) {
+    if (!conf->enableStaticBatching) {
+        return sb->scene != NULL;
+    }
+    bool update = !StaticBatchesUsable(sb, scene) || sb->cellSize != conf->staticBatchCellSize;
+    for (size_t i = 0; i < scene->size; i++) {
+        GameObject* obj = &scene->objects[i];
+        // Objects that keep moving keep pushing their settle frame back:
+        if (obj->worldMatrixChanged && (obj->staticBatched || obj->batchSettleFrame != 0)) {
+            obj->batchSettleFrame = frame + StaticBatch_SettleFrames;
+            update |= obj->staticBatched;
+        } else if (obj->batchSettleFrame != 0 && obj->batchSettleFrame <= frame) {
+            update = true;
+        }
+    }
+    return update;
+}
+
+void UpdateStaticBatches (StaticBatchSet* sb, Scene* scene, vxConfig* conf, uint64_t frame) {
+    if (!conf->enableStaticBatching) {
+        if (sb->scene != NULL) {
+            DeleteStaticBatches(sb);
+        }
+        return;
+    }
+    if (!StaticBatchesUsable(sb, scene) || sb->cellSize != conf->staticBatchCellSize) {
+        BuildStaticBatches(sb, scene, conf->staticBatchCellSize, frame);
+        return;
+    }
+    double tStart = glfwGetTime();
+
+    // Objects that started moving leave their batches, objects that settled join them:
+    size_t left = 0;
+    size_t joined = 0;
+    BatchSource* joining = NULL;
+    for (size_t i = 0; i < scene->size; i++) {
+        GameObject* obj = &scene->objects[i];
+        if (obj->staticBatched && obj->batchSettleFrame > frame) {
+            obj->staticBatched = false;
+            left++;
+        } else if (!obj->staticBatched && obj->batchSettleFrame != 0 && sSettled(obj, frame) &&
+            obj->type == GAMEOBJECT_MODEL && obj->model.model != NULL) {
+            sAddObjectSources(&joining, scene, (int32_t) i, sb->cellSize);
+            obj->staticBatched = true;
+            joined++;
+        }
+    }
+    size_t joiningCount = stbds_arrlenu(joining);
+    qsort(joining, joiningCount, sizeof(BatchSource), sCompareBatchKeys);
+
+    // Rebuild the batches that lost an object or gain one, from the objects that stay in them. Every material and
+    // cell has a single batch, so each source of an object is only gathered from one of them.
+    BatchSource* sources = NULL;
+    BatchSource* other = NULL;
+    size_t dropped = 0;
+    for (size_t i = 0; i < sb->batchCount; i++) {
+        StaticBatch* batch = &sb->batches[i];
+        if (!batch->valid) { continue; }
+        BatchSource key = {batch->rmesh.material, {batch->cell[0], batch->cell[1], batch->cell[2]}, 0, 0};
+        bool rebuild = bsearch(&key, joining, joiningCount, sizeof(BatchSource), sCompareBatchKeys) != NULL;
+        for (size_t j = 0; j < batch->objectCount && !rebuild; j++) {
+            rebuild = !scene->objects[batch->objects[j]].staticBatched;
+        }
+        if (!rebuild) { continue; }
+        for (size_t j = 0; j < batch->objectCount; j++) {
+            if (!scene->objects[batch->objects[j]].staticBatched) { continue; }
+            stbds_arrsetlen(other, 0);
+            sAddObjectSources(&other, scene, batch->objects[j], sb->cellSize);
+            for (size_t k = 0; k < stbds_arrlenu(other); k++) {
+                if (sCompareBatchKeys(&other[k], &key) == 0) {
+                    stbds_arrput(sources, other[k]);
+                }
+            }
+        }
+        sReleaseBatch(batch);
+        dropped++;
+    }
+    for (size_t i = 0; i < joiningCount; i++) {
+        stbds_arrput(sources, joining[i]);
+    }
+    size_t built = sBuildBatches(sb, scene, sources);
+    stbds_arrfree(other);
+    stbds_arrfree(sources);
+    stbds_arrfree(joining);
+
+    vxLog("Rebuilt static batches: %ju objects moved out, %ju settled in, %ju batches replaced by %ju (%.02lf ms)",
+        left, joined, dropped, built, (glfwGetTime() - tStart) * 1000.0);
+}
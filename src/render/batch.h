@@ -0,0 +1,57 @@
+#pragma once
+#include "common.h"
+#include "main.h"
+#include "data/model.h"
+#include "scene/core.h"
+
+// Static batches merge the meshes of objects that never move into world space vertex and index buffers, so that all
+// of them can be drawn with a single call. Meshes are grouped by material and by the grid cell their bounds are
+// centered in, which keeps each batch small enough to be frustum culled.
+// Blended meshes aren't batched, since they have to be sorted back-to-front individually.
+//
+// Batches are rebuilt whenever objects are added to or deleted from the scene, or models are streamed in or out. When a
+// batched object moves, only the batches containing it are rebuilt, without it, and it goes back to being drawn through
+// the render list. Once it has stayed put for StaticBatch_SettleFrames, the batches of its material and cell are
+// rebuilt with it again, so animated objects stay out of the batches without taking their neighbours with them.
+
+// Frames a batched object has to stay put after moving before it's batched again.
+static const uint64_t StaticBatch_SettleFrames = 60;
+
+typedef struct StaticBatch {
+    RenderableMesh rmesh; // merged geometry, with identity matrices and world space bounds
+    int32_t cell [3];     // grid cell of the batch, rmesh.material is its material
+    GLuint vbos [MESH_ATTRIBUTE_SLOTS];
+    size_t objectCount;
+    int32_t* objects;     // scene objects with meshes in this batch, sorted
+    size_t sourceMeshCount;
+    bool valid;
+} StaticBatch;
+
+typedef struct StaticBatchSet {
+    size_t batchSlots;
+    size_t batchCount;
+    StaticBatch* batches;
+    Scene* scene;              // scene the batches were built from
+    uint32_t sceneVersion;     // scene->structureVersion at build time
+    uint32_t modelVersion;     // ModelResidencyVersion at build time
+    float cellSize;
+} StaticBatchSet;
+
+// Returns true for meshes that get merged into a batch when their object is batched. Draw lists skip these meshes in
+// the render list entries of batched objects.
+bool IsStaticBatchable (Mesh* mesh, Material* material);
+
+// Returns false if the scene changed since the batches were built, in which case neither the batches nor the
+// staticBatched flags of the objects can be trusted until the next UpdateStaticBatches.
+bool StaticBatchesUsable (StaticBatchSet* sb, Scene* scene);
+
+void DeleteStaticBatches (StaticBatchSet* sb);
+// Batches every model object, except for those that are still settling after a move.
+void BuildStaticBatches (StaticBatchSet* sb, Scene* scene, float cellSize, uint64_t frame);
+// Returns true if UpdateStaticBatches would change anything, without touching GL. Lets the game thread skip the trip
+// to the render thread on the frames where nothing changes. Also notes which objects are moving (see
+// GameObject.batchSettleFrame), so it has to be called once per frame, after UpdateScene.
+bool StaticBatchesNeedUpdate (StaticBatchSet* sb, Scene* scene, vxConfig* conf, uint64_t frame);
+// Builds, rebuilds or deletes the batches as needed for the current configuration and scene state. Rebuilds the
+// batches of objects that started moving without them, and those of objects that settled with them.
+void UpdateStaticBatches (StaticBatchSet* sb, Scene* scene, vxConfig* conf, uint64_t frame);
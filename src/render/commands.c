@@ -0,0 +1,257 @@
+#include "commands.h"
+
+typedef struct CommandRecorder {
+    CommandBuffer* cb;
+    DrawList* dl;
+} CommandRecorder;
+
+static RenderCommand* sPushCommand (CommandRange* range, RenderCommandType type) {
+    range->count++;
+    if (range->count > range->slots) {
+        range->slots = vxMax(range->count * 2, 64);
+        range->commands = (RenderCommand*) vxAlignedRealloc(range->commands, range->slots, sizeof(RenderCommand),
+            vxAlignOf(RenderCommand));
+    }
+    RenderCommand* cmd = &range->commands[range->count - 1];
+    memset(cmd, 0, sizeof(RenderCommand));
+    cmd->type = type;
+    return cmd;
+}
+
+// Moves a range boundary forward until it no longer splits a run of the same draw (see IsSameDraw).
+static size_t sRangeStart (DrawList* dl, size_t range, size_t rangeCount) {
+    size_t i = dl->count * range / rangeCount;
+    while (i > 0 && i < dl->count &&
+        IsSameDraw(GetDrawItemMesh(dl, &dl->items[i - 1]), GetDrawItemMesh(dl, &dl->items[i]))) {
+        i++;
+    }
+    return i;
+}
+
+// Whether a draw can join the multi-draw started by [first]. Without indirect multi-draws, every draw reads the
+// instance of the first one, so only single instances with the same data qualify.
+static bool sCanMerge (CommandBuffer* cb, IndexedDraw* first, IndexedDraw* draw) {
+    if (!CanMultiDraw(first, draw)) { return false; }
+    if (vxglSupportsMultiDrawIndirect) { return true; }
+    return first->instanceCount == 1 && draw->instanceCount == 1 &&
+           memcmp(&cb->instances[first->firstInstance], &cb->instances[draw->firstInstance], sizeof(InstanceData)) == 0;
+}
+
+static void sRecordRange (CommandRecorder* rec, size_t r) {
+    CommandBuffer* cb = rec->cb;
+    DrawList* dl = rec->dl;
+    CommandRange* range = &cb->ranges[r];
+    range->count = 0;
+    size_t begin = sRangeStart(dl, r, cb->rangeCount);
+    size_t end = sRangeStart(dl, r + 1, cb->rangeCount);
+
+    for (size_t i = begin; i < end; i++) {
+        RenderableMesh* rmesh = GetDrawItemMesh(dl, &dl->items[i]);
+        glm_mat4_copy(rmesh->worldMatrix,     cb->instances[i].model);
+        glm_mat4_copy(rmesh->lastWorldMatrix, cb->instances[i].modelLast);
+        SetInstanceMaterial(cb->instances[i].model, rmesh->material);
+    }
+
+    Program* program = NULL;
+    Material* material = NULL;
+    size_t lastDraw = SIZE_MAX;   // RENDERCMD_DRAW the next draw could be merged with
+    size_t multiDraw = SIZE_MAX;  // RENDERCMD_MULTI_DRAW the last draw belongs to
+    size_t runStart = begin;
+    for (size_t i = begin + 1; i <= end && begin < end; i++) {
+        RenderableMesh* first = GetDrawItemMesh(dl, &dl->items[runStart]);
+        if (i < end && IsSameDraw(first, GetDrawItemMesh(dl, &dl->items[i]))) {
+            continue;
+        }
+        IndexedDraw draw;
+        if (ResolveIndexedDraw(&first->mesh, &draw)) {
+            DrawState state = GetDrawState(dl->pass, dl->program, first);
+            draw.vao = state.vao;
+            if (state.program != program && state.program != NULL) {
+                sPushCommand(range, RENDERCMD_SET_PROGRAM)->program = state.program;
+                program = state.program;
+                material = NULL; // has to be set again for the new program
+                lastDraw = SIZE_MAX;
+                multiDraw = SIZE_MAX;
+            }
+            if (state.material != material) {
+                // Materials of the same bind set only differ in their table entries, which draws find through their
+                // instance data, so there's nothing to switch:
+                bool sameBindSet = material != NULL && SameMaterialBindSet(material, state.material);
+                material = state.material;
+                if (!sameBindSet) {
+                    sPushCommand(range, RENDERCMD_SET_MATERIAL)->material = material;
+                    lastDraw = SIZE_MAX;
+                    multiDraw = SIZE_MAX;
+                }
+            }
+            draw.firstInstance = (uint32_t) runStart;
+            draw.instanceCount = (uint32_t)(i - runStart);
+
+            // Only a multi-draw that ends with the last draw can be extended, otherwise a new one starts there:
+            if (multiDraw != SIZE_MAX && multiDraw + range->commands[multiDraw].drawCount != lastDraw) {
+                multiDraw = SIZE_MAX;
+            }
+            size_t mergeWith = (multiDraw != SIZE_MAX) ? multiDraw + 1 : lastDraw;
+            if (lastDraw == SIZE_MAX || !sCanMerge(cb, &range->commands[mergeWith].draw, &draw)) {
+                multiDraw = SIZE_MAX;
+            } else {
+                if (multiDraw == SIZE_MAX) {
+                    // Put a header in front of the draw the run is merged with:
+                    sPushCommand(range, RENDERCMD_MULTI_DRAW);
+                    multiDraw = lastDraw;
+                    range->commands[multiDraw + 1] = range->commands[multiDraw];
+                    memset(&range->commands[multiDraw], 0, sizeof(RenderCommand));
+                    range->commands[multiDraw].type = RENDERCMD_MULTI_DRAW;
+                    range->commands[multiDraw].drawCount = 1;
+                }
+                range->commands[multiDraw].drawCount++;
+            }
+            RenderCommand* cmd = sPushCommand(range, RENDERCMD_DRAW);
+            cmd->draw = draw;
+            cmd->occlusionTest = (i - runStart == 1);
+            cmd->queryKey = dl->items[runStart].index;
+            lastDraw = range->count - 1;
+        }
+        runStart = i;
+    }
+}
+
+static void sRecordRanges (void* user, size_t begin, size_t end) {
+    for (size_t r = begin; r < end; r++) {
+        sRecordRange((CommandRecorder*) user, r);
+    }
+}
+
+void RecordDrawList (CommandBuffer* cb, DrawList* dl) {
+    if (dl->count > cb->instanceSlots) {
+        cb->instanceSlots = dl->count * 2;
+        cb->instances = (InstanceData*) vxAlignedRealloc(cb->instances, cb->instanceSlots, sizeof(InstanceData),
+            vxAlignOf(InstanceData));
+    }
+    cb->instanceCount = dl->count;
+
+    // A couple of ranges per thread, so threads that finish early can take over the rest:
+    size_t rangeCount = vxMin((size_t) vxJobThreadCount() * 2, dl->count / CommandBuffer_MinRangeItems);
+    rangeCount = vxMax(rangeCount, 1);
+    if (rangeCount > cb->rangeSlots) {
+        cb->ranges = (CommandRange*) vxAlignedRealloc(cb->ranges, rangeCount, sizeof(CommandRange),
+            vxAlignOf(CommandRange));
+        memset(&cb->ranges[cb->rangeSlots], 0, (rangeCount - cb->rangeSlots) * sizeof(CommandRange));
+        cb->rangeSlots = rangeCount;
+    }
+    cb->rangeCount = rangeCount;
+
+    CommandRecorder rec = {cb, dl};
+    if (rangeCount == 1) {
+        sRecordRange(&rec, 0);
+    } else {
+        vxParallelFor("Record Draws", rangeCount, 1, sRecordRanges, &rec);
+    }
+}
+
+void DeleteCommandBuffer (CommandBuffer* cb) {
+    for (size_t r = 0; r < cb->rangeSlots; r++) {
+        if (cb->ranges[r].commands != NULL) {
+            vxFree(cb->ranges[r].commands);
+        }
+    }
+    if (cb->ranges != NULL) {
+        vxFree(cb->ranges);
+    }
+    if (cb->instances != NULL) {
+        vxFree(cb->instances);
+    }
+    memset(cb, 0, sizeof(CommandBuffer));
+}
+
+// Scratch space for SubmitCommandBuffer (GL thread only):
+static size_t sScratchSlots = 0;
+static GLuint* sConditions = NULL;
+static IndexedDraw** sMultiDraws = NULL;
+
+static GLuint sGetCondition (vxConfig* conf, vxFrame* frame, RenderCommand* cmd, OcclusionQuerySet* queries) {
+    if (queries == NULL || !cmd->occlusionTest) { return 0; }
+    return GetOcclusionQueryCondition(queries, conf, frame, cmd->queryKey);
+}
+
+static void sSubmitDraw (RenderState* rs, vxConfig* conf, vxFrame* frame, RenderCommand* cmd, size_t baseInstance,
+    GLuint condition)
+{
+    if (condition != 0) {
+        glBeginConditionalRender(condition, GL_QUERY_NO_WAIT);
+    }
+    RenderIndexedDraw(rs, frame, &cmd->draw, baseInstance);
+    if (condition != 0) {
+        glEndConditionalRender();
+    }
+}
+
+void SubmitCommandBuffer (RenderState* rs, vxConfig* conf, vxFrame* frame, CommandBuffer* cb,
+    OcclusionQuerySet* queries)
+{
+    if (cb->instanceCount == 0) { return; }
+    size_t baseInstance = UploadInstances(cb->instances, cb->instanceCount);
+
+    // Scratch space for the largest multi-draw:
+    size_t maxDrawCount = 0;
+    for (size_t r = 0; r < cb->rangeCount; r++) {
+        for (size_t i = 0; i < cb->ranges[r].count; i++) {
+            if (cb->ranges[r].commands[i].type == RENDERCMD_MULTI_DRAW) {
+                maxDrawCount = vxMax(maxDrawCount, cb->ranges[r].commands[i].drawCount);
+            }
+        }
+    }
+    if (maxDrawCount > sScratchSlots) {
+        sScratchSlots = maxDrawCount * 2;
+        sConditions = (GLuint*) vxAlignedRealloc(sConditions, sScratchSlots, sizeof(GLuint), vxAlignOf(GLuint));
+        sMultiDraws = (IndexedDraw**) vxAlignedRealloc(sMultiDraws, sScratchSlots, sizeof(IndexedDraw*),
+            vxAlignOf(IndexedDraw*));
+    }
+    GLuint* conditions = sConditions;
+    IndexedDraw** multiDraws = sMultiDraws;
+
+    // Material textures go to the same units for every material, like in RenderMeshInstanced:
+    int firstMaterialUnit = rs->nextFreeTextureUnit;
+    for (size_t r = 0; r < cb->rangeCount; r++) {
+        CommandRange* range = &cb->ranges[r];
+        for (size_t i = 0; i < range->count; i++) {
+            RenderCommand* cmd = &range->commands[i];
+            switch (cmd->type) {
+                case RENDERCMD_SET_PROGRAM: {
+                    SetRenderProgram(rs, cmd->program);
+                    firstMaterialUnit = rs->nextFreeTextureUnit;
+                    break;
+                }
+                case RENDERCMD_SET_MATERIAL: {
+                    SetRenderMaterial(rs, cmd->material);
+                    rs->nextFreeTextureUnit = firstMaterialUnit;
+                    break;
+                }
+                case RENDERCMD_DRAW: {
+                    sSubmitDraw(rs, conf, frame, cmd, baseInstance, sGetCondition(conf, frame, cmd, queries));
+                    break;
+                }
+                case RENDERCMD_MULTI_DRAW: {
+                    RenderCommand* draws = &range->commands[i + 1];
+                    bool conditional = false;
+                    for (size_t d = 0; d < cmd->drawCount; d++) {
+                        conditions[d] = sGetCondition(conf, frame, &draws[d], queries);
+                        conditional |= (conditions[d] != 0);
+                    }
+                    if (conditional) {
+                        for (size_t d = 0; d < cmd->drawCount; d++) {
+                            sSubmitDraw(rs, conf, frame, &draws[d], baseInstance, conditions[d]);
+                        }
+                    } else {
+                        for (size_t d = 0; d < cmd->drawCount; d++) {
+                            multiDraws[d] = &draws[d].draw;
+                        }
+                        RenderIndexedDraws(rs, frame, multiDraws, cmd->drawCount, baseInstance);
+                    }
+                    i += cmd->drawCount;
+                    break;
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include "common.h"
+#include "main.h"
+#include "render/render.h"
+#include "render/drawlist.h"
+#include "render/occlusionquery.h"
+
+// Recorded draw submission. A sorted draw list is turned into a compact stream of commands (set program, set material,
+// draw) plus the instance data its draws read. Recording doesn't touch GL, so it runs on the job system's workers: the
+// list is split into ranges that are recorded in parallel, each into its own command array. Ranges never split a run
+// of entries that make up one instanced draw, but multi-draws (see below) don't reach across range boundaries, so a
+// list recorded in pieces can take a few more draw calls than the same list recorded in one go.
+//
+// Replaying the ranges in order on the GL thread is a tight loop over the commands, with the instance data of the whole
+// buffer uploaded at once. Runs of draw list entries with the same mesh and material become a single instanced draw,
+// issued with the program, material and VAO of its DrawState. Materials of the same bind set need no
+// RENDERCMD_SET_MATERIAL between them (see SameMaterialBindSet), and consecutive draws of different meshes that share a
+// bind set and vertex buffers (meshes of the same model, see ModelGeometry) are merged further into one multi-draw: a
+// RENDERCMD_MULTI_DRAW followed by its draws. With indirect multi-draws every draw keeps its own instances. Without
+// them, GL 3.3 has no way to tell the draws of a multi-draw apart in the shader, so only draws of single instances with
+// identical instance data (meshes of the same object with the same transform) are merged. Command buffers refer to
+// programs and materials by pointer, so they're only valid as long as the draw list's render list and batches are.
+
+typedef enum RenderCommandType {
+    RENDERCMD_SET_PROGRAM,
+    RENDERCMD_SET_MATERIAL,
+    RENDERCMD_DRAW,
+    RENDERCMD_MULTI_DRAW,
+} RenderCommandType;
+
+typedef struct RenderCommand {
+    RenderCommandType type;
+    bool occlusionTest; // RENDERCMD_DRAW: single draw that is rendered conditionally if its mesh was hidden
+    uint32_t queryKey;  // RENDERCMD_DRAW: DrawItem.index of the draw, for GetOcclusionQueryCondition
+    union {
+        Program* program;   // RENDERCMD_SET_PROGRAM
+        Material* material; // RENDERCMD_SET_MATERIAL
+        IndexedDraw draw;   // RENDERCMD_DRAW, firstInstance is relative to the buffer's instance data
+        size_t drawCount;   // RENDERCMD_MULTI_DRAW: number of RENDERCMD_DRAW commands that follow and belong to it
+    };
+} RenderCommand;
+
+typedef struct CommandRange {
+    size_t count;
+    size_t slots;
+    RenderCommand* commands;
+} CommandRange;
+
+typedef struct CommandBuffer {
+    size_t rangeCount;       // ranges filled by the last recording
+    size_t rangeSlots;
+    CommandRange* ranges;
+    size_t instanceCount;    // one per draw list entry
+    size_t instanceSlots;
+    InstanceData* instances;
+} CommandBuffer; // zero-initialize
+
+// Draw list entries per range, at least. Smaller lists aren't worth splitting.
+static const size_t CommandBuffer_MinRangeItems = 256;
+
+// Replaces the buffer's contents with the draws of a sorted draw list. Can be called from any thread, waits for the
+// ranges it hands out to the job system.
+void RecordDrawList (CommandBuffer* cb, DrawList* dl);
+void DeleteCommandBuffer (CommandBuffer* cb);
+// Uploads the instance data and issues the recorded commands. GL thread only.
+// If [queries] isn't NULL, single draws of meshes that were hidden on previous frames are rendered conditionally, which
+// splits the multi-draws they are part of back into separate draws.
+void SubmitCommandBuffer (RenderState* rs, vxConfig* conf, vxFrame* frame, CommandBuffer* cb,
+    OcclusionQuerySet* queries);
@@ -0,0 +1,302 @@
+#include "drawlist.h"
+
+void ClearDrawList (DrawList* dl) {
+    if (dl->slots < DrawList_DefaultSlots) {
+        dl->slots = DrawList_DefaultSlots;
+        dl->items   = (DrawItem*) vxAlignedRealloc(dl->items,   dl->slots, sizeof(DrawItem), vxAlignOf(DrawItem));
+        dl->scratch = (DrawItem*) vxAlignedRealloc(dl->scratch, dl->slots, sizeof(DrawItem), vxAlignOf(DrawItem));
+    }
+    dl->count = 0;
+}
+
+void DeleteDrawList (DrawList* dl) {
+    if (dl->items != NULL) {
+        vxFree(dl->items);
+    }
+    if (dl->scratch != NULL) {
+        vxFree(dl->scratch);
+    }
+    memset(dl, 0, sizeof(DrawList));
+}
+
+void AddDrawItem (DrawList* dl, uint64_t key, uint32_t index) {
+    dl->count++;
+    if (dl->count > dl->slots) {
+        dl->slots = dl->count * 2;
+        dl->items   = (DrawItem*) vxAlignedRealloc(dl->items,   dl->slots, sizeof(DrawItem), vxAlignOf(DrawItem));
+        dl->scratch = (DrawItem*) vxAlignedRealloc(dl->scratch, dl->slots, sizeof(DrawItem), vxAlignOf(DrawItem));
+    }
+    DrawItem* item = &dl->items[dl->count - 1];
+    item->key = key;
+    item->index = index;
+}
+
+// LSD radix sort on 8-bit digits. The histograms for all digits are built in a single pass over the keys, and digits
+// that are the same for every key (e.g. the pass bits) are skipped entirely. The sort is stable, so draws with equal
+// keys stay in render list order.
+void SortDrawList (DrawList* dl) {
+    size_t n = dl->count;
+    if (n < 2) { return; }
+
+    uint32_t hist [8][256];
+    memset(hist, 0, sizeof(hist));
+    for (size_t i = 0; i < n; i++) {
+        uint64_t key = dl->items[i].key;
+        for (int d = 0; d < 8; d++) {
+            hist[d][(key >> (d * 8)) & 0xFF]++;
+        }
+    }
+
+    DrawItem* src = dl->items;
+    DrawItem* dst = dl->scratch;
+    for (int d = 0; d < 8; d++) {
+        int shift = d * 8;
+        if (hist[d][(src[0].key >> shift) & 0xFF] == n) {
+            continue;
+        }
+        uint32_t offset = 0;
+        for (int b = 0; b < 256; b++) {
+            uint32_t count = hist[d][b];
+            hist[d][b] = offset;
+            offset += count;
+        }
+        for (size_t i = 0; i < n; i++) {
+            dst[hist[d][(src[i].key >> shift) & 0xFF]++] = src[i];
+        }
+        DrawItem* tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+    dl->items = src;
+    dl->scratch = dst;
+}
+
+DrawState GetDrawState (DrawPass pass, Program* program, RenderableMesh* rmesh) {
+    Mesh* mesh = &rmesh->mesh;
+    DrawState state = {program, rmesh->material, mesh->gl_vertex_array};
+    if (program != NULL) {
+        state.program = GetProgramVariant(program, rmesh->material->features);
+    }
+    if (IsDepthOnlyPass(pass)) {
+        Material* depthMaterial = GetDepthOnlyMaterial(rmesh->material);
+        if (depthMaterial != NULL && mesh->gl_depth_vertex_array != 0) {
+            state.program = &PROG_DEPTH;
+            state.material = depthMaterial;
+            state.vao = mesh->gl_depth_vertex_array;
+        } else if (mesh->gl_masked_vertex_array != 0) {
+            state.vao = mesh->gl_masked_vertex_array;
+        }
+    }
+    return state;
+}
+
+uint64_t MakeDrawKey (DrawPass pass, DrawState* state, Material* material, float depth) {
+    DrawClass cls = DRAWCLASS_OPAQUE;
+    if (material->blend) {
+        cls = DRAWCLASS_BLEND;
+    } else if (material->stipple) {
+        cls = DRAWCLASS_MASKED;
+    }
+
+    // The bits of a non-negative float sort the same way as its value, so the top 20 bits (minus the sign) make a
+    // depth key with roughly logarithmic precision and no need for a maximum distance.
+    depth = vxMax(depth, 0.0f);
+    uint32_t depthBits;
+    memcpy(&depthBits, &depth, sizeof(uint32_t));
+    uint64_t d   = (depthBits >> 11) & 0xFFFFF;
+    uint64_t mat = material->id & 0xFFFF;
+    uint64_t vao = state->vao & 0xFFFF;
+    uint64_t set = state->material->bindSet & 0xFFF;
+    uint64_t prg = (state->program != NULL) ? state->program->object & 0x3F : 0;
+
+    uint64_t key = ((uint64_t)(pass & 0xF) << 60) | ((uint64_t) cls << 58) | (prg << 52);
+    if (cls == DRAWCLASS_BLEND) {
+        key |= ((~d & 0xFFFFF) << 32) | (mat << 16) | vao;
+    } else {
+        key |= (set << 40) | (vao << 24) | ((mat & 0xFFF) << 12) | (d >> 8);
+    }
+    return key;
+}
+
+typedef struct DrawListBuilder {
+    DrawList* dl;
+    RenderList* rl;
+    Scene* scene;
+    Camera* cam;
+    DrawPass pass;
+    Program* program;
+    vec4* planes;    // NULL if not culling
+    bool useBatches; // skip batchable meshes of batched objects
+} DrawListBuilder;
+
+// Distance from the camera to the center of a mesh's bounding box, along the view direction.
+static float sViewDepth (Camera* cam, RenderableMesh* rmesh) {
+    vec3 center, viewPos;
+    glm_vec3_center(rmesh->aabbMin, rmesh->aabbMax, center);
+    glm_mat4_mulv3(cam->view_matrix, center, 1.0f, viewPos);
+    return -viewPos[2];
+}
+
+static void sAddRenderable (DrawListBuilder* b, RenderableMesh* rmesh, uint32_t index) {
+    if (b->planes != NULL && !AABBInFrustum(b->planes, rmesh->aabbMin, rmesh->aabbMax)) {
+        return;
+    }
+    DrawState state = GetDrawState(b->pass, b->program, rmesh);
+    uint64_t key = MakeDrawKey(b->pass, &state, rmesh->material, sViewDepth(b->cam, rmesh));
+    AddDrawItem(b->dl, key, index);
+}
+
+static void sAddMesh (DrawListBuilder* b, size_t imesh) {
+    RenderableMesh* rmesh = &b->rl->meshes[imesh];
+    if (b->useBatches && b->scene->objects[rmesh->object].staticBatched &&
+        IsStaticBatchable(&rmesh->mesh, rmesh->material)) {
+        return;
+    }
+    sAddRenderable(b, rmesh, (uint32_t) imesh);
+}
+
+static bool sAddVisibleObject (void* user, int32_t proxy, int32_t data) {
+    DrawListBuilder* b = (DrawListBuilder*) user;
+    GameObject* obj = &b->scene->objects[data];
+    if (obj->type == GAMEOBJECT_MODEL) {
+        for (size_t i = 0; i < obj->renderCount; i++) {
+            sAddMesh(b, obj->renderFirst + i);
+        }
+    }
+    return true;
+}
+
+void BuildDrawList (DrawList* dl, RenderList* rl, StaticBatchSet* batches, Camera* cam, DrawPass pass,
+    Program* program, bool cull)
+{
+    ClearDrawList(dl);
+    dl->rl = rl;
+    dl->batches = batches;
+    dl->pass = pass;
+    dl->program = program;
+    vec4 planes [6];
+    DrawListBuilder b = {dl, rl, rl->scene, cam, pass, program, NULL, StaticBatchesUsable(batches, rl->scene)};
+    if (cull) {
+        // Whole objects are culled with the scene BVH, then each of their meshes is tested individually.
+        Camera_GetFrustumPlanes(cam, planes);
+        b.planes = planes;
+        BVHQueryFrustum(&rl->scene->bvh, planes, sAddVisibleObject, &b);
+    } else {
+        for (size_t i = 0; i < rl->meshCount; i++) {
+            sAddMesh(&b, i);
+        }
+    }
+    if (b.useBatches) {
+        for (size_t i = 0; i < batches->batchCount; i++) {
+            if (batches->batches[i].valid) {
+                sAddRenderable(&b, &batches->batches[i].rmesh, (uint32_t) i | DRAWITEM_STATIC_BATCH);
+            }
+        }
+    }
+    SortDrawList(dl);
+}
+
+void BuildDepthPrepassList (DrawList* dl, DrawList* src, Camera* cam) {
+    ClearDrawList(dl);
+    dl->rl = src->rl;
+    dl->batches = src->batches;
+    dl->pass = DRAWPASS_DEPTH_PREPASS;
+    dl->program = NULL; // only the depth-only path has a program
+    for (size_t i = 0; i < src->count; i++) {
+        RenderableMesh* rmesh = GetDrawItemMesh(src, &src->items[i]);
+        DrawState state = GetDrawState(dl->pass, dl->program, rmesh);
+        if (state.program == NULL) { continue; }
+        uint64_t key = MakeDrawKey(dl->pass, &state, rmesh->material, sViewDepth(cam, rmesh));
+        AddDrawItem(dl, key, src->items[i].index);
+    }
+    SortDrawList(dl);
+}
+
+static void sExtendScreenRect (float rect [4], vec4 clip) {
+    rect[0] = vxMin(rect[0], clip[0] / clip[3]);
+    rect[1] = vxMin(rect[1], clip[1] / clip[3]);
+    rect[2] = vxMax(rect[2], clip[0] / clip[3]);
+    rect[3] = vxMax(rect[3], clip[1] / clip[3]);
+}
+
+// Fraction of the screen covered by the screen rectangle of a box. The box is clipped to clip space w >= [nearW] (the
+// near plane, for perspective projections) first, so only the part in front of the camera counts.
+static float sScreenArea (mat4 viewProj, float nearW, vec3 min, vec3 max) {
+    vec4 clip [8];
+    for (int i = 0; i < 8; i++) {
+        vec4 corner = {(i & 1) ? max[0] : min[0], (i & 2) ? max[1] : min[1], (i & 4) ? max[2] : min[2], 1.0f};
+        glm_mat4_mulv(viewProj, corner, clip[i]);
+    }
+    // The rectangle around the corners in front of the plane, and the points where edges of the box cross it:
+    float rect [4] = {1.0f, 1.0f, -1.0f, -1.0f}; // {minX, minY, maxX, maxY} in normalized device coordinates
+    for (int i = 0; i < 8; i++) {
+        if (clip[i][3] >= nearW) {
+            sExtendScreenRect(rect, clip[i]);
+        }
+        for (int axis = 1; axis < 8; axis <<= 1) {
+            if (i & axis) { continue; }
+            float* a = clip[i];
+            float* b = clip[i | axis];
+            if ((a[3] >= nearW) == (b[3] >= nearW)) { continue; }
+            float t = (nearW - a[3]) / (b[3] - a[3]);
+            vec4 crossing;
+            glm_vec4_lerp(a, b, t, crossing);
+            crossing[3] = nearW;
+            sExtendScreenRect(rect, crossing);
+        }
+    }
+    float w = vxClamp(rect[2], -1.0f, 1.0f) - vxClamp(rect[0], -1.0f, 1.0f);
+    float h = vxClamp(rect[3], -1.0f, 1.0f) - vxClamp(rect[1], -1.0f, 1.0f);
+    return vxMax(w, 0.0f) * vxMax(h, 0.0f) * 0.25f;
+}
+
+float EstimateOverdraw (DrawList* dl, Camera* cam) {
+    mat4 viewProj;
+    glm_mat4_mul(cam->proj_matrix, cam->view_matrix, viewProj);
+    // Perspective projections put the view space distance in front of the camera into w, orthographic ones 1:
+    float nearW = (cam->projection == CAMERA_PERSPECTIVE) ? vxMax(cam->zn, 1e-4f) : 1e-4f;
+    float area = 0.0f;
+    for (size_t i = 0; i < dl->count; i++) {
+        RenderableMesh* rmesh = GetDrawItemMesh(dl, &dl->items[i]);
+        if (GetDepthOnlyMaterial(rmesh->material) != NULL) {
+            area += sScreenArea(viewProj, nearW, rmesh->aabbMin, rmesh->aabbMax);
+        }
+    }
+    return area;
+}
+
+size_t CullDrawsOutsideCells (DrawList* dl, CellGraph* g, uint64_t visible) {
+    if (visible == CELLS_ALL) { return 0; }
+    size_t kept = 0;
+    for (size_t i = 0; i < dl->count; i++) {
+        RenderableMesh* rmesh = GetDrawItemMesh(dl, &dl->items[i]);
+        if (AABBInCells(g, visible, rmesh->aabbMin, rmesh->aabbMax)) {
+            dl->items[kept++] = dl->items[i];
+        }
+    }
+    size_t culled = dl->count - kept;
+    dl->count = kept;
+    return culled;
+}
+
+size_t CullDrawsWithPVS (DrawList* dl, PVS* pvs, const uint64_t* visible) {
+    size_t kept = 0;
+    for (size_t i = 0; i < dl->count; i++) {
+        DrawItem* item = &dl->items[i];
+        bool keep = false;
+        if (item->index & DRAWITEM_STATIC_BATCH) {
+            StaticBatch* batch = &dl->batches->batches[item->index & ~DRAWITEM_STATIC_BATCH];
+            for (size_t k = 0; k < batch->objectCount && !keep; k++) {
+                keep = PVSObjectVisible(pvs, visible, batch->objects[k]);
+            }
+        } else {
+            keep = PVSObjectVisible(pvs, visible, dl->rl->meshes[item->index].object);
+        }
+        if (keep) {
+            dl->items[kept++] = *item;
+        }
+    }
+    size_t culled = dl->count - kept;
+    dl->count = kept;
+    return culled;
+}
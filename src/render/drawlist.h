@@ -0,0 +1,119 @@
+#pragma once
+#include "common.h"
+#include "data/model.h"
+#include "data/camera.h"
+#include "render/program.h"
+#include "render/render.h"
+#include "scene/core.h"
+#include "render/batch.h"
+
+// Draw lists hold the draws of a single pass as (sort key, render list entry) pairs. Once sorted, submitting them in
+// order groups draws by program variant (see GetProgramVariant), material and VAO, and draws opaque geometry
+// front-to-back.
+//
+// Key layout, from the most significant bit down:
+//   opaque/masked: [pass:4][class:2][program:6][bind set:12][vao:16][material:12][depth:12]
+//   blended:       [pass:4][class:2][program:6][~depth:20][material:16][vao:16]
+// Blended draws have to be drawn back-to-front, so their inverted depth goes before the state bits. Opaque draws are
+// grouped by material bind set before VAO, so draws of different materials that bind the same textures and share
+// vertex buffers end up next to each other and can be merged into multi-draws (see render/commands.h). Program, bind
+// set and VAO are those the draw is issued with (see DrawState), so in depth-only passes, opaque draws are grouped
+// regardless of their own materials.
+
+typedef enum DrawPass {
+    DRAWPASS_SHADOW,
+    DRAWPASS_DEPTH_PREPASS,
+    DRAWPASS_GBUFFER,
+} DrawPass;
+
+// Passes that only write depth, whose opaque draws go through the depth-only path (see GetDepthOnlyMaterial). Their
+// programs must not read any vertex attributes other than positions and texture coordinates.
+static inline bool IsDepthOnlyPass (DrawPass pass) {
+    return pass == DRAWPASS_SHADOW || pass == DRAWPASS_DEPTH_PREPASS;
+}
+
+typedef enum DrawClass {
+    DRAWCLASS_OPAQUE,
+    DRAWCLASS_MASKED,
+    DRAWCLASS_BLEND,
+} DrawClass;
+
+// Set in DrawItem.index for static batches, the remaining bits are an index into StaticBatchSet.batches.
+#define DRAWITEM_STATIC_BATCH 0x80000000u
+
+typedef struct DrawItem {
+    uint64_t key;
+    uint32_t index; // index into RenderList.meshes, or a static batch
+} DrawItem;
+
+typedef struct DrawList {
+    size_t slots;
+    size_t count;
+    DrawItem* items;
+    DrawItem* scratch;       // radix sort ping-pong buffer, same size as items
+    RenderList* rl;          // sources of the items, set by BuildDrawList
+    StaticBatchSet* batches;
+    DrawPass pass;           // set by BuildDrawList
+    Program* program;        // program the draws were keyed for (or its variants), set by BuildDrawList
+} DrawList;
+
+static const size_t DrawList_DefaultSlots = 1024;
+
+void ClearDrawList (DrawList* dl);
+void DeleteDrawList (DrawList* dl);
+void AddDrawItem (DrawList* dl, uint64_t key, uint32_t index);
+void SortDrawList (DrawList* dl);
+
+static inline RenderableMesh* GetDrawItemMesh (DrawList* dl, DrawItem* item) {
+    if (item->index & DRAWITEM_STATIC_BATCH) {
+        return &dl->batches->batches[item->index & ~DRAWITEM_STATIC_BATCH].rmesh;
+    }
+    return &dl->rl->meshes[item->index];
+}
+
+// What a draw list entry is drawn with: the list's program variant for the mesh's material, its material and its VAO,
+// or, for opaque meshes in depth-only passes, PROG_DEPTH, a depth-only material and the mesh's position-only VAO.
+// Other meshes in depth-only passes read only positions and texture coordinates, too.
+typedef struct DrawState {
+    Program* program; // NULL if the list has no program
+    Material* material;
+    GLuint vao;
+} DrawState;
+
+DrawState GetDrawState (DrawPass pass, Program* program, RenderableMesh* rmesh);
+// Keys a draw of [material] (which decides its class and material bits) with the given state.
+uint64_t MakeDrawKey (DrawPass pass, DrawState* state, Material* material, float depth);
+
+// Fills a draw list with the render list's meshes as seen from the given camera, and sorts it. Meshes merged into
+// static batches are replaced by their batches ([batches] can be NULL).
+// If [cull] is set, objects and meshes outside the camera's frustum are skipped.
+void BuildDrawList (DrawList* dl, RenderList* rl, StaticBatchSet* batches, Camera* cam, DrawPass pass,
+    Program* program, bool cull);
+
+// Fills [dl] with the draws of [src] that go through the depth-only path, keyed for the depth prepass and sorted.
+// Culling done on [src] carries over. The G-buffer pass then draws the same meshes with an equal depth test (see
+// RenderState.depthPrepass), while masked and blended draws are only drawn there.
+void BuildDepthPrepassList (DrawList* dl, DrawList* src, Camera* cam);
+// Estimates overdraw as the screen area covered by the bounding boxes of the list's depth-only draws (see
+// GetDepthOnlyMaterial), in screens. Boxes are clipped to the near plane, so those reaching behind the camera only
+// count with the part in front of it.
+float EstimateOverdraw (DrawList* dl, Camera* cam);
+
+// Removes draws of meshes that don't overlap any of the [visible] cells, keeping the order. Returns the number of
+// draws removed.
+size_t CullDrawsOutsideCells (DrawList* dl, CellGraph* g, uint64_t visible);
+// Removes draws of objects that aren't in the [visible] set returned by UpdatePVS, keeping the order. Static batches are
+// kept if any of their objects is visible. Returns the number of draws removed.
+size_t CullDrawsWithPVS (DrawList* dl, PVS* pvs, const uint64_t* visible);
+
+// Whether two meshes can be drawn with one instanced draw. Identical mesh/material pairs end up next to each other in a
+// sorted list (except for blended draws, which are sorted by depth first), so drawing a list only compares neighbours.
+// Draw lists are drawn by recording them into a command buffer, see render/commands.h.
+static inline bool IsSameDraw (RenderableMesh* a, RenderableMesh* b) {
+    return a->material == b->material &&
+           a->mesh.gl_vertex_array  == b->mesh.gl_vertex_array &&
+           a->mesh.gl_element_array == b->mesh.gl_element_array &&
+           a->mesh.gl_element_count == b->mesh.gl_element_count &&
+           a->mesh.gl_first_index   == b->mesh.gl_first_index &&
+           a->mesh.gl_base_vertex   == b->mesh.gl_base_vertex;
+}
@@ -0,0 +1,164 @@
+#include "glstate.h"
+
+typedef enum GLStateCapability {
+    GLSTATE_CAP_BLEND,
+    GLSTATE_CAP_CULL_FACE,
+    GLSTATE_CAP_DEPTH_TEST,
+    GLSTATE_CAP_FRAMEBUFFER_SRGB,
+    GLSTATE_CAP_COUNT,
+} GLStateCapability;
+
+// Texture targets with their own binding on every unit:
+typedef enum GLStateTarget {
+    GLSTATE_TARGET_2D,
+    GLSTATE_TARGET_CUBE_MAP,
+    GLSTATE_TARGET_2D_ARRAY,
+    GLSTATE_TARGET_COUNT,
+} GLStateTarget;
+
+typedef struct GLState {
+    uint8_t enabled [GLSTATE_CAP_COUNT]; // 0, 1 or 0xFF for unknown
+    GLenum blendSrc;
+    GLenum blendDst;
+    GLenum blendEquation;
+    GLenum depthFunc;
+    GLenum cullFace;
+    uint8_t depthMask;
+    uint8_t colorMask;
+    GLuint program;
+    GLuint vao;
+    GLenum activeTexture;
+    GLuint textures [GLSTATE_TEXTURE_UNITS][GLSTATE_TARGET_COUNT];
+    GLuint samplers [GLSTATE_TEXTURE_UNITS];
+} GLState;
+
+static GLState sState;
+static bool sStateValid = false;
+
+void InvalidateGLState () {
+    // All bits set is no valid enum, object name or flag, so the next call to each setter never matches:
+    memset(&sState, 0xFF, sizeof(GLState));
+    sStateValid = true;
+}
+
+static inline GLState* sGetState () {
+    if (!sStateValid) {
+        InvalidateGLState();
+    }
+    return &sState;
+}
+
+void SetGLEnabled (GLenum capability, bool enabled) {
+    int cap = -1;
+    switch (capability) {
+        case GL_BLEND:            { cap = GLSTATE_CAP_BLEND;            break; }
+        case GL_CULL_FACE:        { cap = GLSTATE_CAP_CULL_FACE;        break; }
+        case GL_DEPTH_TEST:       { cap = GLSTATE_CAP_DEPTH_TEST;       break; }
+        case GL_FRAMEBUFFER_SRGB: { cap = GLSTATE_CAP_FRAMEBUFFER_SRGB; break; }
+    }
+    if (cap != -1) {
+        GLState* s = sGetState();
+        if (s->enabled[cap] == (uint8_t) enabled) { return; }
+        s->enabled[cap] = (uint8_t) enabled;
+    }
+    if (enabled) {
+        glEnable(capability);
+    } else {
+        glDisable(capability);
+    }
+}
+
+void SetGLBlendFunc (GLenum srcFactor, GLenum dstFactor, GLenum equation) {
+    GLState* s = sGetState();
+    if (s->blendSrc != srcFactor || s->blendDst != dstFactor) {
+        glBlendFunc(srcFactor, dstFactor);
+        s->blendSrc = srcFactor;
+        s->blendDst = dstFactor;
+    }
+    if (s->blendEquation != equation) {
+        glBlendEquation(equation);
+        s->blendEquation = equation;
+    }
+}
+
+void SetGLDepthFunc (GLenum func) {
+    GLState* s = sGetState();
+    if (s->depthFunc != func) {
+        glDepthFunc(func);
+        s->depthFunc = func;
+    }
+}
+
+void SetGLDepthMask (bool write) {
+    GLState* s = sGetState();
+    if (s->depthMask != (uint8_t) write) {
+        glDepthMask(write ? GL_TRUE : GL_FALSE);
+        s->depthMask = (uint8_t) write;
+    }
+}
+
+void SetGLColorMask (bool write) {
+    GLState* s = sGetState();
+    if (s->colorMask != (uint8_t) write) {
+        GLboolean b = write ? GL_TRUE : GL_FALSE;
+        glColorMask(b, b, b, b);
+        s->colorMask = (uint8_t) write;
+    }
+}
+
+void SetGLCullFace (GLenum face) {
+    GLState* s = sGetState();
+    if (s->cullFace != face) {
+        glCullFace(face);
+        s->cullFace = face;
+    }
+}
+
+void UseGLProgram (GLuint program) {
+    GLState* s = sGetState();
+    if (s->program != program) {
+        glUseProgram(program);
+        s->program = program;
+    }
+}
+
+void BindGLVertexArray (GLuint vao) {
+    GLState* s = sGetState();
+    if (s->vao != vao) {
+        glBindVertexArray(vao);
+        s->vao = vao;
+    }
+}
+
+static void sActiveTexture (GLState* s, int unit) {
+    if (s->activeTexture != GL_TEXTURE0 + unit) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        s->activeTexture = GL_TEXTURE0 + unit;
+    }
+}
+
+void BindGLTexture (int unit, GLenum target, GLuint texture, GLuint sampler) {
+    GLState* s = sGetState();
+    int t = -1;
+    switch (target) {
+        case GL_TEXTURE_2D:       { t = GLSTATE_TARGET_2D;       break; }
+        case GL_TEXTURE_CUBE_MAP: { t = GLSTATE_TARGET_CUBE_MAP; break; }
+        case GL_TEXTURE_2D_ARRAY: { t = GLSTATE_TARGET_2D_ARRAY; break; }
+    }
+    if (unit < 0 || unit >= GLSTATE_TEXTURE_UNITS || t == -1) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        s->activeTexture = GL_TEXTURE0 + unit;
+        glBindTexture(target, texture);
+        glBindSampler(unit, sampler);
+        return;
+    }
+    sActiveTexture(s, unit);
+    if (s->textures[unit][t] != texture) {
+        glBindTexture(target, texture);
+        s->textures[unit][t] = texture;
+    }
+    if (s->samplers[unit] != sampler) {
+        glBindSampler(unit, sampler);
+        s->samplers[unit] = sampler;
+    }
+}
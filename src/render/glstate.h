@@ -0,0 +1,27 @@
+#pragma once
+#include "common.h"
+
+// Shadow copy of the OpenGL state the renderer changes most often. Each setter remembers what it last set and skips
+// the GL call if nothing would change, so render passes and materials can set their whole state every time without
+// paying for it. Anything that changes this state with direct GL calls (texture and model uploads, ImGui, deleting
+// bound objects) leaves the copy out of date, so InvalidateGLState has to be called afterwards. The renderer does that
+// at the start of every frame and after drawing the user interface.
+//
+// Uniform values are shadowed per program, see the SetUniform* functions in render.h.
+
+#define GLSTATE_TEXTURE_UNITS 32 // units whose bindings are shadowed, binds to higher units are always issued
+
+// Forgets the shadowed state, so the next call to each setter is issued no matter what.
+void InvalidateGLState ();
+
+// Shadowed capabilities are GL_BLEND, GL_CULL_FACE, GL_DEPTH_TEST and GL_FRAMEBUFFER_SRGB; others are passed through.
+void SetGLEnabled (GLenum capability, bool enabled);
+void SetGLBlendFunc (GLenum srcFactor, GLenum dstFactor, GLenum equation);
+void SetGLDepthFunc (GLenum func);
+void SetGLDepthMask (bool write);
+void SetGLColorMask (bool write);
+void SetGLCullFace (GLenum face);
+void UseGLProgram (GLuint program);
+void BindGLVertexArray (GLuint vao);
+// Binds a texture and sampler (either can be 0) to a texture unit. Leaves that unit active.
+void BindGLTexture (int unit, GLenum target, GLuint texture, GLuint sampler);
@@ -0,0 +1,397 @@
+#include "graph.h"
+#include "data/texture.h"
+#include "render/glstate.h"
+
+static bool sIsDepthFormat (GLenum format) {
+    return format == GL_DEPTH_COMPONENT16 || format == GL_DEPTH_COMPONENT24 || format == GL_DEPTH_COMPONENT32F;
+}
+
+// Estimated size of a texel, for the memory stats.
+static size_t sFormatBytes (GLenum format) {
+    switch (format) {
+        case GL_DEPTH_COMPONENT16: { return 2; }
+        case GL_RGB16F:            { return 8; } // drivers pad RGB16F to RGBA16F
+        case GL_RGBA16F:           { return 8; }
+        default:                   { return 4; }
+    }
+}
+
+void BeginRenderGraph (RenderGraph* g, int screenW, int screenH) {
+    g->frame++;
+    g->screenW = screenW;
+    g->screenH = screenH;
+    g->targetCount = 0;
+    g->passCount = 0;
+    g->current = GRAPH_NONE;
+}
+
+GraphTarget AddGraphTarget (RenderGraph* g, const char* name, int slot, GLenum format, int w, int h, bool persistent) {
+    vxCheck(g->targetCount < RENDERGRAPH_MAX_TARGETS);
+    RenderGraphTarget* t = &g->targets[g->targetCount];
+    memset(t, 0, sizeof(RenderGraphTarget));
+    t->name = name;
+    t->slot = slot;
+    t->format = format;
+    t->w = vxMax(w, 1); // no 0x0 textures while the window is minimized
+    t->h = vxMax(h, 1);
+    t->persistent = persistent;
+    t->firstPass = -1;
+    t->lastPass = -1;
+    t->texture = -1;
+    return (GraphTarget) g->targetCount++;
+}
+
+GraphPass AddGraphPass (RenderGraph* g, const char* name, bool sideEffects) {
+    vxCheck(g->passCount < RENDERGRAPH_MAX_PASSES);
+    RenderGraphPass* p = &g->passes[g->passCount];
+    memset(p, 0, sizeof(RenderGraphPass));
+    stbsp_snprintf(p->name, (int) sizeof(p->name), "%s", name);
+    p->sideEffects = sideEffects;
+    p->depth = GRAPH_NONE;
+    return (GraphPass) g->passCount++;
+}
+
+void GraphPassReads (RenderGraph* g, GraphPass pass, GraphTarget target) {
+    RenderGraphPass* p = &g->passes[pass];
+    vxCheck(target >= 0 && target < (GraphTarget) g->targetCount);
+    vxCheck(p->readCount < RENDERGRAPH_MAX_READS);
+    p->reads[p->readCount++] = target;
+}
+
+void GraphPassWrites (RenderGraph* g, GraphPass pass, GraphTarget target) {
+    RenderGraphPass* p = &g->passes[pass];
+    if (target == GRAPH_BACKBUFFER) {
+        vxCheck(p->colorCount == 0 && p->depth == GRAPH_NONE);
+        p->backbuffer = true;
+        p->sideEffects = true;
+        return;
+    }
+    vxCheck(target >= 0 && target < (GraphTarget) g->targetCount && !p->backbuffer);
+    if (sIsDepthFormat(g->targets[target].format)) {
+        vxCheck(p->depth == GRAPH_NONE);
+        p->depth = target;
+    } else {
+        vxCheck(p->colorCount < RENDERGRAPH_MAX_COLORS);
+        p->colors[p->colorCount++] = target;
+    }
+}
+
+void AddGraphCopy (RenderGraph* g, GraphTarget from, GraphTarget to) {
+    RenderGraphTarget* src = &g->targets[from];
+    RenderGraphTarget* dst = &g->targets[to];
+    vxCheck(src->w == dst->w && src->h == dst->h && sIsDepthFormat(src->format) == sIsDepthFormat(dst->format));
+    char name [64];
+    stbsp_snprintf(name, (int) sizeof(name), "Copy %s to %s", src->name, dst->name);
+    GraphPass pass = AddGraphPass(g, name, false);
+    g->passes[pass].copy = true;
+    GraphPassReads(g, pass, from);
+    GraphPassWrites(g, pass, to);
+}
+
+static void sTouchTarget (RenderGraph* g, GraphTarget target, int pass) {
+    if (target < 0) { return; }
+    RenderGraphTarget* t = &g->targets[target];
+    if (t->firstPass == -1) {
+        t->firstPass = pass;
+    }
+    t->lastPass = pass;
+}
+
+static void sDeleteFramebuffer (RenderGraph* g, size_t index) {
+    glDeleteFramebuffers(1, &g->framebuffers[index].fbo);
+    g->framebuffers[index] = g->framebuffers[--g->framebufferCount];
+}
+
+static void sDeleteTexture (RenderGraph* g, GLuint texture) {
+    // Framebuffers that aren't bound keep deleted attachments, and the name could be handed out again:
+    for (size_t i = g->framebufferCount; i-- > 0;) {
+        RenderGraphFramebuffer* fb = &g->framebuffers[i];
+        bool attached = (fb->depth == texture);
+        for (int c = 0; c < RENDERGRAPH_MAX_COLORS; c++) {
+            attached |= (fb->colors[c] == texture);
+        }
+        if (attached) {
+            sDeleteFramebuffer(g, i);
+        }
+    }
+    glDeleteTextures(1, &texture);
+}
+
+static int sAssignTexture (RenderGraph* g, RenderGraphTarget* t) {
+    int found = -1;
+    for (size_t i = 0; i < g->textureCount && found == -1; i++) {
+        RenderGraphTexture* tex = &g->textures[i];
+        if (tex->format != t->format || tex->w != t->w || tex->h != t->h) {
+            continue;
+        }
+        if (t->persistent) {
+            // Persistent targets get back the texture they had last frame, so their contents survive:
+            if (tex->persistentName != NULL && strcmp(tex->persistentName, t->name) == 0) {
+                found = (int) i;
+            }
+        } else if (tex->persistentName == NULL && tex->busyUntil < t->firstPass) {
+            found = (int) i;
+        }
+    }
+    if (found == -1) {
+        vxCheck(g->textureCount < RENDERGRAPH_MAX_TEXTURES);
+        found = (int) g->textureCount++;
+        RenderGraphTexture* tex = &g->textures[found];
+        memset(tex, 0, sizeof(RenderGraphTexture));
+        tex->format = t->format;
+        tex->w = t->w;
+        tex->h = t->h;
+        tex->persistentName = t->persistent ? t->name : NULL;
+        glGenTextures(1, &tex->texture);
+        glBindTexture(GL_TEXTURE_2D, tex->texture);
+        glTexStorage2D(GL_TEXTURE_2D, 1, t->format, t->w, t->h);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        vxLog("Render graph: new texture for %s (%dx%d, 0x%x)", t->name, t->w, t->h, t->format);
+    }
+    g->textures[found].used = true;
+    g->textures[found].busyUntil = t->lastPass;
+    return found;
+}
+
+void CompileRenderGraph (RenderGraph* g) {
+    for (size_t i = 0; i < g->targetCount; i++) {
+        g->targets[i].needed = g->targets[i].persistent; // read again next frame
+    }
+
+    // Cull passes, last to first. A pass is kept if it has side effects or writes a target a later pass reads:
+    for (size_t i = g->passCount; i-- > 0;) {
+        RenderGraphPass* p = &g->passes[i];
+        bool keep = p->sideEffects || (p->depth != GRAPH_NONE && g->targets[p->depth].needed);
+        for (size_t c = 0; c < p->colorCount; c++) {
+            keep |= (p->colors[c] != GRAPH_NONE && g->targets[p->colors[c]].needed);
+        }
+        p->culled = !keep;
+        p->done = false;
+        if (!keep) { continue; }
+
+        for (size_t r = 0; r < p->readCount; r++) {
+            g->targets[p->reads[r]].needed = true;
+        }
+        // Drop outputs nothing reads, including this pass. The ones that stay also need whatever earlier passes wrote
+        // into them.
+        if (p->depth != GRAPH_NONE && !g->targets[p->depth].needed) {
+            p->depth = GRAPH_NONE;
+        }
+        for (size_t c = 0; c < p->colorCount; c++) {
+            if (p->colors[c] != GRAPH_NONE && !g->targets[p->colors[c]].needed) {
+                p->colors[c] = GRAPH_NONE;
+            }
+        }
+    }
+
+    // Lifetimes:
+    for (size_t i = 0; i < g->passCount; i++) {
+        RenderGraphPass* p = &g->passes[i];
+        if (p->culled) { continue; }
+        for (size_t r = 0; r < p->readCount; r++) {
+            sTouchTarget(g, p->reads[r], (int) i);
+        }
+        for (size_t c = 0; c < p->colorCount; c++) {
+            sTouchTarget(g, p->colors[c], (int) i);
+        }
+        sTouchTarget(g, p->depth, (int) i);
+    }
+
+    // Textures, handed out in the order targets come to life so that each one can take over any texture whose target
+    // has died by then:
+    for (size_t i = 0; i < g->textureCount; i++) {
+        g->textures[i].used = false;
+        g->textures[i].busyUntil = -1;
+    }
+    size_t oldTextureCount = g->textureCount;
+    for (size_t pass = 0; pass < g->passCount; pass++) {
+        for (size_t i = 0; i < g->targetCount; i++) {
+            RenderGraphTarget* t = &g->targets[i];
+            if (t->firstPass == (int) pass) {
+                if (t->persistent) {
+                    t->lastPass = (int) g->passCount; // never shared
+                }
+                t->texture = sAssignTexture(g, t);
+            }
+        }
+    }
+
+    // Delete textures no target needed this frame:
+    bool changed = (g->textureCount != oldTextureCount);
+    int remap [RENDERGRAPH_MAX_TEXTURES];
+    size_t kept = 0;
+    for (size_t i = 0; i < g->textureCount; i++) {
+        if (g->textures[i].used) {
+            remap[i] = (int) kept;
+            g->textures[kept++] = g->textures[i];
+        } else {
+            vxLog("Render graph: deleting unused %dx%d texture (0x%x)", g->textures[i].w, g->textures[i].h,
+                g->textures[i].format);
+            sDeleteTexture(g, g->textures[i].texture);
+            remap[i] = -1;
+            changed = true;
+        }
+    }
+    g->textureCount = kept;
+    for (size_t i = 0; i < g->targetCount; i++) {
+        if (g->targets[i].texture != -1) {
+            g->targets[i].texture = remap[g->targets[i].texture];
+        }
+    }
+
+    // Framebuffers for attachment sets that went away:
+    for (size_t i = g->framebufferCount; i-- > 0;) {
+        if (g->framebuffers[i].lastUsedFrame + 1 < g->frame) {
+            sDeleteFramebuffer(g, i);
+        }
+    }
+
+    if (changed) {
+        g->textureBytes = 0;
+        for (size_t i = 0; i < g->textureCount; i++) {
+            RenderGraphTexture* tex = &g->textures[i];
+            g->textureBytes += (size_t) tex->w * (size_t) tex->h * sFormatBytes(tex->format);
+        }
+        vxLog("Render graph: %ju textures, %.1f MiB", g->textureCount, g->textureBytes / (1024.0 * 1024.0));
+        // Creating textures went around the GL state cache:
+        InvalidateGLState();
+    }
+}
+
+static GLuint sGetFramebuffer (RenderGraph* g, GLuint depth, const GLuint* colors, size_t colorCount) {
+    GLuint key [RENDERGRAPH_MAX_COLORS] = {0};
+    if (colorCount > 0) {
+        memcpy(key, colors, colorCount * sizeof(GLuint));
+    }
+    for (size_t i = 0; i < g->framebufferCount; i++) {
+        RenderGraphFramebuffer* fb = &g->framebuffers[i];
+        if (fb->depth == depth && memcmp(fb->colors, key, sizeof(key)) == 0) {
+            fb->lastUsedFrame = g->frame;
+            return fb->fbo;
+        }
+    }
+
+    vxCheck(g->framebufferCount < RENDERGRAPH_MAX_FRAMEBUFFERS);
+    RenderGraphFramebuffer* fb = &g->framebuffers[g->framebufferCount++];
+    fb->depth = depth;
+    memcpy(fb->colors, key, sizeof(key));
+    fb->lastUsedFrame = g->frame;
+    glGenFramebuffers(1, &fb->fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fb->fbo);
+    if (depth != 0) {
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth, 0);
+    }
+    // Draw buffers are framebuffer state, so they're only set here. Dropped outputs keep their location:
+    GLenum buffers [RENDERGRAPH_MAX_COLORS];
+    for (size_t c = 0; c < colorCount; c++) {
+        buffers[c] = GL_NONE;
+        if (key[c] != 0) {
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + c, GL_TEXTURE_2D, key[c], 0);
+            buffers[c] = GL_COLOR_ATTACHMENT0 + c;
+        }
+    }
+    if (colorCount > 0) {
+        glDrawBuffers((GLsizei) colorCount, buffers);
+    } else {
+        glDrawBuffer(GL_NONE);
+    }
+    glReadBuffer(colorCount > 0 ? buffers[0] : GL_NONE);
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        vxPanic("Couldn't create render graph framebuffer: error %d", status);
+    }
+    return fb->fbo;
+}
+
+static GLuint sTargetTexture (RenderGraph* g, GraphTarget target) {
+    if (target == GRAPH_NONE) { return 0; }
+    return g->textures[g->targets[target].texture].texture;
+}
+
+// Binds the framebuffer with a pass's outputs to GL_FRAMEBUFFER. Returns the size of the outputs.
+static void sBindOutputs (RenderGraph* g, RenderGraphPass* p, int* w, int* h) {
+    *w = g->screenW;
+    *h = g->screenH;
+    if (p->backbuffer) {
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glDrawBuffer(GL_BACK);
+        return;
+    }
+    GLuint colors [RENDERGRAPH_MAX_COLORS];
+    for (size_t c = 0; c < p->colorCount; c++) {
+        colors[c] = sTargetTexture(g, p->colors[c]);
+        if (p->colors[c] != GRAPH_NONE) {
+            *w = g->targets[p->colors[c]].w;
+            *h = g->targets[p->colors[c]].h;
+        }
+    }
+    if (p->depth != GRAPH_NONE) {
+        *w = g->targets[p->depth].w;
+        *h = g->targets[p->depth].h;
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, sGetFramebuffer(g, sTargetTexture(g, p->depth), colors, p->colorCount));
+}
+
+// Runs the copies declared before a pass that haven't run yet.
+static void sRunCopies (RenderGraph* g, size_t beforePass) {
+    for (size_t i = 0; i < beforePass; i++) {
+        RenderGraphPass* p = &g->passes[i];
+        if (!p->copy || p->culled || p->done) { continue; }
+        p->done = true;
+        GraphTarget to = (p->depth != GRAPH_NONE) ? p->depth : p->colors[0];
+        if (to == GRAPH_NONE) { continue; }
+        StartGPUBlock(p->name);
+        RenderGraphTarget* src = &g->targets[p->reads[0]];
+        GLuint srcTexture = sTargetTexture(g, p->reads[0]);
+        bool depth = sIsDepthFormat(src->format);
+        GLuint read = depth ? sGetFramebuffer(g, srcTexture, NULL, 0) : sGetFramebuffer(g, 0, &srcTexture, 1);
+        int w, h;
+        sBindOutputs(g, p, &w, &h);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, read);
+        glBlitFramebuffer(0, 0, w, h, 0, 0, w, h, depth ? GL_DEPTH_BUFFER_BIT : GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        EndGPUBlock();
+    }
+}
+
+bool StartGraphPass (RenderGraph* g, RenderState* rs, GraphPass pass) {
+    vxCheck(g->current == GRAPH_NONE && pass >= 0 && pass < (GraphPass) g->passCount);
+    sRunCopies(g, (size_t) pass);
+    RenderGraphPass* p = &g->passes[pass];
+    if (p->culled) { return false; }
+    p->done = true;
+    g->current = pass;
+
+    StartRenderPass(rs, p->name);
+    int w, h;
+    sBindOutputs(g, p, &w, &h);
+    glViewport(0, 0, w, h);
+    for (size_t r = 0; r < p->readCount; r++) {
+        RenderGraphTarget* t = &g->targets[p->reads[r]];
+        if (t->slot >= 0) {
+            BindGLTexture(t->slot, GL_TEXTURE_2D, sTargetTexture(g, p->reads[r]), SMP_LINEAR);
+        }
+    }
+    return true;
+}
+
+void EndGraphPass (RenderGraph* g) {
+    vxCheck(g->current != GRAPH_NONE);
+    EndRenderPass();
+    g->current = GRAPH_NONE;
+}
+
+void EndRenderGraph (RenderGraph* g) {
+    sRunCopies(g, g->passCount);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void DeleteRenderGraph (RenderGraph* g) {
+    for (size_t i = 0; i < g->framebufferCount; i++) {
+        glDeleteFramebuffers(1, &g->framebuffers[i].fbo);
+    }
+    for (size_t i = 0; i < g->textureCount; i++) {
+        glDeleteTextures(1, &g->textures[i].texture);
+    }
+    memset(g, 0, sizeof(RenderGraph));
+}
@@ -0,0 +1,119 @@
+#pragma once
+#include "common.h"
+#include "main.h"
+#include "render/render.h"
+
+// Render graph. Every frame, the renderer declares its passes in submission order, along with the render targets each
+// of them reads and writes, and compiles the graph. Compiling
+//   - culls passes none of whose outputs are read later on (passes with side effects, like drawing to the screen or
+//     issuing queries, are always kept), and drops outputs of the remaining passes that nothing reads,
+//   - works out how long each target lives, from the first pass that touches it to the last,
+//   - and gives each target a texture from a pool, sharing one texture between targets of the same format and size
+//     whose lifetimes don't overlap.
+// Only targets that end up being used get a texture, so render target memory follows the features that are enabled.
+//
+// Passes are then run in the same order, each inside StartGraphPass / EndGraphPass. StartGraphPass binds a framebuffer
+// with the pass's outputs attached (in the order they were declared, matching the shader's output locations) and sets
+// the viewport to their size. Inputs are bound to the reserved texture units of their slots (see ReservedTextureUnit
+// in render.h), so shaders keep sampling gDepth, gNormal etc. no matter which texture a target ended up in.
+//
+// Writing a target doesn't clear it, so a pass that writes a target also depends on the passes that wrote it before.
+// A pass that also reads one of its outputs keeps it attached even if nothing reads it later, e.g. to depth test.
+// Copies between targets (AddGraphCopy) are declared like passes and run by the graph itself, as blits, right before
+// the next pass that is started. Persistent targets keep their contents from one frame to the next, for history
+// buffers. They never share their texture and count as read at the end of the frame.
+
+#define RENDERGRAPH_MAX_TARGETS 32
+#define RENDERGRAPH_MAX_PASSES 32
+#define RENDERGRAPH_MAX_READS 12
+#define RENDERGRAPH_MAX_COLORS 8
+#define RENDERGRAPH_MAX_TEXTURES 48
+#define RENDERGRAPH_MAX_FRAMEBUFFERS 64
+
+typedef int32_t GraphTarget; // index into RenderGraph.targets
+typedef int32_t GraphPass;   // index into RenderGraph.passes
+
+#define GRAPH_NONE -1
+#define GRAPH_BACKBUFFER -2  // the default framebuffer, can only be written
+
+typedef struct RenderGraphTarget {
+    const char* name;
+    int slot;            // reserved texture unit the target is bound to when read, -1 for none
+    GLenum format;
+    int w;
+    int h;
+    bool persistent;
+    // Filled in by CompileRenderGraph:
+    bool needed;
+    int firstPass;       // -1 if no pass that was kept touches the target
+    int lastPass;
+    int texture;         // index into RenderGraph.textures, -1 if none
+} RenderGraphTarget;
+
+typedef struct RenderGraphPass {
+    char name [64];
+    bool sideEffects;
+    bool backbuffer;            // draws to the screen
+    bool copy;                  // made by AddGraphCopy, copies reads[0] into its only output
+    size_t readCount;
+    GraphTarget reads [RENDERGRAPH_MAX_READS];
+    size_t colorCount;
+    GraphTarget colors [RENDERGRAPH_MAX_COLORS]; // GRAPH_NONE for outputs dropped by CompileRenderGraph
+    GraphTarget depth;
+    // Filled in by CompileRenderGraph:
+    bool culled;
+    bool done;
+} RenderGraphPass;
+
+// Pool textures, kept from frame to frame.
+typedef struct RenderGraphTexture {
+    GLuint texture;
+    GLenum format;
+    int w;
+    int h;
+    const char* persistentName; // name of the persistent target that owns the texture, NULL for shared textures
+    int busyUntil;              // last pass of the target the texture was last given to, while compiling
+    bool used;                  // given to a target this frame
+} RenderGraphTexture;
+
+typedef struct RenderGraphFramebuffer {
+    GLuint fbo;
+    GLuint depth;
+    GLuint colors [RENDERGRAPH_MAX_COLORS];
+    uint64_t lastUsedFrame;
+} RenderGraphFramebuffer;
+
+typedef struct RenderGraph {
+    uint64_t frame;
+    int screenW;
+    int screenH;
+    size_t targetCount;
+    RenderGraphTarget targets [RENDERGRAPH_MAX_TARGETS];
+    size_t passCount;
+    RenderGraphPass passes [RENDERGRAPH_MAX_PASSES];
+    GraphPass current;          // pass between StartGraphPass and EndGraphPass, GRAPH_NONE if none
+    size_t textureCount;
+    RenderGraphTexture textures [RENDERGRAPH_MAX_TEXTURES];
+    size_t textureBytes;        // estimated memory of the pool's textures
+    size_t framebufferCount;
+    RenderGraphFramebuffer framebuffers [RENDERGRAPH_MAX_FRAMEBUFFERS];
+} RenderGraph; // zero-initialize
+
+// Forgets last frame's passes and targets. The screen size is used for passes that draw to the backbuffer.
+void BeginRenderGraph (RenderGraph* g, int screenW, int screenH);
+GraphTarget AddGraphTarget (RenderGraph* g, const char* name, int slot, GLenum format, int w, int h, bool persistent);
+GraphPass AddGraphPass (RenderGraph* g, const char* name, bool sideEffects);
+void GraphPassReads (RenderGraph* g, GraphPass pass, GraphTarget target);
+// Depth formats become the depth attachment, anything else the next color attachment. GRAPH_BACKBUFFER draws to the
+// screen (which counts as a side effect), and has to be the pass's only output.
+void GraphPassWrites (RenderGraph* g, GraphPass pass, GraphTarget target);
+// Copies one target into another of the same size at this point in the frame.
+void AddGraphCopy (RenderGraph* g, GraphTarget from, GraphTarget to);
+void CompileRenderGraph (RenderGraph* g);
+
+// Returns false if the pass was culled, in which case EndGraphPass must not be called.
+bool StartGraphPass (RenderGraph* g, RenderState* rs, GraphPass pass);
+void EndGraphPass (RenderGraph* g);
+// Runs copies that are still pending. Call after the last pass of the frame.
+void EndRenderGraph (RenderGraph* g);
+void DeleteRenderGraph (RenderGraph* g);
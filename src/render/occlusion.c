@@ -0,0 +1,480 @@
+#include "occlusion.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define OCCLUSION_SSE2 1
+    #include <emmintrin.h>
+#else
+    #define OCCLUSION_SSE2 0
+#endif
+
+// Vertices closer to the camera plane than this are treated as behind it.
+static const float Occlusion_MinW = 1e-5f;
+// Primitives reaching further than this outside the buffer (in pixels) are skipped. Keeps the edge functions precise,
+// and can only cause less culling.
+static const float Occlusion_GuardBand = 1024.0f;
+// Draw list entries per job in CullOccludedDraws.
+static const size_t Occlusion_TestBatchSize = 256;
+
+static void* sReserve (void* array, size_t* slots, size_t count, size_t itemsize, size_t alignment) {
+    if (count <= *slots) { return array; }
+    *slots = count * 2;
+    return vxAlignedRealloc(array, *slots, itemsize, alignment);
+}
+
+void ClearOcclusionBuffer (OcclusionBuffer* ob, Camera* cam) {
+    memset(ob->depth, 0, sizeof(ob->depth));
+    memset(ob->tileMin, 0, sizeof(ob->tileMin));
+    glm_mat4_mul(cam->proj_matrix, cam->view_matrix, ob->viewProj);
+    ob->occluderCount = 0;
+    ob->triangleCount = 0;
+    ob->vertexCount = 0;
+    ob->primitiveCount = 0;
+}
+
+void DeleteOcclusionBuffer (OcclusionBuffer* ob) {
+    void* scratch [] = {ob->occluders, ob->vertices, ob->primitives, ob->binPrimitives, ob->candidates, ob->occluded};
+    for (size_t i = 0; i < vxSize(scratch); i++) {
+        if (scratch[i] != NULL) {
+            vxFree(scratch[i]);
+        }
+    }
+    memset(ob, 0, sizeof(OcclusionBuffer));
+}
+
+// Projects a point to buffer coordinates (in pixels) and depth. Fails for points in front of the near plane.
+static bool sProject (mat4 m, vec3 p, vec3 out) {
+    vec4 clip;
+    glm_mat4_mulv(m, (vec4){p[0], p[1], p[2], 1.0f}, clip);
+    if (clip[3] <= Occlusion_MinW) { return false; }
+    float iw = 1.0f / clip[3];
+    out[0] = (clip[0] * iw * 0.5f + 0.5f) * OCCLUSION_WIDTH;
+    out[1] = (clip[1] * iw * 0.5f + 0.5f) * OCCLUSION_HEIGHT;
+    out[2] = clip[2] * iw;
+    return out[2] <= 1.0f;
+}
+
+// Computes the screen rectangle {minX, minY, maxX, maxY} and nearest depth of a box. Fails if any of its corners
+// can't be projected, in which case the box should be treated as covering the whole screen.
+static bool sProjectAABB (OcclusionBuffer* ob, vec3 min, vec3 max, float rect [4], float* nearZ) {
+    rect[0] = rect[1] = FLT_MAX;
+    rect[2] = rect[3] = -FLT_MAX;
+    *nearZ = 0.0f;
+    for (int i = 0; i < 8; i++) {
+        vec3 corner = {(i & 1) ? max[0] : min[0], (i & 2) ? max[1] : min[1], (i & 4) ? max[2] : min[2]};
+        vec3 s;
+        if (!sProject(ob->viewProj, corner, s)) { return false; }
+        rect[0] = vxMin(rect[0], s[0]);
+        rect[1] = vxMin(rect[1], s[1]);
+        rect[2] = vxMax(rect[2], s[0]);
+        rect[3] = vxMax(rect[3], s[1]);
+        *nearZ = vxMax(*nearZ, s[2]);
+    }
+    return true;
+}
+
+void AddOccluder (OcclusionBuffer* ob, mat4 world, Mesh* mesh, bool cullBackFaces) {
+    size_t stride = mesh->cpu_attribute_components[ATTR_POSITION];
+    if (mesh->cpu_attributes[ATTR_POSITION] == NULL || mesh->cpu_indices == NULL || stride < 3) { return; }
+    ob->occluders = (OcclusionOccluder*) sReserve(ob->occluders, &ob->occluderSlots, ob->occluderCount + 1,
+        sizeof(OcclusionOccluder), vxAlignOf(OcclusionOccluder));
+    OcclusionOccluder* occ = &ob->occluders[ob->occluderCount++];
+    glm_mat4_copy(world, occ->world);
+    occ->mesh = mesh;
+    occ->cullBackFaces = cullBackFaces;
+    occ->firstVertex = ob->vertexCount;
+    occ->firstPrimitive = ob->primitiveCount;
+    ob->vertexCount += mesh->gl_vertex_count;
+    ob->primitiveCount += mesh->cpu_index_count / 3;
+    ob->triangleCount += mesh->cpu_index_count / 3;
+    ob->vertices = (vec4*) sReserve(ob->vertices, &ob->vertexSlots, ob->vertexCount, sizeof(vec4), vxAlignOf(vec4));
+    ob->primitives = (OcclusionPrimitive*) sReserve(ob->primitives, &ob->primitiveSlots, ob->primitiveCount,
+        sizeof(OcclusionPrimitive), vxAlignOf(OcclusionPrimitive));
+}
+
+// Edge function through p and q, positive to the left of p->q, which is the inside of counter-clockwise polygons. It's
+// offset by half a pixel's extent along its normal, so that it's only non-negative at the center of a pixel if the
+// whole pixel is on the inside.
+static void sSetupEdge (float* p, float* q, float edge [3]) {
+    edge[0] = p[1] - q[1];
+    edge[1] = q[0] - p[0];
+    edge[2] = -(edge[0] * p[0] + edge[1] * p[1]) - 0.5f * (fabsf(edge[0]) + fabsf(edge[1]));
+}
+
+// Depth plane of a counter-clockwise triangle, offset so that it gives the farthest depth within the pixel around the
+// point it's evaluated at. Post-projection depth is linear in screen space.
+static void sSetupPlane (float* v0, float* v1, float* v2, float area, float plane [3]) {
+    float* v [3] = {v0, v1, v2};
+    plane[0] = plane[1] = plane[2] = 0.0f;
+    for (int i = 0; i < 3; i++) {
+        // Edge opposite vertex i, which is 0 at the other two vertices:
+        float* va = v[(i + 1) % 3];
+        float* vb = v[(i + 2) % 3];
+        float a = va[1] - vb[1];
+        float b = vb[0] - va[0];
+        float c = -(a * va[0] + b * va[1]);
+        plane[0] += a * v[i][2];
+        plane[1] += b * v[i][2];
+        plane[2] += c * v[i][2];
+    }
+    for (int i = 0; i < 3; i++) {
+        plane[i] /= area;
+    }
+    plane[2] -= 0.5f * (fabsf(plane[0]) + fabsf(plane[1]));
+}
+
+static void sSetupRect (OcclusionPrimitive* p, float** v, int count) {
+    float min [2] = {FLT_MAX, FLT_MAX};
+    float max [2] = {-FLT_MAX, -FLT_MAX};
+    for (int i = 0; i < count; i++) {
+        for (int c = 0; c < 2; c++) {
+            min[c] = vxMin(min[c], v[i][c]);
+            max[c] = vxMax(max[c], v[i][c]);
+        }
+    }
+    if (max[0] < 0.0f || max[1] < 0.0f || min[0] > OCCLUSION_WIDTH || min[1] > OCCLUSION_HEIGHT) { return; }
+    // Clamped before converting, so that coordinates far outside the buffer can't overflow:
+    p->rect[0] = (int) floorf(vxClamp(min[0], 0.0f, (float)(OCCLUSION_WIDTH - 1)));
+    p->rect[1] = (int) floorf(vxClamp(min[1], 0.0f, (float)(OCCLUSION_HEIGHT - 1)));
+    p->rect[2] = (int) floorf(vxClamp(max[0], 0.0f, (float)(OCCLUSION_WIDTH - 1)));
+    p->rect[3] = (int) floorf(vxClamp(max[1], 0.0f, (float)(OCCLUSION_HEIGHT - 1)));
+}
+
+static void sSetupTriangle (OcclusionPrimitive* p, vec4* vertices, uint32_t* t, float area) {
+    float* v [3] = {vertices[t[0]], vertices[t[1]], vertices[t[2]]};
+    for (int i = 0; i < 3; i++) {
+        sSetupEdge(v[i], v[(i + 1) % 3], p->edges[i]);
+    }
+    p->edges[3][0] = 0.0f;
+    p->edges[3][1] = 0.0f;
+    p->edges[3][2] = 1.0f;
+    sSetupPlane(v[0], v[1], v[2], area, p->planes[0]);
+    memcpy(p->planes[1], p->planes[0], sizeof(p->planes[0]));
+    sSetupRect(p, v, 3);
+}
+
+// Sets up two counter-clockwise triangles that share an edge as a single quad. Fails if they don't share an edge or
+// the quad isn't convex, since only then is it covered by the two triangles.
+static bool sSetupQuad (OcclusionPrimitive* p, vec4* vertices, uint32_t* a, float areaA, uint32_t* b, float areaB) {
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            // Both are counter-clockwise, so b runs along the shared edge the other way:
+            if (b[j] != a[(i + 1) % 3] || b[(j + 1) % 3] != a[i]) { continue; }
+            float* q [4] = {vertices[a[(i + 1) % 3]], vertices[a[(i + 2) % 3]], vertices[a[i]],
+                            vertices[b[(j + 2) % 3]]};
+            for (int k = 0; k < 4; k++) {
+                float* u = q[k];
+                float* v = q[(k + 1) % 4];
+                float* w = q[(k + 2) % 4];
+                if ((v[0] - u[0]) * (w[1] - v[1]) - (v[1] - u[1]) * (w[0] - v[0]) <= 0.0f) { return false; }
+            }
+            for (int k = 0; k < 4; k++) {
+                sSetupEdge(q[k], q[(k + 1) % 4], p->edges[k]);
+            }
+            sSetupPlane(vertices[a[0]], vertices[a[1]], vertices[a[2]], areaA, p->planes[0]);
+            sSetupPlane(vertices[b[0]], vertices[b[1]], vertices[b[2]], areaB, p->planes[1]);
+            sSetupRect(p, q, 4);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Puts a triangle's vertices in counter-clockwise order. Fails for triangles with vertices that couldn't be projected,
+// back-facing triangles when culling back faces, and triangles too small to matter.
+static bool sOrientTriangle (vec4* vertices, uint32_t* indices, bool cullBackFaces, uint32_t t [3], float* area) {
+    float* v0 = vertices[indices[0]];
+    float* v1 = vertices[indices[1]];
+    float* v2 = vertices[indices[2]];
+    if (v0[3] == 0.0f || v1[3] == 0.0f || v2[3] == 0.0f) { return false; }
+    float a = (v1[0] - v0[0]) * (v2[1] - v0[1]) - (v1[1] - v0[1]) * (v2[0] - v0[0]);
+    t[0] = indices[0];
+    t[1] = indices[1];
+    t[2] = indices[2];
+    if (a < 0.0f) {
+        if (cullBackFaces) { return false; }
+        t[1] = indices[2];
+        t[2] = indices[1];
+        a = -a;
+    }
+    *area = a;
+    return a >= 1e-6f;
+}
+
+static bool sInGuardBand (float* v) {
+    return v[0] >= -Occlusion_GuardBand && v[0] <= OCCLUSION_WIDTH  + Occlusion_GuardBand &&
+           v[1] >= -Occlusion_GuardBand && v[1] <= OCCLUSION_HEIGHT + Occlusion_GuardBand;
+}
+
+static void sSetupOccluder (OcclusionBuffer* ob, OcclusionOccluder* occ) {
+    Mesh* mesh = occ->mesh;
+    float* positions = mesh->cpu_attributes[ATTR_POSITION];
+    size_t stride = mesh->cpu_attribute_components[ATTR_POSITION];
+    vec4* vertices = &ob->vertices[occ->firstVertex];
+    mat4 m;
+    glm_mat4_mul(ob->viewProj, occ->world, m);
+    for (size_t i = 0; i < mesh->gl_vertex_count; i++) {
+        bool valid = sProject(m, &positions[i * stride], vertices[i]) && sInGuardBand(vertices[i]);
+        vertices[i][3] = valid ? 1.0f : 0.0f;
+    }
+
+    // Consecutive triangles that share an edge (how quads are usually indexed) are merged when they can be:
+    OcclusionPrimitive* primitives = &ob->primitives[occ->firstPrimitive];
+    uint32_t* indices = mesh->cpu_indices;
+    size_t triangleCount = mesh->cpu_index_count / 3;
+    for (size_t i = 0; i < triangleCount; i++) {
+        OcclusionPrimitive* p = &primitives[i];
+        p->rect[0] = 1; // empty
+        p->rect[2] = 0;
+        uint32_t a [3], b [3];
+        float areaA, areaB;
+        if (!sOrientTriangle(vertices, &indices[i * 3], occ->cullBackFaces, a, &areaA)) { continue; }
+        if (i + 1 < triangleCount &&
+            sOrientTriangle(vertices, &indices[(i + 1) * 3], occ->cullBackFaces, b, &areaB) &&
+            sSetupQuad(p, vertices, a, areaA, b, areaB)) {
+            i++;
+            primitives[i].rect[0] = 1;
+            primitives[i].rect[2] = 0;
+            continue;
+        }
+        sSetupTriangle(p, vertices, a, areaA);
+    }
+}
+
+static void sSetupOccluders (void* user, size_t begin, size_t end) {
+    OcclusionBuffer* ob = (OcclusionBuffer*) user;
+    for (size_t i = begin; i < end; i++) {
+        sSetupOccluder(ob, &ob->occluders[i]);
+    }
+}
+
+// Sorts primitive indices into the bins their rectangles overlap.
+static void sBinPrimitives (OcclusionBuffer* ob) {
+    uint32_t counts [OCCLUSION_BINS] = {0};
+    for (int pass = 0; pass < 2; pass++) {
+        for (size_t i = 0; i < ob->primitiveCount; i++) {
+            int* rect = ob->primitives[i].rect;
+            if (rect[0] > rect[2]) { continue; }
+            for (int by = rect[1] / OCCLUSION_BIN_H; by <= rect[3] / OCCLUSION_BIN_H; by++) {
+                for (int bx = rect[0] / OCCLUSION_BIN_W; bx <= rect[2] / OCCLUSION_BIN_W; bx++) {
+                    int bin = by * OCCLUSION_BINS_X + bx;
+                    if (pass == 0) {
+                        counts[bin]++;
+                    } else {
+                        ob->binPrimitives[counts[bin]++] = (uint32_t) i;
+                    }
+                }
+            }
+        }
+        if (pass == 0) {
+            // Turn the counts into the start of each bin, where the second pass starts filling in:
+            uint32_t total = 0;
+            for (int bin = 0; bin < OCCLUSION_BINS; bin++) {
+                ob->binStart[bin] = total;
+                total += counts[bin];
+                counts[bin] = ob->binStart[bin];
+            }
+            ob->binStart[OCCLUSION_BINS] = total;
+            ob->binPrimitives = (uint32_t*) sReserve(ob->binPrimitives, &ob->binPrimitiveSlots, total,
+                sizeof(uint32_t), vxAlignOf(uint32_t));
+        }
+    }
+}
+
+// Rasterizes the part of a primitive inside [clip] {minX, minY, maxX, maxY}. Bins start at multiples of 4 pixels, so
+// the 4-pixel groups never reach past the bin.
+static void sRasterizePrimitive (OcclusionBuffer* ob, OcclusionPrimitive* p, int clip [4]) {
+    int x0 = vxMax(p->rect[0], clip[0]) & ~3;
+    int y0 = vxMax(p->rect[1], clip[1]);
+    int x1 = vxMin(p->rect[2], clip[2]);
+    int y1 = vxMin(p->rect[3], clip[3]);
+    float (*e)[3] = p->edges;
+    float (*z)[3] = p->planes;
+
+    #if OCCLUSION_SSE2
+    __m128 zero = _mm_setzero_ps();
+    __m128 step = _mm_set1_ps(4.0f);
+    __m128 xoff = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+    __m128 a0 = _mm_set1_ps(e[0][0]), a1 = _mm_set1_ps(e[1][0]), a2 = _mm_set1_ps(e[2][0]), a3 = _mm_set1_ps(e[3][0]);
+    __m128 az0 = _mm_set1_ps(z[0][0]), az1 = _mm_set1_ps(z[1][0]);
+    for (int y = y0; y <= y1; y++) {
+        float py = (float) y + 0.5f;
+        __m128 r0 = _mm_set1_ps(e[0][1] * py + e[0][2]);
+        __m128 r1 = _mm_set1_ps(e[1][1] * py + e[1][2]);
+        __m128 r2 = _mm_set1_ps(e[2][1] * py + e[2][2]);
+        __m128 r3 = _mm_set1_ps(e[3][1] * py + e[3][2]);
+        __m128 rz0 = _mm_set1_ps(z[0][1] * py + z[0][2]);
+        __m128 rz1 = _mm_set1_ps(z[1][1] * py + z[1][2]);
+        __m128 px = _mm_add_ps(_mm_set1_ps((float) x0), xoff);
+        for (int x = x0; x <= x1; x += 4) {
+            __m128 e0 = _mm_add_ps(_mm_mul_ps(a0, px), r0);
+            __m128 e1 = _mm_add_ps(_mm_mul_ps(a1, px), r1);
+            __m128 e2 = _mm_add_ps(_mm_mul_ps(a2, px), r2);
+            __m128 e3 = _mm_add_ps(_mm_mul_ps(a3, px), r3);
+            __m128 inside = _mm_cmpge_ps(_mm_min_ps(_mm_min_ps(e0, e1), _mm_min_ps(e2, e3)), zero);
+            if (_mm_movemask_ps(inside) != 0) {
+                float* d = &ob->depth[y][x];
+                __m128 pz = _mm_min_ps(_mm_add_ps(_mm_mul_ps(az0, px), rz0), _mm_add_ps(_mm_mul_ps(az1, px), rz1));
+                __m128 old = _mm_loadu_ps(d);
+                __m128 nearer = _mm_max_ps(old, pz);
+                _mm_storeu_ps(d, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, old)));
+            }
+            px = _mm_add_ps(px, step);
+        }
+    }
+    #else
+    for (int y = y0; y <= y1; y++) {
+        float py = (float) y + 0.5f;
+        for (int x = x0; x <= x1; x++) {
+            float px = (float) x + 0.5f;
+            bool inside = true;
+            for (int i = 0; i < 4; i++) {
+                inside &= (e[i][0] * px + e[i][1] * py + e[i][2] >= 0.0f);
+            }
+            if (inside) {
+                float pz = vxMin(z[0][0] * px + z[0][1] * py + z[0][2], z[1][0] * px + z[1][1] * py + z[1][2]);
+                ob->depth[y][x] = vxMax(ob->depth[y][x], pz);
+            }
+        }
+    }
+    #endif
+}
+
+static void sRasterizeBins (void* user, size_t begin, size_t end) {
+    OcclusionBuffer* ob = (OcclusionBuffer*) user;
+    for (size_t bin = begin; bin < end; bin++) {
+        int bx = (int) bin % OCCLUSION_BINS_X;
+        int by = (int) bin / OCCLUSION_BINS_X;
+        int clip [4] = {bx * OCCLUSION_BIN_W, by * OCCLUSION_BIN_H,
+                        (bx + 1) * OCCLUSION_BIN_W - 1, (by + 1) * OCCLUSION_BIN_H - 1};
+        for (uint32_t i = ob->binStart[bin]; i < ob->binStart[bin + 1]; i++) {
+            sRasterizePrimitive(ob, &ob->primitives[ob->binPrimitives[i]], clip);
+        }
+
+        // Bins are made of whole tiles:
+        for (int ty = clip[1] / OCCLUSION_TILE; ty <= clip[3] / OCCLUSION_TILE; ty++) {
+            for (int tx = clip[0] / OCCLUSION_TILE; tx <= clip[2] / OCCLUSION_TILE; tx++) {
+                float z = FLT_MAX;
+                for (int y = ty * OCCLUSION_TILE; y < (ty + 1) * OCCLUSION_TILE; y++) {
+                    for (int x = tx * OCCLUSION_TILE; x < (tx + 1) * OCCLUSION_TILE; x++) {
+                        z = vxMin(z, ob->depth[y][x]);
+                    }
+                }
+                ob->tileMin[ty][tx] = z;
+            }
+        }
+    }
+}
+
+void FinishOcclusionBuffer (OcclusionBuffer* ob) {
+    vxParallelFor("Set Up Occluders", ob->occluderCount, 1, sSetupOccluders, ob);
+    sBinPrimitives(ob);
+    vxParallelFor("Rasterize Occluders", OCCLUSION_BINS, 1, sRasterizeBins, ob);
+}
+
+bool IsAABBOccluded (OcclusionBuffer* ob, vec3 min, vec3 max) {
+    float rect [4];
+    float nearZ;
+    if (!sProjectAABB(ob, min, max, rect, &nearZ)) { return false; }
+
+    if (rect[2] < 0.0f || rect[3] < 0.0f || rect[0] > OCCLUSION_WIDTH || rect[1] > OCCLUSION_HEIGHT) {
+        return false; // off screen, which is up to frustum culling
+    }
+    // Every pixel the rectangle touches. Clamped before converting, so that coordinates far outside the buffer can't
+    // overflow:
+    int x0 = (int) floorf(vxClamp(rect[0], 0.0f, (float)(OCCLUSION_WIDTH - 1)));
+    int y0 = (int) floorf(vxClamp(rect[1], 0.0f, (float)(OCCLUSION_HEIGHT - 1)));
+    int x1 = (int) floorf(vxClamp(rect[2], 0.0f, (float)(OCCLUSION_WIDTH - 1)));
+    int y1 = (int) floorf(vxClamp(rect[3], 0.0f, (float)(OCCLUSION_HEIGHT - 1)));
+
+    for (int ty = y0 / OCCLUSION_TILE; ty <= y1 / OCCLUSION_TILE; ty++) {
+        for (int tx = x0 / OCCLUSION_TILE; tx <= x1 / OCCLUSION_TILE; tx++) {
+            if (ob->tileMin[ty][tx] > nearZ) { continue; }
+            // The tile is partially uncovered, check the pixels inside the rectangle:
+            int py0 = vxMax(y0, ty * OCCLUSION_TILE), py1 = vxMin(y1, (ty + 1) * OCCLUSION_TILE - 1);
+            int px0 = vxMax(x0, tx * OCCLUSION_TILE), px1 = vxMin(x1, (tx + 1) * OCCLUSION_TILE - 1);
+            for (int y = py0; y <= py1; y++) {
+                for (int x = px0; x <= px1; x++) {
+                    if (ob->depth[y][x] <= nearZ) { return false; }
+                }
+            }
+        }
+    }
+    return true;
+}
+
+static int sCompareOccluders (const void* pa, const void* pb) {
+    float a = ((const OccluderCandidate*) pa)->area;
+    float b = ((const OccluderCandidate*) pb)->area;
+    return (a > b) ? -1 : (a < b);
+}
+
+void RenderOccluders (OcclusionBuffer* ob, DrawList* dl, Camera* cam, vxConfig* conf) {
+    ClearOcclusionBuffer(ob, cam);
+    if (cam->projection != CAMERA_PERSPECTIVE) { return; } // depth math assumes reverse-Z perspective
+
+    size_t candidateCount = 0;
+    for (size_t i = 0; i < dl->count; i++) {
+        RenderableMesh* rmesh = GetDrawItemMesh(dl, &dl->items[i]);
+        Material* mat = rmesh->material;
+        Mesh* mesh = &rmesh->mesh;
+        if (mat->blend || mat->stipple || mesh->type != GL_TRIANGLES) { continue; }
+        if (mesh->cpu_attributes[ATTR_POSITION] == NULL || mesh->cpu_indices == NULL) { continue; }
+
+        float rect [4];
+        float nearZ;
+        float area = OCCLUSION_WIDTH * OCCLUSION_HEIGHT;
+        if (sProjectAABB(ob, rmesh->aabbMin, rmesh->aabbMax, rect, &nearZ)) {
+            float w = vxClamp(rect[2], 0.0f, OCCLUSION_WIDTH) - vxClamp(rect[0], 0.0f, OCCLUSION_WIDTH);
+            float h = vxClamp(rect[3], 0.0f, OCCLUSION_HEIGHT) - vxClamp(rect[1], 0.0f, OCCLUSION_HEIGHT);
+            area = w * h;
+        }
+        if (area < conf->occlusionMinOccluderArea) { continue; }
+
+        candidateCount++;
+        ob->candidates = (OccluderCandidate*) sReserve(ob->candidates, &ob->candidateSlots, candidateCount,
+            sizeof(OccluderCandidate), vxAlignOf(OccluderCandidate));
+        ob->candidates[candidateCount - 1] = (OccluderCandidate){rmesh, area};
+    }
+
+    OccluderCandidate* candidates = ob->candidates;
+    qsort(candidates, candidateCount, sizeof(OccluderCandidate), sCompareOccluders);
+    size_t budget = (size_t) vxMax(conf->occlusionTriangleBudget, 0);
+    for (size_t i = 0; i < candidateCount; i++) {
+        RenderableMesh* rmesh = candidates[i].rmesh;
+        size_t triangles = rmesh->mesh.cpu_index_count / 3;
+        if (triangles > budget) { continue; }
+        budget -= triangles;
+        bool cullBackFaces = rmesh->material->cull && rmesh->material->cull_face == GL_BACK;
+        AddOccluder(ob, rmesh->worldMatrix, &rmesh->mesh, cullBackFaces);
+    }
+    FinishOcclusionBuffer(ob);
+}
+
+typedef struct OcclusionTest {
+    OcclusionBuffer* ob;
+    DrawList* dl;
+} OcclusionTest;
+
+static void sTestDraws (void* user, size_t begin, size_t end) {
+    OcclusionTest* test = (OcclusionTest*) user;
+    for (size_t i = begin; i < end; i++) {
+        RenderableMesh* rmesh = GetDrawItemMesh(test->dl, &test->dl->items[i]);
+        test->ob->occluded[i] = IsAABBOccluded(test->ob, rmesh->aabbMin, rmesh->aabbMax);
+    }
+}
+
+size_t CullOccludedDraws (OcclusionBuffer* ob, DrawList* dl) {
+    if (ob->occluderCount == 0) { return 0; }
+    ob->occluded = (bool*) sReserve(ob->occluded, &ob->occludedSlots, dl->count, sizeof(bool), vxAlignOf(bool));
+    OcclusionTest test = {ob, dl};
+    vxParallelFor("Test Occlusion", dl->count, Occlusion_TestBatchSize, sTestDraws, &test);
+    size_t kept = 0;
+    for (size_t i = 0; i < dl->count; i++) {
+        if (!ob->occluded[i]) {
+            dl->items[kept++] = dl->items[i];
+        }
+    }
+    size_t culled = dl->count - kept;
+    dl->count = kept;
+    return culled;
+}
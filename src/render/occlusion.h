@@ -0,0 +1,98 @@
+#pragma once
+#include "common.h"
+#include "main.h"
+#include "data/model.h"
+#include "data/camera.h"
+#include "render/drawlist.h"
+
+// Software occlusion culling. Large opaque meshes that made it through frustum culling are rasterized on the CPU into
+// a small depth buffer, and draws whose bounding boxes are completely hidden behind that depth are dropped before
+// submission.
+//
+// Rasterizing is spread over the job system. Occluders are transformed and set up in parallel, one job each, and their
+// primitives are sorted into screen bins. Each bin is then rasterized by a single job, so no two jobs ever write the
+// same pixel. The rasterizer works on 4 pixels at a time with SSE2 where available, and falls back to scalar code.
+//
+// Depth follows the renderer's reverse-Z convention: 0 is infinitely far away and larger values are nearer.
+// Occluders are conservative. A pixel only takes an occluder's depth if a single primitive covers all of it, and then
+// the farthest depth the primitive has inside the pixel. Pairs of triangles that form a convex quad (most walls and
+// floors) are rasterized as one primitive, so the diagonal between them doesn't leave a line of uncovered pixels.
+// Other gaps between triangles are never filled in, which costs some culling but never hides anything that could be
+// seen through them. An object is culled only if every pixel it could cover holds something nearer than the nearest
+// point of its bounding box. The buffer is tested through a hierarchy of tiles storing their farthest depth, so most
+// boxes are decided without touching individual pixels.
+//
+// src/tools/occlusionbench.c checks the buffer against a supersampled reference and benchmarks the rasterizer.
+
+#define OCCLUSION_WIDTH  256
+#define OCCLUSION_HEIGHT 128
+#define OCCLUSION_TILE   8
+#define OCCLUSION_TILES_X (OCCLUSION_WIDTH / OCCLUSION_TILE)
+#define OCCLUSION_TILES_Y (OCCLUSION_HEIGHT / OCCLUSION_TILE)
+// Bins are rasterized in parallel. Their size is a multiple of the tile size and of 4 pixels (the SIMD width).
+#define OCCLUSION_BIN_W  64
+#define OCCLUSION_BIN_H  32
+#define OCCLUSION_BINS_X (OCCLUSION_WIDTH / OCCLUSION_BIN_W)
+#define OCCLUSION_BINS_Y (OCCLUSION_HEIGHT / OCCLUSION_BIN_H)
+#define OCCLUSION_BINS   (OCCLUSION_BINS_X * OCCLUSION_BINS_Y)
+
+// A triangle or convex quad, set up for rasterizing. A pixel is covered if all edge functions are non-negative at its
+// center, which they're offset for to mean the whole pixel is inside. Depth is the farther of two planes (the same
+// plane twice for triangles), offset to the farthest point of the pixel.
+typedef struct OcclusionPrimitive {
+    float edges [4][3];  // {a, b, c} of E(x,y) = a*x + b*y + c, triangles have an always positive 4th edge
+    float planes [2][3]; // {a, b, c} of z(x,y)
+    int rect [4];        // {minX, minY, maxX, maxY}, inclusive, empty if minX > maxX
+} OcclusionPrimitive;
+
+typedef struct OcclusionOccluder {
+    mat4 world;
+    Mesh* mesh;
+    bool cullBackFaces;
+    size_t firstVertex;    // into OcclusionBuffer.vertices
+    size_t firstPrimitive; // into OcclusionBuffer.primitives, one per triangle
+} OcclusionOccluder;
+
+typedef struct OccluderCandidate {
+    RenderableMesh* rmesh;
+    float area; // in occlusion buffer pixels
+} OccluderCandidate;
+
+typedef struct OcclusionBuffer {
+    float depth [OCCLUSION_HEIGHT][OCCLUSION_WIDTH]; // row 0 is the bottom of the screen
+    float tileMin [OCCLUSION_TILES_Y][OCCLUSION_TILES_X]; // farthest depth in each tile
+    mat4 viewProj;
+    size_t occluderCount;
+    size_t triangleCount;
+    // Scratch memory, kept from one frame to the next:
+    size_t occluderSlots;
+    OcclusionOccluder* occluders;  // queued by AddOccluder
+    size_t vertexCount;
+    size_t vertexSlots;
+    vec4* vertices;                // projected, the last component is 0 for vertices that can't be projected
+    size_t primitiveCount;
+    size_t primitiveSlots;
+    OcclusionPrimitive* primitives;
+    uint32_t binStart [OCCLUSION_BINS + 1]; // ranges of binPrimitives
+    size_t binPrimitiveSlots;
+    uint32_t* binPrimitives;
+    size_t candidateSlots;
+    OccluderCandidate* candidates;
+    size_t occludedSlots;
+    bool* occluded;                // per draw list entry, for CullOccludedDraws
+} OcclusionBuffer; // zero-initialize
+
+void ClearOcclusionBuffer (OcclusionBuffer* ob, Camera* cam);
+void DeleteOcclusionBuffer (OcclusionBuffer* ob);
+// Queues a mesh's CPU geometry for rasterizing. The mesh has to stay around until FinishOcclusionBuffer. Triangles
+// crossing the near plane or reaching far outside the buffer are skipped, which can only cause less culling.
+void AddOccluder (OcclusionBuffer* ob, mat4 world, Mesh* mesh, bool cullBackFaces);
+// Rasterizes the queued occluders and builds the tile hierarchy. Call before testing. Waits for the jobs it hands out.
+void FinishOcclusionBuffer (OcclusionBuffer* ob);
+bool IsAABBOccluded (OcclusionBuffer* ob, vec3 min, vec3 max);
+
+// Picks occluders from a built draw list (largest on screen first, until the triangle budget in [conf] runs out) and
+// renders them into the occlusion buffer as seen from [cam].
+void RenderOccluders (OcclusionBuffer* ob, DrawList* dl, Camera* cam, vxConfig* conf);
+// Removes occluded draws from a draw list, keeping it sorted. Returns the number of removed draws.
+size_t CullOccludedDraws (OcclusionBuffer* ob, DrawList* dl);
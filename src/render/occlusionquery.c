@@ -0,0 +1,125 @@
+#include "occlusionquery.h"
+
+static Material sBoxMaterial;
+static bool sBoxMaterialReady = false;
+
+static bool sNearBox (vec3 min, vec3 max, vec3 p, float distance) {
+    for (int i = 0; i < 3; i++) {
+        if (p[i] < min[i] - distance || p[i] > max[i] + distance) { return false; }
+    }
+    return true;
+}
+
+void DeleteOcclusionQueries (OcclusionQuerySet* oq) {
+    for (ptrdiff_t i = 0; i < stbds_hmlen(oq->map); i++) {
+        glDeleteQueries(OCCLUSION_QUERY_SLOTS, oq->map[i].value.queries);
+    }
+    stbds_hmfree(oq->map);
+    memset(oq, 0, sizeof(OcclusionQuerySet));
+}
+
+void UpdateOcclusionQueries (OcclusionQuerySet* oq, Scene* scene, uint32_t sceneVersion, vxConfig* conf,
+    vxFrame* frame)
+{
+    if (oq->scene != scene || oq->sceneVersion != sceneVersion || oq->modelVersion != ModelResidencyVersion) {
+        DeleteOcclusionQueries(oq);
+        oq->scene = scene;
+        oq->sceneVersion = sceneVersion;
+        oq->modelVersion = ModelResidencyVersion;
+    }
+
+    // Iterate backwards, since stbds_hmdel moves the last entry into the deleted one's place:
+    for (ptrdiff_t i = stbds_hmlen(oq->map) - 1; i >= 0; i--) {
+        OcclusionQuery* q = &oq->map[i].value;
+        if (frame->n - q->lastUsedFrame > OcclusionQuery_MaxIdleFrames) {
+            glDeleteQueries(OCCLUSION_QUERY_SLOTS, q->queries);
+            stbds_hmdel(oq->map, oq->map[i].key);
+            continue;
+        }
+        for (int s = 0; s < OCCLUSION_QUERY_SLOTS; s++) {
+            if (!q->pending[s]) { continue; }
+            GLuint available = 0;
+            glGetQueryObjectuiv(q->queries[s], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available) { continue; }
+            GLuint passed = 0;
+            glGetQueryObjectuiv(q->queries[s], GL_QUERY_RESULT, &passed);
+            if (passed) {
+                q->lastVisibleFrame = vxMax(q->lastVisibleFrame, q->issuedFrame[s]);
+            }
+            q->pending[s] = false;
+        }
+    }
+}
+
+GLuint GetOcclusionQueryCondition (OcclusionQuerySet* oq, vxConfig* conf, vxFrame* frame, uint32_t index) {
+    ptrdiff_t entry = stbds_hmgeti(oq->map, index);
+    if (entry < 0) { return 0; }
+    OcclusionQuery* q = &oq->map[entry].value;
+    q->lastUsedFrame = frame->n;
+    if (q->latest == 0 || q->latestFrame + 1 != frame->n) { return 0; }
+    if (frame->n - q->lastVisibleFrame <= (uint64_t) vxMax(conf->occlusionQueryHysteresis, 0)) { return 0; }
+    frame->perfConditionalDraws++;
+    return q->latest;
+}
+
+void IssueOcclusionQueries (OcclusionQuerySet* oq, RenderState* rs, vxConfig* conf, vxFrame* frame, DrawList* dl) {
+    if (!sBoxMaterialReady) {
+        InitMaterial(&sBoxMaterial);
+        sBoxMaterial.depth_write = false;
+        sBoxMaterial.depth_func = GL_GEQUAL;
+        sBoxMaterial.cull = false;
+        sBoxMaterialReady = true;
+    }
+
+    RenderState rsBox = *rs;
+    SetGLColorMask(false);
+    for (size_t i = 0; i < dl->count; i++) {
+        RenderableMesh* rmesh = GetDrawItemMesh(dl, &dl->items[i]);
+        size_t triangles = rmesh->mesh.gl_element_count * FAccessorComponentCount(rmesh->mesh.gl_element_type) / 3;
+        if (rmesh->material->blend || triangles < (size_t) vxMax(conf->occlusionQueryMinTriangles, 0)) { continue; }
+
+        uint32_t key = dl->items[i].index;
+        ptrdiff_t entry = stbds_hmgeti(oq->map, key);
+        if (entry < 0) {
+            OcclusionQuery nq = {0};
+            glGenQueries(OCCLUSION_QUERY_SLOTS, nq.queries);
+            nq.lastVisibleFrame = frame->n;
+            stbds_hmput(oq->map, key, nq);
+            entry = stbds_hmgeti(oq->map, key);
+        }
+        OcclusionQuery* q = &oq->map[entry].value;
+        q->lastUsedFrame = frame->n;
+
+        vec3 min, max;
+        glm_vec3_subs(rmesh->aabbMin, OcclusionQuery_BoxMargin, min);
+        glm_vec3_adds(rmesh->aabbMax, OcclusionQuery_BoxMargin, max);
+        if (sNearBox(min, max, rs->camPos, 2.0f * vxMax(conf->camMain.near, 0.0f))) {
+            // The box could be clipped by the near plane, so the mesh is visible as far as we can tell:
+            q->lastVisibleFrame = frame->n;
+            continue;
+        }
+        int slot = -1;
+        for (int s = 0; s < OCCLUSION_QUERY_SLOTS && slot < 0; s++) {
+            if (!q->pending[s]) { slot = s; }
+        }
+        if (slot < 0) { continue; } // the GPU is lagging behind, draw unconditionally next frame
+
+        // MESH_CUBE spans [-1,1] on each axis:
+        vec3 center, halfSize;
+        mat4 model;
+        glm_vec3_center(min, max, center);
+        glm_vec3_sub(max, center, halfSize);
+        glm_translate_make(model, center);
+        glm_scale(model, halfSize);
+        SetModelMatrix(&rsBox, model, model);
+
+        glBeginQuery(GL_ANY_SAMPLES_PASSED, q->queries[slot]);
+        RenderMesh(&rsBox, conf, frame, &MESH_CUBE, &sBoxMaterial);
+        glEndQuery(GL_ANY_SAMPLES_PASSED);
+        q->pending[slot] = true;
+        q->issuedFrame[slot] = frame->n;
+        q->latest = q->queries[slot];
+        q->latestFrame = frame->n;
+    }
+    SetGLColorMask(true);
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include "common.h"
+#include "main.h"
+#include "render/render.h"
+#include "render/drawlist.h"
+#include "scene/core.h"
+
+// GPU occlusion queries for heavy meshes. After the main GBuffer pass, the bounding boxes of meshes with lots of
+// triangles are drawn (without writing anything) inside GL_ANY_SAMPLES_PASSED queries. On the next frame their draws
+// are wrapped in conditional rendering with GL_QUERY_NO_WAIT, so the GPU skips them if the box was hidden, and draws
+// them anyway if the result isn't ready yet. The CPU never waits for a query result.
+//
+// Results are also read back on the CPU once they're available, without blocking. A mesh is only drawn conditionally
+// after none of its queries passed for a number of frames (conf->occlusionQueryHysteresis), so meshes near the edge
+// of an occluder don't flicker in and out from the one frame of latency.
+//
+// Queries are keyed by DrawItem.index, which stays the same for a mesh until objects are added or deleted.
+
+#define OCCLUSION_QUERY_SLOTS 4 // queries in flight per mesh
+
+typedef struct OcclusionQuery {
+    GLuint queries [OCCLUSION_QUERY_SLOTS];
+    bool pending [OCCLUSION_QUERY_SLOTS];
+    uint64_t issuedFrame [OCCLUSION_QUERY_SLOTS];
+    GLuint latest; // most recently issued query, 0 if none
+    uint64_t latestFrame; // frame [latest] was issued on
+    uint64_t lastVisibleFrame;
+    uint64_t lastUsedFrame;
+} OcclusionQuery;
+
+typedef struct OcclusionQuerySet {
+    struct { uint32_t key; OcclusionQuery value; }* map; // stb_ds hashmap
+    Scene* scene;
+    uint32_t sceneVersion;
+    uint32_t modelVersion; // ModelResidencyVersion, render list entries move when models are streamed in or out
+} OcclusionQuerySet;
+
+// Queries for meshes that haven't been drawn for this many frames are deleted.
+static const uint64_t OcclusionQuery_MaxIdleFrames = 120;
+// Amount added to each side of the bounding boxes, to account for camera movement between frames.
+static const float OcclusionQuery_BoxMargin = 0.05f;
+
+void DeleteOcclusionQueries (OcclusionQuerySet* oq);
+// Collects available results. Call once per frame, before drawing anything with the queries. The scene is only compared
+// against the one the queries were made for, never read, so this is safe on the render thread while the game thread
+// updates the scene. [sceneVersion] is scene->structureVersion as of the draw lists the queries are used with.
+void UpdateOcclusionQueries (OcclusionQuerySet* oq, Scene* scene, uint32_t sceneVersion, vxConfig* conf,
+    vxFrame* frame);
+// Returns the query a draw should be conditional on, or 0 if it should be drawn unconditionally. Only a query issued
+// on the previous frame is used. An older one tested a box against a depth buffer that's no longer current (the mesh
+// was culled or too close to query since), so the draw goes ahead unconditionally instead.
+GLuint GetOcclusionQueryCondition (OcclusionQuerySet* oq, vxConfig* conf, vxFrame* frame, uint32_t index);
+// Draws the bounding boxes of heavy meshes in a draw list against the current depth buffer, using the render state's
+// camera. Color writes are disabled while drawing.
+void IssueOcclusionQueries (OcclusionQuerySet* oq, RenderState* rs, vxConfig* conf, vxFrame* frame, DrawList* dl);
@@ -1,26 +1,34 @@
 #include "program.h"
+#include "render/render.h"
+#include "render/glstate.h"
 
 #define X(type, name, path) Shader name;
 XM_SHADERS
 #undef X
 
-#define X(name, vsh, fsh) Program name;
+#define X(name, vsh, fsh, features) Program name;
 XM_PROGRAMS
 #undef X
 
-#define X(name, glslName) GLint name;
-XM_PROGRAM_UNIFORMS
-#undef X
-
 #define X(name, location, glslName, gltfName) const GLint name = location;
 XM_PROGRAM_ATTRIBUTES
 #undef X
 
+#define X(name, location, glslName) const GLint name = location;
+XM_PROGRAM_INSTANCE_ATTRIBUTES
+#undef X
+
+#define X(name, binding, glslName) const GLuint name = binding;
+XM_PROGRAM_UNIFORM_BLOCKS
+#undef X
+
 typedef struct DefineBlock {
     uint64_t hash;
     char* defines;
 } DefineBlock;
 
+static DefineBlock sDefineBlock; // last one generated, for variants compiled between updates
+
 static DefineBlock sGenerateDefineBlock (vxConfig* conf) {
     static size_t hash = 0;
     static char block [4096];
@@ -34,6 +42,11 @@ static DefineBlock sGenerateDefineBlock (vxConfig* conf) {
         static type field; \
         if (!blockExists || field != conf->field) { fieldsChanged = true; field = conf->field; block; }
     #define WRITE(...) i += stbsp_snprintf(&block[i], l-i, __VA_ARGS__)
+
+    // Constants shared with the C side don't depend on the config, they're just written out with everything else:
+    if (!blockExists) {
+        WRITE("#define MATERIAL_PAGE_SIZE %d\n", MATERIAL_PAGE_SIZE);
+    }
     
     DEFINE(bool, gpuSupportsClipControl, {
         if (gpuSupportsClipControl) { WRITE("#define DEPTH_ZERO_TO_ONE\n"); }
@@ -97,6 +110,17 @@ static DefineBlock sGenerateDefineBlock (vxConfig* conf) {
     return (DefineBlock){hash, block};
 }
 
+// Material variants get their feature defines after the config's define block:
+static void sWriteFeatureDefines (Shader* s, char* block, int l) {
+    block[0] = '\0';
+    if (!s->materialVariant) { return; }
+    int i = stbsp_snprintf(block, l, "#define MATERIAL_VARIANT\n");
+    #define X(name, bit, glslName) \
+        if (s->materialFeatures & name) { i += stbsp_snprintf(&block[i], l-i, "#define " glslName "\n"); }
+    XM_MATERIAL_FEATURES
+    #undef X
+}
+
 static void sCompileShader (Shader* s, DefineBlock defineBlock) {
     char* code = vxReadFile(s->path, "r", NULL);
     if (strncmp(code, "#version", 8) != 0) {
@@ -110,7 +134,9 @@ static void sCompileShader (Shader* s, DefineBlock defineBlock) {
         strncpy(s->versionBlock, code, linesize);
         s->versionBlock[linesize] = '\0';
     }
-    const char* sources[] = {s->versionBlock, defineBlock.defines, s->codeBlock};
+    char features [512];
+    sWriteFeatureDefines(s, features, vxSize(features));
+    const char* sources[] = {s->versionBlock, defineBlock.defines, features, s->codeBlock};
 
     GLuint shader = glCreateShader(s->type);
     glShaderSource(shader, (GLsizei) vxSize(sources), sources, NULL);
@@ -164,6 +190,24 @@ static void sLinkProgram (Program* p) {
             glDeleteProgram(p->object);
         }
         p->object = program;
+        // Looking these up once per link keeps glGetUniformLocation out of SetRenderProgram:
+        #define X(name, glslName) p->uniforms[name] = glGetUniformLocation(program, glslName);
+        XM_PROGRAM_UNIFORMS
+        #undef X
+        // A new program starts out with all uniforms set to zero, and the old one may have been current:
+        memset(p->uniformCacheWords, 0, sizeof(p->uniformCacheWords));
+        InvalidateGLState();
+        // GLSL 3.30 can't set block bindings in the shader, every program gets the same fixed ones:
+        #define X(name, binding, glslName) { \
+            GLuint block = glGetUniformBlockIndex(program, glslName); \
+            if (block != GL_INVALID_INDEX) { glUniformBlockBinding(program, block, binding); } \
+        }
+        XM_PROGRAM_UNIFORM_BLOCKS
+        #undef X
+        // Variants that failed to compile at first become usable once a reload links them:
+        if (p->base != NULL) {
+            vxAtomicStore32(&p->base->variantReady[p->vsh->materialFeatures], 1);
+        }
     } else {
         char* log = vxAlloc(logsize, char);
         glGetProgramInfoLog(program, logsize, NULL, log);
@@ -194,10 +238,14 @@ static void sInitShader (size_t idx, Shader* s, const GLenum type, const char* p
     }
 }
 
-static void sInitProgram (size_t idx, Program* p, Shader* vsh, Shader* fsh) {
+static void sInitProgram (size_t idx, Program* p, Shader* vsh, Shader* fsh, uint32_t materialFeatures) {
     gPrograms[idx] = p;
     p->vsh = vsh;
     p->fsh = fsh;
+    p->materialFeatures = materialFeatures;
+    for (int i = 0; i < UNIF_COUNT; i++) {
+        p->uniforms[i] = -1;
+    }
     sLinkProgram(p);
 }
 
@@ -208,7 +256,7 @@ void InitProgramSystem (vxConfig* conf) {
     XM_SHADERS
     #undef X
 
-    #define X(name, vsh, fsh) gProgramCount++;
+    #define X(name, vsh, fsh, features) gProgramCount++;
     XM_PROGRAMS
     #undef X
 
@@ -216,6 +264,7 @@ void InitProgramSystem (vxConfig* conf) {
     gPrograms = vxAlloc(gProgramCount, Program*);
 
     DefineBlock defineBlock = sGenerateDefineBlock(conf);
+    sDefineBlock = defineBlock;
 
     size_t iS = 0;
     #define X(type, name, path) sInitShader(iS++, &name, type, path, defineBlock);
@@ -223,7 +272,7 @@ void InitProgramSystem (vxConfig* conf) {
     #undef X
 
     size_t iP = 0;
-    #define X(name, vsh, fsh) sInitProgram(iP++, &name, &vsh, &fsh);
+    #define X(name, vsh, fsh, features) sInitProgram(iP++, &name, &vsh, &fsh, features);
     XM_PROGRAMS
     #undef X
 }
@@ -254,6 +303,7 @@ void UpdatePrograms (vxConfig* conf) {
         static int i = 0;
         Shader* s = gShaders[i];
         DefineBlock defineBlock = sGenerateDefineBlock(conf);
+        sDefineBlock = defineBlock;
         sUpdateShader(s, defineBlock);
         if (++i >= gShaderCount) {
             i = 0;
@@ -272,4 +322,50 @@ void UpdatePrograms (vxConfig* conf) {
             step = STEP_UNMARK_SHADERS;
         }
     }
-}
\ No newline at end of file
+}
+
+// Variants get their own copies of the program's shaders, which are added to gShaders and gPrograms so UpdatePrograms
+// reloads them like any other.
+static Shader* sAddVariantShader (Shader* base, uint32_t features) {
+    Shader* s = vxAlloc(1, Shader);
+    memset(s, 0, sizeof(Shader));
+    s->materialVariant = true;
+    s->materialFeatures = features;
+    gShaders = (Shader**) vxAlignedRealloc(gShaders, gShaderCount + 1, sizeof(Shader*), vxAlignOf(Shader*));
+    sInitShader(gShaderCount++, s, base->type, base->path, sDefineBlock);
+    return s;
+}
+
+static void sAddProgramVariant (Program* p, uint32_t features) {
+    vxLog("Compiling variant 0x%02x of program (%s, %s)", features, p->vsh->path, p->fsh->path);
+    Shader* vsh = sAddVariantShader(p->vsh, features);
+    Shader* fsh = sAddVariantShader(p->fsh, features);
+    Program* v = vxAlloc(1, Program);
+    memset(v, 0, sizeof(Program));
+    v->base = p;
+    // Stored before linking, which marks the variant ready. Until then materials keep using the full program:
+    p->variants[features] = v;
+    gPrograms = (Program**) vxAlignedRealloc(gPrograms, gProgramCount + 1, sizeof(Program*), vxAlignOf(Program*));
+    sInitProgram(gProgramCount++, v, vsh, fsh, 0);
+}
+
+Program* GetProgramVariant (Program* p, uint32_t materialFeatures) {
+    uint32_t features = materialFeatures & p->materialFeatures;
+    // The program itself has every feature:
+    if (features == p->materialFeatures || vxAtomicLoad32(&p->variantReady[features]) == 0) {
+        return p;
+    }
+    return p->variants[features];
+}
+
+void PrepareProgramVariants (uint32_t materialFeatures) {
+    // Variants are appended to gPrograms, and have none of their own:
+    size_t count = gProgramCount;
+    for (size_t i = 0; i < count; i++) {
+        Program* p = gPrograms[i];
+        uint32_t features = materialFeatures & p->materialFeatures;
+        if (features != p->materialFeatures && p->variants[features] == NULL) {
+            sAddProgramVariant(p, features);
+        }
+    }
+}
@@ -2,6 +2,7 @@
 #include "common.h"
 #include "assets.h"
 #include "main.h"
+#include "data/model.h"
 
 typedef struct Shader {
     char* path;
@@ -12,33 +13,69 @@ typedef struct Shader {
     size_t defineBlockHash;
     GLuint object;
     bool justReloaded;
+    bool materialVariant;      // compiled with MATERIAL_VARIANT and the defines of materialFeatures
+    uint32_t materialFeatures;
 } Shader;
 
+// Uniforms are identified by their index in XM_PROGRAM_UNIFORMS. Each program maps them to its own locations.
+#define X(name, glslName) name,
+typedef enum UniformId {
+    XM_PROGRAM_UNIFORMS
+    UNIF_COUNT
+} UniformId;
+#undef X
+
+// Uniform values up to this size are remembered per program, so setting one to the value it already has is skipped.
+#define PROGRAM_UNIFORM_CACHE_WORDS 16
+
 typedef struct Program {
     Shader* vsh;
     Shader* fsh;
     GLuint object;
+    GLint uniforms [UNIF_COUNT]; // locations, -1 for uniforms the program doesn't use; refreshed on every link
+    uint8_t uniformCacheWords [UNIF_COUNT]; // size of the value in uniformCache, 0 if it isn't known
+    uint32_t uniformCache [UNIF_COUNT][PROGRAM_UNIFORM_CACHE_WORDS];
+    uint32_t materialFeatures;                  // features the program has variants for, 0 for variants themselves
+    struct Program* variants [MATFEAT_ALL + 1]; // by feature mask, NULL until added
+    volatile int32_t variantReady [MATFEAT_ALL + 1]; // set once the variant links and can be used from any thread
+    struct Program* base;                       // program this is a variant of, NULL for the others
 } Program;
 
 #define X(type, name, path) extern Shader name;
 XM_SHADERS
 #undef X
 
-#define X(name, vsh, fsh) extern Program name;
+#define X(name, vsh, fsh, features) extern Program name;
 XM_PROGRAMS
 #undef X
 
-#define X(name, glslName) extern GLint name;
-XM_PROGRAM_UNIFORMS
-#undef X
-
 #define X(name, location, glslName, gltfName) extern const GLint name;
 XM_PROGRAM_ATTRIBUTES
 #undef X
 
+#define X(name, location, glslName) extern const GLint name;
+XM_PROGRAM_INSTANCE_ATTRIBUTES
+#undef X
+
+#define X(name, binding, glslName) extern const GLuint name;
+XM_PROGRAM_UNIFORM_BLOCKS
+#undef X
+
 void InitProgramSystem (vxConfig* conf);
 void UpdatePrograms (vxConfig* conf);
 
+// Material variants. A program's shaders handle every material, sampling all texture slots and branching on material
+// constants. Variants are compiled from the same shaders with MATERIAL_VARIANT defined, plus the define of each
+// MaterialFeature the variant is for (after the config's define block), so they leave out what their materials don't
+// use. Programs list the features they have variants for in XM_PROGRAMS.
+//
+// Returns the variant of [p] for materials with the given features, or [p] itself if the variant hasn't been compiled
+// (yet). Doesn't touch GL, so it can be called from any thread.
+Program* GetProgramVariant (Program* p, uint32_t materialFeatures);
+// Compiles the variants of every program for materials with the given features, unless they already exist. Variants
+// are reloaded along with the other programs. GL thread only.
+void PrepareProgramVariants (uint32_t materialFeatures);
+
 extern size_t    gShaderCount;
 extern Shader**  gShaders;
 extern size_t    gProgramCount;
@@ -5,16 +5,91 @@
 void APIENTRY vxglDummyTextureBarrier() {}
 PFNGLTEXTUREBARRIERPROC vxglTextureBarrier = vxglDummyTextureBarrier;
 int vxglMaxTextureUnits = 16; // resonable default, apparently getting GL_MAX_TEXTURE_IMAGE_UNITS can fail
+bool vxglSupportsBaseInstance = false;
+bool vxglSupportsMultiDrawIndirect = false;
+bool vxglSupportsCopyImage = false;
+
+// Streaming buffer for per-instance data. It is filled front to back and orphaned when it runs out of space, so
+// uploads never overwrite data the GPU might still be reading.
+static GLuint sInstanceBuffer = 0;
+static size_t sInstanceBufferSlots = 4096;
+static size_t sInstanceBufferNext = 0;
+
+// Streaming buffer for the commands of indirect multi-draws, filled and orphaned like the instance buffer.
+typedef struct DrawElementsIndirectCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+} DrawElementsIndirectCommand;
+static GLuint sIndirectBuffer = 0;
+static size_t sIndirectBufferSlots = 1024;
+static size_t sIndirectBufferNext = 0;
+
+// Parameter arrays for multi-draw calls, reused between calls:
+static size_t sMultiDrawSlots = 0;
+static GLsizei* sMultiDrawCounts = NULL;
+static void** sMultiDrawOffsets = NULL;
+static GLint* sMultiDrawBaseVertices = NULL;
+static DrawElementsIndirectCommand* sMultiDrawCommands = NULL;
+
+// Streaming buffer for the view and draw uniform blocks, filled and orphaned the same way. Blocks are bound by range,
+// at offsets aligned to GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT. Orphaning throws away everything uploaded before, so each
+// orphan starts a new generation and render states upload their blocks again.
+static GLuint sUniformBuffer = 0;
+static size_t sUniformBufferSize = 256 * VX_KiB;
+static size_t sUniformBufferNext = 0;
+static uint32_t sUniformBufferGeneration = 1; // 0 marks render state blocks that haven't been uploaded
+static GLint sUniformBufferAlignment = 256;
+#define X(name, binding, glslName) + 1
+static size_t sBoundUniformOffsets [0 XM_PROGRAM_UNIFORM_BLOCKS]; // range bound to each binding point, or SIZE_MAX
+#undef X
+static GLuint sFrameUniformBuffer = 0;
+
+// Material table. Pages are MATERIAL_PAGE_SIZE entries apart, rounded up to GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT so each
+// can be bound by range. The buffer only grows, by copying it into a bigger one.
+static GLuint sMaterialBuffer = 0;
+static size_t sMaterialPageStride = 0;
+static size_t sMaterialSlots = 0;
+static Material** sMaterials = NULL;           // by table index, NULL for free entries
+static size_t sBoundMaterialPage = SIZE_MAX;   // page bound to UBO_MATERIALS
+
+// Everything SetRenderMaterial binds or sets apart from the material's table entry, plus the features that pick the
+// program variant. Materials with equal bind sets get the same bind set number.
+typedef struct MaterialBindSet {
+    uint32_t features;
+    GLuint arrays [MATERIAL_TEXTURE_SLOTS];
+    GLuint samplers [MATERIAL_TEXTURE_SLOTS];
+    GLenum blend [3];    // 0 if not blending
+    GLenum cullFace;     // 0 if not culling
+    GLenum depthFunc;    // 0 if not depth testing
+    bool depthWrite;
+    bool depthOnly;      // has a depth-only material, which changes the depth state after a depth prepass
+} MaterialBindSet;
+static size_t sBindSetCount = 0;
+static size_t sBindSetSlots = 0;
+static MaterialBindSet* sBindSets = NULL;
+
+// Texture uniforms by MaterialTextureSlot:
+static const UniformId sMaterialTextureUniforms [MATERIAL_TEXTURE_SLOTS] = {
+    UNIF_TEX_DIFFUSE, UNIF_TEX_OCC_RGH_MET, UNIF_TEX_OCCLUSION, UNIF_TEX_METALLIC, UNIF_TEX_ROUGHNESS, UNIF_TEX_NORMAL,
+};
 
 Material MAT_FULLSCREEN_QUAD;
 Material MAT_LIGHT_VOLUME;
 Material MAT_DIFFUSE_WHITE;
+Material MAT_DEPTH_ONLY;
+Material MAT_DEPTH_ONLY_DOUBLE_SIDED;
 Mesh MESH_QUAD;
 Mesh MESH_CUBE;
 
 void InitRenderSystem() {
     // Retrieve OpenGL properties:
     glGetIntegerv(GL_MAX_TEXTURE_IMAGE_UNITS, &vxglMaxTextureUnits);
+    if (vxglMaxTextureUnits < TEXUNIT_RESERVED_COUNT + 6) {
+        vxLog("Warning: only %d texture units, some material textures won't be bound", vxglMaxTextureUnits);
+    }
     
     // Retrieve the correct glTextureBarrier (regular or NV) function for this system:
     if (glfwExtensionSupported("GL_NV_texture_barrier")) {
@@ -25,6 +100,41 @@ void InitRenderSystem() {
         vxLog("Warning: this program requires the GL_*_texture_barrier extension.");
     }
 
+    // Without ARB_base_instance, instanced draws have to re-point the instance attributes for every draw.
+    vxglSupportsBaseInstance = glfwExtensionSupported("GL_ARB_base_instance");
+    // Indirect multi-draws let every draw start at its own instance, but only with ARB_base_instance as well (the
+    // base instance of an indirect command must be 0 otherwise).
+    vxglSupportsMultiDrawIndirect = vxglSupportsBaseInstance && glfwExtensionSupported("GL_ARB_draw_indirect") &&
+        glfwExtensionSupported("GL_ARB_multi_draw_indirect");
+    if (vxglSupportsMultiDrawIndirect) {
+        glGenBuffers(1, &sIndirectBuffer);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, sIndirectBuffer);
+        glBufferData(GL_DRAW_INDIRECT_BUFFER, sIndirectBufferSlots * sizeof(DrawElementsIndirectCommand), NULL,
+            GL_STREAM_DRAW);
+    }
+
+    // Create instance buffer:
+    glGenBuffers(1, &sInstanceBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, sInstanceBuffer);
+    glBufferData(GL_ARRAY_BUFFER, sInstanceBufferSlots * sizeof(InstanceData), NULL, GL_STREAM_DRAW);
+
+    // Create uniform buffers:
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &sUniformBufferAlignment);
+    sUniformBufferAlignment = vxMax(sUniformBufferAlignment, 1);
+    glGenBuffers(1, &sUniformBuffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, sUniformBuffer);
+    glBufferData(GL_UNIFORM_BUFFER, sUniformBufferSize, NULL, GL_STREAM_DRAW);
+    memset(sBoundUniformOffsets, 0xFF, sizeof(sBoundUniformOffsets));
+    glGenBuffers(1, &sFrameUniformBuffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, sFrameUniformBuffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameUniforms), NULL, GL_STREAM_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, UBO_FRAME, sFrameUniformBuffer);
+    size_t align = (size_t) sUniformBufferAlignment;
+    sMaterialPageStride = (MATERIAL_PAGE_SIZE * sizeof(MaterialData) + align - 1) / align * align;
+
+    // Material textures are copied into texture arrays when models are loaded, on the GPU if possible:
+    vxglSupportsCopyImage = glfwExtensionSupported("GL_ARB_copy_image");
+
     // Generate standard materials:
     InitMaterial(&MAT_FULLSCREEN_QUAD);
     MAT_FULLSCREEN_QUAD.depth_test = false;
@@ -39,6 +149,14 @@ void InitRenderSystem() {
     MAT_LIGHT_VOLUME.blend_dstf = GL_ONE;
     InitMaterial(&MAT_DIFFUSE_WHITE);
     MAT_DIFFUSE_WHITE.const_metallic = 0.0f;
+    InitMaterial(&MAT_DEPTH_ONLY);
+    InitMaterial(&MAT_DEPTH_ONLY_DOUBLE_SIDED);
+    MAT_DEPTH_ONLY_DOUBLE_SIDED.cull = false;
+    UpdateMaterial(&MAT_FULLSCREEN_QUAD);
+    UpdateMaterial(&MAT_LIGHT_VOLUME);
+    UpdateMaterial(&MAT_DIFFUSE_WHITE);
+    UpdateMaterial(&MAT_DEPTH_ONLY);
+    UpdateMaterial(&MAT_DEPTH_ONLY_DOUBLE_SIDED);
 
     // Generate standard upwards-facing quad mesh:
     {
@@ -190,8 +308,156 @@ void StartFrame (vxConfig* conf, GLFWwindow* window) {
     }
 }
 
+void SetFrameUniforms (vxConfig* conf, vxFrame* frame, vec2 jitter, vec2 jitterLast) {
+    FrameUniforms u = {0};
+    u.iResolution[0] = conf->displayW;
+    u.iResolution[1] = conf->displayH;
+    u.iTime = frame->t;
+    u.iFrame = (int32_t) frame->n;
+    glm_vec2_copy(jitter, u.uJitter);
+    glm_vec2_copy(jitterLast, u.uJitterLast);
+    glBindBuffer(GL_UNIFORM_BUFFER, sFrameUniformBuffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameUniforms), &u, GL_STREAM_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, UBO_FRAME, sFrameUniformBuffer);
+}
+
+// Copies a uniform block into the streaming buffer and returns its offset.
+static size_t sUploadUniforms (const void* data, size_t size) {
+    size_t align = (size_t) sUniformBufferAlignment;
+    size_t offset = (sUniformBufferNext + align - 1) / align * align;
+    glBindBuffer(GL_UNIFORM_BUFFER, sUniformBuffer);
+    if (offset + size > sUniformBufferSize) {
+        // Orphan the buffer instead of waiting for the GPU to finish with it:
+        glBufferData(GL_UNIFORM_BUFFER, sUniformBufferSize, NULL, GL_STREAM_DRAW);
+        sUniformBufferGeneration++;
+        memset(sBoundUniformOffsets, 0xFF, sizeof(sBoundUniformOffsets));
+        offset = 0;
+    }
+    glBufferSubData(GL_UNIFORM_BUFFER, (GLintptr) offset, (GLsizeiptr) size, data);
+    sUniformBufferNext = offset + size;
+    return offset;
+}
+
+static void sBindUniforms (GLuint binding, size_t offset, size_t size) {
+    if (sBoundUniformOffsets[binding] != offset) {
+        glBindBufferRange(GL_UNIFORM_BUFFER, binding, sUniformBuffer, (GLintptr) offset, (GLsizeiptr) size);
+        sBoundUniformOffsets[binding] = offset;
+    }
+}
+
+static void sUploadViewUniforms (RenderState* rs) {
+    ViewUniforms u;
+    glm_mat4_copy(rs->matView,     u.uViewMatrix);
+    glm_mat4_copy(rs->matProj,     u.uProjMatrix);
+    glm_mat4_copy(rs->matViewInv,  u.uInvViewMatrix);
+    glm_mat4_copy(rs->matProjInv,  u.uInvProjMatrix);
+    glm_mat4_copy(rs->matViewLast, u.uLastViewMatrix);
+    glm_mat4_copy(rs->matProjLast, u.uLastProjMatrix);
+    glm_mat4_copy(rs->matVP,       u.uVP);
+    glm_mat4_copy(rs->matVPInv,    u.uVPInv);
+    glm_mat4_copy(rs->matVPLast,   u.uVPLast);
+    glm_vec4(rs->camPos,     1.0f, u.uCameraPos);
+    glm_vec4(rs->camPosLast, 1.0f, u.uCameraPosLast);
+    rs->viewOffset = sUploadUniforms(&u, sizeof(u));
+    rs->viewGeneration = sUniformBufferGeneration;
+}
+
+static uint32_t sFindBindSet (Material* mat) {
+    MaterialBindSet set;
+    memset(&set, 0, sizeof(set)); // compared with memcmp
+    set.features = mat->features;
+    for (int t = 0; t < MATERIAL_TEXTURE_SLOTS; t++) {
+        set.arrays[t] = mat->textures[t].array;
+        set.samplers[t] = mat->textures[t].sampler;
+    }
+    if (mat->blend) {
+        set.blend[0] = mat->blend_srcf;
+        set.blend[1] = mat->blend_dstf;
+        set.blend[2] = mat->blend_func;
+    }
+    if (mat->cull) {
+        set.cullFace = mat->cull_face;
+    }
+    if (mat->depth_test) {
+        set.depthFunc = mat->depth_func;
+        set.depthWrite = mat->depth_write;
+    }
+    set.depthOnly = (GetDepthOnlyMaterial(mat) != NULL);
+    for (size_t i = 0; i < sBindSetCount; i++) {
+        if (memcmp(&sBindSets[i], &set, sizeof(set)) == 0) { return (uint32_t) i; }
+    }
+    if (sBindSetCount == sBindSetSlots) {
+        sBindSetSlots = vxMax(sBindSetSlots * 2, 64);
+        sBindSets = (MaterialBindSet*) vxAlignedRealloc(sBindSets, sBindSetSlots, sizeof(MaterialBindSet),
+            vxAlignOf(MaterialBindSet));
+    }
+    sBindSets[sBindSetCount] = set;
+    return (uint32_t) sBindSetCount++;
+}
+
+static void sGrowMaterialTable (size_t slots) {
+    size_t oldPages = sMaterialSlots / MATERIAL_PAGE_SIZE;
+    size_t pages = (slots + MATERIAL_PAGE_SIZE - 1) / MATERIAL_PAGE_SIZE;
+    GLuint buffer;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, pages * sMaterialPageStride, NULL, GL_STATIC_DRAW);
+    if (sMaterialBuffer != 0) {
+        glBindBuffer(GL_COPY_READ_BUFFER, sMaterialBuffer);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, oldPages * sMaterialPageStride);
+        glDeleteBuffers(1, &sMaterialBuffer);
+    }
+    sMaterialBuffer = buffer;
+    sBoundMaterialPage = SIZE_MAX;
+
+    sMaterials = (Material**) vxAlignedRealloc(sMaterials, pages * MATERIAL_PAGE_SIZE, sizeof(Material*),
+        vxAlignOf(Material*));
+    memset(&sMaterials[sMaterialSlots], 0, (pages * MATERIAL_PAGE_SIZE - sMaterialSlots) * sizeof(Material*));
+    sMaterialSlots = pages * MATERIAL_PAGE_SIZE;
+}
+
+void UpdateMaterial (Material* mat) {
+    if (mat->tableIndex < 0) {
+        size_t index = 0;
+        while (index < sMaterialSlots && sMaterials[index] != NULL) { index++; }
+        if (index == sMaterialSlots) {
+            sGrowMaterialTable(sMaterialSlots + 1);
+        }
+        sMaterials[index] = mat;
+        mat->tableIndex = (int32_t) index;
+    }
+    mat->bindSet = sFindBindSet(mat);
+    PrepareProgramVariants(mat->features);
+
+    MaterialData d = {0};
+    glm_vec4_copy(mat->const_diffuse, d.diffuse);
+    d.metallic  = mat->const_metallic;
+    d.roughness = mat->const_roughness;
+    d.occlusion = mat->const_occlusion;
+    if (mat->stipple) {
+        d.stipple = 1;
+        d.stippleHardCutoff = mat->stipple_hard_cutoff;
+        d.stippleSoftCutoff = mat->stipple_soft_cutoff;
+    }
+    for (int t = 0; t < MATERIAL_TEXTURE_SLOTS; t++) {
+        d.layers[t] = mat->textures[t].layer;
+    }
+    size_t page = (size_t) mat->tableIndex / MATERIAL_PAGE_SIZE;
+    size_t offset = page * sMaterialPageStride + (size_t)(mat->tableIndex % MATERIAL_PAGE_SIZE) * sizeof(MaterialData);
+    glBindBuffer(GL_UNIFORM_BUFFER, sMaterialBuffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, (GLintptr) offset, sizeof(MaterialData), &d);
+}
+
+void ReleaseMaterial (Material* mat) {
+    if (mat->tableIndex >= 0 && (size_t) mat->tableIndex < sMaterialSlots) {
+        sMaterials[mat->tableIndex] = NULL;
+    }
+    mat->tableIndex = -1;
+}
+
 void StartRenderPass (RenderState* rs, const char* passName) {
     rs->program = 0;
+    rs->currentProgram = NULL;
     rs->material = NULL;
     glm_mat4_identity(rs->matView);
     glm_mat4_identity(rs->matViewInv);
@@ -201,16 +467,18 @@ void StartRenderPass (RenderState* rs, const char* passName) {
     glm_mat4_identity(rs->matProjLast);
     glm_mat4_identity(rs->matModel);
     glm_mat4_identity(rs->matModelLast);
-    rs->nextFreeTextureUnit = 0;
-    rs->forceNoDepthTest = false;
+    rs->nextFreeTextureUnit = TEXUNIT_RESERVED_COUNT;
     rs->forceNoDepthTest = false;
+    rs->forceNoDepthWrite = false;
+    rs->depthPrepass = false;
+    rs->viewGeneration = 0;
 
-    // Reset OpenGL state as well:
+    // Reset OpenGL state as well (only what actually changed reaches the driver):
     // Avoids issues like the shadow framebuffer not being cleared because we disable depth writes at some point.
-    glDisable(GL_BLEND);
-    glDisable(GL_CULL_FACE);
-    glDisable(GL_DEPTH_TEST);
-    glDepthMask(GL_TRUE);
+    SetGLEnabled(GL_BLEND, false);
+    SetGLEnabled(GL_CULL_FACE, false);
+    SetGLEnabled(GL_DEPTH_TEST, false);
+    SetGLDepthMask(true);
 
     StartGPUBlock(passName);
 }
@@ -227,12 +495,14 @@ void SetViewMatrix (RenderState* rs, mat4 view, mat4 viewInv, mat4 viewLast) {
     glm_mat4_copy(view,     rs->matView);
     glm_mat4_copy(viewInv,  rs->matViewInv);
     glm_mat4_copy(viewLast, rs->matViewLast);
+    rs->viewGeneration = 0;
 }
 
 void SetProjMatrix (RenderState* rs, mat4 proj, mat4 projInv, mat4 projLast) {
     glm_mat4_copy(proj,     rs->matProj);
     glm_mat4_copy(projInv,  rs->matProjInv);
     glm_mat4_copy(projLast, rs->matProjLast);
+    rs->viewGeneration = 0;
 }
 
 void SetCamera (RenderState* rs, Camera* cam) {
@@ -251,6 +521,8 @@ void SetCamera (RenderState* rs, Camera* cam) {
     glm_mat4_mulv(viewInvLast, selector, camPosLast);
     glm_vec3_copy(camPos, rs->camPos);
     glm_vec3_copy(camPosLast, rs->camPosLast);
+    // Uploaded right away, so copies of the render state made for single draws share the block:
+    sUploadViewUniforms(rs);
 }
 
 void ResetModelMatrix (RenderState* rs) {
@@ -300,9 +572,66 @@ void MulModelScale (RenderState* rs, vec3 scl, vec3 sclLast) {
     glm_mat4_mul(rs->matVPLast, rs->matModelLast, rs->matMVPLast);
 }
 
+static inline GLint sUniformLocation (RenderState* rs, UniformId unif) {
+    return (rs->currentProgram != NULL) ? rs->currentProgram->uniforms[unif] : -1;
+}
+
+// Returns the uniform's location if it has to be set to the given value, or -1 if the current program doesn't use it
+// or already has that value. Values too large for the program's cache are always set.
+static GLint sUniformToSet (RenderState* rs, UniformId unif, const void* value, size_t size) {
+    Program* p = rs->currentProgram;
+    if (p == NULL || p->uniforms[unif] == -1) { return -1; }
+    size_t words = size / sizeof(uint32_t);
+    if (words > PROGRAM_UNIFORM_CACHE_WORDS) {
+        p->uniformCacheWords[unif] = 0;
+        return p->uniforms[unif];
+    }
+    if (p->uniformCacheWords[unif] == words && memcmp(p->uniformCache[unif], value, size) == 0) { return -1; }
+    memcpy(p->uniformCache[unif], value, size);
+    p->uniformCacheWords[unif] = (uint8_t) words;
+    return p->uniforms[unif];
+}
+
+void SetUniform1i (RenderState* rs, UniformId unif, int x) {
+    GLint loc = sUniformToSet(rs, unif, &x, sizeof(x));
+    if (loc != -1) { glUniform1i(loc, x); }
+}
+
+void SetUniform1f (RenderState* rs, UniformId unif, float x) {
+    GLint loc = sUniformToSet(rs, unif, &x, sizeof(x));
+    if (loc != -1) { glUniform1f(loc, x); }
+}
+
+void SetUniform2i (RenderState* rs, UniformId unif, int x, int y) {
+    int v [2] = {x, y};
+    GLint loc = sUniformToSet(rs, unif, v, sizeof(v));
+    if (loc != -1) { glUniform2i(loc, x, y); }
+}
+
+void SetUniform2f (RenderState* rs, UniformId unif, float x, float y) {
+    float v [2] = {x, y};
+    GLint loc = sUniformToSet(rs, unif, v, sizeof(v));
+    if (loc != -1) { glUniform2f(loc, x, y); }
+}
+
+void SetUniform3fv (RenderState* rs, UniformId unif, int count, const float* v) {
+    GLint loc = sUniformToSet(rs, unif, v, count * 3 * sizeof(float));
+    if (loc != -1) { glUniform3fv(loc, count, v); }
+}
+
+void SetUniform4fv (RenderState* rs, UniformId unif, int count, const float* v) {
+    GLint loc = sUniformToSet(rs, unif, v, count * 4 * sizeof(float));
+    if (loc != -1) { glUniform4fv(loc, count, v); }
+}
+
+void SetUniformMatrix4fv (RenderState* rs, UniformId unif, mat4 m) {
+    GLint loc = sUniformToSet(rs, unif, m, sizeof(mat4));
+    if (loc != -1) { glUniformMatrix4fv(loc, 1, false, (float*) m); }
+}
+
 // Binds a texture and sampler to an automatically-selected texture unit.
-// Returns the texture unit index (ranging from 0 to vxglMaxTextureUnits-1), or -1 if no units are available.
-// Note that the texture and sampler can be 0. See the OpenGL documentation for glBindTexture/glBindSampler.
+// Returns the texture unit index (ranging from TEXUNIT_RESERVED_COUNT to vxglMaxTextureUnits-1), or -1 if no units are
+// available. Note that the texture and sampler can be 0. See the OpenGL documentation for glBindTexture/glBindSampler.
 // The [target] parameter should be set to e.g. GL_TEXTURE_2D or GL_TEXTURE_CUBE_MAP.
 int BindTexture (RenderState* rs, GLenum target, GLuint texture, GLuint sampler) {
     if (rs->nextFreeTextureUnit >= vxglMaxTextureUnits) {
@@ -310,27 +639,37 @@ int BindTexture (RenderState* rs, GLenum target, GLuint texture, GLuint sampler)
         return -1;
     }
     int unit = rs->nextFreeTextureUnit++;
-    glActiveTexture(GL_TEXTURE0 + unit);
-    glBindTexture(target, texture);
-    glBindSampler(unit, sampler);
+    BindGLTexture(unit, target, texture, sampler);
     return unit;
 }
 
-// Binds a 2D texture and sampler to a given program uniform. Invalid uniforms (-1) are ignored.
+// Binds a 2D texture and sampler to a given program uniform. Uniforms the program doesn't use are ignored.
 // Note that the sampler can be set to 0 in order to use the texture's default sampling parameters.
-void SetUniformTextureSampler2D (RenderState* rs, GLint unif, GLuint tex, GLuint sampler) {
-    if (unif != -1) {
+void SetUniformTextureSampler2D (RenderState* rs, UniformId unif, GLuint tex, GLuint sampler) {
+    GLint loc = sUniformLocation(rs, unif);
+    if (loc != -1) {
         int unit = BindTexture(rs, GL_TEXTURE_2D, tex, sampler);
         if (unit != -1) {
-            glUniform1i(unif, unit);
+            SetUniform1i(rs, unif, unit);
+        }
+    }
+}
+
+// Binds a 2D array texture and sampler to a given program uniform. Uniforms the program doesn't use are ignored.
+void SetUniformTextureSampler2DArray (RenderState* rs, UniformId unif, GLuint tex, GLuint sampler) {
+    GLint loc = sUniformLocation(rs, unif);
+    if (loc != -1) {
+        int unit = BindTexture(rs, GL_TEXTURE_2D_ARRAY, tex, sampler);
+        if (unit != -1) {
+            SetUniform1i(rs, unif, unit);
         }
     }
 }
 
-// Binds a 2D texture to a given program uniform. Invalid uniforms (-1) are ignored.
+// Binds a 2D texture to a given program uniform. Uniforms the program doesn't use are ignored.
 // A sampler is automatically configured from the given sampling parameters.
-void SetUniformTexture2D (RenderState* rs, GLint unif, GLuint tex, GLenum min, GLenum mag, GLenum wrap) {
-    if (unif != -1) {
+void SetUniformTexture2D (RenderState* rs, UniformId unif, GLuint tex, GLenum min, GLenum mag, GLenum wrap) {
+    if (sUniformLocation(rs, unif) != -1) {
         GLuint sampler = VXGL_SAMPLER[rs->nextFreeTextureUnit];
         glSamplerParameteri(sampler, GL_TEXTURE_MIN_FILTER, min);
         glSamplerParameteri(sampler, GL_TEXTURE_MAG_FILTER, mag);
@@ -340,21 +679,22 @@ void SetUniformTexture2D (RenderState* rs, GLint unif, GLuint tex, GLenum min, G
     }
 }
 
-// Binds a cubemap texture and sampler to a given program uniform. Invalid uniforms (-1) are ignored.
+// Binds a cubemap texture and sampler to a given program uniform. Uniforms the program doesn't use are ignored.
 // Note that the sampler can be set to 0 in order to use the texture's default sampling parameters.
-void SetUniformTextureSamplerCube (RenderState* rs, GLint unif, GLuint tex, GLuint sampler) {
-    if (unif != -1) {
+void SetUniformTextureSamplerCube (RenderState* rs, UniformId unif, GLuint tex, GLuint sampler) {
+    GLint loc = sUniformLocation(rs, unif);
+    if (loc != -1) {
         int unit = BindTexture(rs, GL_TEXTURE_CUBE_MAP, tex, sampler);
         if (unit != -1) {
-            glUniform1i(unif, unit);
+            SetUniform1i(rs, unif, unit);
         }
     }
 }
 
-// Binds a cubemap texture to a given program uniform. Invalid uniforms (-1) are ignored.
+// Binds a cubemap texture to a given program uniform. Uniforms the program doesn't use are ignored.
 // A sampler is automatically configured from the given sampling parameters.
-void SetUniformTextureCube (RenderState* rs, GLint unif, GLuint tex, GLenum min, GLenum mag, GLenum wrap) {
-    if (unif != -1) {
+void SetUniformTextureCube (RenderState* rs, UniformId unif, GLuint tex, GLenum min, GLenum mag, GLenum wrap) {
+    if (sUniformLocation(rs, unif) != -1) {
         GLuint sampler = VXGL_SAMPLER[rs->nextFreeTextureUnit];
         glSamplerParameteri(sampler, GL_TEXTURE_MIN_FILTER, min);
         glSamplerParameteri(sampler, GL_TEXTURE_MAG_FILTER, mag);
@@ -365,33 +705,27 @@ void SetUniformTextureCube (RenderState* rs, GLint unif, GLuint tex, GLenum min,
     }
 }
 
+void BindNoiseTextures () {
+    BindGLTexture(TEXUNIT_BLUENOISE_64, GL_TEXTURE_2D, TEX_BLUENOISE_64, SMP_NEAREST_REPEAT);
+}
+
 void SetRenderProgram (RenderState* rs, Program* p) {
     rs->program = p->object;
-    
-    // Reset next TU and uniform locations:
-    rs->nextFreeTextureUnit = 0;
-    #define X(name, glslName) name = -1;
-    XM_PROGRAM_UNIFORMS
-    #undef X
+    rs->material = NULL; // material uniforms have to be set again for the new program
+    rs->nextFreeTextureUnit = TEXUNIT_RESERVED_COUNT;
+    // Locations are looked up when the program is linked, so switching programs only swaps the table:
+    rs->currentProgram = (p->object != 0) ? p : NULL;
 
     if (p->object != 0) {
-        glUseProgram(p->object);
-
-        // Retrieve uniform locations:
-        #define X(name, glslName) name = glGetUniformLocation(p->object, glslName);
-        XM_PROGRAM_UNIFORMS
-        #undef X
+        UseGLProgram(p->object);
 
-        // Set render target uniforms.
-        // Doing it here is a bit weird, but I can't think of any other good options.
-        // NOTE: Envmap render targets are only used when rendering the envmap and should never be bound as textures.
-        #define X(name, format) SetUniformTextureSampler2D(rs, UNIF_ ## name, name, SMP_LINEAR);
+        // Point the render target and noise texture samplers at their reserved units. Uniform values are cached per
+        // program, so this only reaches GL the first time a program is used after being linked.
+        #define X(name, format) SetUniform1i(rs, UNIF_ ## name, TEXUNIT_ ## name);
         XM_RENDERTARGETS_SCREEN
         XM_RENDERTARGETS_SHADOW
         #undef X
-
-        // Set noise texture uniforms:
-        SetUniformTextureSampler2D(rs, UNIF_BLUENOISE_64, TEX_BLUENOISE_64, SMP_NEAREST_REPEAT);
+        SetUniform1i(rs, UNIF_BLUENOISE_64, TEXUNIT_BLUENOISE_64);
     } else {
         vxLog("Warning: program (%s, %s) is not available", p->vsh->path, p->fsh->path);
     }
@@ -400,90 +734,135 @@ void SetRenderProgram (RenderState* rs, Program* p) {
 void SetRenderMaterial (RenderState* rs, Material* mat) {
     if (mat != rs->material) {
         rs->material = mat;
+        if (mat->tableIndex < 0) {
+            UpdateMaterial(mat);
+        }
 
+        // These go through the GL state cache, so switching between materials with the same state costs nothing:
+        SetGLEnabled(GL_BLEND, mat->blend);
         if (mat->blend) {
-            glEnable(GL_BLEND);
-            glBlendFunc(mat->blend_srcf, mat->blend_dstf);
-            glBlendEquation(mat->blend_func);
-        } else {
-            glDisable(GL_BLEND);
+            SetGLBlendFunc(mat->blend_srcf, mat->blend_dstf, mat->blend_func);
         }
 
+        SetGLEnabled(GL_CULL_FACE, mat->cull);
         if (mat->cull) {
-            glEnable(GL_CULL_FACE);
-            if (rs->forceCullFace == 0) {
-                glCullFace(mat->cull_face);
-            } else {
-                glCullFace(rs->forceCullFace);
-            }
-        } else {
-            glDisable(GL_CULL_FACE);
+            SetGLCullFace((rs->forceCullFace == 0) ? mat->cull_face : rs->forceCullFace);
         }
 
-        if (mat->depth_test && !rs->forceNoDepthTest) {
-            glEnable(GL_DEPTH_TEST);
-            glDepthFunc(mat->depth_func);
-            glDepthMask((mat->depth_write && !rs->forceNoDepthWrite) ? GL_TRUE : GL_FALSE);
-        } else {
-            glDisable(GL_DEPTH_TEST);
+        bool depthTest = mat->depth_test && !rs->forceNoDepthTest;
+        SetGLEnabled(GL_DEPTH_TEST, depthTest);
+        if (depthTest) {
+            bool prepassed = rs->depthPrepass && GetDepthOnlyMaterial(mat) != NULL;
+            SetGLDepthFunc(prepassed ? GL_EQUAL : mat->depth_func);
+            SetGLDepthMask(mat->depth_write && !rs->forceNoDepthWrite && !prepassed);
         }
 
-        if (mat->stipple) {
-            glUniform1i(UNIF_STIPPLE, 1);
-            glUniform1f(UNIF_STIPPLE_HARD_CUTOFF, mat->stipple_hard_cutoff);
-            glUniform1f(UNIF_STIPPLE_SOFT_CUTOFF, mat->stipple_soft_cutoff);
-        } else {
-            glUniform1i(UNIF_STIPPLE, 0);
+        // Materials with the same bind set get the same units (see RenderMesh), so this only reaches GL when the
+        // texture arrays change:
+        for (int t = 0; t < MATERIAL_TEXTURE_SLOTS; t++) {
+            SetUniformTextureSampler2DArray(rs, sMaterialTextureUniforms[t], mat->textures[t].array,
+                mat->textures[t].sampler);
         }
+    }
+}
 
-        glUniform4fv(UNIF_CONST_DIFFUSE, 1, (float*) mat->const_diffuse);
-        glUniform1f(UNIF_CONST_OCCLUSION,  mat->const_occlusion);
-        glUniform1f(UNIF_CONST_METALLIC,   mat->const_metallic);
-        glUniform1f(UNIF_CONST_ROUGHNESS,  mat->const_roughness);
-        SetUniformTextureSampler2D(rs, UNIF_TEX_DIFFUSE,      mat->tex_diffuse,       mat->smp_diffuse);
-        SetUniformTextureSampler2D(rs, UNIF_TEX_OCC_RGH_MET,  mat->tex_occ_rgh_met,   mat->smp_occ_rgh_met);
-        SetUniformTextureSampler2D(rs, UNIF_TEX_OCCLUSION,    mat->tex_occlusion,     mat->smp_occlusion);
-        SetUniformTextureSampler2D(rs, UNIF_TEX_METALLIC,     mat->tex_metallic,      mat->smp_metallic);
-        SetUniformTextureSampler2D(rs, UNIF_TEX_ROUGHNESS,    mat->tex_roughness,     mat->smp_roughness);
-        SetUniformTextureSampler2D(rs, UNIF_TEX_NORMAL,       mat->tex_normal,        mat->smp_normal);
+static void sSetInstanceAttribPointers (size_t baseInstance) {
+    glBindBuffer(GL_ARRAY_BUFFER, sInstanceBuffer);
+    size_t base = baseInstance * sizeof(InstanceData);
+    for (int i = 0; i < 4; i++) {
+        glVertexAttribPointer(ATTR_INSTANCE_MODEL + i, 4, GL_FLOAT, false, sizeof(InstanceData),
+            (void*)(base + offsetof(InstanceData, model) + i * sizeof(vec4)));
+        glVertexAttribPointer(ATTR_INSTANCE_MODEL_LAST + i, 4, GL_FLOAT, false, sizeof(InstanceData),
+            (void*)(base + offsetof(InstanceData, modelLast) + i * sizeof(vec4)));
     }
 }
 
-void RenderMesh (RenderState* rs, vxConfig* conf, vxFrame* frame, Mesh* mesh, Material* material) {
-    if (!mesh->gl_vertex_array || !mesh->gl_element_array) {
-        vxLog("Warning: mesh 0x%lx has no VAO (%u) or EBO (%u)", mesh, mesh->gl_vertex_array, mesh->gl_element_array);
-        return;
+// Makes a mesh's VAO read its model matrices from the instance buffer. Meshes without instance attributes use the
+// generic attribute values set by RenderMesh instead.
+static void sEnableInstanceAttributes (GLuint vao) {
+    BindGLVertexArray(vao);
+    sSetInstanceAttribPointers(0);
+    for (int i = 0; i < 4; i++) {
+        glEnableVertexAttribArray(ATTR_INSTANCE_MODEL + i);
+        glEnableVertexAttribArray(ATTR_INSTANCE_MODEL_LAST + i);
+        glVertexAttribDivisor(ATTR_INSTANCE_MODEL + i, 1);
+        glVertexAttribDivisor(ATTR_INSTANCE_MODEL_LAST + i, 1);
+    }
+    BindGLVertexArray(0);
+}
+
+void EnableInstanceAttributes (Mesh* mesh) {
+    sEnableInstanceAttributes(mesh->gl_vertex_array);
+    mesh->gl_instance_attribs = true;
+}
+
+static GLuint sCreateDepthVertexArray (GLuint positions, GLuint texcoords) {
+    GLuint vao;
+    glGenVertexArrays(1, &vao);
+    BindGLVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, positions);
+    glEnableVertexAttribArray(ATTR_POSITION);
+    glVertexAttribPointer(ATTR_POSITION, 3, GL_FLOAT, false, 3 * sizeof(float), NULL);
+    if (texcoords != 0) {
+        glBindBuffer(GL_ARRAY_BUFFER, texcoords);
+        glEnableVertexAttribArray(ATTR_TEXCOORD0);
+        glVertexAttribPointer(ATTR_TEXCOORD0, 2, GL_FLOAT, false, 2 * sizeof(float), NULL);
     }
+    sEnableInstanceAttributes(vao);
+    return vao;
+}
 
-    int saved_nextFreeTextureUnit = rs->nextFreeTextureUnit;
-    Material* saved_material = rs->material;
-
-    SetRenderMaterial(rs, material);
-    glUniformMatrix4fv(UNIF_MODEL_MATRIX,      1, false, (float*) rs->matModel);
-    glUniformMatrix4fv(UNIF_LAST_MODEL_MATRIX, 1, false, (float*) rs->matModelLast);
-    glUniformMatrix4fv(UNIF_PROJ_MATRIX,       1, false, (float*) rs->matProj);
-    glUniformMatrix4fv(UNIF_INV_PROJ_MATRIX,   1, false, (float*) rs->matProjInv);
-    glUniformMatrix4fv(UNIF_LAST_PROJ_MATRIX,  1, false, (float*) rs->matProjLast);
-    glUniformMatrix4fv(UNIF_VIEW_MATRIX,       1, false, (float*) rs->matView);
-    glUniformMatrix4fv(UNIF_INV_VIEW_MATRIX,   1, false, (float*) rs->matViewInv);
-    glUniformMatrix4fv(UNIF_LAST_VIEW_MATRIX,  1, false, (float*) rs->matViewLast);
-
-    glUniformMatrix4fv(UNIF_MVP,      1, false, (float*) rs->matMVP);
-    glUniformMatrix4fv(UNIF_MVP_LAST, 1, false, (float*) rs->matMVPLast);
-    glUniformMatrix4fv(UNIF_VP,       1, false, (float*) rs->matVP);
-    glUniformMatrix4fv(UNIF_VP_INV,   1, false, (float*) rs->matVPInv);
-    glUniformMatrix4fv(UNIF_VP_LAST,  1, false, (float*) rs->matVPLast);
-
-    glUniform3fv(UNIF_CAMERA_POS,      1, (float*) rs->camPos);
-    glUniform3fv(UNIF_CAMERA_POS_LAST, 1, (float*) rs->camPosLast);
-
-    glUniform2i(UNIF_IRESOLUTION, conf->displayW, conf->displayH);
-    glUniform1f(UNIF_ITIME,  frame->t);
-    glUniform1i(UNIF_IFRAME, (int) frame->n);
-
-    glBindVertexArray(mesh->gl_vertex_array);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->gl_element_array);
+void CreateDepthVertexArrays (GLuint positions, GLuint texcoords, GLuint* depthArray, GLuint* maskedArray) {
+    *depthArray = sCreateDepthVertexArray(positions, 0);
+    *maskedArray = (texcoords != 0) ? sCreateDepthVertexArray(positions, texcoords) : 0;
+}
 
+Material* GetDepthOnlyMaterial (Material* mat) {
+    if (mat->blend || mat->stipple || !mat->depth_test || !mat->depth_write || mat->depth_func != GL_GREATER) {
+        return NULL;
+    }
+    if (!mat->cull) {
+        return &MAT_DEPTH_ONLY_DOUBLE_SIDED;
+    }
+    return (mat->cull_face == GL_BACK) ? &MAT_DEPTH_ONLY : NULL;
+}
+
+// Copies instance data to the instance buffer and returns the index of the first uploaded instance, to be passed to
+// RenderMeshInstanced. Data stays valid until the end of the frame.
+size_t UploadInstances (InstanceData* instances, size_t count) {
+    glBindBuffer(GL_ARRAY_BUFFER, sInstanceBuffer);
+    if (count > sInstanceBufferSlots) {
+        sInstanceBufferSlots = count * 2;
+        glBufferData(GL_ARRAY_BUFFER, sInstanceBufferSlots * sizeof(InstanceData), NULL, GL_STREAM_DRAW);
+        sInstanceBufferNext = 0;
+    } else if (sInstanceBufferNext + count > sInstanceBufferSlots) {
+        // Orphan the buffer instead of waiting for the GPU to finish with it:
+        glBufferData(GL_ARRAY_BUFFER, sInstanceBufferSlots * sizeof(InstanceData), NULL, GL_STREAM_DRAW);
+        sInstanceBufferNext = 0;
+    }
+    size_t base = sInstanceBufferNext;
+    glBufferSubData(GL_ARRAY_BUFFER, base * sizeof(InstanceData), count * sizeof(InstanceData), instances);
+    sInstanceBufferNext += count;
+    return base;
+}
+
+// Binds the render state's view block, uploading it again if the streaming buffer was orphaned since, and the page of
+// the material table its material is in.
+static void sBindDrawUniforms (RenderState* rs) {
+    if (rs->viewGeneration != sUniformBufferGeneration) {
+        sUploadViewUniforms(rs);
+    }
+    sBindUniforms(UBO_VIEW, rs->viewOffset, sizeof(ViewUniforms));
+    size_t page = (rs->material != NULL) ? (size_t) rs->material->tableIndex / MATERIAL_PAGE_SIZE : 0;
+    if (page != sBoundMaterialPage && sMaterialBuffer != 0) {
+        glBindBufferRange(GL_UNIFORM_BUFFER, UBO_MATERIALS, sMaterialBuffer, (GLintptr)(page * sMaterialPageStride),
+            (GLsizeiptr)(MATERIAL_PAGE_SIZE * sizeof(MaterialData)));
+        sBoundMaterialPage = page;
+    }
+}
+
+bool ResolveIndexedDraw (Mesh* mesh, IndexedDraw* draw) {
+    memset(draw, 0, sizeof(IndexedDraw));
     GLsizei elementCount = mesh->gl_element_count * FAccessorComponentCount(mesh->gl_element_type);
     GLenum componentType = 0;
     size_t triangleCount = 0;
@@ -494,18 +873,188 @@ void RenderMesh (RenderState* rs, vxConfig* conf, vxFrame* frame, Mesh* mesh, Ma
         case FACCESSOR_UINT16_VEC3: { componentType = GL_UNSIGNED_SHORT; triangleCount = elementCount;     break; }
         case FACCESSOR_UINT32:      { componentType = GL_UNSIGNED_INT;   triangleCount = elementCount / 3; break; }
         case FACCESSOR_UINT32_VEC3: { componentType = GL_UNSIGNED_INT;   triangleCount = elementCount;     break; }
-        default: { vxLog("Warning: Mesh 0x%lx has unknown index accessor type %ju", mesh, mesh->gl_element_type); }
+        default: {
+            vxLog("Warning: Mesh 0x%lx has unknown index accessor type %ju", mesh, mesh->gl_element_type);
+            return false;
+        }
+    }
+    draw->vao = mesh->gl_vertex_array;
+    draw->ebo = mesh->gl_element_array;
+    draw->mode = mesh->type;
+    draw->indexType = componentType;
+    draw->indexCount = elementCount;
+    draw->firstIndex = (uint32_t) mesh->gl_first_index;
+    draw->baseVertex = mesh->gl_base_vertex;
+    draw->triangles = (uint32_t) triangleCount;
+    draw->vertices = (uint32_t) mesh->gl_vertex_count;
+    draw->instanced = mesh->gl_instance_attribs;
+    draw->instanceCount = 1;
+    return true;
+}
+
+static void* sIndexOffset (IndexedDraw* draw) {
+    size_t indexSize = 4;
+    switch (draw->indexType) {
+        case GL_UNSIGNED_BYTE:  { indexSize = 1; break; }
+        case GL_UNSIGNED_SHORT: { indexSize = 2; break; }
+    }
+    return (void*)((size_t) draw->firstIndex * indexSize);
+}
+
+static void sCountDraw (vxFrame* frame, IndexedDraw* draw) {
+    frame->perfTriangles += (uint64_t) draw->triangles * draw->instanceCount;
+    frame->perfVertices += (uint64_t) draw->vertices * draw->instanceCount;
+}
+
+// Issues the draw call for a resolved draw whose VAO is already bound.
+static void sIssueDraw (vxFrame* frame, IndexedDraw* draw, size_t baseInstance) {
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, draw->ebo);
+    size_t firstInstance = baseInstance + draw->firstInstance;
+    void* offset = sIndexOffset(draw);
+    if (!draw->instanced) {
+        glDrawElementsBaseVertex(draw->mode, draw->indexCount, draw->indexType, offset, draw->baseVertex);
+    } else if (vxglSupportsBaseInstance) {
+        glDrawElementsInstancedBaseVertexBaseInstance(draw->mode, draw->indexCount, draw->indexType, offset,
+            (GLsizei) draw->instanceCount, draw->baseVertex, (GLuint) firstInstance);
+    } else {
+        sSetInstanceAttribPointers(firstInstance);
+        glDrawElementsInstancedBaseVertex(draw->mode, draw->indexCount, draw->indexType, offset,
+            (GLsizei) draw->instanceCount, draw->baseVertex);
+    }
+    frame->perfDrawCalls += 1;
+    sCountDraw(frame, draw);
+}
+
+// Copies indirect draw commands to the indirect buffer, which is left bound. Returns their offset in bytes.
+static size_t sUploadIndirectCommands (DrawElementsIndirectCommand* commands, size_t count) {
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, sIndirectBuffer);
+    if (count > sIndirectBufferSlots || sIndirectBufferNext + count > sIndirectBufferSlots) {
+        sIndirectBufferSlots = vxMax(sIndirectBufferSlots, count * 2);
+        glBufferData(GL_DRAW_INDIRECT_BUFFER, sIndirectBufferSlots * sizeof(DrawElementsIndirectCommand), NULL,
+            GL_STREAM_DRAW);
+        sIndirectBufferNext = 0;
+    }
+    size_t offset = sIndirectBufferNext * sizeof(DrawElementsIndirectCommand);
+    glBufferSubData(GL_DRAW_INDIRECT_BUFFER, offset, count * sizeof(DrawElementsIndirectCommand), commands);
+    sIndirectBufferNext += count;
+    return offset;
+}
+
+void RenderIndexedDraw (RenderState* rs, vxFrame* frame, IndexedDraw* draw, size_t baseInstance) {
+    sBindDrawUniforms(rs);
+    BindGLVertexArray(draw->vao);
+    sIssueDraw(frame, draw, baseInstance);
+}
+
+void RenderIndexedDraws (RenderState* rs, vxFrame* frame, IndexedDraw* const* draws, size_t count,
+    size_t baseInstance)
+{
+    if (count == 0) { return; }
+    if (count == 1) {
+        RenderIndexedDraw(rs, frame, draws[0], baseInstance);
+        return;
     }
+    if (count > sMultiDrawSlots) {
+        sMultiDrawSlots = count * 2;
+        sMultiDrawCounts = (GLsizei*) vxAlignedRealloc(sMultiDrawCounts, sMultiDrawSlots, sizeof(GLsizei),
+            vxAlignOf(GLsizei));
+        sMultiDrawOffsets = (void**) vxAlignedRealloc(sMultiDrawOffsets, sMultiDrawSlots, sizeof(void*),
+            vxAlignOf(void*));
+        sMultiDrawBaseVertices = (GLint*) vxAlignedRealloc(sMultiDrawBaseVertices, sMultiDrawSlots, sizeof(GLint),
+            vxAlignOf(GLint));
+        sMultiDrawCommands = (DrawElementsIndirectCommand*) vxAlignedRealloc(sMultiDrawCommands, sMultiDrawSlots,
+            sizeof(DrawElementsIndirectCommand), vxAlignOf(DrawElementsIndirectCommand));
+    }
+
+    IndexedDraw* first = draws[0];
+    sBindDrawUniforms(rs);
+    BindGLVertexArray(first->vao);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, first->ebo);
+    if (vxglSupportsMultiDrawIndirect) {
+        // Every command starts at its own instances, like the draws it replaces:
+        for (size_t i = 0; i < count; i++) {
+            DrawElementsIndirectCommand* cmd = &sMultiDrawCommands[i];
+            cmd->count = (GLuint) draws[i]->indexCount;
+            cmd->instanceCount = draws[i]->instanceCount;
+            cmd->firstIndex = draws[i]->firstIndex;
+            cmd->baseVertex = draws[i]->baseVertex;
+            cmd->baseInstance = (GLuint)(baseInstance + draws[i]->firstInstance);
+            sCountDraw(frame, draws[i]);
+        }
+        size_t offset = sUploadIndirectCommands(sMultiDrawCommands, count);
+        glMultiDrawElementsIndirect(first->mode, first->indexType, (void*) offset, (GLsizei) count, 0);
+    } else {
+        // All draws read the first draw's instance, since there is no draw index to offset it by:
+        for (size_t i = 0; i < count; i++) {
+            sMultiDrawCounts[i] = draws[i]->indexCount;
+            sMultiDrawOffsets[i] = sIndexOffset(draws[i]);
+            sMultiDrawBaseVertices[i] = draws[i]->baseVertex;
+            sCountDraw(frame, draws[i]);
+        }
+        sSetInstanceAttribPointers(baseInstance + first->firstInstance);
+        glMultiDrawElementsBaseVertex(first->mode, sMultiDrawCounts, first->indexType,
+            (const void* const*) sMultiDrawOffsets, (GLsizei) count, sMultiDrawBaseVertices);
+        if (vxglSupportsBaseInstance) {
+            sSetInstanceAttribPointers(0); // where base instance draws expect them
+        }
+    }
+    frame->perfDrawCalls += 1;
+}
+
+void RenderMesh (RenderState* rs, vxConfig* conf, vxFrame* frame, Mesh* mesh, Material* material) {
+    if (!mesh->gl_vertex_array || !mesh->gl_element_array) {
+        vxLog("Warning: mesh 0x%lx has no VAO (%u) or EBO (%u)", mesh, mesh->gl_vertex_array, mesh->gl_element_array);
+        return;
+    }
+
+    // The material stays set after the draw, so consecutive draws with the same material (e.g. from a sorted draw
+    // list) skip SetRenderMaterial. Its textures stay bound to the units after saved_nextFreeTextureUnit.
+    int saved_nextFreeTextureUnit = rs->nextFreeTextureUnit;
+
+    IndexedDraw draw;
+    if (ResolveIndexedDraw(mesh, &draw)) {
+        SetRenderMaterial(rs, material);
+        InstanceData instance;
+        glm_mat4_copy(rs->matModel,     instance.model);
+        glm_mat4_copy(rs->matModelLast, instance.modelLast);
+        SetInstanceMaterial(instance.model, material);
+        if (mesh->gl_instance_attribs) {
+            RenderIndexedDraw(rs, frame, &draw, UploadInstances(&instance, 1));
+        } else {
+            // The instance attributes aren't enabled in this mesh's VAO, so the shader sees the generic attribute
+            // values:
+            for (int i = 0; i < 4; i++) {
+                glVertexAttrib4fv(ATTR_INSTANCE_MODEL + i,      (float*) instance.model[i]);
+                glVertexAttrib4fv(ATTR_INSTANCE_MODEL_LAST + i, (float*) instance.modelLast[i]);
+            }
+            RenderIndexedDraw(rs, frame, &draw, 0);
+        }
+    }
+
+    rs->nextFreeTextureUnit = saved_nextFreeTextureUnit;
+}
+
+// Draws [instanceCount] instances of a mesh, using the instance data previously uploaded at [baseInstance], which has
+// to point at the material (see SetInstanceMaterial). The model matrices in the render state are ignored.
+void RenderMeshInstanced (RenderState* rs, vxConfig* conf, vxFrame* frame, Mesh* mesh, Material* material,
+    size_t baseInstance, size_t instanceCount)
+{
+    if (!mesh->gl_vertex_array || !mesh->gl_element_array || !mesh->gl_instance_attribs) {
+        vxLog("Warning: mesh 0x%lx has no VAO (%u), EBO (%u) or instance attributes",
+            mesh, mesh->gl_vertex_array, mesh->gl_element_array);
+        return;
+    }
+
+    int saved_nextFreeTextureUnit = rs->nextFreeTextureUnit;
 
-    if (componentType != 0) {
-        glDrawElements(mesh->type, elementCount, componentType, NULL);
-        frame->perfDrawCalls += 1;
-        frame->perfTriangles += triangleCount;
-        frame->perfVertices += mesh->gl_vertex_count;
+    IndexedDraw draw;
+    if (ResolveIndexedDraw(mesh, &draw)) {
+        draw.instanceCount = (uint32_t) instanceCount;
+        SetRenderMaterial(rs, material);
+        RenderIndexedDraw(rs, frame, &draw, baseInstance);
     }
 
     rs->nextFreeTextureUnit = saved_nextFreeTextureUnit;
-    rs->material = saved_material;
 }
 
 void RenderModel (RenderState* rs, vxConfig* conf, vxFrame* frame, Model* model) {
@@ -5,23 +5,106 @@
 #include "data/model.h"
 #include "data/camera.h"
 #include "render/program.h"
+#include "render/glstate.h"
 
 typedef struct GLFWwindow GLFWwindow;
 
 extern PFNGLTEXTUREBARRIERPROC vxglTextureBarrier;
 extern int vxglMaxTextureUnits;
+extern bool vxglSupportsBaseInstance;
+extern bool vxglSupportsMultiDrawIndirect;
+extern bool vxglSupportsCopyImage;
 
 extern Material MAT_FULLSCREEN_QUAD;
 extern Material MAT_LIGHT_VOLUME;
 extern Material MAT_DIFFUSE_WHITE;
+extern Material MAT_DEPTH_ONLY;
+extern Material MAT_DEPTH_ONLY_DOUBLE_SIDED;
 extern Mesh MESH_QUAD;
 extern Mesh MESH_CUBE;
 
 void InitRenderSystem();
 void StartFrame (vxConfig* conf, GLFWwindow* window);
 
+// Texture units reserved for the render targets and the noise texture. Render targets are bound by the render graph
+// when a pass reads them, the noise texture once per frame by BindNoiseTextures. Programs only point their sampler
+// uniforms at these units. Material textures use the units after them.
+#define X(name, format) TEXUNIT_ ## name,
+typedef enum ReservedTextureUnit {
+    XM_RENDERTARGETS_SCREEN
+    XM_RENDERTARGETS_SHADOW
+    TEXUNIT_BLUENOISE_64,
+    TEXUNIT_RESERVED_COUNT
+} ReservedTextureUnit;
+#undef X
+
+// Formats of the render targets, to declare them to the render graph with.
+#define X(name, format) static const GLenum FORMAT_ ## name = format;
+XM_RENDERTARGETS_SCREEN
+XM_RENDERTARGETS_SHADOW
+#undef X
+
+// Binds the noise texture to its reserved unit. Call once per frame, after the GL state cache was invalidated.
+void BindNoiseTextures ();
+
+// Contents of the uniform blocks in XM_PROGRAM_UNIFORM_BLOCKS, laid out as std140. Field names match the GLSL ones.
+// FrameUniforms is uploaded once per frame and ViewUniforms whenever the camera changes (SetCamera), into a streaming
+// buffer that is bound by range. MaterialUniforms is a page of the material table, see below.
+typedef struct FrameUniforms {
+    int32_t iResolution [2];
+    float iTime;
+    int32_t iFrame;
+    vec2 uJitter;
+    vec2 uJitterLast;
+} FrameUniforms;
+
+typedef struct ViewUniforms {
+    mat4 uViewMatrix;
+    mat4 uProjMatrix;
+    mat4 uInvViewMatrix;
+    mat4 uInvProjMatrix;
+    mat4 uLastViewMatrix;
+    mat4 uLastProjMatrix;
+    mat4 uVP;
+    mat4 uVPInv;
+    mat4 uVPLast;
+    vec4 uCameraPos;     // vec3 in GLSL, padded to 16 bytes by std140
+    vec4 uCameraPosLast;
+} ViewUniforms;
+
+// Material table. Every material that is drawn has its constants and texture layers in a table that stays on the GPU,
+// written by UpdateMaterial. The table is bound to UBO_MATERIALS one page at a time, as the uMaterials array of
+// MaterialUniforms, and draws pick their entry through their instance data (see SetInstanceMaterial). Switching
+// between materials of the same bind set and page therefore changes no GL state at all, and their draws can be merged
+// into one multi-draw. Shaders get the page size as MATERIAL_PAGE_SIZE from the define block.
+#define MATERIAL_PAGE_SIZE 128
+
+typedef struct MaterialData {
+    vec4 diffuse;
+    float metallic;
+    float roughness;
+    float occlusion;
+    int32_t stipple;
+    float stippleHardCutoff;
+    float stippleSoftCutoff;
+    float padding [2];
+    int32_t layers [8];  // by MaterialTextureSlot, ivec4 layers0 and ivec2 layers1 in GLSL
+} MaterialData;
+
+// Adds a material to the material table, or writes its entry again after it was changed. Also works out its bind set
+// and compiles the program variants for its features (see GetProgramVariant). Materials are added on their first
+// SetRenderMaterial otherwise, which is too late for command buffers, so materials that go into draw lists have to be
+// added when they're created. GL thread only.
+void UpdateMaterial (Material* mat);
+// Frees a material's table entry, e.g. when its model is unloaded.
+void ReleaseMaterial (Material* mat);
+
+// Uploads the per-frame uniform block. Call once per frame, before rendering anything.
+void SetFrameUniforms (vxConfig* conf, vxFrame* frame, vec2 jitter, vec2 jitterLast);
+
 typedef struct RenderState {
     GLuint program;
+    Program* currentProgram; // NULL if there is none
     Material* material;
     mat4 matView;
     mat4 matViewInv;
@@ -38,10 +121,17 @@ typedef struct RenderState {
     mat4 matVPLast;
     vec3 camPos;
     vec3 camPosLast;
+    // Where this state's ViewUniforms are in the uniform streaming buffer. The offset is only valid while the
+    // generation matches the buffer's, which changes whenever it's orphaned.
+    size_t viewOffset;
+    uint32_t viewGeneration;
     int nextFreeTextureUnit;
     bool forceNoDepthTest;
     bool forceNoDepthWrite;
     GLenum forceCullFace;
+    // The depth of draws with depth-only materials (see GetDepthOnlyMaterial) is already in the depth buffer, so they
+    // test for equal depth and don't write it. Vertex shaders that draw them declare gl_Position as invariant.
+    bool depthPrepass;
 } RenderState;
 
 void StartRenderPass (RenderState* rs, const char* passName);
@@ -62,14 +152,92 @@ void MulModelPosition (RenderState* rs, vec3 pos, vec3 posLast);
 void MulModelRotation (RenderState* rs, versor rot, versor rotLast);
 void MulModelScale (RenderState* rs, vec3 scl, vec3 sclLast);
 
+// Uniform setters for the current program (see SetRenderProgram). Uniforms it doesn't use are skipped, and so are
+// values the program already has.
+void SetUniform1i (RenderState* rs, UniformId unif, int x);
+void SetUniform1f (RenderState* rs, UniformId unif, float x);
+void SetUniform2i (RenderState* rs, UniformId unif, int x, int y);
+void SetUniform2f (RenderState* rs, UniformId unif, float x, float y);
+void SetUniform3fv (RenderState* rs, UniformId unif, int count, const float* v);
+void SetUniform4fv (RenderState* rs, UniformId unif, int count, const float* v);
+void SetUniformMatrix4fv (RenderState* rs, UniformId unif, mat4 m);
+
 int BindTexture (RenderState* rs, GLenum target, GLuint texture, GLuint sampler);
-void SetUniformTextureSampler2D (RenderState* rs, GLint unif, GLuint tex, GLuint sampler);
-void SetUniformTexture2D (RenderState* rs, GLint unif, GLuint tex, GLenum min, GLenum mag, GLenum wrap);
-void SetUniformTextureSamplerCube (RenderState* rs, GLint unif, GLuint tex, GLuint sampler);
-void SetUniformTextureCube (RenderState* rs, GLint unif, GLuint tex, GLenum min, GLenum mag, GLenum wrap);
+void SetUniformTextureSampler2D (RenderState* rs, UniformId unif, GLuint tex, GLuint sampler);
+void SetUniformTextureSampler2DArray (RenderState* rs, UniformId unif, GLuint tex, GLuint sampler);
+void SetUniformTexture2D (RenderState* rs, UniformId unif, GLuint tex, GLenum min, GLenum mag, GLenum wrap);
+void SetUniformTextureSamplerCube (RenderState* rs, UniformId unif, GLuint tex, GLuint sampler);
+void SetUniformTextureCube (RenderState* rs, UniformId unif, GLuint tex, GLenum min, GLenum mag, GLenum wrap);
 
 void SetRenderProgram (RenderState* rs, Program* p);
 void SetRenderMaterial (RenderState* rs, Material* mat);
 
+// Per-instance data, read by vertex shaders through the ATTR_INSTANCE_* attributes. Model matrices are affine, so the
+// bottom row of [model] is always (0, 0, 0, 1). Its first element carries the instance's index into the bound page of
+// the material table instead, and shaders put the 0 back before using the matrix.
+typedef struct InstanceData {
+    mat4 model;
+    mat4 modelLast;
+} InstanceData;
+
+static inline void SetInstanceMaterial (mat4 model, Material* mat) {
+    model[0][3] = (float)((mat->tableIndex >= 0) ? mat->tableIndex % MATERIAL_PAGE_SIZE : 0);
+}
+
+void EnableInstanceAttributes (Mesh* mesh);
+size_t UploadInstances (InstanceData* instances, size_t count);
+
+// Depth-only draws. Opaque meshes only need their positions to write depth, so depth-only passes (the shadow map) draw
+// them with PROG_DEPTH through a VAO that reads nothing else, and with one of the MAT_DEPTH_ONLY* materials instead of
+// their own, which binds no textures and lets draws of different materials be merged.
+//
+// Makes the depth-only VAOs of a mesh from its position and (optional) texture coordinate buffers, which have to hold
+// tightly packed floats. The VAOs read the instance attributes, and [maskedArray] is 0 if [texcoords] is.
+void CreateDepthVertexArrays (GLuint positions, GLuint texcoords, GLuint* depthArray, GLuint* maskedArray);
+// Returns the material depth-only draws of [mat] use, or NULL if [mat] has to be drawn with its own (e.g. because of
+// an alpha mask, blending, or depth and cull state the MAT_DEPTH_ONLY* materials don't have).
+Material* GetDepthOnlyMaterial (Material* mat);
+
+// A mesh draw with everything the GL calls need worked out beforehand, so it can be prepared on any thread and issued
+// later on the GL thread (see render/commands.h).
+typedef struct IndexedDraw {
+    GLuint vao;
+    GLuint ebo;
+    GLenum mode;
+    GLenum indexType;
+    GLsizei indexCount;
+    uint32_t firstIndex;    // offset into the element array, in indices
+    int32_t baseVertex;
+    uint32_t triangles;     // per instance, for the frame stats
+    uint32_t vertices;
+    bool instanced;         // the VAO reads the instance attributes, see EnableInstanceAttributes
+    uint32_t firstInstance; // added to the base instance given to RenderIndexedDraw
+    uint32_t instanceCount;
+} IndexedDraw;
+
+// Fills in a single-instance draw of the mesh. Returns false (with a warning) if the mesh can't be drawn. Doesn't call GL.
+bool ResolveIndexedDraw (Mesh* mesh, IndexedDraw* draw);
+// Issues a resolved draw with the render state's material, see SetRenderMaterial.
+void RenderIndexedDraw (RenderState* rs, vxFrame* frame, IndexedDraw* draw, size_t baseInstance);
+// Whether two materials can be switched between without changing any GL state or program variant, and their draws
+// merged.
+static inline bool SameMaterialBindSet (Material* a, Material* b) {
+    return a->bindSet == b->bindSet && a->tableIndex >= 0 && b->tableIndex >= 0 &&
+           a->tableIndex / MATERIAL_PAGE_SIZE == b->tableIndex / MATERIAL_PAGE_SIZE;
+}
+
+// Whether two resolved draws can be issued by the same RenderIndexedDraws call.
+static inline bool CanMultiDraw (IndexedDraw* a, IndexedDraw* b) {
+    return a->vao == b->vao && a->ebo == b->ebo && a->mode == b->mode && a->indexType == b->indexType &&
+           a->instanced && b->instanced;
+}
+// Issues several resolved draws with a single multi-draw call (glMultiDrawElementsIndirect where supported, otherwise
+// glMultiDrawElementsBaseVertex). All pairs of draws must pass CanMultiDraw. Without vxglSupportsMultiDrawIndirect,
+// every draw reads the instance data of the first one, so draws may only be merged if theirs is the same.
+void RenderIndexedDraws (RenderState* rs, vxFrame* frame, IndexedDraw* const* draws, size_t count,
+    size_t baseInstance);
+
 void RenderMesh  (RenderState* rs, vxConfig* conf, vxFrame* frame, Mesh* mesh, Material* material);
+void RenderMeshInstanced (RenderState* rs, vxConfig* conf, vxFrame* frame, Mesh* mesh, Material* material,
+    size_t baseInstance, size_t instanceCount);
 void RenderModel (RenderState* rs, vxConfig* conf, vxFrame* frame, Model* model);
\ No newline at end of file
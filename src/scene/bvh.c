@@ -0,0 +1,508 @@
+#include "bvh.h"
+
+// Maximum traversal stack depth. Balanced trees with a few million leaves are nowhere near this deep.
+#define BVH_STACK_SIZE 256
+
+static inline bool sIsLeaf (BVHNode* node) {
+    return node->child1 == BVH_NULL;
+}
+
+static inline float sSurfaceArea (vec3 min, vec3 max) {
+    float dx = max[0] - min[0];
+    float dy = max[1] - min[1];
+    float dz = max[2] - min[2];
+    return 2.0f * (dx * dy + dy * dz + dz * dx);
+}
+
+static inline void sUnion (vec3 amin, vec3 amax, vec3 bmin, vec3 bmax, vec3 outMin, vec3 outMax) {
+    for (int i = 0; i < 3; i++) {
+        outMin[i] = vxMin(amin[i], bmin[i]);
+        outMax[i] = vxMax(amax[i], bmax[i]);
+    }
+}
+
+static inline bool sContains (vec3 outerMin, vec3 outerMax, vec3 innerMin, vec3 innerMax) {
+    return outerMin[0] <= innerMin[0] && outerMin[1] <= innerMin[1] && outerMin[2] <= innerMin[2] &&
+           outerMax[0] >= innerMax[0] && outerMax[1] >= innerMax[1] && outerMax[2] >= innerMax[2];
+}
+
+static inline bool sOverlaps (vec3 amin, vec3 amax, vec3 bmin, vec3 bmax) {
+    return amin[0] <= bmax[0] && amin[1] <= bmax[1] && amin[2] <= bmax[2] &&
+           amax[0] >= bmin[0] && amax[1] >= bmin[1] && amax[2] >= bmin[2];
+}
+
+void InitBVH (BVH* bvh, float margin) {
+    vxCheck(bvh != NULL);
+    memset(bvh, 0, sizeof(BVH));
+    bvh->root = BVH_NULL;
+    bvh->freeList = BVH_NULL;
+    bvh->margin = margin;
+}
+
+void DeleteBVH (BVH* bvh) {
+    if (bvh == NULL) { return; }
+    if (bvh->nodes != NULL) {
+        vxFree(bvh->nodes);
+    }
+    InitBVH(bvh, bvh->margin);
+}
+
+static int32_t sAllocNode (BVH* bvh) {
+    if (bvh->freeList == BVH_NULL) {
+        size_t oldSlots = bvh->nodeSlots;
+        bvh->nodeSlots = vxMax(oldSlots * 2, 64);
+        bvh->nodes = (BVHNode*) vxAlignedRealloc(bvh->nodes, bvh->nodeSlots, sizeof(BVHNode), vxAlignOf(BVHNode));
+        for (size_t i = oldSlots; i < bvh->nodeSlots; i++) {
+            bvh->nodes[i].parent = (i + 1 < bvh->nodeSlots) ? (int32_t)(i + 1) : BVH_NULL;
+            bvh->nodes[i].height = -1;
+        }
+        bvh->freeList = (int32_t) oldSlots;
+    }
+    int32_t index = bvh->freeList;
+    BVHNode* node = &bvh->nodes[index];
+    bvh->freeList = node->parent;
+    node->parent = BVH_NULL;
+    node->child1 = BVH_NULL;
+    node->child2 = BVH_NULL;
+    node->height = 0;
+    node->data = 0;
+    bvh->nodeCount++;
+    return index;
+}
+
+static void sFreeNode (BVH* bvh, int32_t index) {
+    vxAssert(index >= 0 && (size_t) index < bvh->nodeSlots);
+    bvh->nodes[index].parent = bvh->freeList;
+    bvh->nodes[index].height = -1;
+    bvh->freeList = index;
+    bvh->nodeCount--;
+}
+
+// Performs a left or right rotation if node A is imbalanced. Returns the new root of the subtree.
+static int32_t sBalance (BVH* bvh, int32_t iA) {
+    BVHNode* A = &bvh->nodes[iA];
+    if (sIsLeaf(A) || A->height < 2) {
+        return iA;
+    }
+
+    int32_t iB = A->child1;
+    int32_t iC = A->child2;
+    BVHNode* B = &bvh->nodes[iB];
+    BVHNode* C = &bvh->nodes[iC];
+    int32_t balance = C->height - B->height;
+
+    // Rotate C up:
+    if (balance > 1) {
+        int32_t iF = C->child1;
+        int32_t iG = C->child2;
+        BVHNode* F = &bvh->nodes[iF];
+        BVHNode* G = &bvh->nodes[iG];
+
+        // Swap A and C:
+        C->child1 = iA;
+        C->parent = A->parent;
+        A->parent = iC;
+
+        // A's old parent should point to C:
+        if (C->parent != BVH_NULL) {
+            BVHNode* P = &bvh->nodes[C->parent];
+            if (P->child1 == iA) { P->child1 = iC; } else { P->child2 = iC; }
+        } else {
+            bvh->root = iC;
+        }
+
+        // Rotate:
+        if (F->height > G->height) {
+            C->child2 = iF;
+            A->child2 = iG;
+            G->parent = iA;
+            sUnion(B->min, B->max, G->min, G->max, A->min, A->max);
+            sUnion(A->min, A->max, F->min, F->max, C->min, C->max);
+            A->height = 1 + vxMax(B->height, G->height);
+            C->height = 1 + vxMax(A->height, F->height);
+        } else {
+            C->child2 = iG;
+            A->child2 = iF;
+            F->parent = iA;
+            sUnion(B->min, B->max, F->min, F->max, A->min, A->max);
+            sUnion(A->min, A->max, G->min, G->max, C->min, C->max);
+            A->height = 1 + vxMax(B->height, F->height);
+            C->height = 1 + vxMax(A->height, G->height);
+        }
+        return iC;
+    }
+
+    // Rotate B up:
+    if (balance < -1) {
+        int32_t iD = B->child1;
+        int32_t iE = B->child2;
+        BVHNode* D = &bvh->nodes[iD];
+        BVHNode* E = &bvh->nodes[iE];
+
+        // Swap A and B:
+        B->child1 = iA;
+        B->parent = A->parent;
+        A->parent = iB;
+
+        // A's old parent should point to B:
+        if (B->parent != BVH_NULL) {
+            BVHNode* P = &bvh->nodes[B->parent];
+            if (P->child1 == iA) { P->child1 = iB; } else { P->child2 = iB; }
+        } else {
+            bvh->root = iB;
+        }
+
+        // Rotate:
+        if (D->height > E->height) {
+            B->child2 = iD;
+            A->child1 = iE;
+            E->parent = iA;
+            sUnion(C->min, C->max, E->min, E->max, A->min, A->max);
+            sUnion(A->min, A->max, D->min, D->max, B->min, B->max);
+            A->height = 1 + vxMax(C->height, E->height);
+            B->height = 1 + vxMax(A->height, D->height);
+        } else {
+            B->child2 = iE;
+            A->child1 = iD;
+            D->parent = iA;
+            sUnion(C->min, C->max, D->min, D->max, A->min, A->max);
+            sUnion(A->min, A->max, E->min, E->max, B->min, B->max);
+            A->height = 1 + vxMax(C->height, D->height);
+            B->height = 1 + vxMax(A->height, E->height);
+        }
+        return iB;
+    }
+
+    return iA;
+}
+
+// Walks from the given node up to the root, refitting bounding boxes and rebalancing along the way.
+static void sRefitAncestors (BVH* bvh, int32_t index) {
+    while (index != BVH_NULL) {
+        index = sBalance(bvh, index);
+        BVHNode* node = &bvh->nodes[index];
+        BVHNode* c1 = &bvh->nodes[node->child1];
+        BVHNode* c2 = &bvh->nodes[node->child2];
+        node->height = 1 + vxMax(c1->height, c2->height);
+        sUnion(c1->min, c1->max, c2->min, c2->max, node->min, node->max);
+        index = node->parent;
+    }
+}
+
+static void sInsertLeaf (BVH* bvh, int32_t leaf) {
+    if (bvh->root == BVH_NULL) {
+        bvh->root = leaf;
+        bvh->nodes[leaf].parent = BVH_NULL;
+        return;
+    }
+
+    // Find the best sibling for this leaf using the surface area heuristic:
+    vec3 leafMin, leafMax;
+    glm_vec3_copy(bvh->nodes[leaf].min, leafMin);
+    glm_vec3_copy(bvh->nodes[leaf].max, leafMax);
+    int32_t index = bvh->root;
+    while (!sIsLeaf(&bvh->nodes[index])) {
+        BVHNode* node = &bvh->nodes[index];
+        int32_t child1 = node->child1;
+        int32_t child2 = node->child2;
+
+        vec3 cmin, cmax;
+        float area = sSurfaceArea(node->min, node->max);
+        sUnion(node->min, node->max, leafMin, leafMax, cmin, cmax);
+        float combinedArea = sSurfaceArea(cmin, cmax);
+
+        // Cost of creating a new parent for this node and the new leaf:
+        float cost = 2.0f * combinedArea;
+        // Minimum cost of pushing the leaf further down the tree:
+        float inheritanceCost = 2.0f * (combinedArea - area);
+
+        float childCost [2];
+        int32_t children [2] = {child1, child2};
+        for (int i = 0; i < 2; i++) {
+            BVHNode* child = &bvh->nodes[children[i]];
+            sUnion(child->min, child->max, leafMin, leafMax, cmin, cmax);
+            if (sIsLeaf(child)) {
+                childCost[i] = sSurfaceArea(cmin, cmax) + inheritanceCost;
+            } else {
+                childCost[i] = sSurfaceArea(cmin, cmax) - sSurfaceArea(child->min, child->max) + inheritanceCost;
+            }
+        }
+
+        // Descend according to the minimum cost:
+        if (cost < childCost[0] && cost < childCost[1]) {
+            break;
+        }
+        index = (childCost[0] < childCost[1]) ? child1 : child2;
+    }
+    int32_t sibling = index;
+
+    // Create a new parent for the leaf and its sibling:
+    // NOTE: sAllocNode can reallocate the node array, so we can't keep pointers across this call.
+    int32_t newParent = sAllocNode(bvh);
+    BVHNode* parentNode = &bvh->nodes[newParent];
+    BVHNode* siblingNode = &bvh->nodes[sibling];
+    int32_t oldParent = siblingNode->parent;
+    parentNode->parent = oldParent;
+    parentNode->data = 0;
+    parentNode->height = siblingNode->height + 1;
+    sUnion(leafMin, leafMax, siblingNode->min, siblingNode->max, parentNode->min, parentNode->max);
+
+    if (oldParent != BVH_NULL) {
+        BVHNode* op = &bvh->nodes[oldParent];
+        if (op->child1 == sibling) { op->child1 = newParent; } else { op->child2 = newParent; }
+    } else {
+        bvh->root = newParent;
+    }
+    parentNode->child1 = sibling;
+    parentNode->child2 = leaf;
+    siblingNode->parent = newParent;
+    bvh->nodes[leaf].parent = newParent;
+
+    sRefitAncestors(bvh, bvh->nodes[leaf].parent);
+}
+
+static void sRemoveLeaf (BVH* bvh, int32_t leaf) {
+    if (leaf == bvh->root) {
+        bvh->root = BVH_NULL;
+        return;
+    }
+
+    int32_t parent = bvh->nodes[leaf].parent;
+    int32_t grandParent = bvh->nodes[parent].parent;
+    int32_t sibling = (bvh->nodes[parent].child1 == leaf) ? bvh->nodes[parent].child2 : bvh->nodes[parent].child1;
+
+    if (grandParent != BVH_NULL) {
+        // Destroy the parent and connect the sibling to the grandparent:
+        BVHNode* gp = &bvh->nodes[grandParent];
+        if (gp->child1 == parent) { gp->child1 = sibling; } else { gp->child2 = sibling; }
+        bvh->nodes[sibling].parent = grandParent;
+        sFreeNode(bvh, parent);
+        sRefitAncestors(bvh, grandParent);
+    } else {
+        bvh->root = sibling;
+        bvh->nodes[sibling].parent = BVH_NULL;
+        sFreeNode(bvh, parent);
+    }
+}
+
+// Inserts a new leaf into the tree. The bounding box is enlarged by the tree's margin.
+// Returns the leaf's proxy ID.
+int32_t BVHInsert (BVH* bvh, vec3 min, vec3 max, int32_t data) {
+    int32_t proxy = sAllocNode(bvh);
+    BVHNode* node = &bvh->nodes[proxy];
+    vec3 m = {bvh->margin, bvh->margin, bvh->margin};
+    glm_vec3_sub(min, m, node->min);
+    glm_vec3_add(max, m, node->max);
+    node->data = data;
+    node->height = 0;
+    sInsertLeaf(bvh, proxy);
+    return proxy;
+}
+
+void BVHRemove (BVH* bvh, int32_t proxy) {
+    vxAssert(proxy >= 0 && (size_t) proxy < bvh->nodeSlots);
+    vxAssert(sIsLeaf(&bvh->nodes[proxy]));
+    sRemoveLeaf(bvh, proxy);
+    sFreeNode(bvh, proxy);
+}
+
+// Updates the bounding box of a leaf. If the new box still fits inside the leaf's fat box, nothing happens. Otherwise,
+// the leaf is reinserted with a new fat box. Returns true if the tree was modified.
+bool BVHMove (BVH* bvh, int32_t proxy, vec3 min, vec3 max) {
+    vxAssert(proxy >= 0 && (size_t) proxy < bvh->nodeSlots);
+    BVHNode* node = &bvh->nodes[proxy];
+    vxAssert(sIsLeaf(node));
+    if (sContains(node->min, node->max, min, max)) {
+        return false;
+    }
+    sRemoveLeaf(bvh, proxy);
+    node = &bvh->nodes[proxy];
+    vec3 m = {bvh->margin, bvh->margin, bvh->margin};
+    glm_vec3_sub(min, m, node->min);
+    glm_vec3_add(max, m, node->max);
+    sInsertLeaf(bvh, proxy);
+    return true;
+}
+
+// Incrementally improves the tree by removing and reinserting [passes] leaves. Each call continues walking the tree
+// where the last one left off, so calling this with a small pass count once per frame eventually touches every leaf.
+void BVHOptimize (BVH* bvh, int passes) {
+    for (int pass = 0; pass < passes; pass++) {
+        if (bvh->root == BVH_NULL || sIsLeaf(&bvh->nodes[bvh->root])) {
+            return;
+        }
+        int32_t index = bvh->root;
+        uint32_t bit = 0;
+        while (!sIsLeaf(&bvh->nodes[index])) {
+            BVHNode* node = &bvh->nodes[index];
+            index = ((bvh->optimizePath >> bit) & 1) ? node->child2 : node->child1;
+            bit = (bit + 1) & 31;
+        }
+        bvh->optimizePath++;
+        sRemoveLeaf(bvh, index);
+        sInsertLeaf(bvh, index);
+    }
+}
+
+int BVHHeight (BVH* bvh) {
+    if (bvh->root == BVH_NULL) { return 0; }
+    return bvh->nodes[bvh->root].height;
+}
+
+void BVHQueryAABB (BVH* bvh, vec3 min, vec3 max, BVHQueryCallback cb, void* user) {
+    int32_t stack [BVH_STACK_SIZE];
+    int sp = 0;
+    if (bvh->root != BVH_NULL) { stack[sp++] = bvh->root; }
+    while (sp > 0) {
+        BVHNode* node = &bvh->nodes[stack[--sp]];
+        if (!sOverlaps(node->min, node->max, min, max)) {
+            continue;
+        }
+        if (sIsLeaf(node)) {
+            if (!cb(user, (int32_t)(node - bvh->nodes), node->data)) { return; }
+        } else {
+            vxCheck(sp + 2 <= BVH_STACK_SIZE);
+            stack[sp++] = node->child1;
+            stack[sp++] = node->child2;
+        }
+    }
+}
+
+void BVHQuerySphere (BVH* bvh, vec3 center, float radius, BVHQueryCallback cb, void* user) {
+    float r2 = radius * radius;
+    int32_t stack [BVH_STACK_SIZE];
+    int sp = 0;
+    if (bvh->root != BVH_NULL) { stack[sp++] = bvh->root; }
+    while (sp > 0) {
+        BVHNode* node = &bvh->nodes[stack[--sp]];
+        // Squared distance from the sphere's center to the closest point in the box:
+        float d2 = 0.0f;
+        for (int i = 0; i < 3; i++) {
+            float v = center[i];
+            if (v < node->min[i]) { d2 += (node->min[i] - v) * (node->min[i] - v); }
+            if (v > node->max[i]) { d2 += (v - node->max[i]) * (v - node->max[i]); }
+        }
+        if (d2 > r2) {
+            continue;
+        }
+        if (sIsLeaf(node)) {
+            if (!cb(user, (int32_t)(node - bvh->nodes), node->data)) { return; }
+        } else {
+            vxCheck(sp + 2 <= BVH_STACK_SIZE);
+            stack[sp++] = node->child1;
+            stack[sp++] = node->child2;
+        }
+    }
+}
+
+// Frustum planes are given as (normal, distance) with the normal pointing inwards, i.e. a point P is inside the plane
+// if dot(N, P) + D >= 0. Planes with a zero normal (e.g. the far plane of an infinite projection) are ignored.
+// Each subtree tracks which planes it might still cross, so nodes that are entirely inside skip further plane tests.
+void BVHQueryFrustum (BVH* bvh, vec4 planes[6], BVHQueryCallback cb, void* user) {
+    int32_t stack [BVH_STACK_SIZE];
+    uint8_t masks [BVH_STACK_SIZE];
+    int sp = 0;
+    if (bvh->root != BVH_NULL) { stack[sp] = bvh->root; masks[sp] = 0x3F; sp++; }
+    while (sp > 0) {
+        sp--;
+        BVHNode* node = &bvh->nodes[stack[sp]];
+        uint8_t mask = masks[sp];
+        bool outside = false;
+        for (int ip = 0; ip < 6 && !outside; ip++) {
+            if (!(mask & (1 << ip))) { continue; }
+            float* p = planes[ip];
+            // Positive and negative vertices of the box relative to the plane normal:
+            float px = (p[0] >= 0.0f) ? node->max[0] : node->min[0];
+            float py = (p[1] >= 0.0f) ? node->max[1] : node->min[1];
+            float pz = (p[2] >= 0.0f) ? node->max[2] : node->min[2];
+            float nx = (p[0] >= 0.0f) ? node->min[0] : node->max[0];
+            float ny = (p[1] >= 0.0f) ? node->min[1] : node->max[1];
+            float nz = (p[2] >= 0.0f) ? node->min[2] : node->max[2];
+            if (p[0] * px + p[1] * py + p[2] * pz + p[3] < 0.0f) {
+                outside = true;
+            } else if (p[0] * nx + p[1] * ny + p[2] * nz + p[3] >= 0.0f) {
+                mask &= ~(1 << ip);
+            }
+        }
+        if (outside) {
+            continue;
+        }
+        if (sIsLeaf(node)) {
+            if (!cb(user, (int32_t)(node - bvh->nodes), node->data)) { return; }
+        } else {
+            vxCheck(sp + 2 <= BVH_STACK_SIZE);
+            stack[sp] = node->child1; masks[sp] = mask; sp++;
+            stack[sp] = node->child2; masks[sp] = mask; sp++;
+        }
+    }
+}
+
+void BVHQueryRay (BVH* bvh, vec3 origin, vec3 dir, float tmax, BVHRayCallback cb, void* user) {
+    vec3 invDir = {1.0f / dir[0], 1.0f / dir[1], 1.0f / dir[2]};
+    int32_t stack [BVH_STACK_SIZE];
+    int sp = 0;
+    if (bvh->root != BVH_NULL) { stack[sp++] = bvh->root; }
+    while (sp > 0) {
+        BVHNode* node = &bvh->nodes[stack[--sp]];
+        float t;
+        if (!RayIntersectsAABB(origin, invDir, node->min, node->max, tmax, &t)) {
+            continue;
+        }
+        if (sIsLeaf(node)) {
+            tmax = cb(user, (int32_t)(node - bvh->nodes), node->data, origin, dir, tmax);
+            if (tmax <= 0.0f) { return; }
+        } else {
+            vxCheck(sp + 2 <= BVH_STACK_SIZE);
+            stack[sp++] = node->child1;
+            stack[sp++] = node->child2;
+        }
+    }
+}
+
+// Slab test. Writes the entry distance (clamped to 0 for rays starting inside the box) to [outT] if provided.
+bool RayIntersectsAABB (vec3 origin, vec3 invDir, vec3 min, vec3 max, float tmax, float* outT) {
+    float t0 = 0.0f;
+    float t1 = tmax;
+    for (int i = 0; i < 3; i++) {
+        float tn = (min[i] - origin[i]) * invDir[i];
+        float tf = (max[i] - origin[i]) * invDir[i];
+        if (tn > tf) { float tmp = tn; tn = tf; tf = tmp; }
+        t0 = (tn > t0) ? tn : t0;
+        t1 = (tf < t1) ? tf : t1;
+        if (t0 > t1) {
+            return false;
+        }
+    }
+    if (outT) { *outT = t0; }
+    return true;
+}
+
+bool AABBInFrustum (vec4 planes[6], vec3 min, vec3 max) {
+    for (int ip = 0; ip < 6; ip++) {
+        float* p = planes[ip];
+        float px = (p[0] >= 0.0f) ? max[0] : min[0];
+        float py = (p[1] >= 0.0f) ? max[1] : min[1];
+        float pz = (p[2] >= 0.0f) ? max[2] : min[2];
+        if (p[0] * px + p[1] * py + p[2] * pz + p[3] < 0.0f) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Computes the axis-aligned bounding box of a transformed AABB.
+// See Jim Arvo, "Transforming Axis-Aligned Bounding Boxes", Graphics Gems (1990).
+void TransformAABB (mat4 m, vec3 min, vec3 max, vec3 outMin, vec3 outMax) {
+    vec3 rmin, rmax;
+    for (int i = 0; i < 3; i++) {
+        rmin[i] = rmax[i] = m[3][i];
+        for (int j = 0; j < 3; j++) {
+            float a = m[j][i] * min[j];
+            float b = m[j][i] * max[j];
+            rmin[i] += vxMin(a, b);
+            rmax[i] += vxMax(a, b);
+        }
+    }
+    glm_vec3_copy(rmin, outMin);
+    glm_vec3_copy(rmax, outMax);
+}
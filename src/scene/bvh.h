@@ -0,0 +1,58 @@
+#pragma once
+#include "common.h"
+
+// Dynamic AABB tree (bounding volume hierarchy), based on the one in Box2D.
+// Leaves store "fat" bounding boxes (the tight box grown by a margin), so small movements don't require the tree to be
+// modified at all. Inserts pick a sibling using the surface area heuristic, and the tree is kept balanced with AVL-style
+// rotations on the way back up. BVHOptimize can be called periodically to reinsert a few leaves at a time, which
+// cleans up the structure left behind by lots of incremental moves.
+// Leaves are identified by proxy IDs (node indices), which remain stable until the leaf is removed.
+
+#define BVH_NULL (-1)
+
+typedef struct BVHNode {
+    vec3 min;
+    vec3 max;
+    int32_t parent; // also used as "next" pointer for nodes in the free list
+    int32_t child1;
+    int32_t child2;
+    int32_t height; // 0 for leaves, -1 for free nodes
+    int32_t data;   // user data, only valid for leaves
+} BVHNode;
+
+typedef struct BVH {
+    int32_t root;
+    size_t nodeSlots;
+    size_t nodeCount;
+    BVHNode* nodes;
+    int32_t freeList;
+    uint32_t optimizePath; // bit path used by BVHOptimize to walk the tree
+    float margin;          // amount added to each side of a leaf's bounding box
+} BVH;
+
+VX_EXPORT void InitBVH (BVH* bvh, float margin);
+VX_EXPORT void DeleteBVH (BVH* bvh);
+VX_EXPORT int32_t BVHInsert (BVH* bvh, vec3 min, vec3 max, int32_t data);
+VX_EXPORT void BVHRemove (BVH* bvh, int32_t proxy);
+VX_EXPORT bool BVHMove (BVH* bvh, int32_t proxy, vec3 min, vec3 max);
+VX_EXPORT void BVHOptimize (BVH* bvh, int passes);
+VX_EXPORT int BVHHeight (BVH* bvh);
+
+static inline int32_t BVHGetData (BVH* bvh, int32_t proxy) { return bvh->nodes[proxy].data; }
+static inline void BVHSetData (BVH* bvh, int32_t proxy, int32_t data) { bvh->nodes[proxy].data = data; }
+
+// Query callbacks are called once for each leaf that passes the query. Return false to stop the query.
+typedef bool (*BVHQueryCallback) (void* user, int32_t proxy, int32_t data);
+// Ray callbacks receive the current maximum distance along the ray and return a new one. Returning a smaller value
+// clips the ray (use this to find the nearest hit), returning 0 stops the query.
+typedef float (*BVHRayCallback) (void* user, int32_t proxy, int32_t data, vec3 origin, vec3 dir, float tmax);
+
+VX_EXPORT void BVHQueryAABB    (BVH* bvh, vec3 min, vec3 max, BVHQueryCallback cb, void* user);
+VX_EXPORT void BVHQuerySphere  (BVH* bvh, vec3 center, float radius, BVHQueryCallback cb, void* user);
+VX_EXPORT void BVHQueryFrustum (BVH* bvh, vec4 planes[6], BVHQueryCallback cb, void* user);
+VX_EXPORT void BVHQueryRay     (BVH* bvh, vec3 origin, vec3 dir, float tmax, BVHRayCallback cb, void* user);
+
+// Geometry helpers shared by the tree and its users:
+VX_EXPORT bool RayIntersectsAABB (vec3 origin, vec3 invDir, vec3 min, vec3 max, float tmax, float* outT);
+VX_EXPORT bool AABBInFrustum (vec4 planes[6], vec3 min, vec3 max);
+VX_EXPORT void TransformAABB (mat4 m, vec3 min, vec3 max, vec3 outMin, vec3 outMax);
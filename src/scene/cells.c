@@ -0,0 +1,248 @@
+#include "cells.h"
+
+static const char MAGIC[] = "VXEngine Cells v1.0\n";
+
+// Clipped portal polygons gain at most one point per clipping plane.
+#define CELLS_MAX_CLIP_POINTS 40
+
+void DeleteCellGraph (CellGraph* g) {
+    if (g->portals != NULL) {
+        vxFree(g->portals);
+    }
+    memset(g, 0, sizeof(CellGraph));
+}
+
+int AddCell (CellGraph* g, vec3 min, vec3 max) {
+    if (g->cellCount >= CELLS_MAX) {
+        vxLog("Warning: Cell limit hit!");
+        return -1;
+    }
+    Cell* cell = &g->cells[g->cellCount++];
+    glm_vec3_minv(min, max, cell->min);
+    glm_vec3_maxv(min, max, cell->max);
+    return (int)(g->cellCount - 1);
+}
+
+Portal* AddPortal (CellGraph* g, int cellA, int cellB) {
+    g->portalCount++;
+    if (g->portalCount > g->portalSlots) {
+        g->portalSlots = vxMax(g->portalCount * 2, 16);
+        g->portals = (Portal*) vxAlignedRealloc(g->portals, g->portalSlots, sizeof(Portal), vxAlignOf(Portal));
+    }
+    Portal* portal = &g->portals[g->portalCount - 1];
+    memset(portal, 0, sizeof(Portal));
+    portal->cells[0] = cellA;
+    portal->cells[1] = cellB;
+    return portal;
+}
+
+// Loads a cell graph, replacing the given one. Returns false (leaving the graph empty) if the file doesn't exist or
+// can't be read.
+bool LoadCells (CellGraph* g, const char* filename) {
+    DeleteCellGraph(g);
+    FILE* f = fopen(filename, "r");
+    if (f == NULL) {
+        return false;
+    }
+
+    #define SCAN(expected, ...) do { \
+        int scanned = fscanf(f, __VA_ARGS__); \
+        if (scanned != expected) { \
+            vxLog("Read failed: fscanf read %d elements, expected %d", scanned, expected); \
+            if (feof(f)) { vxLog("Read failed: end of file"); } \
+            goto fail; \
+        } \
+    } while(0)
+
+    char buf [sizeof(MAGIC)] = {0};
+    if (fread(buf, 1, sizeof(MAGIC)-1, f) != sizeof(MAGIC)-1 || strncmp(buf, MAGIC, sizeof(MAGIC)-1) != 0) {
+        vxLog("Read failed: %s is not a valid cells file", filename);
+        goto fail;
+    }
+
+    int numCells, numPortals;
+    SCAN(2, "%d cells %d portals", &numCells, &numPortals);
+    for (int i = 0; i < numCells; i++) {
+        vec3 min, max;
+        SCAN(6, "\nC min(%g %g %g) max(%g %g %g)", &min[0], &min[1], &min[2], &max[0], &max[1], &max[2]);
+        if (AddCell(g, min, max) < 0) { goto fail; }
+    }
+    for (int i = 0; i < numPortals; i++) {
+        int a, b, n;
+        SCAN(3, "\nP %d %d %d", &a, &b, &n);
+        if (a < 0 || b < 0 || a >= numCells || b >= numCells || n < 3 || n > PORTAL_MAX_POINTS) {
+            vxLog("Read failed: portal %d is invalid (cells %d and %d, %d points)", i, a, b, n);
+            goto fail;
+        }
+        Portal* portal = AddPortal(g, a, b);
+        portal->pointCount = n;
+        for (int k = 0; k < n; k++) {
+            SCAN(3, " (%g %g %g)", &portal->points[k][0], &portal->points[k][1], &portal->points[k][2]);
+        }
+    }
+
+    #undef SCAN
+
+    vxLog("Read %ju cells and %ju portals from %s", g->cellCount, g->portalCount, filename);
+    fclose(f);
+    return true;
+
+    fail:
+    DeleteCellGraph(g);
+    fclose(f);
+    return false;
+}
+
+void SaveCells (CellGraph* g, const char* filename) {
+    FILE* f = fopen(filename, "w");
+    if (f == NULL) {
+        vxLog("Write failed: can't open file! %s", strerror(errno));
+        return;
+    }
+    fputs(MAGIC, f);
+    fprintf(f, "%d cells %d portals", (int) g->cellCount, (int) g->portalCount);
+    for (size_t i = 0; i < g->cellCount; i++) {
+        Cell* c = &g->cells[i];
+        fprintf(f, "\nC min(%g %g %g) max(%g %g %g)", c->min[0], c->min[1], c->min[2], c->max[0], c->max[1], c->max[2]);
+    }
+    for (size_t i = 0; i < g->portalCount; i++) {
+        Portal* p = &g->portals[i];
+        fprintf(f, "\nP %d %d %d", p->cells[0], p->cells[1], p->pointCount);
+        for (int k = 0; k < p->pointCount; k++) {
+            fprintf(f, " (%g %g %g)", p->points[k][0], p->points[k][1], p->points[k][2]);
+        }
+    }
+    fclose(f);
+}
+
+// Sutherland-Hodgman clipping of a convex polygon against planes, keeping the side where dot(n,p) + d >= 0.
+// If the result has too many points, the polygon is returned unclipped, which is always safe for visibility.
+static int sClipPolygon (vec3* points, int count, vec4* planes, int planeCount, vec3* out) {
+    vec3 bufA [CELLS_MAX_CLIP_POINTS], bufB [CELLS_MAX_CLIP_POINTS];
+    vec3* src = bufA;
+    vec3* dst = bufB;
+    int originalCount = count;
+    memcpy(src, points, count * sizeof(vec3));
+    for (int ip = 0; ip < planeCount && count >= 3; ip++) {
+        float* plane = planes[ip];
+        int n = 0;
+        for (int i = 0; i < count; i++) {
+            float* a = src[i];
+            float* b = src[(i + 1) % count];
+            float da = glm_vec3_dot(plane, a) + plane[3];
+            float db = glm_vec3_dot(plane, b) + plane[3];
+            if (n + 2 > CELLS_MAX_CLIP_POINTS) {
+                memcpy(out, points, originalCount * sizeof(vec3));
+                return originalCount;
+            }
+            if (da >= 0.0f) {
+                glm_vec3_copy(a, dst[n++]);
+            }
+            if ((da >= 0.0f) != (db >= 0.0f)) {
+                glm_vec3_lerp(a, b, da / (da - db), dst[n++]);
+            }
+        }
+        vec3* tmp = src;
+        src = dst;
+        dst = tmp;
+        count = n;
+    }
+    memcpy(out, src, count * sizeof(vec3));
+    return count;
+}
+
+static void sFlood (CellGraph* g, int cell, int fromPortal, vec3 eye, vec4* planes, int planeCount, int depth,
+    uint64_t* visible)
+{
+    *visible |= (uint64_t) 1 << cell;
+    if (depth >= Cells_MaxPortalDepth) { return; }
+
+    for (size_t ip = 0; ip < g->portalCount; ip++) {
+        Portal* portal = &g->portals[ip];
+        if ((int) ip == fromPortal || (portal->cells[0] != cell && portal->cells[1] != cell)) { continue; }
+        int next = (portal->cells[0] == cell) ? portal->cells[1] : portal->cells[0];
+
+        vec3 clipped [CELLS_MAX_CLIP_POINTS];
+        int count = sClipPolygon(portal->points, portal->pointCount, planes, planeCount, clipped);
+        if (count < 3) { continue; }
+
+        // Plane of the portal, facing away from the eye:
+        vec4 portalPlane;
+        vec3 e1, e2;
+        glm_vec3_sub(portal->points[1], portal->points[0], e1);
+        glm_vec3_sub(portal->points[2], portal->points[0], e2);
+        glm_vec3_crossn(e1, e2, portalPlane);
+        portalPlane[3] = -glm_vec3_dot(portalPlane, portal->points[0]);
+        float eyeDist = glm_vec3_dot(portalPlane, eye) + portalPlane[3];
+        if (fabsf(eyeDist) < 1e-3f) {
+            // Standing in the portal: it doesn't narrow the view at all.
+            sFlood(g, next, (int) ip, eye, planes, planeCount, depth + 1, visible);
+            continue;
+        }
+        if (eyeDist > 0.0f) {
+            glm_vec4_negate(portalPlane);
+        }
+
+        // Narrow the frustum to the planes through the eye and each edge of the clipped portal:
+        vec3 center = GLM_VEC3_ZERO_INIT;
+        for (int i = 0; i < count; i++) {
+            glm_vec3_add(center, clipped[i], center);
+        }
+        glm_vec3_scale(center, 1.0f / count, center);
+        vec4 narrowed [CELLS_MAX_CLIP_POINTS + 1];
+        int narrowedCount = 0;
+        for (int i = 0; i < count; i++) {
+            vec3 a, b;
+            glm_vec3_sub(clipped[i], eye, a);
+            glm_vec3_sub(clipped[(i + 1) % count], eye, b);
+            float* plane = narrowed[narrowedCount];
+            glm_vec3_cross(a, b, plane);
+            float len = glm_vec3_norm(plane);
+            if (len < 1e-6f) { continue; } // degenerate edge
+            glm_vec3_scale(plane, 1.0f / len, plane);
+            plane[3] = -glm_vec3_dot(plane, eye);
+            if (glm_vec3_dot(plane, center) + plane[3] < 0.0f) {
+                glm_vec4_negate(plane);
+            }
+            narrowedCount++;
+        }
+        glm_vec4_copy(portalPlane, narrowed[narrowedCount++]);
+        sFlood(g, next, (int) ip, eye, narrowed, narrowedCount, depth + 1, visible);
+    }
+}
+
+uint64_t FindVisibleCells (CellGraph* g, Camera* cam) {
+    vec3 eye;
+    glm_vec3_copy(cam->inv_view_matrix[3], eye);
+    vec4 planes [6];
+    Camera_GetFrustumPlanes(cam, planes);
+
+    uint64_t visible = 0;
+    bool inside = false;
+    for (size_t i = 0; i < g->cellCount; i++) {
+        Cell* c = &g->cells[i];
+        if (eye[0] >= c->min[0] && eye[1] >= c->min[1] && eye[2] >= c->min[2] &&
+            eye[0] <= c->max[0] && eye[1] <= c->max[1] && eye[2] <= c->max[2])
+        {
+            inside = true;
+            sFlood(g, (int) i, -1, eye, planes, 6, 0, &visible);
+        }
+    }
+    return inside ? visible : CELLS_ALL;
+}
+
+bool AABBInCells (CellGraph* g, uint64_t cells, vec3 min, vec3 max) {
+    if (cells == CELLS_ALL) { return true; }
+    bool contained = false;
+    for (size_t i = 0; i < g->cellCount; i++) {
+        Cell* c = &g->cells[i];
+        bool overlaps = min[0] <= c->max[0] && min[1] <= c->max[1] && min[2] <= c->max[2] &&
+                        max[0] >= c->min[0] && max[1] >= c->min[1] && max[2] >= c->min[2];
+        if (overlaps && (cells & ((uint64_t) 1 << i))) {
+            return true;
+        }
+        contained = contained || (min[0] >= c->min[0] && min[1] >= c->min[1] && min[2] >= c->min[2] &&
+                                  max[0] <= c->max[0] && max[1] <= c->max[1] && max[2] <= c->max[2]);
+    }
+    return !contained;
+}
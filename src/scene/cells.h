@@ -0,0 +1,57 @@
+#pragma once
+#include "common.h"
+#include "data/camera.h"
+
+// Cells and portals for indoor visibility. Cells are axis-aligned boxes (rooms, corridors, galleries), and portals are
+// convex polygons (doorways, windows, arches) connecting two cells. Starting from the cell(s) containing the camera,
+// visibility flood-fills through every portal that can be seen, with the view frustum narrowed to the portal's
+// outline at every step. Anything that doesn't overlap a reachable cell can be culled.
+//
+// Cell graphs are stored next to the scene, in a file with the same name and a .vxcells extension:
+//
+//     VXEngine Cells v1.0
+//     2 cells 1 portals
+//     C min(-10 0 -4) max(10 8 4)
+//     C min(-10 0 4) max(10 8 12)
+//     P 0 1 4 (-1 0 4) (1 0 4) (1 3 4) (-1 3 4)
+//
+// Portal lines list the two connected cells, the number of points and the points themselves, in order around the
+// polygon. Only boxes that fit entirely inside a cell can be culled, so cells only need to cover the parts of a
+// scene that benefit from them.
+
+#define CELLS_MAX 64 // cells are tracked in 64-bit masks
+#define CELLS_ALL (~(uint64_t) 0)
+#define PORTAL_MAX_POINTS 8
+
+typedef struct Cell {
+    vec3 min;
+    vec3 max;
+} Cell;
+
+typedef struct Portal {
+    int32_t cells [2];
+    int32_t pointCount;
+    vec3 points [PORTAL_MAX_POINTS];
+} Portal;
+
+typedef struct CellGraph {
+    size_t cellCount;
+    Cell cells [CELLS_MAX];
+    size_t portalSlots;
+    size_t portalCount;
+    Portal* portals;
+} CellGraph;
+
+// Portal chains longer than this aren't followed.
+static const int Cells_MaxPortalDepth = 16;
+
+VX_EXPORT void DeleteCellGraph (CellGraph* g);
+VX_EXPORT int AddCell (CellGraph* g, vec3 min, vec3 max);
+VX_EXPORT Portal* AddPortal (CellGraph* g, int cellA, int cellB);
+VX_EXPORT bool LoadCells (CellGraph* g, const char* filename);
+VX_EXPORT void SaveCells (CellGraph* g, const char* filename);
+
+// Returns the mask of cells visible from the camera, or CELLS_ALL if the camera isn't inside any cell.
+VX_EXPORT uint64_t FindVisibleCells (CellGraph* g, Camera* cam);
+// Returns true if the box overlaps one of the cells in the mask, or doesn't fit entirely inside any single cell.
+VX_EXPORT bool AABBInCells (CellGraph* g, uint64_t cells, vec3 min, vec3 max);
@@ -1,44 +1,130 @@
 #include "core.h"
+#include "journal.h"
 
-void UpdateScene (Scene* scene) {
-    bool worldMatricesNeedUpdate = false;
+// Radius beyond which a point light's contribution drops below the threshold used by the light volume pass.
+float PointLightRadius (vec3 color) {
+    const float threshold = 0.02f; // intensity beyond which we don't render the light
+    float intensity = glm_vec3_max(color);
+    return sqrtf(intensity / threshold);
+}
+
+// Inserts new objects into the scene BVH and moves the ones that changed since the last update.
+static void sUpdateBVH (Scene* scene) {
     for (size_t i = 0; i < scene->size; i++) {
         GameObject* obj = &scene->objects[i];
-        if (!glm_vec3_eqv(obj->localPosition, obj->lastLocalPosition) ||
-            !glm_vec3_eqv(obj->localScale,    obj->lastLocalScale) ||
-            !glm_vec4_eqv(obj->localRotation, obj->lastLocalRotation) ||
-            obj->needsUpdate)
-        {
+        vec3 min, max;
+        switch (obj->type) {
+            case GAMEOBJECT_MODEL: {
+                Model* mdl = obj->model.model;
+                if (mdl == NULL || mdl->meshCount == 0) { continue; }
+                if (obj->bvhProxy != BVH_NULL && !obj->worldMatrixChanged) { continue; }
+                TransformAABB(obj->worldMatrix, mdl->aabbMin, mdl->aabbMax, min, max);
+            } break;
+
+            case GAMEOBJECT_POINT_LIGHT: {
+                // Light colors can change without touching the transform, so these are checked every frame.
+                // BVHMove returns early as long as the sphere stays within the leaf's fat bounds.
+                float r = PointLightRadius(obj->pointLight.color);
+                glm_vec3_subs(obj->localPosition, r, min);
+                glm_vec3_adds(obj->localPosition, r, max);
+            } break;
+
+            default: {
+                continue;
+            } break;
+        }
+        if (obj->bvhProxy == BVH_NULL) {
+            obj->bvhProxy = BVHInsert(&scene->bvh, min, max, (int32_t) i);
+        } else {
+            BVHMove(&scene->bvh, obj->bvhProxy, min, max);
+        }
+    }
+    BVHOptimize(&scene->bvh, Scene_BVHOptimizePasses);
+}
+
+// The per-object passes of UpdateScene each only write to the objects in their range, so they run as parallel-for
+// jobs. World matrices read the local matrices of parents, which are all done by the time that pass starts.
+static void sSaveLastWorldMatrices (void* user, size_t begin, size_t end) {
+    Scene* scene = (Scene*) user;
+    for (size_t i = begin; i < end; i++) {
+        GameObject* obj = &scene->objects[i];
+        obj->lastWorldMatrixChanged = obj->worldMatrixChanged;
+        if (obj->worldMatrixChanged) {
+            glm_mat4_copy(obj->worldMatrix, obj->lastWorldMatrix);
+            obj->worldMatrixChanged = false;
+        }
+    }
+}
+
+static bool sObjectMoved (GameObject* obj) {
+    return !glm_vec3_eqv(obj->localPosition, obj->lastLocalPosition) ||
+           !glm_vec3_eqv(obj->localScale,    obj->lastLocalScale) ||
+           !glm_vec4_eqv(obj->localRotation, obj->lastLocalRotation);
+}
+
+typedef struct LocalMatrixPass {
+    Scene* scene;
+    volatile int32_t anyChanged;
+} LocalMatrixPass;
+
+static void sUpdateLocalMatrices (void* user, size_t begin, size_t end) {
+    LocalMatrixPass* pass = (LocalMatrixPass*) user;
+    bool anyChanged = false;
+    for (size_t i = begin; i < end; i++) {
+        GameObject* obj = &pass->scene->objects[i];
+        if (sObjectMoved(obj) || obj->needsUpdate) {
             glm_translate_make(obj->localMatrix, obj->localPosition);
             glm_quat_rotate(obj->localMatrix, obj->localRotation, obj->localMatrix);
             glm_scale(obj->localMatrix, obj->localScale);
-            worldMatricesNeedUpdate = true;
+            anyChanged = true;
             glm_vec3_copy(obj->localPosition, obj->lastLocalPosition);
             glm_vec3_copy(obj->localScale,    obj->lastLocalScale);
             glm_quat_copy(obj->localRotation, obj->lastLocalRotation);
+            obj->needsUpdate = false;
         }
     }
-    if (worldMatricesNeedUpdate) {
-        for (size_t i = 0; i < scene->size; i++) {
-            GameObject* obj = &scene->objects[i];
-            glm_mat4_copy(obj->localMatrix, obj->worldMatrix);
-            GameObject* parent = obj->parent;
-            while (parent != NULL) {
-                // FIXME: correct order?
-                glm_mat4_mul(obj->worldMatrix, parent->localMatrix, obj->worldMatrix);
-                obj->worldMatrixChanged = true;
-                parent = parent->parent;
-            }
+    if (anyChanged) {
+        vxAtomicStore32(&pass->anyChanged, 1);
+    }
+}
+
+static void sUpdateWorldMatrices (void* user, size_t begin, size_t end) {
+    Scene* scene = (Scene*) user;
+    for (size_t i = begin; i < end; i++) {
+        GameObject* obj = &scene->objects[i];
+        mat4 world;
+        glm_mat4_copy(obj->localMatrix, world);
+        GameObject* parent = obj->parent;
+        while (parent != NULL) {
+            // FIXME: correct order?
+            glm_mat4_mul(world, parent->localMatrix, world);
+            parent = parent->parent;
         }
-    } else {
+        // Only flag objects whose world matrix actually changed, so unrelated objects don't get refit:
+        if (memcmp(world, obj->worldMatrix, sizeof(mat4)) != 0) {
+            glm_mat4_copy(world, obj->worldMatrix);
+            obj->worldMatrixChanged = true;
+        }
+    }
+}
+
+void UpdateScene (Scene* scene) {
+    // Objects that moved during the last update have been rendered once with their new world matrix by now:
+    vxParallelFor("Save Last World Matrices", scene->size, Scene_UpdateBatchSize, sSaveLastWorldMatrices, scene);
+    // The journal isn't thread-safe, so moves are recorded before the parallel pass resets the last transforms:
+    if (scene->journal != NULL && scene->journal->file != NULL) {
         for (size_t i = 0; i < scene->size; i++) {
-            GameObject* obj = &scene->objects[i];
-            if (obj->worldMatrixChanged) {
-                glm_mat4_copy(obj->worldMatrix, obj->lastWorldMatrix);
-                obj->worldMatrixChanged = false;
+            if (sObjectMoved(&scene->objects[i])) {
+                RecordObjectChanged(scene->journal, scene, (int32_t) i);
             }
         }
     }
+    LocalMatrixPass pass = {scene, 0};
+    vxParallelFor("Update Local Matrices", scene->size, Scene_UpdateBatchSize, sUpdateLocalMatrices, &pass);
+    if (vxAtomicLoad32(&pass.anyChanged) != 0) {
+        vxParallelFor("Update World Matrices", scene->size, Scene_UpdateBatchSize, sUpdateWorldMatrices, scene);
+    }
+    sUpdateBVH(scene);
 }
 
 void InitScene (Scene* scene) {
@@ -46,6 +132,9 @@ void InitScene (Scene* scene) {
     DeleteScene(scene);
     scene->slots = 2048;
     scene->objects = vxAlloc(scene->slots, GameObject);
+    InitBVH(&scene->bvh, Scene_BVHMargin);
+    scene->renderDirtyFrom = 0;
+    scene->structureVersion++;
 }
 
 void DeleteScene (Scene* scene) {
@@ -53,21 +142,44 @@ void DeleteScene (Scene* scene) {
     if (scene->objects != NULL) {
         vxFree(scene->objects);
     }
+    DeleteBVH(&scene->bvh);
+    DeleteCellGraph(&scene->cells);
+    DeletePVS(&scene->pvs);
     scene->size = 0;
     scene->slots = 0;
     scene->objects = NULL;
 }
 
+// Grows the object array to hold at least [slots] objects. Parent pointers are fixed up if the array moves.
+void ReserveSceneObjects (Scene* scene, size_t slots) {
+    if (slots <= scene->slots) { return; }
+    GameObject* objects = vxAlloc(slots, GameObject);
+    if (scene->objects != NULL) {
+        memcpy(objects, scene->objects, scene->size * sizeof(GameObject));
+        for (size_t i = 0; i < scene->size; i++) {
+            if (objects[i].parent != NULL) {
+                objects[i].parent = objects + (objects[i].parent - scene->objects);
+            }
+        }
+        vxFree(scene->objects);
+    }
+    scene->objects = objects;
+    scene->slots = slots;
+}
+
 GameObject* AddObject (Scene* scene, GameObject* parent, GameObjectType type) {
-    scene->size++;
-    if (scene->size > scene->slots) {
+    if (scene->size >= scene->slots) {
         vxLog("Warning: Scene object limit hit!");
         return NULL;
     }
+    scene->size++;
+    scene->renderDirtyFrom = vxMin(scene->renderDirtyFrom, scene->size - 1);
+    scene->structureVersion++;
     GameObject* obj = &scene->objects[scene->size - 1];
     memset(obj, 0, sizeof(GameObject));
     obj->parent = parent;
     obj->type = type;
+    obj->bvhProxy = BVH_NULL;
     glm_vec3_zero(obj->localPosition);
     glm_vec3_zero(obj->lastLocalPosition);
     glm_vec3_one(obj->localScale);
@@ -77,6 +189,9 @@ GameObject* AddObject (Scene* scene, GameObject* parent, GameObjectType type) {
     glm_mat4_identity(obj->localMatrix);
     glm_mat4_identity(obj->worldMatrix);
     glm_mat4_identity(obj->lastWorldMatrix);
+    if (scene->journal != NULL) {
+        RecordObjectAdded(scene->journal, scene, (int32_t)(scene->size - 1));
+    }
     return obj;
 }
 
@@ -94,11 +209,126 @@ void DeleteObjectFromScene (Scene* scene, GameObject* object) {
         vxLog("Warning: Object 0x%lx not found in scene 0x%lx", object, scene);
         return;
     }
+    if (object->bvhProxy != BVH_NULL) {
+        BVHRemove(&scene->bvh, object->bvhProxy);
+    }
+    if (scene->journal != NULL) {
+        RecordObjectDeleted(scene->journal, index);
+    }
+    scene->renderDirtyFrom = vxMin(scene->renderDirtyFrom, (size_t) index);
+    scene->structureVersion++;
     for (int i = index + 1; i < scene->size; i++) {
         scene->objects[i-1] = scene->objects[i];
         // memcpy(&scene->objects[i-1], &scene->objects[i], sizeof(GameObject));
     }
     scene->size--;
+    // Everything after the deleted object moved down by one slot, so fix up references to those objects:
+    for (int i = 0; i < scene->size; i++) {
+        GameObject* obj = &scene->objects[i];
+        if (obj->parent != NULL && obj->parent > object) {
+            obj->parent--;
+        }
+        if (i >= index && obj->bvhProxy != BVH_NULL) {
+            BVHSetData(&scene->bvh, obj->bvhProxy, i);
+        }
+    }
+}
+
+// Deletes every object owned by a streaming chunk, in a single pass over the scene. Children of deleted objects are
+// moved up to their closest remaining ancestor, like with DeleteObjectFromScene.
+void DeleteChunkObjects (Scene* scene, uint32_t chunk) {
+    if (scene->size == 0 || chunk == 0) { return; }
+    int32_t* parents = vxAlloc(scene->size, int32_t); // original parent indices
+    int32_t* remap = vxAlloc(scene->size, int32_t);   // new index of each object, -1 if deleted
+    size_t kept = 0;
+    size_t firstDeleted = SIZE_MAX;
+    for (size_t i = 0; i < scene->size; i++) {
+        GameObject* obj = &scene->objects[i];
+        parents[i] = (obj->parent != NULL) ? (int32_t)(obj->parent - scene->objects) : -1;
+        if (obj->chunk == chunk) {
+            remap[i] = -1;
+            firstDeleted = vxMin(firstDeleted, i);
+            if (obj->bvhProxy != BVH_NULL) {
+                BVHRemove(&scene->bvh, obj->bvhProxy);
+            }
+        } else {
+            remap[i] = (int32_t) kept++;
+        }
+    }
+    if (firstDeleted != SIZE_MAX) {
+        // Recorded from the back, so each index is still valid when the record is replayed:
+        for (size_t i = scene->size; i-- > firstDeleted && scene->journal != NULL;) {
+            if (remap[i] < 0) {
+                RecordObjectDeleted(scene->journal, (int32_t) i);
+            }
+        }
+        // Objects only ever move towards the front, so this can be done in place:
+        for (size_t i = firstDeleted; i < scene->size; i++) {
+            if (remap[i] < 0) { continue; }
+            GameObject* obj = &scene->objects[remap[i]];
+            *obj = scene->objects[i];
+            if (obj->bvhProxy != BVH_NULL) {
+                BVHSetData(&scene->bvh, obj->bvhProxy, remap[i]);
+            }
+        }
+        for (size_t i = 0; i < scene->size; i++) {
+            if (remap[i] < 0) { continue; }
+            int32_t parent = parents[i];
+            while (parent >= 0 && remap[parent] < 0) {
+                parent = parents[parent];
+            }
+            scene->objects[remap[i]].parent = (parent >= 0) ? &scene->objects[remap[parent]] : NULL;
+        }
+        scene->size = kept;
+        scene->renderDirtyFrom = vxMin(scene->renderDirtyFrom, firstDeleted);
+        scene->structureVersion++;
+    }
+    vxFree(parents);
+    vxFree(remap);
+}
+
+typedef struct PickQuery {
+    Scene* scene;
+    GameObject* hit;
+} PickQuery;
+
+static float sPickCallback (void* user, int32_t proxy, int32_t data, vec3 origin, vec3 dir, float tmax) {
+    PickQuery* q = (PickQuery*) user;
+    GameObject* obj = &q->scene->objects[data];
+    vec3 invDir = {1.0f / dir[0], 1.0f / dir[1], 1.0f / dir[2]};
+    float t;
+    if (obj->type == GAMEOBJECT_MODEL) {
+        // Test each mesh's bounds separately, since the model bounds are usually a lot larger than its contents:
+        Model* mdl = obj->model.model;
+        for (size_t imesh = 0; imesh < mdl->meshCount; imesh++) {
+            mat4 m;
+            vec3 min, max;
+            glm_mat4_mul(obj->worldMatrix, mdl->meshTransforms[imesh], m);
+            TransformAABB(m, mdl->meshes[imesh].aabbMin, mdl->meshes[imesh].aabbMax, min, max);
+            if (RayIntersectsAABB(origin, invDir, min, max, tmax, &t) && t > 0.0f) {
+                tmax = t;
+                q->hit = obj;
+            }
+        }
+    } else if (obj->type == GAMEOBJECT_POINT_LIGHT) {
+        // Point lights are picked by a small box around their position rather than their whole influence sphere:
+        const float size = 0.25f;
+        vec3 min, max;
+        glm_vec3_subs(obj->localPosition, size, min);
+        glm_vec3_adds(obj->localPosition, size, max);
+        if (RayIntersectsAABB(origin, invDir, min, max, tmax, &t) && t > 0.0f) {
+            tmax = t;
+            q->hit = obj;
+        }
+    }
+    return tmax;
+}
+
+// Returns the closest object hit by a ray, or NULL. Models are tested against their mesh bounding boxes.
+GameObject* PickObject (Scene* scene, vec3 origin, vec3 dir, float maxDist) {
+    PickQuery q = {scene, NULL};
+    BVHQueryRay(&scene->bvh, origin, dir, maxDist, sPickCallback, &q);
+    return q.hit;
 }
 
 static void sAllocRenderList (RenderList* rl) {
@@ -123,6 +353,51 @@ void ClearRenderList (RenderList* rl) {
     rl->lightProbeCount = 0;
 }
 
+static void* sGrowRenderables (void* items, size_t* slots, size_t count, size_t itemSize, size_t alignment) {
+    if (*slots < count) {
+        *slots = count;
+        items = vxAlignedRealloc(items, *slots, itemSize, alignment);
+    }
+    return items;
+}
+
+typedef struct RenderListCopy {
+    RenderList* dst;
+    RenderList* src;
+} RenderListCopy;
+
+static void sCopyRenderableMeshes (void* user, size_t begin, size_t end) {
+    RenderListCopy* copy = (RenderListCopy*) user;
+    memcpy(&copy->dst->meshes[begin], &copy->src->meshes[begin], (end - begin) * sizeof(RenderableMesh));
+}
+
+void CopyRenderList (RenderList* dst, RenderList* src) {
+    if (dst->meshSlots < RenderList_DefaultMeshSlots) {
+        ClearRenderList(dst);
+    }
+    dst->scene = src->scene;
+    dst->meshes = sGrowRenderables(dst->meshes, &dst->meshSlots, src->meshCount,
+        sizeof(RenderableMesh), vxAlignOf(RenderableMesh));
+    dst->directionalLights = sGrowRenderables(dst->directionalLights, &dst->directionalLightSlots,
+        src->directionalLightCount, sizeof(RenderableDirectionalLight), vxAlignOf(RenderableDirectionalLight));
+    dst->pointLights = sGrowRenderables(dst->pointLights, &dst->pointLightSlots, src->pointLightCount,
+        sizeof(RenderablePointLight), vxAlignOf(RenderablePointLight));
+    dst->lightProbes = sGrowRenderables(dst->lightProbes, &dst->lightProbeSlots, src->lightProbeCount,
+        sizeof(RenderableLightProbe), vxAlignOf(RenderableLightProbe));
+    dst->meshCount = src->meshCount;
+    dst->directionalLightCount = src->directionalLightCount;
+    dst->pointLightCount = src->pointLightCount;
+    dst->lightProbeCount = src->lightProbeCount;
+
+    // Mesh entries are a few hundred bytes each, big scenes are copied in parallel:
+    RenderListCopy copy = {dst, src};
+    vxParallelFor("Copy Render List", src->meshCount, 4096, sCopyRenderableMeshes, &copy);
+    memcpy(dst->directionalLights, src->directionalLights,
+        src->directionalLightCount * sizeof(RenderableDirectionalLight));
+    memcpy(dst->pointLights, src->pointLights, src->pointLightCount * sizeof(RenderablePointLight));
+    memcpy(dst->lightProbes, src->lightProbes, src->lightProbeCount * sizeof(RenderableLightProbe));
+}
+
 #define MAKE_RENDERABLE_ADD_FUNCTION(type, slotsField, countField, objField) \
     static type* sAdd ## type (RenderList* rl) { \
         rl->countField++; \
@@ -140,20 +415,55 @@ MAKE_RENDERABLE_ADD_FUNCTION(RenderableLightProbe, lightProbeSlots, lightProbeCo
 
 #undef MAKE_RENDERABLE_ADD_FUNCTION
 
+static void sUpdateRenderableMeshMatrices (RenderableMesh* rmesh, GameObject* obj, Model* mdl, size_t imesh) {
+    // FIXME: correct order?
+    glm_mat4_mul(obj->worldMatrix,     mdl->meshTransforms[imesh], rmesh->worldMatrix);
+    glm_mat4_mul(obj->lastWorldMatrix, mdl->meshTransforms[imesh], rmesh->lastWorldMatrix);
+    TransformAABB(rmesh->worldMatrix, rmesh->mesh.aabbMin, rmesh->mesh.aabbMax, rmesh->aabbMin, rmesh->aabbMax);
+}
+
+// Mesh entries persist between updates. They are grouped by object in scene order, with each object remembering its
+// range of entries. Objects at or after scene->renderDirtyFrom (set when objects are added or deleted) get their
+// entries rebuilt, while all other objects only refresh their matrices when their world matrix has changed.
+// Lights are cheap and can be edited without touching their transform, so they are still gathered every update.
 void UpdateRenderList (RenderList* rl, Scene* scene) {
-    ClearRenderList(rl);
+    if (rl->meshSlots < RenderList_DefaultMeshSlots || rl->scene != scene) {
+        ClearRenderList(rl);
+        rl->scene = scene;
+        scene->renderDirtyFrom = 0;
+    }
+    rl->directionalLightCount = 0;
+    rl->pointLightCount = 0;
+    rl->lightProbeCount = 0;
+
+    // Drop the entries of every object from the first dirty one onwards:
+    size_t dirtyFrom = vxMin(scene->renderDirtyFrom, scene->size);
+    if (dirtyFrom == 0) {
+        rl->meshCount = 0;
+    } else {
+        GameObject* prev = &scene->objects[dirtyFrom - 1];
+        rl->meshCount = prev->renderFirst + prev->renderCount;
+    }
+
     for (size_t i = 0; i < scene->size; i++) {
         GameObject* obj = &scene->objects[i];
         switch (obj->type) {
             case GAMEOBJECT_MODEL: {
                 Model* mdl = obj->model.model;
-                for (size_t imesh = 0; imesh < mdl->meshCount; imesh++) {
-                    RenderableMesh* rmesh = sAddRenderableMesh(rl);
-                    rmesh->mesh = mdl->meshes[imesh];
-                    rmesh->material = mdl->meshMaterials[imesh];
-                    // FIXME: correct order?
-                    glm_mat4_mul(obj->worldMatrix,     mdl->meshTransforms[imesh], rmesh->worldMatrix);
-                    glm_mat4_mul(obj->lastWorldMatrix, mdl->meshTransforms[imesh], rmesh->lastWorldMatrix);
+                if (i >= dirtyFrom) {
+                    obj->renderFirst = rl->meshCount;
+                    obj->renderCount = (mdl != NULL) ? mdl->meshCount : 0;
+                    for (size_t imesh = 0; imesh < obj->renderCount; imesh++) {
+                        RenderableMesh* rmesh = sAddRenderableMesh(rl);
+                        rmesh->mesh = mdl->meshes[imesh];
+                        rmesh->material = mdl->meshMaterials[imesh];
+                        rmesh->object = (int32_t) i;
+                        sUpdateRenderableMeshMatrices(rmesh, obj, mdl, imesh);
+                    }
+                } else if (obj->worldMatrixChanged || obj->lastWorldMatrixChanged) {
+                    for (size_t imesh = 0; imesh < obj->renderCount; imesh++) {
+                        sUpdateRenderableMeshMatrices(&rl->meshes[obj->renderFirst + imesh], obj, mdl, imesh);
+                    }
                 }
             } break;
             
@@ -180,5 +490,10 @@ void UpdateRenderList (RenderList* rl, Scene* scene) {
                 glm_vec3_copy(obj->lightProbe.colorZn, ((vec3*)rlp->colors)[5]);
             } break;
         }
+        if (obj->type != GAMEOBJECT_MODEL && i >= dirtyFrom) {
+            obj->renderFirst = rl->meshCount;
+            obj->renderCount = 0;
+        }
     }
-}
\ No newline at end of file
+    scene->renderDirtyFrom = SIZE_MAX;
+}
@@ -1,6 +1,9 @@
 #pragma once
 #include "common.h"
 #include "data/model.h"
+#include "scene/bvh.h"
+#include "scene/cells.h"
+#include "scene/pvs.h"
 
 typedef enum GameObjectType {
     GAMEOBJECT_NULL,
@@ -47,7 +50,14 @@ typedef struct GameObject {
     mat4   worldMatrix;     // read-only
     mat4   lastWorldMatrix; // read-only
     bool   worldMatrixChanged;
+    bool   lastWorldMatrixChanged; // set for one update after worldMatrixChanged, when lastWorldMatrix catches up
     bool   needsUpdate; // forces world matrix update
+    int32_t bvhProxy;   // leaf in the scene's BVH, or BVH_NULL
+    size_t renderFirst; // range of this object's entries in the render list, managed by UpdateRenderList
+    size_t renderCount;
+    bool   staticBatched; // drawn as part of a static batch instead of through its render list entries
+    uint64_t batchSettleFrame; // frame from which a moving object can rejoin static batches, 0 if not moving
+    uint32_t chunk;     // streaming chunk that owns this object, 0 for none (see scene/stream.h)
     union {
         GameObject_Model model;
         GameObject_DirectionalLight directionalLight;
@@ -56,18 +66,38 @@ typedef struct GameObject {
     };
 } GameObject;
 
+typedef struct SceneJournal SceneJournal;
+typedef struct StreamingWorld StreamingWorld;
 
 typedef struct Scene {
     size_t slots;
     size_t size;
     GameObject* objects;
+    BVH bvh; // contains models and point light influence spheres, leaf data is the object index
+    size_t renderDirtyFrom; // first object whose render list entries must be rebuilt, SIZE_MAX if none
+    uint32_t structureVersion; // incremented whenever objects are added or deleted
+    CellGraph cells; // optional, for portal visibility
+    PVS pvs;         // optional, baked by the PVSBake tool
+    SceneJournal* journal; // optional, records edits for autosave (see scene/journal.h)
+    StreamingWorld* world; // optional, streams chunks of a larger world in and out (see scene/stream.h)
 } Scene;
 
+// Margin added to each side of the bounding boxes in the scene BVH. Objects can move this far before the tree changes.
+static const float Scene_BVHMargin = 0.1f;
+// Number of leaves reinserted into the scene BVH every frame to keep it in shape.
+static const int Scene_BVHOptimizePasses = 2;
+// Objects per job when UpdateScene spreads its passes over the job system.
+static const size_t Scene_UpdateBatchSize = 1024;
+
 VX_EXPORT void InitScene (Scene* scene);
 VX_EXPORT void DeleteScene (Scene* scene);
 VX_EXPORT void UpdateScene (Scene* scene);
+VX_EXPORT void ReserveSceneObjects (Scene* scene, size_t slots);
 VX_EXPORT GameObject* AddObject (Scene* scene, GameObject* parent, GameObjectType type);
 VX_EXPORT void DeleteObjectFromScene (Scene* scene, GameObject* object);
+VX_EXPORT void DeleteChunkObjects (Scene* scene, uint32_t chunk);
+VX_EXPORT GameObject* PickObject (Scene* scene, vec3 origin, vec3 dir, float maxDist);
+VX_EXPORT float PointLightRadius (vec3 color);
 
 
 typedef struct RenderableMesh {
@@ -75,6 +105,9 @@ typedef struct RenderableMesh {
     mat4 lastWorldMatrix;
     Material* material;
     Mesh mesh;
+    int32_t object; // index of the owning object in the scene
+    vec3 aabbMin;   // world space bounds
+    vec3 aabbMax;
 } RenderableMesh;
 
 typedef struct RenderableDirectionalLight {
@@ -98,6 +131,7 @@ static const size_t RenderList_DefaultPointLightSlots = 128;
 static const size_t RenderList_DefaultLightProbeSlots = 64;
 
 typedef struct RenderList {
+    Scene* scene; // scene the mesh entries were built from
     size_t meshSlots;
     size_t meshCount;
     RenderableMesh* meshes;
@@ -113,4 +147,7 @@ typedef struct RenderList {
 } RenderList;
 
 VX_EXPORT void ClearRenderList (RenderList* rl);
-VX_EXPORT void UpdateRenderList (RenderList* rl, Scene* scene);
\ No newline at end of file
+VX_EXPORT void UpdateRenderList (RenderList* rl, Scene* scene);
+// Copies a render list's entries into another one, growing its arrays as needed. Used to hand a snapshot of the render
+// list to the render thread while the original keeps being updated incrementally.
+VX_EXPORT void CopyRenderList (RenderList* dst, RenderList* src);
\ No newline at end of file
@@ -0,0 +1,500 @@
+#include "journal.h"
+#include "save.h"
+#include "data/model.h"
+
+static const char MAGIC[] = "VXEngine Scene Journal\n";
+
+#define JOURNAL_VERSION 1
+
+typedef enum JournalOp {
+    JOURNAL_ADD = 1,
+    JOURNAL_DELETE,
+    JOURNAL_SET,    // replaces everything but the object's index
+} JournalOp;
+
+// Journals are a header (the magic string and version) followed by fixed size records. Model names follow the
+// records that use them. Records are only ever appended, so after a crash the last one may be cut off. The checksum
+// catches that, and replay stops there.
+typedef struct JournalRecord {
+    uint32_t checksum;    // of everything after this field, including the model name
+    uint8_t op;
+    uint8_t type;         // same characters as in scene files
+    uint16_t nameLength;  // bytes of model name following the record, without a NUL
+    int32_t object;
+    int32_t parent;       // -1 for none
+    float position [3];
+    float rotation [4];
+    float scale [3];
+    float colors [18];    // 3 for directional and point lights, 18 for light probes
+} JournalRecord;
+
+static uint32_t sChecksum (JournalRecord* rec, const char* name) {
+    // FNV-1a:
+    uint32_t h = 2166136261U;
+    const uint8_t* bytes = (const uint8_t*) rec + sizeof(rec->checksum);
+    for (size_t i = 0; i < sizeof(JournalRecord) - sizeof(rec->checksum); i++) {
+        h = (h ^ bytes[i]) * 16777619U;
+    }
+    for (size_t i = 0; i < rec->nameLength; i++) {
+        h = (h ^ (uint8_t) name[i]) * 16777619U;
+    }
+    return h;
+}
+
+static char sTypeChar (GameObjectType type) {
+    switch (type) {
+        case GAMEOBJECT_MODEL:              { return 'M'; }
+        case GAMEOBJECT_DIRECTIONAL_LIGHT:  { return 'D'; }
+        case GAMEOBJECT_POINT_LIGHT:        { return 'P'; }
+        case GAMEOBJECT_LIGHT_PROBE:        { return 'L'; }
+        default:                            { return 'N'; }
+    }
+}
+
+static GameObjectType sTypeFromChar (char c) {
+    switch (c) {
+        case 'M': { return GAMEOBJECT_MODEL; }
+        case 'D': { return GAMEOBJECT_DIRECTIONAL_LIGHT; }
+        case 'P': { return GAMEOBJECT_POINT_LIGHT; }
+        case 'L': { return GAMEOBJECT_LIGHT_PROBE; }
+        default:  { return GAMEOBJECT_NULL; }
+    }
+}
+
+static void sSnapshotFilename (const char* directory, uint64_t generation, char* out, size_t size) {
+    stbsp_snprintf(out, (int) size, "%s/snapshot-%llu.vxscene", directory, (unsigned long long) generation);
+}
+
+static void sJournalFilename (const char* directory, uint64_t generation, char* out, size_t size) {
+    stbsp_snprintf(out, (int) size, "%s/journal-%llu.vxjournal", directory, (unsigned long long) generation);
+}
+
+// Returns true if name is "<prefix><number><suffix>", and writes the number to generation.
+static bool sParseGeneration (const char* name, const char* prefix, const char* suffix, uint64_t* generation) {
+    size_t prefixLen = strlen(prefix);
+    if (strncmp(name, prefix, prefixLen) != 0) { return false; }
+    char* end = NULL;
+    unsigned long long n = strtoull(name + prefixLen, &end, 10);
+    if (end == name + prefixLen || strcmp(end, suffix) != 0) { return false; }
+    *generation = (uint64_t) n;
+    return true;
+}
+
+// *********************************************************************************************************************
+// Recording:
+
+static void sWriteRecord (SceneJournal* journal, JournalRecord* rec, const char* name) {
+    rec->nameLength = (name != NULL) ? (uint16_t) vxMin(strlen(name), UINT16_MAX) : 0;
+    rec->checksum = sChecksum(rec, name);
+    fwrite(rec, sizeof(JournalRecord), 1, journal->file);
+    if (rec->nameLength > 0) {
+        fwrite(name, 1, rec->nameLength, journal->file);
+    }
+    journal->recordCount++;
+}
+
+void RecordObjectAdded (SceneJournal* journal, Scene* scene, int32_t object) {
+    if (journal->file == NULL) { return; }
+    GameObject* obj = &scene->objects[object];
+    JournalRecord rec = {0};
+    rec.op = JOURNAL_ADD;
+    rec.type = (uint8_t) sTypeChar(obj->type);
+    rec.object = object;
+    rec.parent = (obj->parent != NULL) ? (int32_t)(obj->parent - scene->objects) : -1;
+    sWriteRecord(journal, &rec, NULL);
+
+    journal->addedCount++;
+    if (journal->addedCount > journal->addedSlots) {
+        journal->addedSlots = vxMax(journal->addedCount * 2, 64);
+        journal->added = (int32_t*) vxAlignedRealloc(journal->added, journal->addedSlots, sizeof(int32_t),
+            vxAlignOf(int32_t));
+    }
+    journal->added[journal->addedCount - 1] = object;
+}
+
+void RecordObjectDeleted (SceneJournal* journal, int32_t object) {
+    if (journal->file == NULL) { return; }
+    JournalRecord rec = {0};
+    rec.op = JOURNAL_DELETE;
+    rec.object = object;
+    rec.parent = -1;
+    sWriteRecord(journal, &rec, NULL);
+
+    // Objects after the deleted one move down by one slot:
+    size_t n = 0;
+    for (size_t i = 0; i < journal->addedCount; i++) {
+        int32_t added = journal->added[i];
+        if (added != object) {
+            journal->added[n++] = (added > object) ? added - 1 : added;
+        }
+    }
+    journal->addedCount = n;
+}
+
+void RecordObjectChanged (SceneJournal* journal, Scene* scene, int32_t object) {
+    if (journal->file == NULL) { return; }
+    GameObject* obj = &scene->objects[object];
+    JournalRecord rec = {0};
+    rec.op = JOURNAL_SET;
+    rec.type = (uint8_t) sTypeChar(obj->type);
+    rec.object = object;
+    rec.parent = (obj->parent != NULL) ? (int32_t)(obj->parent - scene->objects) : -1;
+    memcpy(rec.position, obj->localPosition, sizeof(vec3));
+    memcpy(rec.rotation, obj->localRotation, sizeof(versor));
+    memcpy(rec.scale,    obj->localScale,    sizeof(vec3));
+    const char* name = NULL;
+    switch (obj->type) {
+        case GAMEOBJECT_MODEL: {
+            // Objects that were just added may not have a model yet, they're recorded again once they do:
+            if (obj->model.model == NULL) {
+                rec.type = 'N';
+            } else {
+                name = obj->model.model->name;
+            }
+        } break;
+        case GAMEOBJECT_DIRECTIONAL_LIGHT: {
+            memcpy(rec.colors, obj->directionalLight.color, sizeof(vec3));
+        } break;
+        case GAMEOBJECT_POINT_LIGHT: {
+            memcpy(rec.colors, obj->pointLight.color, sizeof(vec3));
+        } break;
+        case GAMEOBJECT_LIGHT_PROBE: {
+            memcpy(rec.colors + 0,  obj->lightProbe.colorXp, sizeof(vec3));
+            memcpy(rec.colors + 3,  obj->lightProbe.colorXn, sizeof(vec3));
+            memcpy(rec.colors + 6,  obj->lightProbe.colorYp, sizeof(vec3));
+            memcpy(rec.colors + 9,  obj->lightProbe.colorYn, sizeof(vec3));
+            memcpy(rec.colors + 12, obj->lightProbe.colorZp, sizeof(vec3));
+            memcpy(rec.colors + 15, obj->lightProbe.colorZn, sizeof(vec3));
+        } break;
+        default: break;
+    }
+    sWriteRecord(journal, &rec, name);
+}
+
+// *********************************************************************************************************************
+// Background writer:
+
+static void sDeleteGeneration (const char* directory, uint64_t generation) {
+    char filename [4096];
+    sSnapshotFilename(directory, generation, filename, sizeof(filename));
+    remove(filename);
+    sJournalFilename(directory, generation, filename, sizeof(filename));
+    remove(filename);
+}
+
+static void sWriteSnapshotJob (void* user) {
+    SceneJournal* journal = (SceneJournal*) user;
+    // Written to a temporary file first, so a crash halfway through never leaves a broken scene behind:
+    char tmpFilename [4096 + 8];
+    stbsp_snprintf(tmpFilename, (int) sizeof(tmpFilename), "%s.tmp", journal->snapshotPath);
+    bool ok = journal->snapshotBinary ? SaveSceneBinary(&journal->snapshot, tmpFilename) :
+                                        SaveScene(&journal->snapshot, tmpFilename);
+    ok = ok && vxReplaceFile(tmpFilename, journal->snapshotPath);
+    if (!ok) {
+        remove(tmpFilename);
+    } else if (journal->snapshotAutosave) {
+        // The new snapshot covers everything in older generations now:
+        for (uint64_t g = journal->oldestGeneration; g < journal->generation; g++) {
+            sDeleteGeneration(journal->directory, g);
+        }
+        journal->oldestGeneration = journal->generation;
+    }
+}
+
+static void sWaitForWriter (SceneJournal* journal) {
+    if (vxAtomicLoad32(&journal->writer.pending) > 0) {
+        StartBlock("Wait For Scene Writer");
+        vxWaitForJobs(&journal->writer);
+        EndBlock();
+    }
+}
+
+// Copies the scene's objects for the writer. Objects are plain data (model names stay valid even while the model is
+// unloaded), so a flat copy with fixed up parent pointers is a complete snapshot.
+static void sStartWriter (SceneJournal* journal, Scene* scene, const char* filename, bool binary, bool autosave) {
+    sWaitForWriter(journal);
+    Scene* snapshot = &journal->snapshot;
+    if (snapshot->slots < scene->size) {
+        if (snapshot->objects != NULL) { vxFree(snapshot->objects); }
+        snapshot->slots = vxMax(scene->size * 2, 64);
+        snapshot->objects = vxAlloc(snapshot->slots, GameObject);
+    }
+    memcpy(snapshot->objects, scene->objects, scene->size * sizeof(GameObject));
+    for (size_t i = 0; i < scene->size; i++) {
+        if (snapshot->objects[i].parent != NULL) {
+            snapshot->objects[i].parent = snapshot->objects + (scene->objects[i].parent - scene->objects);
+        }
+    }
+    snapshot->size = scene->size;
+    stbsp_snprintf(journal->snapshotPath, (int) sizeof(journal->snapshotPath), "%s", filename);
+    journal->snapshotBinary = binary;
+    journal->snapshotAutosave = autosave;
+
+    vxRunBackgroundJob("Write Scene Snapshot", sWriteSnapshotJob, journal, &journal->writer);
+}
+
+// Closes the current journal, and starts the next generation with a snapshot of the scene.
+static void sStartGeneration (SceneJournal* journal, Scene* scene) {
+    sWaitForWriter(journal);
+    if (journal->file != NULL) {
+        fclose(journal->file);
+        journal->file = NULL;
+    }
+    journal->generation++;
+    journal->recordCount = 0;
+    journal->addedCount = 0;
+
+    static char filename [4096];
+    sJournalFilename(journal->directory, journal->generation, filename, sizeof(filename));
+    journal->file = fopen(filename, "wb");
+    if (journal->file == NULL) {
+        vxLog("Warning: can't open journal %s (%s), autosave is off.", filename, strerror(errno));
+        return;
+    }
+    uint32_t version = JOURNAL_VERSION;
+    fwrite(MAGIC, 1, sizeof(MAGIC)-1, journal->file);
+    fwrite(&version, sizeof(version), 1, journal->file);
+
+    sSnapshotFilename(journal->directory, journal->generation, filename, sizeof(filename));
+    sStartWriter(journal, scene, filename, true, true);
+}
+
+// *********************************************************************************************************************
+// Journal management:
+
+void InitSceneJournal (SceneJournal* journal, Scene* scene, const char* directory) {
+    memset(journal, 0, sizeof(SceneJournal));
+    stbsp_snprintf(journal->directory, (int) sizeof(journal->directory), "%s", directory);
+    vxCreateDirectory(directory);
+
+    // Generations continue from the files already there (if any), which are cleaned up by the first snapshot:
+    uint64_t oldest = UINT64_MAX;
+    uint64_t newest = 0;
+    char** files = vxListFiles(directory, NULL);
+    for (size_t i = 0; files != NULL && files[i] != NULL; i++) {
+        uint64_t g;
+        if (sParseGeneration(files[i], "snapshot-", ".vxscene", &g) ||
+            sParseGeneration(files[i], "journal-", ".vxjournal", &g))
+        {
+            oldest = vxMin(oldest, g);
+            newest = vxMax(newest, g);
+        }
+    }
+    journal->generation = newest;
+    journal->oldestGeneration = (oldest == UINT64_MAX) ? newest + 1 : oldest;
+    scene->journal = journal;
+}
+
+void DeleteSceneJournal (SceneJournal* journal, Scene* scene) {
+    sWaitForWriter(journal);
+    if (journal->file != NULL) {
+        // A clean shutdown, nothing to recover next time:
+        fclose(journal->file);
+        for (uint64_t g = journal->oldestGeneration; g <= journal->generation; g++) {
+            sDeleteGeneration(journal->directory, g);
+        }
+    }
+    if (journal->added != NULL) { vxFree(journal->added); }
+    if (journal->snapshot.objects != NULL) { vxFree(journal->snapshot.objects); }
+    if (scene->journal == journal) {
+        scene->journal = NULL;
+    }
+    memset(journal, 0, sizeof(SceneJournal));
+}
+
+void RestartSceneJournal (SceneJournal* journal, Scene* scene) {
+    journal->addedCount = 0;
+    if (journal->file != NULL) {
+        sStartGeneration(journal, scene);
+    }
+}
+
+void UpdateSceneJournal (SceneJournal* journal, Scene* scene, float time, bool autosave, float interval) {
+    if (autosave && journal->file == NULL) {
+        sStartGeneration(journal, scene);
+        journal->lastSnapshotTime = time;
+    } else if (!autosave && journal->file != NULL) {
+        sWaitForWriter(journal);
+        fclose(journal->file);
+        journal->file = NULL;
+        for (uint64_t g = journal->oldestGeneration; g <= journal->generation; g++) {
+            sDeleteGeneration(journal->directory, g);
+        }
+        journal->oldestGeneration = journal->generation + 1;
+    }
+    if (journal->file == NULL) {
+        journal->addedCount = 0;
+        return;
+    }
+
+    for (size_t i = 0; i < journal->addedCount; i++) {
+        RecordObjectChanged(journal, scene, journal->added[i]);
+    }
+    journal->addedCount = 0;
+    fflush(journal->file);
+
+    bool writerIdle = vxAtomicLoad32(&journal->writer.pending) == 0;
+    bool due = time - journal->lastSnapshotTime >= interval || journal->recordCount >= Journal_MaxRecords;
+    if (writerIdle && journal->recordCount > 0 && due) {
+        sStartGeneration(journal, scene);
+        journal->lastSnapshotTime = time;
+    }
+}
+
+void SaveSceneInBackground (Scene* scene, const char* filename, bool binary) {
+    SceneJournal* journal = scene->journal;
+    if (journal == NULL) {
+        if (binary) {
+            SaveSceneBinary(scene, filename);
+        } else {
+            SaveScene(scene, filename);
+        }
+        return;
+    }
+    // Snapshots don't include the cell graph, but it's small enough to save right away:
+    if (scene->cells.cellCount > 0) {
+        static char cellsFilename [4096];
+        GetSceneSiblingFilename(filename, ".vxcells", cellsFilename, sizeof(cellsFilename));
+        SaveCells(&scene->cells, cellsFilename);
+    }
+    sStartWriter(journal, scene, filename, binary, false);
+}
+
+// *********************************************************************************************************************
+// Recovery:
+
+// [model] is the model the record's name resolves to, NULL if there's none.
+static void sApplyRecord (Scene* scene, GameObject* obj, JournalRecord* rec, const char* name, Model* model) {
+    if (rec->parent >= 0 && (size_t) rec->parent < scene->size && &scene->objects[rec->parent] != obj) {
+        obj->parent = &scene->objects[rec->parent];
+    } else {
+        obj->parent = NULL;
+    }
+    memcpy(obj->localPosition, rec->position, sizeof(vec3));
+    memcpy(obj->localRotation, rec->rotation, sizeof(versor));
+    memcpy(obj->localScale,    rec->scale,    sizeof(vec3));
+    obj->type = sTypeFromChar((char) rec->type);
+    switch (obj->type) {
+        case GAMEOBJECT_MODEL: {
+            obj->model.model = model;
+            if (model == NULL) {
+                vxLog("Warning: unknown model %s in journal, replacing object %ju with an empty one", name,
+                    (size_t)(obj - scene->objects));
+                obj->type = GAMEOBJECT_NULL;
+            }
+        } break;
+        case GAMEOBJECT_DIRECTIONAL_LIGHT: {
+            memcpy(obj->directionalLight.color, rec->colors, sizeof(vec3));
+        } break;
+        case GAMEOBJECT_POINT_LIGHT: {
+            memcpy(obj->pointLight.color, rec->colors, sizeof(vec3));
+        } break;
+        case GAMEOBJECT_LIGHT_PROBE: {
+            memcpy(obj->lightProbe.colorXp, rec->colors + 0,  sizeof(vec3));
+            memcpy(obj->lightProbe.colorXn, rec->colors + 3,  sizeof(vec3));
+            memcpy(obj->lightProbe.colorYp, rec->colors + 6,  sizeof(vec3));
+            memcpy(obj->lightProbe.colorYn, rec->colors + 9,  sizeof(vec3));
+            memcpy(obj->lightProbe.colorZp, rec->colors + 12, sizeof(vec3));
+            memcpy(obj->lightProbe.colorZn, rec->colors + 15, sizeof(vec3));
+        } break;
+        default: break;
+    }
+    glm_vec3_copy(obj->localPosition, obj->lastLocalPosition);
+    glm_quat_copy(obj->localRotation, obj->lastLocalRotation);
+    glm_vec3_copy(obj->localScale,    obj->lastLocalScale);
+    obj->needsUpdate = true;
+}
+
+// Replays a journal into a scene. Returns the number of records applied, stopping at the first broken one.
+static size_t sReplayJournal (Scene* scene, const char* filename) {
+    FILE* f = fopen(filename, "rb");
+    if (f == NULL) {
+        return 0;
+    }
+    char buf [sizeof(MAGIC)] = {0};
+    uint32_t version = 0;
+    if (fread(buf, 1, sizeof(MAGIC)-1, f) != sizeof(MAGIC)-1 || strncmp(buf, MAGIC, sizeof(MAGIC)-1) != 0 ||
+        fread(&version, sizeof(version), 1, f) != 1 || version != JOURNAL_VERSION)
+    {
+        vxLog("Warning: %s is not a valid journal", filename);
+        fclose(f);
+        return 0;
+    }
+
+    // Model names are resolved through a hashmap of the registered models, like binary scenes do (see scene/save.c):
+    struct { char* key; Model* value; }* modelsByName = NULL;
+    for (size_t i = 0; i < ModelCount; i++) {
+        stbds_shput(modelsByName, (char*) ModelNames[i], Models[i]);
+    }
+
+    size_t applied = 0;
+    JournalRecord rec;
+    static char name [UINT16_MAX + 1];
+    while (fread(&rec, sizeof(JournalRecord), 1, f) == 1) {
+        if (fread(name, 1, rec.nameLength, f) != rec.nameLength) { break; }
+        name[rec.nameLength] = '\0';
+        if (rec.checksum != sChecksum(&rec, name)) {
+            vxLog("Warning: record %ju of %s is damaged, skipping the rest", applied, filename);
+            break;
+        }
+        bool valid = rec.object >= 0 && (size_t) rec.object < scene->size;
+        if (rec.op == JOURNAL_ADD) {
+            GameObject* parent = (rec.parent >= 0 && (size_t) rec.parent < scene->size) ?
+                &scene->objects[rec.parent] : NULL;
+            // Models are filled in by the JOURNAL_SET record that follows:
+            GameObjectType type = sTypeFromChar((char) rec.type);
+            if (type == GAMEOBJECT_MODEL) { type = GAMEOBJECT_NULL; }
+            if (scene->size >= scene->slots) {
+                ReserveSceneObjects(scene, scene->slots * 2);
+            }
+            if (AddObject(scene, parent, type) == NULL) { break; }
+        } else if (rec.op == JOURNAL_DELETE && valid) {
+            DeleteObjectFromScene(scene, &scene->objects[rec.object]);
+        } else if (rec.op == JOURNAL_SET && valid) {
+            Model* model = NULL;
+            if (sTypeFromChar((char) rec.type) == GAMEOBJECT_MODEL) {
+                ptrdiff_t entry = stbds_shgeti(modelsByName, name);
+                model = (entry >= 0) ? modelsByName[entry].value : NULL;
+            }
+            sApplyRecord(scene, &scene->objects[rec.object], &rec, name, model);
+        } else {
+            vxLog("Warning: record %ju of %s is invalid, skipping the rest", applied, filename);
+            break;
+        }
+        applied++;
+    }
+    stbds_shfree(modelsByName);
+    fclose(f);
+    return applied;
+}
+
+bool RecoverScene (Scene* scene, const char* directory) {
+    vxCheck(scene->journal == NULL);
+    bool found = false;
+    uint64_t generation = 0;
+    char** files = vxListFiles(directory, ".vxscene");
+    for (size_t i = 0; files != NULL && files[i] != NULL; i++) {
+        uint64_t g;
+        if (sParseGeneration(files[i], "snapshot-", ".vxscene", &g) && (!found || g > generation)) {
+            generation = g;
+            found = true;
+        }
+    }
+    if (!found) {
+        return false;
+    }
+
+    // The journal of the next generation exists if its snapshot was still being written:
+    static char filename [4096];
+    sSnapshotFilename(directory, generation, filename, sizeof(filename));
+    vxLog("Recovering scene from %s...", filename);
+    if (!LoadScene(scene, filename)) {
+        return false;
+    }
+    sJournalFilename(directory, generation, filename, sizeof(filename));
+    size_t replayed = sReplayJournal(scene, filename);
+    sJournalFilename(directory, generation + 1, filename, sizeof(filename));
+    replayed += sReplayJournal(scene, filename);
+    vxLog("Recovered %ju objects, replayed %ju edits", scene->size, replayed);
+    return true;
+}
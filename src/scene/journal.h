@@ -0,0 +1,62 @@
+#pragma once
+#include "common.h"
+#include "core.h"
+
+// Autosave and crash recovery for the editor. Every object that's added, deleted or moved is appended to a binary
+// journal as it happens, which is cheap enough to do every frame. Every now and then the journal is compacted: the
+// scene's objects are copied into a snapshot that a background job writes out as a binary scene, while new edits
+// go to a fresh journal. After a crash, the newest snapshot is loaded and the journals written since are replayed.
+//
+// Autosave files live in their own directory, numbered by generation:
+//   snapshot-<n>.vxscene   the scene at the start of generation n, in the binary format
+//   journal-<n>.vxjournal  edits made during generation n, on top of its snapshot
+// A snapshot is written to a temporary file and renamed once it's complete, and only then are older generations
+// deleted, so there's always a complete snapshot and every journal written after it on disk. Cell graphs and PVS data
+// aren't part of snapshots.
+//
+// The same background writer saves scenes from the editor, so saving never stalls a frame either.
+
+typedef struct SceneJournal {
+    char directory [1024];
+    FILE* file;              // journal of the current generation, NULL if autosave is off
+    uint64_t generation;
+    uint64_t oldestGeneration; // oldest generation that may still have files on disk
+    size_t recordCount;      // records in the current journal
+    float lastSnapshotTime;
+    // Objects added since the last update. They're recorded in full by UpdateSceneJournal, since their contents are
+    // usually filled in right after AddObject returns.
+    size_t addedSlots;
+    size_t addedCount;
+    int32_t* added;
+    // Background writer:
+    vxJobCounter writer;      // the job writing the snapshot
+    Scene snapshot;           // copy of the objects being written
+    bool snapshotBinary;
+    bool snapshotAutosave;    // delete older generations once the snapshot is complete
+    char snapshotPath [4096]; // final name, the writer uses a temporary file next to it
+} SceneJournal;
+
+// Journals with at least this many records are compacted without waiting for the autosave interval.
+static const size_t Journal_MaxRecords = 65536;
+
+// Replays the autosave files in a directory into a scene. Returns false (leaving the scene alone) if there's nothing
+// to recover, i.e. the last session shut down cleanly.
+VX_EXPORT bool RecoverScene (Scene* scene, const char* directory);
+
+// Attaches a journal to a scene. Autosave files are written once UpdateSceneJournal is called with autosave enabled.
+VX_EXPORT void InitSceneJournal (SceneJournal* journal, Scene* scene, const char* directory);
+// Waits for the background writer and deletes the autosave files.
+VX_EXPORT void DeleteSceneJournal (SceneJournal* journal, Scene* scene);
+// Flushes the journal, and starts a new snapshot if the interval has passed. Call once per frame, after UpdateScene.
+VX_EXPORT void UpdateSceneJournal (SceneJournal* journal, Scene* scene, float time, bool autosave, float interval);
+// Starts a new generation right away. Used when the whole scene is replaced, e.g. by LoadScene.
+VX_EXPORT void RestartSceneJournal (SceneJournal* journal, Scene* scene);
+
+// Saves a scene on the background writer, or right away if the scene has no journal. Waits for a previous save that's
+// still in progress.
+VX_EXPORT void SaveSceneInBackground (Scene* scene, const char* filename, bool binary);
+
+// Called by the scene when objects change:
+VX_EXPORT void RecordObjectAdded (SceneJournal* journal, Scene* scene, int32_t object);
+VX_EXPORT void RecordObjectDeleted (SceneJournal* journal, int32_t object);
+VX_EXPORT void RecordObjectChanged (SceneJournal* journal, Scene* scene, int32_t object);
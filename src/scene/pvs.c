@@ -0,0 +1,262 @@
+#include "pvs.h"
+#include "core.h"
+
+static const char MAGIC[] = "VXEngine PVS v1.0\n";
+
+// Bounds that differ from the baked ones by more than this count as moved.
+static const float PVS_BoundsTolerance = 1e-3f;
+
+// Compressed bitsets are a sequence of runs, each starting with a control byte c:
+//   c < 128:         c+1 literal bytes follow
+//   128 <= c < 192:  c-127 zero bytes
+//   192 <= c:        c-191 0xFF bytes
+// Most objects are either hidden or visible from large groups of neighbouring cells, so long runs of zeros and ones
+// are common.
+
+void DeletePVS (PVS* pvs) {
+    if (pvs->objectBounds != NULL) { vxFree(pvs->objectBounds); }
+    if (pvs->cellOffsets != NULL) { vxFree(pvs->cellOffsets); }
+    if (pvs->data != NULL) { vxFree(pvs->data); }
+    if (pvs->visible != NULL) { vxFree(pvs->visible); }
+    if (pvs->moved != NULL) { vxFree(pvs->moved); }
+    memset(pvs, 0, sizeof(PVS));
+    pvs->currentCell = -1;
+}
+
+static void sAllocRuntimeState (PVS* pvs) {
+    size_t words = vxMax(PVSWordCount(pvs->objectCount), 1);
+    pvs->visible = vxAlloc(words, uint64_t);
+    pvs->moved = vxAlloc(words, uint64_t);
+    memset(pvs->moved, 0, words * sizeof(uint64_t));
+    pvs->currentCell = -1;
+}
+
+void InitPVS (PVS* pvs, vec3 min, float cellSize, int32_t dims[3], size_t objectCount) {
+    DeletePVS(pvs);
+    glm_vec3_copy(min, pvs->min);
+    pvs->cellSize = cellSize;
+    memcpy(pvs->dims, dims, sizeof(pvs->dims));
+    pvs->objectCount = objectCount;
+    pvs->objectBounds = vxAlloc(vxMax(objectCount, 1) * 6, float);
+    memset(pvs->objectBounds, 0, vxMax(objectCount, 1) * 6 * sizeof(float));
+    pvs->cellOffsets = vxAlloc((size_t) dims[0] * dims[1] * dims[2] + 1, uint32_t);
+    pvs->cellOffsets[0] = 0;
+    sAllocRuntimeState(pvs);
+}
+
+static void sPushByte (PVS* pvs, uint8_t b) {
+    pvs->dataSize++;
+    if (pvs->dataSize > pvs->dataSlots) {
+        pvs->dataSlots = vxMax(pvs->dataSize * 2, 4096);
+        pvs->data = (uint8_t*) vxAlignedRealloc(pvs->data, pvs->dataSlots, sizeof(uint8_t), vxAlignOf(uint8_t));
+    }
+    pvs->data[pvs->dataSize - 1] = b;
+}
+
+void AddPVSCell (PVS* pvs, const uint64_t* bits) {
+    const uint8_t* bytes = (const uint8_t*) bits;
+    size_t n = PVSWordCount(pvs->objectCount) * sizeof(uint64_t);
+    size_t i = 0;
+    while (i < n) {
+        uint8_t b = bytes[i];
+        size_t run = 1;
+        if (b == 0x00 || b == 0xFF) {
+            while (i + run < n && bytes[i + run] == b && run < 64) { run++; }
+            sPushByte(pvs, (uint8_t)((b == 0x00 ? 128 : 192) + run - 1));
+        } else {
+            while (i + run < n && bytes[i + run] != 0x00 && bytes[i + run] != 0xFF && run < 128) { run++; }
+            sPushByte(pvs, (uint8_t)(run - 1));
+            for (size_t k = 0; k < run; k++) {
+                sPushByte(pvs, bytes[i + k]);
+            }
+        }
+        i += run;
+    }
+    pvs->cellCount++;
+    pvs->cellOffsets[pvs->cellCount] = (uint32_t) pvs->dataSize;
+}
+
+// Returns false if the compressed data doesn't decode to exactly one bitset.
+static bool sDecodeCell (PVS* pvs, int64_t cell, uint64_t* bits) {
+    uint8_t* bytes = (uint8_t*) bits;
+    size_t n = PVSWordCount(pvs->objectCount) * sizeof(uint64_t);
+    size_t i = 0;
+    const uint8_t* src = pvs->data + pvs->cellOffsets[cell];
+    const uint8_t* end = pvs->data + pvs->cellOffsets[cell + 1];
+    while (src < end) {
+        uint8_t c = *src++;
+        if (c < 128) {
+            size_t run = (size_t) c + 1;
+            if (i + run > n || src + run > end) { return false; }
+            memcpy(bytes + i, src, run);
+            src += run;
+            i += run;
+        } else {
+            size_t run = (c < 192) ? (size_t) c - 127 : (size_t) c - 191;
+            if (i + run > n) { return false; }
+            memset(bytes + i, (c < 192) ? 0x00 : 0xFF, run);
+            i += run;
+        }
+    }
+    return i == n;
+}
+
+bool LoadPVS (PVS* pvs, const char* filename) {
+    DeletePVS(pvs);
+    FILE* f = fopen(filename, "rb");
+    if (f == NULL) {
+        return false;
+    }
+
+    #define READ(buf, size) do { \
+        size_t r = fread(buf, 1, size, f); \
+        if (r != (size_t)(size)) { \
+            vxLog("Read failed: fread %ju bytes, expected %ju", r, (size_t)(size)); \
+            goto fail; \
+        } \
+    } while(0)
+
+    char buf [sizeof(MAGIC)] = {0};
+    READ(buf, sizeof(MAGIC)-1);
+    if (strncmp(buf, MAGIC, sizeof(MAGIC)-1) != 0) {
+        vxLog("Read failed: %s is not a valid PVS file", filename);
+        goto fail;
+    }
+
+    uint32_t objectCount, dataSize;
+    vec3 min;
+    float cellSize;
+    int32_t dims [3];
+    READ(&objectCount, sizeof(objectCount));
+    READ(min, sizeof(vec3));
+    READ(&cellSize, sizeof(cellSize));
+    READ(dims, sizeof(dims));
+    READ(&dataSize, sizeof(dataSize));
+    if (dims[0] <= 0 || dims[1] <= 0 || dims[2] <= 0 || (int64_t) dims[0] * dims[1] * dims[2] > INT32_MAX ||
+        !(cellSize > 0.0f))
+    {
+        vxLog("Read failed: %s has an invalid grid", filename);
+        goto fail;
+    }
+
+    InitPVS(pvs, min, cellSize, dims, objectCount);
+    size_t cellCount = (size_t) dims[0] * dims[1] * dims[2];
+    READ(pvs->objectBounds, objectCount * 6 * sizeof(float));
+    READ(pvs->cellOffsets, (cellCount + 1) * sizeof(uint32_t));
+    pvs->cellCount = cellCount;
+    pvs->dataSlots = vxMax(dataSize, 1);
+    pvs->data = vxAlloc(pvs->dataSlots, uint8_t);
+    pvs->dataSize = dataSize;
+    READ(pvs->data, dataSize);
+    for (size_t i = 0; i < cellCount; i++) {
+        if (pvs->cellOffsets[i] > pvs->cellOffsets[i + 1] || pvs->cellOffsets[i + 1] > dataSize) {
+            vxLog("Read failed: %s has invalid cell offsets", filename);
+            goto fail;
+        }
+    }
+
+    #undef READ
+
+    vxLog("Read PVS with %ju cells and %ju objects (%ju bytes) from %s", cellCount, pvs->objectCount,
+        pvs->dataSize, filename);
+    fclose(f);
+    return true;
+
+    fail:
+    DeletePVS(pvs);
+    fclose(f);
+    return false;
+}
+
+bool SavePVS (PVS* pvs, const char* filename) {
+    FILE* f = fopen(filename, "wb");
+    if (f == NULL) {
+        vxLog("Write failed: can't open file! %s", strerror(errno));
+        return false;
+    }
+    uint32_t objectCount = (uint32_t) pvs->objectCount;
+    uint32_t dataSize = (uint32_t) pvs->dataSize;
+    fwrite(MAGIC, 1, sizeof(MAGIC)-1, f);
+    fwrite(&objectCount, sizeof(objectCount), 1, f);
+    fwrite(pvs->min, sizeof(vec3), 1, f);
+    fwrite(&pvs->cellSize, sizeof(float), 1, f);
+    fwrite(pvs->dims, sizeof(pvs->dims), 1, f);
+    fwrite(&dataSize, sizeof(dataSize), 1, f);
+    fwrite(pvs->objectBounds, sizeof(float), pvs->objectCount * 6, f);
+    fwrite(pvs->cellOffsets, sizeof(uint32_t), pvs->cellCount + 1, f);
+    fwrite(pvs->data, 1, pvs->dataSize, f);
+    bool ok = !ferror(f);
+    fclose(f);
+    if (!ok) {
+        vxLog("Write failed: %s", strerror(errno));
+    }
+    return ok;
+}
+
+int64_t FindPVSCell (PVS* pvs, vec3 p) {
+    int64_t cell = 0;
+    int64_t stride = 1;
+    for (int i = 0; i < 3; i++) {
+        float c = floorf((p[i] - pvs->min[i]) / pvs->cellSize);
+        if (!(c >= 0.0f && c < (float) pvs->dims[i])) { return -1; }
+        cell += (int64_t) c * stride;
+        stride *= pvs->dims[i];
+    }
+    return cell;
+}
+
+void GetPVSObjectBounds (GameObject* obj, vec3 min, vec3 max) {
+    if (obj->type == GAMEOBJECT_MODEL && obj->model.model != NULL) {
+        TransformAABB(obj->worldMatrix, obj->model.model->aabbMin, obj->model.model->aabbMax, min, max);
+    } else {
+        glm_vec3_copy(obj->worldMatrix[3], min);
+        glm_vec3_copy(obj->worldMatrix[3], max);
+    }
+}
+
+static bool sMatchesBakedBounds (PVS* pvs, size_t object, vec3 min, vec3 max) {
+    float* baked = &pvs->objectBounds[object * 6];
+    for (int i = 0; i < 3; i++) {
+        if (fabsf(baked[i] - min[i]) > PVS_BoundsTolerance || fabsf(baked[i + 3] - max[i]) > PVS_BoundsTolerance) {
+            return false;
+        }
+    }
+    return true;
+}
+
+const uint64_t* UpdatePVS (PVS* pvs, Scene* scene, vec3 eye) {
+    if (pvs->cellCount == 0 || pvs->sceneVersion != scene->structureVersion || pvs->objectCount > scene->size) {
+        return NULL;
+    }
+
+    // Objects that moved stay visible from everywhere, even if they move back:
+    size_t words = PVSWordCount(pvs->objectCount);
+    for (size_t i = 0; i < pvs->objectCount; i++) {
+        GameObject* obj = &scene->objects[i];
+        uint64_t bit = (uint64_t) 1 << (i % 64);
+        if (!obj->worldMatrixChanged || (pvs->moved[i / 64] & bit)) { continue; }
+        vec3 min, max;
+        GetPVSObjectBounds(obj, min, max);
+        if (!sMatchesBakedBounds(pvs, i, min, max)) {
+            pvs->moved[i / 64] |= bit;
+            pvs->visible[i / 64] |= bit;
+        }
+    }
+
+    int64_t cell = FindPVSCell(pvs, eye);
+    if (cell < 0) {
+        return NULL;
+    }
+    if (cell != pvs->currentCell) {
+        if (!sDecodeCell(pvs, cell, pvs->visible)) {
+            vxLog("Warning: PVS cell %jd is corrupted, disabling the PVS.", cell);
+            DeletePVS(pvs);
+            return NULL;
+        }
+        for (size_t w = 0; w < words; w++) {
+            pvs->visible[w] |= pvs->moved[w];
+        }
+        pvs->currentCell = cell;
+    }
+    return pvs->visible;
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include "common.h"
+
+// Potentially visible sets, baked offline by the PVSBake tool (see tools/pvsbake.c). The scene's bounds are divided
+// into a grid of view cells, and each cell stores a bitset of the scene objects that can be seen from anywhere inside
+// it, run-length compressed. At runtime, the cell containing the camera is decoded once when the camera enters it,
+// and draws of objects that aren't in its set are skipped.
+//
+// Bits are indexed by scene object. Objects that aren't covered by the bake are always visible, and so are objects
+// whose bounds no longer match the baked ones (i.e. that moved). Adding or deleting objects at runtime disables the
+// whole set, since deleting an object shifts the indices of the ones after it.
+//
+// Sets are stored next to the scene, in a binary file with the same name and a .vxpvs extension.
+
+typedef struct PVS {
+    vec3 min;              // corner of the grid
+    float cellSize;
+    int32_t dims [3];      // number of cells along each axis
+    size_t objectCount;    // scene objects covered by the bitsets
+    float* objectBounds;   // baked world space bounds, min and max for each object
+    size_t cellCount;
+    uint32_t* cellOffsets; // start of each cell's compressed bitset in data, plus the end of the last one
+    size_t dataSlots;
+    size_t dataSize;
+    uint8_t* data;
+    // Runtime state:
+    uint32_t sceneVersion; // scene->structureVersion when loaded
+    int64_t currentCell;   // cell decoded into visible, -1 if none
+    uint64_t* visible;     // visible objects from the current cell, including moved ones
+    uint64_t* moved;       // objects that no longer match their baked bounds
+} PVS;
+
+// Number of 64-bit words in a bitset with one bit per object.
+static inline size_t PVSWordCount (size_t objectCount) { return (objectCount + 63) / 64; }
+
+VX_EXPORT void DeletePVS (PVS* pvs);
+// Sets up an empty grid, to be filled in cell order with AddPVSCell (cells are ordered x first, then y, then z).
+VX_EXPORT void InitPVS (PVS* pvs, vec3 min, float cellSize, int32_t dims[3], size_t objectCount);
+VX_EXPORT void AddPVSCell (PVS* pvs, const uint64_t* bits);
+VX_EXPORT bool LoadPVS (PVS* pvs, const char* filename);
+VX_EXPORT bool SavePVS (PVS* pvs, const char* filename);
+
+// Returns the index of the cell containing a point, or -1 if it's outside the grid.
+VX_EXPORT int64_t FindPVSCell (PVS* pvs, vec3 p);
+
+typedef struct Scene Scene;
+typedef struct GameObject GameObject;
+
+// World space bounds of an object, as stored in the bake. Objects without geometry are a single point.
+VX_EXPORT void GetPVSObjectBounds (GameObject* obj, vec3 min, vec3 max);
+
+// Tracks moved objects and decodes the set of the cell containing the eye. Returns the visible objects as a bitset
+// with PVSWordCount(pvs->objectCount) words, or NULL if nothing should be culled (no PVS for this scene, the scene
+// changed since it was baked, or the eye is outside the grid).
+VX_EXPORT const uint64_t* UpdatePVS (PVS* pvs, Scene* scene, vec3 eye);
+
+static inline bool PVSObjectVisible (PVS* pvs, const uint64_t* visible, int32_t object) {
+    return object < 0 || (size_t) object >= pvs->objectCount || (visible[object / 64] >> (object % 64)) & 1;
+}
@@ -1,19 +1,60 @@
 #include "save.h"
 #include "data/model.h"
+#include "journal.h"
 
 static const char MAGIC[] = "VXEngine Scene v1.0\n";
+static const char BINARY_MAGIC[] = "VXEngine Binary Scene\n";
 
-// Loads a scene from the given file. Initializes the given scene object.
-void LoadScene (Scene* scene, const char* filename) {
-    static char buf[128]; // temporary storage used by various parts of this function
+#define BINARY_SCENE_VERSION 1
 
-    vxCheck(scene != NULL);
-    vxLog("Reading into scene 0x%jx from file %s...", scene, filename);
+// Binary scene files hold the same data as text ones, laid out so they can be mapped and read in place:
+// * a header
+// * the object table, one fixed size record per object
+// * a pool of light colors (3 floats for directional and point lights, 18 for light probes)
+// * the offsets of the model names in the string table
+// * the string table, i.e. NUL-terminated model names, each stored once
+// Every section starts at an 8-byte aligned offset. Values are stored in native byte order.
+
+typedef struct BinarySceneHeader {
+    char magic [24];
+    uint32_t version;
+    uint32_t objectCount;
+    uint32_t colorCount;  // floats in the color pool
+    uint32_t stringCount;
+    uint64_t stringBytes;
+    uint64_t objectsOffset;
+    uint64_t colorsOffset;
+    uint64_t stringOffsetsOffset;
+    uint64_t stringsOffset;
+} BinarySceneHeader;
+
+typedef struct BinarySceneObject {
+    uint8_t type;     // same characters as in the text format
+    uint8_t reserved [3];
+    int32_t parent;   // -1 for none
+    uint32_t payload; // models: index in the string table, lights: first float in the color pool
+    float position [3];
+    float rotation [4];
+    float scale [3];
+} BinarySceneObject;
+
+// Cell graphs and PVS data are stored next to the scene file, with the .vxscene extension replaced by their own.
+void GetSceneSiblingFilename (const char* filename, const char* siblingExt, char* out, size_t size) {
+    size_t len = strlen(filename);
+    const char* ext = ".vxscene";
+    if (len >= strlen(ext) && strcmp(filename + len - strlen(ext), ext) == 0) {
+        len -= strlen(ext);
+    }
+    stbsp_snprintf(out, (int) size, "%.*s%s", (int) len, filename, siblingExt);
+}
+
+static bool sLoadTextScene (Scene* scene, const char* filename) {
+    char buf[128]; // temporary storage used by various parts of this function
 
     FILE* f = fopen(filename, "r");
     if (f == NULL) {
         vxLog("Read failed: can't open file! %s", strerror(errno));
-        return;
+        return false;
     }
     fseek(f, 0L, SEEK_END);
     size_t len = ftell(f);
@@ -48,6 +89,7 @@ void LoadScene (Scene* scene, const char* filename) {
 
     // Preallocate:
     InitScene(scene);
+    ReserveSceneObjects(scene, (size_t) vxMax(numObjects, 0));
     for (int iobj = 0; iobj < numObjects; iobj++) {
         AddObject(scene, NULL, GAMEOBJECT_NULL);
     }
@@ -75,7 +117,7 @@ void LoadScene (Scene* scene, const char* filename) {
                 SCAN(1, " %127s", buf);
                 Model* mdl = NULL;
                 for (size_t i = 0; i < ModelCount; i++) {
-                    if (strncmp(buf, Models[i]->name, sizeof(buf)) == 0) {
+                    if (strncmp(buf, ModelNames[i], sizeof(buf)) == 0) {
                         mdl = Models[i];
                         break;
                     }
@@ -135,24 +177,204 @@ void LoadScene (Scene* scene, const char* filename) {
     #undef SCAN
 
     fclose(f);
-    return;
+    return true;
 
     fail:
-    InitScene(scene);
     fclose(f);
+    return false;
+}
+
+static bool sSectionInFile (uint64_t offset, uint64_t count, uint64_t itemSize, size_t fileSize) {
+    return offset % 8 == 0 && offset <= fileSize && (itemSize == 0 || count <= (fileSize - offset) / itemSize);
 }
 
-// Saves a scene to the given file, overwriting any existing contents.
-void SaveScene (Scene* scene, const char* filename) {
+static bool sLoadBinaryScene (Scene* scene, const uint8_t* data, size_t size) {
+    if (size < sizeof(BinarySceneHeader)) {
+        vxLog("Read failed: file is too small for a binary scene");
+        return false;
+    }
+    const BinarySceneHeader* header = (const BinarySceneHeader*) data;
+    if (header->version != BINARY_SCENE_VERSION) {
+        vxLog("Read failed: unsupported binary scene version %u", header->version);
+        return false;
+    }
+    if (!sSectionInFile(header->objectsOffset, header->objectCount, sizeof(BinarySceneObject), size) ||
+        !sSectionInFile(header->colorsOffset, header->colorCount, sizeof(float), size) ||
+        !sSectionInFile(header->stringOffsetsOffset, header->stringCount, sizeof(uint32_t), size) ||
+        !sSectionInFile(header->stringsOffset, header->stringBytes, 1, size))
+    {
+        vxLog("Read failed: binary scene sections don't fit in the file");
+        return false;
+    }
+    const BinarySceneObject* objects = (const BinarySceneObject*)(data + header->objectsOffset);
+    const float* colors = (const float*)(data + header->colorsOffset);
+    const uint32_t* stringOffsets = (const uint32_t*)(data + header->stringOffsetsOffset);
+    const char* strings = (const char*)(data + header->stringsOffset);
+
+    // Resolve each model name once, through a hashmap of the registered models. Scenes can be loaded on other threads
+    // (see scene/stream.h), so this only uses the names that never change.
+    struct { char* key; Model* value; }* modelsByName = NULL;
+    for (size_t i = 0; i < ModelCount; i++) {
+        stbds_shput(modelsByName, (char*) ModelNames[i], Models[i]);
+    }
+    Model** stringModels = vxAlloc(vxMax(header->stringCount, 1), Model*);
+    bool ok = true;
+    for (uint32_t i = 0; i < header->stringCount && ok; i++) {
+        uint64_t offset = stringOffsets[i];
+        if (offset >= header->stringBytes || memchr(strings + offset, '\0', header->stringBytes - offset) == NULL) {
+            vxLog("Read failed: string %u is out of bounds", i);
+            ok = false;
+            break;
+        }
+        ptrdiff_t entry = stbds_shgeti(modelsByName, strings + offset);
+        stringModels[i] = (entry >= 0) ? modelsByName[entry].value : NULL;
+    }
+    stbds_shfree(modelsByName);
+
+    InitScene(scene);
+    ReserveSceneObjects(scene, header->objectCount);
+    for (uint32_t iobj = 0; iobj < header->objectCount && ok; iobj++) {
+        AddObject(scene, NULL, GAMEOBJECT_NULL);
+    }
+
+    for (uint32_t iobj = 0; iobj < header->objectCount && ok; iobj++) {
+        const BinarySceneObject* src = &objects[iobj];
+        GameObject* obj = &scene->objects[iobj];
+        if (src->parent < -1 || src->parent >= (int64_t) header->objectCount) {
+            vxLog("Read failed: object %u has invalid parent %d", iobj, src->parent);
+            ok = false;
+            break;
+        }
+        if (src->parent >= 0) {
+            obj->parent = &scene->objects[src->parent];
+        }
+        memcpy(obj->localPosition, src->position, sizeof(vec3));
+        memcpy(obj->localRotation, src->rotation, sizeof(versor));
+        memcpy(obj->localScale,    src->scale,    sizeof(vec3));
+
+        uint32_t colorFloats = (src->type == 'L') ? 18 : 3;
+        bool colorsValid = src->payload <= header->colorCount && colorFloats <= header->colorCount - src->payload;
+        switch (src->type) {
+            case 'N': {
+                obj->type = GAMEOBJECT_NULL;
+            } break;
+
+            case 'M': {
+                obj->type = GAMEOBJECT_MODEL;
+                if (src->payload >= header->stringCount || stringModels[src->payload] == NULL) {
+                    vxLog("Read failed: unknown model %s for object %u", (src->payload < header->stringCount) ?
+                        strings + stringOffsets[src->payload] : "(invalid)", iobj);
+                    ok = false;
+                    break;
+                }
+                obj->model.model = stringModels[src->payload];
+            } break;
+
+            case 'D': case 'P': case 'L': {
+                if (!colorsValid) {
+                    vxLog("Read failed: object %u has invalid colors", iobj);
+                    ok = false;
+                    break;
+                }
+                const float* c = &colors[src->payload];
+                if (src->type == 'D') {
+                    obj->type = GAMEOBJECT_DIRECTIONAL_LIGHT;
+                    memcpy(obj->directionalLight.color, c, sizeof(vec3));
+                } else if (src->type == 'P') {
+                    obj->type = GAMEOBJECT_POINT_LIGHT;
+                    memcpy(obj->pointLight.color, c, sizeof(vec3));
+                } else {
+                    obj->type = GAMEOBJECT_LIGHT_PROBE;
+                    memcpy(obj->lightProbe.colorXp, c + 0,  sizeof(vec3));
+                    memcpy(obj->lightProbe.colorXn, c + 3,  sizeof(vec3));
+                    memcpy(obj->lightProbe.colorYp, c + 6,  sizeof(vec3));
+                    memcpy(obj->lightProbe.colorYn, c + 9,  sizeof(vec3));
+                    memcpy(obj->lightProbe.colorZp, c + 12, sizeof(vec3));
+                    memcpy(obj->lightProbe.colorZn, c + 15, sizeof(vec3));
+                }
+            } break;
+
+            default: {
+                vxLog("Read failed: object %u has unknown type %c (%u)", iobj, src->type, src->type);
+                ok = false;
+            } break;
+        }
+
+        glm_vec3_copy(obj->localPosition, obj->lastLocalPosition);
+        glm_quat_copy(obj->localRotation, obj->lastLocalRotation);
+        glm_vec3_copy(obj->localScale,    obj->lastLocalScale);
+        obj->needsUpdate = true;
+    }
+    vxFree(stringModels);
+    return ok;
+}
+
+// Loads a scene from the given file, which can be in either the text or the binary format. Initializes the given
+// scene object. Returns false if the file couldn't be read. Scenes that aren't used anywhere else can be loaded on any
+// thread.
+bool LoadScene (Scene* scene, const char* filename) {
+    vxCheck(scene != NULL);
+    vxLog("Reading into scene 0x%jx from file %s...", scene, filename);
+
+    vxMappedFile file;
+    if (!vxMapFile(filename, &file)) {
+        vxLog("Read failed: can't open file!");
+        return false;
+    }
+    // Loading replaces the whole scene, so it isn't journaled object by object. The journal starts over from a
+    // snapshot of the loaded scene instead.
+    SceneJournal* journal = scene->journal;
+    scene->journal = NULL;
+    bool binary = file.size >= sizeof(BINARY_MAGIC)-1 && memcmp(file.data, BINARY_MAGIC, sizeof(BINARY_MAGIC)-1) == 0;
+    bool ok = binary ? sLoadBinaryScene(scene, (const uint8_t*) file.data, file.size) : sLoadTextScene(scene, filename);
+    vxUnmapFile(&file);
+    if (!ok) {
+        InitScene(scene);
+    }
+    scene->journal = journal;
+    if (journal != NULL) {
+        RestartSceneJournal(journal, scene);
+    }
+    if (!ok) {
+        return false;
+    }
+    vxLog("Read %ju objects", scene->size);
+
+    char siblingFilename [4096];
+    GetSceneSiblingFilename(filename, ".vxcells", siblingFilename, sizeof(siblingFilename));
+    LoadCells(&scene->cells, siblingFilename);
+    GetSceneSiblingFilename(filename, ".vxpvs", siblingFilename, sizeof(siblingFilename));
+    if (LoadPVS(&scene->pvs, siblingFilename)) {
+        if (scene->pvs.objectCount > scene->size) {
+            vxLog("Warning: %s was baked for a different scene, ignoring it.", siblingFilename);
+            DeletePVS(&scene->pvs);
+        }
+        scene->pvs.sceneVersion = scene->structureVersion;
+    }
+    return true;
+}
+
+static void sSaveSiblings (Scene* scene, const char* filename) {
+    if (scene->cells.cellCount > 0) {
+        char cellsFilename [4096];
+        GetSceneSiblingFilename(filename, ".vxcells", cellsFilename, sizeof(cellsFilename));
+        SaveCells(&scene->cells, cellsFilename);
+    }
+}
+
+// Saves a scene to the given file, overwriting any existing contents. Returns false if the file couldn't be written.
+bool SaveScene (Scene* scene, const char* filename) {
     vxCheck(scene != NULL);
     vxLog("Writing scene 0x%jx with %ju objects into file %s...", scene, scene->size, filename);
     FILE* f = fopen(filename, "w");
     if (f == NULL) {
         vxLog("Write failed: can't open file! %s", strerror(errno));
-        return;
+        return false;
     }
 
     fputs(MAGIC, f);
+    // Floats are written with 9 significant digits, which is enough to read back the exact same value, so text and
+    // binary scenes can be converted into each other without any loss.
     int numObjects = (int) scene->size;
     fprintf(f, "%d objects", numObjects);
 
@@ -174,7 +396,7 @@ void SaveScene (Scene* scene, const char* filename) {
                 continue;
             } break;
         }
-        fprintf(f, "\n%c %d pos(%g %g %g) rot(%g %g %g %g) scl(%g %g %g)", type, iparent,
+        fprintf(f, "\n%c %d pos(%.9g %.9g %.9g) rot(%.9g %.9g %.9g %.9g) scl(%.9g %.9g %.9g)", type, iparent,
             obj->localPosition[0], obj->localPosition[1], obj->localPosition[2],
             obj->localRotation[0], obj->localRotation[1], obj->localRotation[2], obj->localRotation[3],
             obj->localScale[0], obj->localScale[1], obj->localScale[2]);
@@ -184,13 +406,13 @@ void SaveScene (Scene* scene, const char* filename) {
                 fprintf(f, " %s", obj->model.model->name);
             } break;
             case GAMEOBJECT_DIRECTIONAL_LIGHT: {
-                fprintf(f, " color(%g %g %g)",
+                fprintf(f, " color(%.9g %.9g %.9g)",
                     obj->directionalLight.color[0],
                     obj->directionalLight.color[1],
                     obj->directionalLight.color[2]);
             } break;
             case GAMEOBJECT_POINT_LIGHT: {
-                fprintf(f, " color(%g %g %g)",
+                fprintf(f, " color(%.9g %.9g %.9g)",
                     obj->pointLight.color[0],
                     obj->pointLight.color[1],
                     obj->pointLight.color[2]);
@@ -202,14 +424,151 @@ void SaveScene (Scene* scene, const char* filename) {
                 float* yn = obj->lightProbe.colorYn;
                 float* zp = obj->lightProbe.colorZp;
                 float* zn = obj->lightProbe.colorZn;
-                fprintf(f, " xp(%g %g %g)", xp[0], xp[1], xp[2]);
-                fprintf(f, " xn(%g %g %g)", xn[0], xn[1], xn[2]);
-                fprintf(f, " yp(%g %g %g)", yp[0], yp[1], yp[2]);
-                fprintf(f, " yn(%g %g %g)", yn[0], yn[1], yn[2]);
-                fprintf(f, " zp(%g %g %g)", zp[0], zp[1], zp[2]);
-                fprintf(f, " zn(%g %g %g)", zn[0], zn[1], zn[2]);
+                fprintf(f, " xp(%.9g %.9g %.9g)", xp[0], xp[1], xp[2]);
+                fprintf(f, " xn(%.9g %.9g %.9g)", xn[0], xn[1], xn[2]);
+                fprintf(f, " yp(%.9g %.9g %.9g)", yp[0], yp[1], yp[2]);
+                fprintf(f, " yn(%.9g %.9g %.9g)", yn[0], yn[1], yn[2]);
+                fprintf(f, " zp(%.9g %.9g %.9g)", zp[0], zp[1], zp[2]);
+                fprintf(f, " zn(%.9g %.9g %.9g)", zn[0], zn[1], zn[2]);
             } break;
         }
     }
+    bool ok = !ferror(f);
+    if (!ok) {
+        vxLog("Write failed: %s", strerror(errno));
+    }
     fclose(f);
+    sSaveSiblings(scene, filename);
+    return ok;
+}
+
+static void sWritePadding (FILE* f, uint64_t* offset) {
+    static const uint8_t zeros [8] = {0};
+    uint64_t padding = (8 - (*offset % 8)) % 8;
+    fwrite(zeros, 1, (size_t) padding, f);
+    *offset += padding;
+}
+
+// Saves a scene to the given file in the binary format, overwriting any existing contents. Returns false if the file
+// couldn't be written.
+bool SaveSceneBinary (Scene* scene, const char* filename) {
+    vxCheck(scene != NULL);
+    vxLog("Writing scene 0x%jx with %ju objects into binary file %s...", scene, scene->size, filename);
+    FILE* f = fopen(filename, "wb");
+    if (f == NULL) {
+        vxLog("Write failed: can't open file! %s", strerror(errno));
+        return false;
+    }
+
+    BinarySceneObject* objects = vxAlloc(vxMax(scene->size, 1), BinarySceneObject);
+    float* colors = NULL;            // stb_ds array
+    uint32_t* stringOffsets = NULL;  // stb_ds array
+    char* strings = NULL;            // stb_ds array
+    struct { char* key; uint32_t value; }* stringIndices = NULL;
+    for (size_t iobj = 0; iobj < scene->size; iobj++) {
+        GameObject* obj = &scene->objects[iobj];
+        BinarySceneObject* dst = &objects[iobj];
+        memset(dst, 0, sizeof(BinarySceneObject));
+        dst->parent = (obj->parent != NULL) ? (int32_t)(obj->parent - scene->objects) : -1;
+        memcpy(dst->position, obj->localPosition, sizeof(vec3));
+        memcpy(dst->rotation, obj->localRotation, sizeof(versor));
+        memcpy(dst->scale,    obj->localScale,    sizeof(vec3));
+        size_t at = stbds_arrlenu(colors);
+        dst->payload = (uint32_t) at;
+        switch (obj->type) {
+            case GAMEOBJECT_NULL: {
+                dst->type = 'N';
+                dst->payload = 0;
+            } break;
+            case GAMEOBJECT_MODEL: {
+                vxCheck(obj->model.model != NULL);
+                dst->type = 'M';
+                char* name = obj->model.model->name;
+                ptrdiff_t entry = stbds_shgeti(stringIndices, name);
+                if (entry < 0) {
+                    stbds_shput(stringIndices, name, (uint32_t) stbds_arrlen(stringOffsets));
+                    stbds_arrput(stringOffsets, (uint32_t) stbds_arrlen(strings));
+                    size_t at = stbds_arrlenu(strings);
+                    size_t len = strlen(name) + 1;
+                    stbds_arrsetlen(strings, at + len);
+                    memcpy(&strings[at], name, len);
+                    entry = stbds_shgeti(stringIndices, name);
+                }
+                dst->payload = stringIndices[entry].value;
+            } break;
+            case GAMEOBJECT_DIRECTIONAL_LIGHT: {
+                dst->type = 'D';
+                stbds_arrsetlen(colors, at + 3);
+                memcpy(&colors[at], obj->directionalLight.color, sizeof(vec3));
+            } break;
+            case GAMEOBJECT_POINT_LIGHT: {
+                dst->type = 'P';
+                stbds_arrsetlen(colors, at + 3);
+                memcpy(&colors[at], obj->pointLight.color, sizeof(vec3));
+            } break;
+            case GAMEOBJECT_LIGHT_PROBE: {
+                dst->type = 'L';
+                stbds_arrsetlen(colors, at + 18);
+                float* c = &colors[at];
+                memcpy(c + 0,  obj->lightProbe.colorXp, sizeof(vec3));
+                memcpy(c + 3,  obj->lightProbe.colorXn, sizeof(vec3));
+                memcpy(c + 6,  obj->lightProbe.colorYp, sizeof(vec3));
+                memcpy(c + 9,  obj->lightProbe.colorYn, sizeof(vec3));
+                memcpy(c + 12, obj->lightProbe.colorZp, sizeof(vec3));
+                memcpy(c + 15, obj->lightProbe.colorZn, sizeof(vec3));
+            } break;
+            default: {
+                // Written as an empty object rather than skipped, so the indices of later objects stay valid:
+                vxLog("Write warning: saving object %ju (0x%jx) with unknown type %d as empty", iobj, obj, obj->type);
+                dst->type = 'N';
+                dst->payload = 0;
+            } break;
+        }
+    }
+
+    BinarySceneHeader header = {0};
+    memcpy(header.magic, BINARY_MAGIC, sizeof(BINARY_MAGIC)-1);
+    header.version = BINARY_SCENE_VERSION;
+    header.objectCount = (uint32_t) scene->size;
+    header.colorCount = (uint32_t) stbds_arrlen(colors);
+    header.stringCount = (uint32_t) stbds_arrlen(stringOffsets);
+    header.stringBytes = (uint64_t) stbds_arrlen(strings);
+
+    // Sections are written in order, so compute their offsets the same way:
+    uint64_t offset = sizeof(BinarySceneHeader);
+    offset += (8 - offset % 8) % 8;
+    header.objectsOffset = offset;
+    offset += header.objectCount * sizeof(BinarySceneObject);
+    offset += (8 - offset % 8) % 8;
+    header.colorsOffset = offset;
+    offset += header.colorCount * sizeof(float);
+    offset += (8 - offset % 8) % 8;
+    header.stringOffsetsOffset = offset;
+    offset += header.stringCount * sizeof(uint32_t);
+    offset += (8 - offset % 8) % 8;
+    header.stringsOffset = offset;
+
+    offset = 0;
+    offset += fwrite(&header, 1, sizeof(header), f);
+    sWritePadding(f, &offset);
+    offset += fwrite(objects, 1, header.objectCount * sizeof(BinarySceneObject), f);
+    sWritePadding(f, &offset);
+    offset += fwrite(colors, 1, header.colorCount * sizeof(float), f);
+    sWritePadding(f, &offset);
+    offset += fwrite(stringOffsets, 1, header.stringCount * sizeof(uint32_t), f);
+    sWritePadding(f, &offset);
+    offset += fwrite(strings, 1, (size_t) header.stringBytes, f);
+    bool ok = !ferror(f);
+    if (!ok) {
+        vxLog("Write failed: %s", strerror(errno));
+    }
+    fclose(f);
+
+    vxFree(objects);
+    stbds_arrfree(colors);
+    stbds_arrfree(stringOffsets);
+    stbds_arrfree(strings);
+    stbds_shfree(stringIndices);
+    sSaveSiblings(scene, filename);
+    return ok;
 }
\ No newline at end of file
@@ -2,5 +2,8 @@
 #include "common.h"
 #include "core.h"
 
-VX_EXPORT void LoadScene (Scene* scene, const char* filename);
-VX_EXPORT void SaveScene (Scene* scene, const char* filename);
\ No newline at end of file
+VX_EXPORT bool LoadScene (Scene* scene, const char* filename);
+VX_EXPORT bool SaveScene (Scene* scene, const char* filename);
+VX_EXPORT bool SaveSceneBinary (Scene* scene, const char* filename);
+// Writes the name of a file stored next to a scene file, e.g. "x.vxscene" becomes "x.vxpvs" for the extension ".vxpvs".
+VX_EXPORT void GetSceneSiblingFilename (const char* filename, const char* siblingExt, char* out, size_t size);
\ No newline at end of file
@@ -0,0 +1,471 @@
+#include "stream.h"
+#include "save.h"
+#include "data/model.h"
+
+static const char MAGIC[] = "VXEngine World v1.0\n";
+
+// Chunk coordinates are packed into hashmap keys with 21 bits per axis.
+static const int32_t Stream_MaxChunkCoord = (1 << 20) - 1;
+
+static uint64_t sChunkKey (int32_t coords[3]) {
+    uint64_t key = 0;
+    for (int i = 0; i < 3; i++) {
+        key |= (uint64_t)(coords[i] & 0x1FFFFF) << (21 * i);
+    }
+    return key;
+}
+
+static void sChunkFilename (const char* directory, int32_t coords[3], char* out, size_t size) {
+    stbsp_snprintf(out, (int) size, "%s/chunk_%d_%d_%d.vxscene", directory, coords[0], coords[1], coords[2]);
+}
+
+// Writes the directory holding a world's scenes, i.e. the world's filename without the .vxworld extension.
+static void sWorldDirectory (const char* filename, char* out, size_t size) {
+    size_t len = strlen(filename);
+    const char* ext = ".vxworld";
+    if (len >= strlen(ext) && strcmp(filename + len - strlen(ext), ext) == 0) {
+        len -= strlen(ext);
+    }
+    stbsp_snprintf(out, (int) size, "%.*s", (int) len, filename);
+}
+
+// Distance from a point to the closest point of a chunk, 0 if the point is inside.
+static float sChunkDistance (StreamingWorld* world, StreamChunk* chunk, vec3 p) {
+    float d2 = 0.0f;
+    for (int i = 0; i < 3; i++) {
+        float min = (float) chunk->coords[i] * world->chunkSize;
+        float max = min + world->chunkSize;
+        float d = vxMax(vxMax(min - p[i], p[i] - max), 0.0f);
+        d2 += d * d;
+    }
+    return sqrtf(d2);
+}
+
+// *********************************************************************************************************************
+// Chunks:
+
+static void sLoadChunkJob (void* user) {
+    StreamingWorld* world = (StreamingWorld*) user;
+    world->stagingOk = LoadScene(&world->staging, world->loadingPath);
+}
+
+static void sWaitForLoader (StreamingWorld* world) {
+    if (vxAtomicLoad32(&world->chunkLoad.pending) > 0) {
+        StartBlock("Wait For Chunk Loader");
+        vxWaitForJobs(&world->chunkLoad);
+        EndBlock();
+    }
+}
+
+static void sStartLoader (StreamingWorld* world, int32_t chunk) {
+    world->loadingChunk = chunk;
+    world->chunks[chunk].state = STREAMCHUNK_LOADING;
+    sChunkFilename(world->directory, world->chunks[chunk].coords, world->loadingPath, sizeof(world->loadingPath));
+    vxRunBackgroundJob("Load Chunk", sLoadChunkJob, world, &world->chunkLoad);
+}
+
+// Appends the objects read by the loader to the scene, as part of the given chunk.
+static void sIntegrateChunk (StreamingWorld* world, Scene* scene, uint32_t chunk) {
+    Scene* staging = &world->staging;
+    size_t base = scene->size;
+    if (scene->size + staging->size > scene->slots) {
+        ReserveSceneObjects(scene, vxMax(scene->slots * 2, scene->size + staging->size));
+    }
+    for (size_t i = 0; i < staging->size; i++) {
+        GameObject* src = &staging->objects[i];
+        GameObject* obj = AddObject(scene, NULL, src->type);
+        *obj = *src;
+        obj->parent = (src->parent != NULL) ? &scene->objects[base + (src->parent - staging->objects)] : NULL;
+        obj->bvhProxy = BVH_NULL;
+        obj->renderFirst = 0;
+        obj->renderCount = 0;
+        obj->staticBatched = false;
+        obj->needsUpdate = true;
+        obj->chunk = chunk;
+    }
+}
+
+static void sUpdateChunks (StreamingWorld* world, Scene* scene, vec3 eye, float loadRadius, float unloadRadius) {
+    // Move the last chunk into the scene once the loader is done with it:
+    if (world->loadingChunk >= 0 && vxAtomicLoad32(&world->chunkLoad.pending) == 0) {
+        StreamChunk* chunk = &world->chunks[world->loadingChunk];
+        if (world->stagingOk) {
+            StartBlock("Integrate Chunk");
+            sIntegrateChunk(world, scene, (uint32_t) world->loadingChunk + 1);
+            EndBlock();
+            chunk->state = STREAMCHUNK_LOADED;
+        } else {
+            vxLog("Warning: can't read chunk %s, skipping it.", world->loadingPath);
+            chunk->state = STREAMCHUNK_FAILED;
+        }
+        world->loadingChunk = -1;
+    }
+
+    // Unload far chunks right away, and load the closest chunk in range that isn't loaded yet:
+    unloadRadius = vxMax(unloadRadius, loadRadius);
+    int32_t nearest = -1;
+    float nearestDistance = FLT_MAX;
+    for (size_t i = 0; i < world->chunkCount; i++) {
+        StreamChunk* chunk = &world->chunks[i];
+        float distance = sChunkDistance(world, chunk, eye);
+        if (chunk->state == STREAMCHUNK_LOADED && distance > unloadRadius) {
+            DeleteChunkObjects(scene, (uint32_t) i + 1);
+            chunk->state = STREAMCHUNK_UNLOADED;
+        } else if (chunk->state == STREAMCHUNK_UNLOADED && distance <= loadRadius && distance < nearestDistance) {
+            nearest = (int32_t) i;
+            nearestDistance = distance;
+        }
+    }
+    if (nearest >= 0 && world->loadingChunk < 0) {
+        sStartLoader(world, nearest);
+    }
+}
+
+bool OpenStreamingWorld (StreamingWorld* world, Scene* scene, const char* filename) {
+    FILE* f = fopen(filename, "r");
+    if (f == NULL) {
+        vxLog("Read failed: can't open file! %s", strerror(errno));
+        return false;
+    }
+    StreamChunk* chunks = NULL;
+
+    #define SCAN(expected, ...) do { \
+        int scanned = fscanf(f, __VA_ARGS__); \
+        if (scanned != expected) { \
+            vxLog("Read failed: fscanf read %d elements, expected %d", scanned, expected); \
+            if (feof(f)) { vxLog("Read failed: end of file"); } \
+            goto fail; \
+        } \
+    } while(0)
+
+    char buf [sizeof(MAGIC)] = {0};
+    if (fread(buf, 1, sizeof(MAGIC)-1, f) != sizeof(MAGIC)-1 || strncmp(buf, MAGIC, sizeof(MAGIC)-1) != 0) {
+        vxLog("Read failed: %s is not a valid world file", filename);
+        goto fail;
+    }
+
+    float chunkSize;
+    int chunkCount;
+    SCAN(2, "chunk size %g chunks %d", &chunkSize, &chunkCount);
+    if (!(chunkSize > 0.0f) || chunkCount < 0) {
+        vxLog("Read failed: %s has an invalid chunk size or count", filename);
+        goto fail;
+    }
+    chunks = vxAlloc(vxMax(chunkCount, 1), StreamChunk);
+    for (int i = 0; i < chunkCount; i++) {
+        SCAN(3, "\nK %d %d %d", &chunks[i].coords[0], &chunks[i].coords[1], &chunks[i].coords[2]);
+        chunks[i].state = STREAMCHUNK_UNLOADED;
+    }
+
+    #undef SCAN
+
+    fclose(f);
+    CloseStreamingWorld(world, scene);
+    world->open = true;
+    sWorldDirectory(filename, world->directory, sizeof(world->directory));
+    world->chunkSize = chunkSize;
+    world->chunkCount = (size_t) chunkCount;
+    world->chunks = chunks;
+    world->loadingChunk = -1;
+
+    char globalFilename [4096 + 64];
+    stbsp_snprintf(globalFilename, (int) sizeof(globalFilename), "%s/global.vxscene", world->directory);
+    if (!LoadScene(scene, globalFilename)) {
+        InitScene(scene);
+    }
+    vxLog("Opened world %s with %ju chunks of size %g", filename, world->chunkCount, world->chunkSize);
+    return true;
+
+    fail:
+    if (chunks != NULL) { vxFree(chunks); }
+    fclose(f);
+    return false;
+}
+
+void CloseStreamingWorld (StreamingWorld* world, Scene* scene) {
+    vxWaitForJobs(&world->modelRead);
+    vxWaitForJobs(&world->modelUpload);
+    vxWaitForJobs(&world->modelUnload);
+    if (world->readingModel != NULL && !world->uploading) {
+        DiscardModelStaging(&world->modelStaging);
+    }
+    world->readingModel = NULL;
+    world->uploading = false;
+    if (world->modelUnloading != NULL) {
+        memset(world->modelUnloading, 0, vxMax(world->modelCount, 1) * sizeof(bool));
+    }
+    if (!world->open) { return; }
+    sWaitForLoader(world);
+    for (size_t i = 0; i < scene->size; i++) {
+        scene->objects[i].chunk = 0;
+    }
+    if (world->chunks != NULL) { vxFree(world->chunks); }
+    DeleteScene(&world->staging);
+    world->open = false;
+    world->directory[0] = '\0';
+    world->chunkCount = 0;
+    world->chunks = NULL;
+    world->loadingChunk = -1;
+}
+
+// *********************************************************************************************************************
+// Models:
+
+static void sCountModelRefs (StreamingWorld* world, Scene* scene) {
+    if (world->modelCount != ModelCount) {
+        if (world->modelRefs != NULL) { vxFree(world->modelRefs); }
+        if (world->modelFirstUser != NULL) { vxFree(world->modelFirstUser); }
+        if (world->modelLastUsed != NULL) { vxFree(world->modelLastUsed); }
+        stbds_hmfree(world->modelIndices);
+        // Models are only ever added to Models, so unloads still in flight keep their place:
+        bool* unloading = vxAlloc(vxMax(ModelCount, 1), bool);
+        memset(unloading, 0, vxMax(ModelCount, 1) * sizeof(bool));
+        if (world->modelUnloading != NULL) {
+            memcpy(unloading, world->modelUnloading, vxMin(world->modelCount, ModelCount) * sizeof(bool));
+            vxFree(world->modelUnloading);
+        }
+        world->modelUnloading = unloading;
+        world->modelCount = ModelCount;
+        world->modelRefs = vxAlloc(vxMax(ModelCount, 1), uint32_t);
+        world->modelFirstUser = vxAlloc(vxMax(ModelCount, 1), size_t);
+        world->modelLastUsed = vxAlloc(vxMax(ModelCount, 1), uint64_t);
+        memset(world->modelLastUsed, 0, vxMax(ModelCount, 1) * sizeof(uint64_t));
+        for (size_t i = 0; i < ModelCount; i++) {
+            stbds_hmput(world->modelIndices, Models[i], i);
+        }
+    }
+    memset(world->modelRefs, 0, vxMax(world->modelCount, 1) * sizeof(uint32_t));
+    for (size_t i = 0; i < world->modelCount; i++) {
+        world->modelFirstUser[i] = SIZE_MAX;
+    }
+    for (size_t i = 0; i < scene->size; i++) {
+        GameObject* obj = &scene->objects[i];
+        if (obj->type != GAMEOBJECT_MODEL || obj->model.model == NULL) { continue; }
+        Model* mdl = obj->model.model;
+        ptrdiff_t entry = stbds_hmgeti(world->modelIndices, mdl);
+        if (entry < 0) { continue; }
+        size_t index = world->modelIndices[entry].value;
+        world->modelRefs[index]++;
+        world->modelFirstUser[index] = vxMin(world->modelFirstUser[index], i);
+    }
+    world->scene = scene;
+    world->sceneVersion = scene->structureVersion;
+}
+
+// Model GPU objects belong to the render thread, so uploads and unloads are queued for it. This thread doesn't wait
+// for them, it checks their counters on the next updates instead.
+static void sSubmitMainThreadJob (const char* name, vxJobFunc func, void* user, vxJobCounter* counter) {
+    vxJob job = {0};
+    job.name = name;
+    job.func = func;
+    job.user = user;
+    job.counter = counter;
+    job.mainThread = true;
+    vxSubmitJob(&job);
+}
+
+static void sReadModelJob (void* user) {
+    StreamingWorld* world = (StreamingWorld*) user;
+    ReadModelStaging(&world->modelStaging, world->readingModel->sourceDirectory, world->readingModel->sourceFile);
+}
+
+static void sUploadModelJob (void* user) {
+    StreamingWorld* world = (StreamingWorld*) user;
+    UploadModel(world->readingModel, &world->modelStaging);
+}
+
+static void sUnloadModelJob (void* user) {
+    UnloadModel((Model*) user);
+}
+
+static void sUpdateModels (StreamingWorld* world, Scene* scene, size_t budget) {
+    world->frame++;
+    if (world->modelCount != ModelCount || world->scene != scene || world->sceneVersion != scene->structureVersion) {
+        sCountModelRefs(world, scene);
+    }
+
+    // Unloads queued on earlier updates are done once their counter drops. Until then their models are neither
+    // resident nor loaded again, and the render thread may be changing them, so nothing here looks at them:
+    if (world->modelUnloading != NULL && vxAtomicLoad32(&world->modelUnload.pending) == 0) {
+        memset(world->modelUnloading, 0, vxMax(world->modelCount, 1) * sizeof(bool));
+    }
+    // The same goes for the model being uploaded, until the upload is done. Render list entries of its objects have to
+    // be rebuilt once it has meshes:
+    if (world->uploading && vxAtomicLoad32(&world->modelUpload.pending) == 0) {
+        if (world->readingModel->resident && world->readingIndex < world->modelCount) {
+            scene->renderDirtyFrom = vxMin(scene->renderDirtyFrom, world->modelFirstUser[world->readingIndex]);
+        }
+        world->readingModel = NULL;
+        world->uploading = false;
+    }
+
+    size_t residentBytes = 0;
+    size_t missing = SIZE_MAX;
+    for (size_t i = 0; i < world->modelCount; i++) {
+        Model* mdl = Models[i];
+        if (world->modelRefs[i] > 0) {
+            world->modelLastUsed[i] = world->frame;
+        }
+        if (world->modelUnloading[i] || (mdl == world->readingModel && world->uploading)) {
+            continue;
+        }
+        if (world->modelRefs[i] > 0 && !mdl->resident && !mdl->failed && missing == SIZE_MAX) {
+            missing = i;
+        }
+        if (mdl->resident) {
+            residentBytes += mdl->memoryBytes;
+        }
+    }
+
+    // Read one model at a time in a background job. Once it's read, only the upload runs on the render thread:
+    if (world->readingModel == NULL && missing != SIZE_MAX) {
+        world->readingModel = Models[missing];
+        world->readingIndex = missing;
+        vxRunBackgroundJob("Read Model", sReadModelJob, world, &world->modelRead);
+    }
+    if (world->readingModel != NULL && !world->uploading && vxAtomicLoad32(&world->modelRead.pending) == 0) {
+        world->uploading = true;
+        sSubmitMainThreadJob("Upload Model", sUploadModelJob, world, &world->modelUpload);
+    }
+
+    // Over budget, unload unused models, least recently used first. Models are only unloaded once they've gone unused
+    // for a whole frame, so the render list and static batches have been rebuilt without them by then.
+    while (residentBytes > budget) {
+        size_t lru = SIZE_MAX;
+        for (size_t i = 0; i < world->modelCount; i++) {
+            if (world->modelUnloading[i] || (Models[i] == world->readingModel && world->uploading)) { continue; }
+            if (!Models[i]->resident || world->modelRefs[i] > 0 || world->modelLastUsed[i] + 1 >= world->frame) {
+                continue;
+            }
+            if (lru == SIZE_MAX || world->modelLastUsed[i] < world->modelLastUsed[lru]) {
+                lru = i;
+            }
+        }
+        if (lru == SIZE_MAX) { break; }
+        residentBytes -= Models[lru]->memoryBytes;
+        world->modelUnloading[lru] = true;
+        sSubmitMainThreadJob("Unload Model", sUnloadModelJob, Models[lru], &world->modelUnload);
+    }
+    world->residentBytes = residentBytes;
+}
+
+void UpdateStreamingWorld (StreamingWorld* world, Scene* scene, vec3 eye, float loadRadius, float unloadRadius,
+    size_t modelBudget)
+{
+    if (world->open) {
+        sUpdateChunks(world, scene, eye, loadRadius, unloadRadius);
+    }
+    if (ModelStreaming) {
+        sUpdateModels(world, scene, modelBudget);
+    }
+}
+
+// *********************************************************************************************************************
+// Saving:
+
+bool SaveSceneAsWorld (Scene* scene, const char* filename, float chunkSize) {
+    if (!(chunkSize > 0.0f)) {
+        chunkSize = Stream_DefaultChunkSize;
+    }
+    char directory [4096];
+    sWorldDirectory(filename, directory, sizeof(directory));
+    vxCreateDirectory(directory);
+    vxLog("Writing scene 0x%jx with %ju objects into world %s...", scene, scene->size, filename);
+
+    // Assign each object to the chunk its root ancestor is in. Chunk 0 is the global scene:
+    size_t n = vxMax(scene->size, 1);
+    uint32_t* objectChunks = vxAlloc(n, uint32_t);
+    StreamChunk* chunks = vxAlloc(n, StreamChunk); // at most one per object
+    size_t chunkCount = 0;
+    struct { uint64_t key; uint32_t value; }* chunksByKey = NULL;
+    for (size_t i = 0; i < scene->size; i++) {
+        GameObject* root = &scene->objects[i];
+        while (root->parent != NULL) {
+            root = root->parent;
+        }
+        if (root->type == GAMEOBJECT_DIRECTIONAL_LIGHT) {
+            objectChunks[i] = 0;
+            continue;
+        }
+        int32_t coords [3];
+        for (int k = 0; k < 3; k++) {
+            float c = floorf(root->localPosition[k] / chunkSize);
+            coords[k] = (int32_t) vxClamp(c, (float) -Stream_MaxChunkCoord, (float) Stream_MaxChunkCoord);
+        }
+        uint64_t key = sChunkKey(coords);
+        ptrdiff_t entry = stbds_hmgeti(chunksByKey, key);
+        if (entry < 0) {
+            memcpy(chunks[chunkCount].coords, coords, sizeof(coords));
+            chunks[chunkCount].state = STREAMCHUNK_UNLOADED;
+            chunkCount++;
+            stbds_hmput(chunksByKey, key, (uint32_t) chunkCount);
+            objectChunks[i] = (uint32_t) chunkCount;
+        } else {
+            objectChunks[i] = chunksByKey[entry].value;
+        }
+    }
+    stbds_hmfree(chunksByKey);
+
+    // Sort the objects by chunk, keeping their order within each chunk. Parents are always in the same chunk as their
+    // children, so parent pointers can be moved over directly:
+    size_t* offsets = vxAlloc(chunkCount + 2, size_t);
+    memset(offsets, 0, (chunkCount + 2) * sizeof(size_t));
+    for (size_t i = 0; i < scene->size; i++) {
+        offsets[objectChunks[i] + 1]++;
+    }
+    for (size_t c = 1; c < chunkCount + 2; c++) {
+        offsets[c] += offsets[c - 1];
+    }
+    size_t* sortedIndex = vxAlloc(n, size_t);
+    size_t* cursors = vxAlloc(chunkCount + 1, size_t);
+    memcpy(cursors, offsets, (chunkCount + 1) * sizeof(size_t));
+    GameObject* sorted = vxAlloc(n, GameObject);
+    for (size_t i = 0; i < scene->size; i++) {
+        sortedIndex[i] = cursors[objectChunks[i]]++;
+        sorted[sortedIndex[i]] = scene->objects[i];
+    }
+    for (size_t i = 0; i < scene->size; i++) {
+        GameObject* parent = scene->objects[i].parent;
+        sorted[sortedIndex[i]].parent = (parent != NULL) ? &sorted[sortedIndex[parent - scene->objects]] : NULL;
+    }
+
+    bool ok = true;
+    char chunkFilename [4096 + 64];
+    for (size_t c = 0; c <= chunkCount; c++) {
+        Scene part = {0};
+        part.objects = sorted + offsets[c];
+        part.size = offsets[c + 1] - offsets[c];
+        part.slots = part.size;
+        if (c == 0) {
+            stbsp_snprintf(chunkFilename, (int) sizeof(chunkFilename), "%s/global.vxscene", directory);
+        } else {
+            sChunkFilename(directory, chunks[c - 1].coords, chunkFilename, sizeof(chunkFilename));
+        }
+        ok = SaveSceneBinary(&part, chunkFilename) && ok;
+    }
+
+    FILE* f = fopen(filename, "w");
+    if (f == NULL) {
+        vxLog("Write failed: can't open file! %s", strerror(errno));
+        ok = false;
+    } else {
+        fwrite(MAGIC, 1, sizeof(MAGIC)-1, f);
+        fprintf(f, "chunk size %g chunks %ju\n", chunkSize, chunkCount);
+        for (size_t c = 0; c < chunkCount; c++) {
+            fprintf(f, "K %d %d %d\n", chunks[c].coords[0], chunks[c].coords[1], chunks[c].coords[2]);
+        }
+        ok = !ferror(f) && ok;
+        fclose(f);
+    }
+    if (ok) {
+        vxLog("Wrote world with %ju chunks", chunkCount);
+    }
+
+    vxFree(objectChunks);
+    vxFree(chunks);
+    vxFree(offsets);
+    vxFree(sortedIndex);
+    vxFree(cursors);
+    vxFree(sorted);
+    return ok;
+}
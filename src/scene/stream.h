@@ -0,0 +1,91 @@
+#pragma once
+#include "common.h"
+#include "core.h"
+
+// World streaming. A world is split into cubic chunks, each stored as its own scene file, and only the chunks near the
+// camera are part of the scene. Chunks are read by a background job as the camera approaches them and deleted from
+// the scene once it's far enough away. The unload radius is larger than the load radius, so moving back and forth
+// across a chunk border doesn't keep reloading it.
+//
+// Worlds are stored as a small text file that lists the chunks, with the chunk scenes in a directory of the same name:
+//
+//     userdata/worlds/Island.vxworld
+//         VXEngine World v1.0
+//         chunk size 64 chunks 2
+//         K 0 0 0
+//         K -1 0 2
+//     userdata/worlds/Island/global.vxscene    loaded when the world is opened and never unloaded
+//     userdata/worlds/Island/chunk_0_0_0.vxscene
+//     userdata/worlds/Island/chunk_-1_0_2.vxscene
+//
+// Objects are assigned to chunks by the position of their root ancestor, so hierarchies are never split. Directional
+// lights always go into the global scene. Objects added while a world is streaming don't belong to any chunk and stay
+// in the scene. Object indices shift whenever a chunk is unloaded, so autosave should be off while streaming.
+//
+// When ModelStreaming is set, the same update also manages which models are resident: models are loaded once an object
+// refers to them, and models that nothing refers to anymore are unloaded, least recently used first, whenever the
+// resident ones add up to more than the budget. Models are loaded one at a time. Their files are read and decoded by a
+// background job, and only their GL objects are created on the render thread once the job is done. Uploads and unloads
+// are queued for the render thread without waiting for them, so the game thread never waits for a render frame.
+
+typedef enum StreamChunkState {
+    STREAMCHUNK_UNLOADED,
+    STREAMCHUNK_LOADING,
+    STREAMCHUNK_LOADED,
+    STREAMCHUNK_FAILED, // the file couldn't be read, it isn't tried again
+} StreamChunkState;
+
+typedef struct StreamChunk {
+    int32_t coords [3]; // chunk covers [coords * chunkSize, (coords + 1) * chunkSize)
+    StreamChunkState state;
+} StreamChunk;
+
+typedef struct StreamingWorld {
+    bool open;
+    char directory [4096]; // chunk scenes
+    float chunkSize;
+    size_t chunkCount;
+    StreamChunk* chunks;   // objects of chunks[i] have GameObject.chunk == i + 1
+    // Background loader:
+    vxJobCounter chunkLoad;   // the job reading loadingChunk
+    int32_t loadingChunk;     // chunk being read into staging, -1 if none
+    char loadingPath [4096 + 64];
+    Scene staging;            // scene the loader reads into, moved into the real scene on the main thread
+    bool stagingOk;
+    // Model residency:
+    uint64_t frame;           // number of updates so far
+    uint32_t sceneVersion;    // scene->structureVersion when modelRefs were counted
+    Scene* scene;
+    struct { Model* key; size_t value; }* modelIndices; // stb_ds hashmap, index of each model in Models
+    size_t modelCount;        // size of the arrays below, same order as Models
+    uint32_t* modelRefs;      // objects referring to each model
+    size_t* modelFirstUser;   // lowest index of an object referring to each model
+    uint64_t* modelLastUsed;  // last update at which each model was referenced
+    bool* modelUnloading;     // models whose unload is queued on the render thread
+    vxJobCounter modelUnload; // the queued unloads
+    size_t residentBytes;     // sum of Model.memoryBytes over the resident models
+    // Model reading:
+    Model* readingModel;      // model being read into modelStaging or uploaded from it, NULL if none
+    size_t readingIndex;      // its index in Models
+    vxJobCounter modelRead;   // the reading job
+    bool uploading;           // the model has been read, and its upload is queued on the render thread
+    vxJobCounter modelUpload; // the upload job
+    ModelStaging modelStaging;
+} StreamingWorld;
+
+// Chunk size used by SaveSceneAsWorld when none is given.
+static const float Stream_DefaultChunkSize = 64.0f;
+
+// Opens a world and replaces the scene's contents with its global scene. Chunks are loaded by UpdateStreamingWorld.
+// Returns false (leaving the scene alone) if the world file can't be read.
+VX_EXPORT bool OpenStreamingWorld (StreamingWorld* world, Scene* scene, const char* filename);
+// Waits for the loader and forgets the world. Objects of loaded chunks stay in the scene as regular objects. A model
+// that's still being read is dropped, and read again once it's needed.
+VX_EXPORT void CloseStreamingWorld (StreamingWorld* world, Scene* scene);
+// Loads and unloads chunks around the eye, and models as needed. Call once per frame, before UpdateScene. Radii are
+// measured from the eye to the closest point of each chunk. The model budget is in bytes.
+VX_EXPORT void UpdateStreamingWorld (StreamingWorld* world, Scene* scene, vec3 eye, float loadRadius,
+    float unloadRadius, size_t modelBudget);
+
+// Splits a scene into chunks and writes it out as a world. Returns false if any of the files couldn't be written.
+VX_EXPORT bool SaveSceneAsWorld (Scene* scene, const char* filename, float chunkSize);
@@ -0,0 +1,64 @@
+#include "stress.h"
+
+// Children are placed this far from their parent at most, along each axis.
+static const float Stress_ChildOffset = 2.0f;
+
+// xorshift64*
+static float sRandom (uint64_t* state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return (float)((*state * 0x2545F4914F6CDD1DULL) >> 40) / (float)(1 << 24);
+}
+
+// The same objects are animated every frame: those whose hashed index falls below the motion fraction.
+static bool sIsAnimated (StressSceneDesc* desc, size_t object) {
+    uint32_t h = (uint32_t) object * 2654435761u;
+    return (float)(h >> 8) / (float)(1 << 24) < desc->motionFraction;
+}
+
+void GenerateStressScene (Scene* scene, StressSceneDesc* desc) {
+    InitScene(scene);
+    ReserveSceneObjects(scene, desc->objectCount + desc->pointLightCount + 1);
+    uint64_t rng = (desc->seed != 0) ? desc->seed : 1;
+    size_t depth = (size_t) vxMax(desc->hierarchyDepth, 1);
+
+    // Model objects come first, so their indices match the ones AnimateStressScene expects:
+    for (size_t i = 0; i < desc->objectCount; i++) {
+        GameObject* parent = (i % depth != 0) ? &scene->objects[i - 1] : NULL;
+        GameObject* obj = AddObject(scene, parent, GAMEOBJECT_MODEL);
+        if (desc->modelCount > 0) {
+            obj->model.model = desc->models[(size_t)(sRandom(&rng) * (float) desc->modelCount) % desc->modelCount];
+        }
+        for (int k = 0; k < 3; k++) {
+            float r = sRandom(&rng);
+            if (parent == NULL) {
+                obj->localPosition[k] = (r - 0.5f) * desc->extent;
+            } else {
+                obj->localPosition[k] = (2.0f * r - 1.0f) * Stress_ChildOffset;
+            }
+        }
+        glm_quat(obj->localRotation, 2.0f * (float) M_PI * sRandom(&rng), 0.0f, 1.0f, 0.0f);
+    }
+
+    for (size_t i = 0; i < desc->pointLightCount; i++) {
+        GameObject* obj = AddObject(scene, NULL, GAMEOBJECT_POINT_LIGHT);
+        for (int k = 0; k < 3; k++) {
+            obj->localPosition[k] = (sRandom(&rng) - 0.5f) * desc->extent;
+            obj->pointLight.color[k] = 1.0f + 9.0f * sRandom(&rng);
+        }
+    }
+
+    GameObject* sun = AddObject(scene, NULL, GAMEOBJECT_DIRECTIONAL_LIGHT);
+    glm_vec3_copy((vec3){1.0f, 1.0f, 1.0f}, sun->localPosition);
+    glm_vec3_copy((vec3){2.0f, 2.0f, 1.8f}, sun->directionalLight.color);
+}
+
+void AnimateStressScene (Scene* scene, StressSceneDesc* desc, float t) {
+    size_t count = vxMin(desc->objectCount, scene->size);
+    for (size_t i = 0; i < count; i++) {
+        if (sIsAnimated(desc, i)) {
+            glm_quat(scene->objects[i].localRotation, t + (float) i, 0.0f, 1.0f, 0.0f);
+        }
+    }
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include "common.h"
+#include "core.h"
+
+// Synthetic scenes for stress testing and benchmarks (see tools/scenebench.c). Model objects are spread over a cube
+// and grouped into parent chains, so every object below the root of its chain has to walk its ancestors when world
+// matrices are updated. A fixed subset of the objects is moved by AnimateStressScene, the rest never move.
+
+typedef struct StressSceneDesc {
+    size_t objectCount;     // model objects
+    int hierarchyDepth;     // length of the parent chains, 1 for no hierarchy
+    size_t pointLightCount; // point lights, in addition to the model objects and one directional light
+    float motionFraction;   // fraction of the model objects moved by AnimateStressScene
+    float extent;           // size of the cube the objects are spread over
+    uint64_t seed;
+    size_t modelCount;      // models picked at random for the model objects
+    Model** models;
+} StressSceneDesc;
+
+// Replaces the scene's contents with a synthetic scene.
+VX_EXPORT void GenerateStressScene (Scene* scene, StressSceneDesc* desc);
+// Moves the animated objects to where they are at time t. Call before UpdateScene.
+VX_EXPORT void AnimateStressScene (Scene* scene, StressSceneDesc* desc, float t);
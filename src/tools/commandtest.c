@@ -0,0 +1,249 @@
+// CommandTest: checks the draw command recorder (see render/commands.h).
+//
+// Records a hand-made draw list and random ones into command buffers, with and without indirect multi-draws, and
+// checks the commands against the lists: every entry is drawn exactly once and in order, with its own material or one
+// of the same bind set, and all draws merged into a multi-draw can be issued together. Random lists interleave runs of
+// mergeable and unmergeable draws, and are long enough to be recorded in several ranges. The random lists are recorded
+// with the job system running on 1, 2, 4, ... threads. Any violation is reported and makes the run fail.
+//
+// Meshes are made up (nothing is drawn), so no assets and no window or GL context are needed. Usage:
+//
+//     CommandTest [random lists = 100] [max threads = all cores]
+
+#include "common.h"
+#include "data/model.h"
+#include "render/drawlist.h"
+#include "render/commands.h"
+
+#define COMMANDTEST_MATERIALS 8
+#define COMMANDTEST_VAOS 3
+#define COMMANDTEST_PARTS 4 // meshes sharing each VAO
+#define COMMANDTEST_MAX_ITEMS 3000
+
+static Material sMaterials [COMMANDTEST_MATERIALS];
+
+static uint32_t sRandom (uint64_t* rng, uint32_t count) {
+    *rng ^= *rng >> 12;
+    *rng ^= *rng << 25;
+    *rng ^= *rng >> 27;
+    return (uint32_t)(((*rng * 0x2545F4914F6CDD1DULL) >> 32) % count);
+}
+
+// Pairs of materials share a bind set, so some material changes need no command.
+static void sMakeMaterials () {
+    for (int i = 0; i < COMMANDTEST_MATERIALS; i++) {
+        memset(&sMaterials[i], 0, sizeof(Material));
+        sMaterials[i].tableIndex = i;
+        sMaterials[i].bindSet = (uint32_t)(i / 2);
+    }
+}
+
+// Meshes of the same VAO share their buffers, like the meshes of one model (see ModelGeometry).
+static void sMakeMesh (RenderableMesh* rmesh, uint32_t vao, uint32_t part, uint32_t material, uint32_t position) {
+    memset(rmesh, 0, sizeof(RenderableMesh));
+    glm_translate_make(rmesh->worldMatrix, (vec3){(float) position, 0.0f, 0.0f});
+    glm_mat4_copy(rmesh->worldMatrix, rmesh->lastWorldMatrix);
+    rmesh->material = &sMaterials[material];
+    Mesh* mesh = &rmesh->mesh;
+    mesh->type = GL_TRIANGLES;
+    mesh->gl_vertex_array = 1 + vao;
+    mesh->gl_element_array = 1 + vao;
+    mesh->gl_first_index = part * 300;
+    mesh->gl_element_count = 3 * (1 + part);
+    mesh->gl_element_type = FACCESSOR_UINT32;
+    mesh->gl_vertex_count = 100;
+    mesh->gl_instance_attribs = true;
+}
+
+static void sAddMesh (DrawList* dl, uint32_t vao, uint32_t part, uint32_t material, uint32_t position) {
+    RenderList* rl = dl->rl;
+    vxCheck(rl->meshCount < rl->meshSlots);
+    sMakeMesh(&rl->meshes[rl->meshCount], vao, part, material, position);
+    AddDrawItem(dl, 0, (uint32_t) rl->meshCount);
+    rl->meshCount++;
+}
+
+static void sClearList (DrawList* dl) {
+    ClearDrawList(dl);
+    dl->rl->meshCount = 0;
+}
+
+// Runs of the same draw, and neighbours that differ in one way or another: in their material, bind set, VAO (which
+// keeps them from being merged), or their transform (which only keeps them from being merged without indirect draws).
+static void sMakeRandomList (DrawList* dl, uint64_t* rng) {
+    sClearList(dl);
+    size_t count = 1 + sRandom(rng, COMMANDTEST_MAX_ITEMS);
+    uint32_t vao = 0, part = 0, material = 0, position = 0;
+    for (size_t i = 0; i < count; i++) {
+        switch (sRandom(rng, 8)) {
+            case 0: { material = sRandom(rng, COMMANDTEST_MATERIALS); break; }
+            case 1: { vao = sRandom(rng, COMMANDTEST_VAOS); break; }
+            case 2: { position = sRandom(rng, 2); break; }
+            case 3: case 4: { part = sRandom(rng, COMMANDTEST_PARTS); break; }
+            default: break; // the same draw again
+        }
+        sAddMesh(dl, vao, part, material, position);
+    }
+}
+
+// Whether two draws of a multi-draw can be issued together, see RenderIndexedDraws.
+static bool sCanIssueTogether (CommandBuffer* cb, IndexedDraw* first, IndexedDraw* draw) {
+    if (!CanMultiDraw(first, draw)) { return false; }
+    if (vxglSupportsMultiDrawIndirect) { return true; }
+    return first->instanceCount == 1 && draw->instanceCount == 1 &&
+           memcmp(&cb->instances[first->firstInstance], &cb->instances[draw->firstInstance], sizeof(InstanceData)) == 0;
+}
+
+// Returns the number of violations. Counts the multi-draws and the draws in them.
+static size_t sCheckCommands (CommandBuffer* cb, DrawList* dl, const char* name, size_t* multiDraws,
+    size_t* mergedDraws)
+{
+    size_t violations = 0;
+    size_t next = 0; // first draw list entry of the next draw
+    #define COMMANDTEST_FAIL(...) { if (violations < 8) { vxLog(__VA_ARGS__); } violations++; }
+    for (size_t r = 0; r < cb->rangeCount; r++) {
+        CommandRange* range = &cb->ranges[r];
+        Material* material = NULL;
+        for (size_t i = 0; i < range->count; i++) {
+            RenderCommand* cmd = &range->commands[i];
+            if (cmd->type == RENDERCMD_SET_MATERIAL) {
+                material = cmd->material;
+            } else if (cmd->type == RENDERCMD_MULTI_DRAW) {
+                if (cmd->drawCount < 2 || i + cmd->drawCount >= range->count) {
+                    COMMANDTEST_FAIL("%s: multi-draw %ju of range %ju has %ju draws", name, i, r, cmd->drawCount);
+                    continue;
+                }
+                *multiDraws += 1;
+                *mergedDraws += cmd->drawCount;
+                RenderCommand* draws = &range->commands[i + 1];
+                for (size_t d = 0; d < cmd->drawCount; d++) {
+                    if (draws[d].type != RENDERCMD_DRAW || !sCanIssueTogether(cb, &draws[0].draw, &draws[d].draw)) {
+                        COMMANDTEST_FAIL("%s: command %ju of multi-draw %ju in range %ju doesn't belong to it", name,
+                            d, i, r);
+                    }
+                }
+            } else if (cmd->type == RENDERCMD_DRAW) {
+                IndexedDraw* draw = &cmd->draw;
+                if (draw->firstInstance != next || draw->instanceCount == 0 ||
+                    next + draw->instanceCount > dl->count) {
+                    COMMANDTEST_FAIL("%s: draw %ju of range %ju covers entries %u to %u, expected %ju next", name, i,
+                        r, draw->firstInstance, draw->firstInstance + draw->instanceCount, next);
+                    next = vxMin((size_t) draw->firstInstance + draw->instanceCount, dl->count);
+                    continue;
+                }
+                RenderableMesh* first = GetDrawItemMesh(dl, &dl->items[next]);
+                for (size_t k = next; k < next + draw->instanceCount; k++) {
+                    RenderableMesh* rmesh = GetDrawItemMesh(dl, &dl->items[k]);
+                    if (!IsSameDraw(first, rmesh) || rmesh->mesh.gl_vertex_array != draw->vao ||
+                        rmesh->mesh.gl_first_index != draw->firstIndex) {
+                        COMMANDTEST_FAIL("%s: entry %ju is drawn by draw %ju of range %ju, which is another mesh",
+                            name, k, i, r);
+                    }
+                    if (material == NULL ||
+                        (material != rmesh->material && !SameMaterialBindSet(material, rmesh->material))) {
+                        COMMANDTEST_FAIL("%s: entry %ju is drawn with the wrong material", name, k);
+                    }
+                }
+                next += draw->instanceCount;
+            } else {
+                COMMANDTEST_FAIL("%s: unexpected command %d", name, (int) cmd->type);
+            }
+        }
+    }
+    if (next != dl->count) {
+        COMMANDTEST_FAIL("%s: %ju of %ju entries drawn", name, next, dl->count);
+    }
+    #undef COMMANDTEST_FAIL
+    return violations;
+}
+
+// Two merged draws, one that can't be merged with them, and two that can be merged with the first ones but not with
+// the one in between. The last two have to start a new multi-draw rather than extend the first.
+static size_t sCheckInterleaved (CommandBuffer* cb, DrawList* dl) {
+    sClearList(dl);
+    sAddMesh(dl, 0, 0, 0, 0);
+    sAddMesh(dl, 0, 1, 0, 0);
+    sAddMesh(dl, 1, 0, 0, 0);
+    sAddMesh(dl, 0, 2, 0, 0);
+    sAddMesh(dl, 0, 3, 0, 0);
+    RecordDrawList(cb, dl);
+    size_t multiDraws = 0, mergedDraws = 0;
+    size_t violations = sCheckCommands(cb, dl, "interleaved", &multiDraws, &mergedDraws);
+    RenderCommandType expected [] = {
+        RENDERCMD_SET_MATERIAL, RENDERCMD_MULTI_DRAW, RENDERCMD_DRAW, RENDERCMD_DRAW,
+        RENDERCMD_DRAW, RENDERCMD_MULTI_DRAW, RENDERCMD_DRAW, RENDERCMD_DRAW,
+    };
+    CommandRange* range = &cb->ranges[0];
+    bool same = cb->rangeCount == 1 && range->count == vxSize(expected) &&
+        range->commands[1].drawCount == 2 && range->commands[5].drawCount == 2;
+    for (size_t i = 0; same && i < vxSize(expected); i++) {
+        same = (range->commands[i].type == expected[i]);
+    }
+    if (!same) {
+        vxLog("interleaved: recorded %ju commands instead of two multi-draws of 2 draws around a single draw",
+            range->count);
+        violations++;
+    }
+    return violations;
+}
+
+static size_t sCheckRandomLists (CommandBuffer* cb, DrawList* dl, int listCount, int threads) {
+    if (threads > 1) {
+        vxStartJobs(threads - 1);
+    }
+    size_t violations = 0, multiDraws = 0, mergedDraws = 0, ranges = 0, entries = 0;
+    uint64_t rng = 0x9E3779B97F4A7C15ULL;
+    for (int i = 0; i < listCount; i++) {
+        sMakeRandomList(dl, &rng);
+        RecordDrawList(cb, dl);
+        violations += sCheckCommands(cb, dl, "random", &multiDraws, &mergedDraws);
+        ranges += cb->rangeCount;
+        entries += dl->count;
+    }
+    vxStopJobs();
+    vxLog("%7d  %8ju  %10ju  %11ju  %13ju  %10ju", threads, entries, ranges, multiDraws, mergedDraws, violations);
+    return violations;
+}
+
+int main (int argc, char** argv) {
+    vxEnableSignalHandlers();
+    vxConfigureLogging();
+    int listCount = (argc > 1) ? atoi(argv[1]) : 100;
+    int maxThreads = (argc > 2) ? atoi(argv[2]) : vxCoreCount();
+    if (listCount < 0) {
+        vxLog("Usage: CommandTest [random lists = 100] [max threads = all cores]");
+        return 1;
+    }
+    maxThreads = vxClamp(maxThreads, 1, 256);
+
+    sMakeMaterials();
+    static RenderList rl;
+    rl.meshSlots = COMMANDTEST_MAX_ITEMS;
+    rl.meshes = vxAlloc(rl.meshSlots, RenderableMesh);
+    static DrawList dl;
+    dl.rl = &rl;
+    dl.pass = DRAWPASS_GBUFFER;
+    static CommandBuffer cb;
+
+    size_t violations = 0;
+    const char* modes [2] = {"without", "with"};
+    for (int indirect = 0; indirect < 2; indirect++) {
+        vxglSupportsMultiDrawIndirect = indirect;
+        vxLog("Recording %s indirect multi-draws:", modes[indirect]);
+        violations += sCheckInterleaved(&cb, &dl);
+        vxLog("%7s  %8s  %10s  %11s  %13s  %10s", "threads", "entries", "ranges", "multi-draws", "merged draws",
+            "violations");
+        for (int threads = 1; threads <= maxThreads; threads *= 2) {
+            violations += sCheckRandomLists(&cb, &dl, listCount, threads);
+            if (threads < maxThreads && threads * 2 > maxThreads) {
+                violations += sCheckRandomLists(&cb, &dl, listCount, maxThreads);
+            }
+        }
+    }
+    vxLog("%ju violations", violations);
+
+    DeleteCommandBuffer(&cb);
+    DeleteDrawList(&dl);
+    vxFree(rl.meshes);
+    return (violations == 0) ? 0 : 1;
+}
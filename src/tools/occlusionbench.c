@@ -0,0 +1,350 @@
+// OcclusionBench: checks the software occlusion buffer (see render/occlusion.h) against a reference and benchmarks it.
+//
+// Generates random scenes of boxes (closed meshes with back faces culled) and walls (two-sided quads) in front of a
+// camera, some of them crossing the near plane. Each scene is rasterized into the occlusion buffer and, for reference,
+// point-sampled at 4x4 samples per pixel. The occlusion buffer is conservative if no pixel is nearer than any of its
+// reference samples, and a box is only culled if every reference sample it could cover is nearer than the box. Any
+// violation is reported and makes the run fail, so it doubles as a test. The share of boxes hidden in the reference
+// that the buffer culls is reported as well.
+//
+// Then the first scene is rasterized and tested for a number of frames with the job system running on 1, 2, 4, ...
+// threads. No assets and no window or GL context are needed. Usage:
+//
+//     OcclusionBench [occluders = 200] [test boxes = 10000] [scenes = 8] [frames = 200] [max threads = all cores]
+
+#include "common.h"
+#include "data/model.h"
+#include "data/camera.h"
+#include "render/occlusion.h"
+#include <time.h>
+
+#define OCCLUSIONBENCH_SUBSAMPLES 4
+#define OCCLUSIONBENCH_REF_W (OCCLUSION_WIDTH * OCCLUSIONBENCH_SUBSAMPLES)
+#define OCCLUSIONBENCH_REF_H (OCCLUSION_HEIGHT * OCCLUSIONBENCH_SUBSAMPLES)
+
+typedef struct BenchOccluder {
+    mat4 world;
+    Mesh* mesh;
+    bool cullBackFaces;
+} BenchOccluder;
+
+typedef struct BenchBox {
+    vec3 min;
+    vec3 max;
+} BenchBox;
+
+typedef struct BenchScene {
+    Camera cam;
+    size_t occluderCount;
+    BenchOccluder* occluders;
+    size_t boxCount;
+    BenchBox* boxes;
+} BenchScene;
+
+static float sReference [OCCLUSIONBENCH_REF_H][OCCLUSIONBENCH_REF_W];
+
+static double sTime () {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+static float sRandom (uint64_t* rng, float min, float max) {
+    *rng ^= *rng >> 12;
+    *rng ^= *rng << 25;
+    *rng ^= *rng >> 27;
+    uint32_t bits = (uint32_t)((*rng * 0x2545F4914F6CDD1DULL) >> 40);
+    return min + (max - min) * ((float) bits / (float) (1 << 24));
+}
+
+// A unit box with counter-clockwise outward faces, each indexed as two triangles sharing a diagonal, and a two-sided
+// unit quad in the XY plane.
+static void sMakeMeshes (Mesh* box, Mesh* wall) {
+    static float boxPositions [8 * 3];
+    static uint32_t boxIndices [] = {
+        1, 3, 7, 1, 7, 5,   0, 4, 6, 0, 6, 2,   2, 6, 7, 2, 7, 3,
+        0, 1, 5, 0, 5, 4,   4, 5, 7, 4, 7, 6,   0, 2, 3, 0, 3, 1,
+    };
+    for (int i = 0; i < 8; i++) {
+        boxPositions[i * 3 + 0] = (i & 1) ? 1.0f : -1.0f;
+        boxPositions[i * 3 + 1] = (i & 2) ? 1.0f : -1.0f;
+        boxPositions[i * 3 + 2] = (i & 4) ? 1.0f : -1.0f;
+    }
+    static float wallPositions [] = {-1.0f, -1.0f, 0.0f,   1.0f, -1.0f, 0.0f,   1.0f, 1.0f, 0.0f,   -1.0f, 1.0f, 0.0f};
+    static uint32_t wallIndices [] = {0, 1, 2, 0, 2, 3};
+
+    Mesh* meshes [2] = {box, wall};
+    float* positions [2] = {boxPositions, wallPositions};
+    uint32_t* indices [2] = {boxIndices, wallIndices};
+    size_t vertexCounts [2] = {8, 4};
+    size_t indexCounts [2] = {vxSize(boxIndices), vxSize(wallIndices)};
+    for (int i = 0; i < 2; i++) {
+        Mesh* mesh = meshes[i];
+        memset(mesh, 0, sizeof(Mesh));
+        mesh->type = GL_TRIANGLES;
+        mesh->gl_vertex_count = vertexCounts[i];
+        mesh->cpu_attributes[ATTR_POSITION] = positions[i];
+        mesh->cpu_attribute_components[ATTR_POSITION] = 3;
+        mesh->cpu_indices = indices[i];
+        mesh->cpu_index_count = indexCounts[i];
+        glm_vec3_broadcast(-1.0f, mesh->aabbMin);
+        glm_vec3_broadcast(+1.0f, mesh->aabbMax);
+    }
+}
+
+static void sMakeScene (BenchScene* scene, size_t occluderCount, size_t boxCount, Mesh* box, Mesh* wall,
+    uint64_t seed)
+{
+    uint64_t rng = 0x9E3779B97F4A7C15ULL ^ (seed * 0xD1B54A32D192ED03ULL);
+    Camera_InitPerspective(&scene->cam, 0.1f, 0.0f, 90.0f);
+    mat4 view;
+    glm_lookat((vec3){0.0f, 1.0f, 0.0f}, (vec3){sRandom(&rng, -0.3f, 0.3f), 1.0f, -1.0f}, (vec3){0.0f, 1.0f, 0.0f},
+        view);
+    Camera_Update(&scene->cam, 1920, 1080, view);
+
+    scene->occluderCount = occluderCount;
+    scene->occluders = vxAlloc(occluderCount, BenchOccluder);
+    for (size_t i = 0; i < occluderCount; i++) {
+        BenchOccluder* occ = &scene->occluders[i];
+        bool isWall = (i % 3 == 0);
+        occ->mesh = isWall ? wall : box;
+        occ->cullBackFaces = !isWall;
+        // A tenth of the occluders are right in front of the camera, where some cross the near plane:
+        bool closeUp = (i % 10 == 0);
+        vec3 position = {sRandom(&rng, -30.0f, 30.0f), sRandom(&rng, -2.0f, 6.0f), sRandom(&rng, -80.0f, -5.0f)};
+        if (closeUp) {
+            position[0] = sRandom(&rng, -2.0f, 2.0f);
+            position[2] = sRandom(&rng, -3.0f, 0.5f);
+        }
+        vec3 scale = {sRandom(&rng, 0.5f, 4.0f), sRandom(&rng, 0.5f, 4.0f), sRandom(&rng, 0.5f, 4.0f)};
+        if (isWall) {
+            scale[0] = sRandom(&rng, 2.0f, 10.0f);
+        }
+        glm_translate_make(occ->world, position);
+        glm_rotate_y(occ->world, sRandom(&rng, 0.0f, 2.0f * (float) M_PI), occ->world);
+        glm_rotate_x(occ->world, sRandom(&rng, -0.3f, 0.3f), occ->world);
+        glm_scale(occ->world, scale);
+    }
+
+    scene->boxCount = boxCount;
+    scene->boxes = vxAlloc(boxCount, BenchBox);
+    for (size_t i = 0; i < boxCount; i++) {
+        BenchBox* b = &scene->boxes[i];
+        vec3 center = {sRandom(&rng, -40.0f, 40.0f), sRandom(&rng, -2.0f, 6.0f), sRandom(&rng, -100.0f, -5.0f)};
+        vec3 extent = {sRandom(&rng, 0.1f, 1.0f), sRandom(&rng, 0.1f, 1.0f), sRandom(&rng, 0.1f, 1.0f)};
+        glm_vec3_sub(center, extent, b->min);
+        glm_vec3_add(center, extent, b->max);
+    }
+}
+
+static void sDeleteScene (BenchScene* scene) {
+    vxFree(scene->occluders);
+    vxFree(scene->boxes);
+    memset(scene, 0, sizeof(BenchScene));
+}
+
+// Projects like the occlusion buffer does, to pixels and depth.
+static bool sProject (mat4 m, vec3 p, vec3 out) {
+    vec4 clip;
+    glm_mat4_mulv(m, (vec4){p[0], p[1], p[2], 1.0f}, clip);
+    if (clip[3] <= 1e-5f) { return false; }
+    float iw = 1.0f / clip[3];
+    out[0] = (clip[0] * iw * 0.5f + 0.5f) * OCCLUSION_WIDTH;
+    out[1] = (clip[1] * iw * 0.5f + 0.5f) * OCCLUSION_HEIGHT;
+    out[2] = clip[2] * iw;
+    return out[2] <= 1.0f;
+}
+
+// Point-samples a triangle into the reference. Triangles the occlusion buffer is allowed to skip (not fully in front of
+// the near plane, or back-facing) are skipped here too, anything else is rasterized exactly.
+static void sRasterizeReference (vec3 v0, vec3 v1, vec3 v2, bool cullBackFaces) {
+    float area = (v1[0] - v0[0]) * (v2[1] - v0[1]) - (v1[1] - v0[1]) * (v2[0] - v0[0]);
+    if (area == 0.0f || (cullBackFaces && area < 0.0f)) { return; }
+    const float s = OCCLUSIONBENCH_SUBSAMPLES;
+    float minX = vxMin(vxMin(v0[0], v1[0]), v2[0]) * s, maxX = vxMax(vxMax(v0[0], v1[0]), v2[0]) * s;
+    float minY = vxMin(vxMin(v0[1], v1[1]), v2[1]) * s, maxY = vxMax(vxMax(v0[1], v1[1]), v2[1]) * s;
+    int x0 = (int) floorf(vxClamp(minX, 0.0f, (float)(OCCLUSIONBENCH_REF_W - 1)));
+    int x1 = (int) floorf(vxClamp(maxX, 0.0f, (float)(OCCLUSIONBENCH_REF_W - 1)));
+    int y0 = (int) floorf(vxClamp(minY, 0.0f, (float)(OCCLUSIONBENCH_REF_H - 1)));
+    int y1 = (int) floorf(vxClamp(maxY, 0.0f, (float)(OCCLUSIONBENCH_REF_H - 1)));
+    for (int y = y0; y <= y1; y++) {
+        for (int x = x0; x <= x1; x++) {
+            float px = ((float) x + 0.5f) / s;
+            float py = ((float) y + 0.5f) / s;
+            float w0 = ((v1[0] - px) * (v2[1] - py) - (v1[1] - py) * (v2[0] - px)) / area;
+            float w1 = ((v2[0] - px) * (v0[1] - py) - (v2[1] - py) * (v0[0] - px)) / area;
+            float w2 = 1.0f - w0 - w1;
+            if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f) { continue; }
+            float z = w0 * v0[2] + w1 * v1[2] + w2 * v2[2];
+            sReference[y][x] = vxMax(sReference[y][x], z);
+        }
+    }
+}
+
+static void sRenderReference (BenchScene* scene, mat4 viewProj) {
+    memset(sReference, 0, sizeof(sReference));
+    for (size_t i = 0; i < scene->occluderCount; i++) {
+        BenchOccluder* occ = &scene->occluders[i];
+        mat4 m;
+        glm_mat4_mul(viewProj, occ->world, m);
+        float* positions = occ->mesh->cpu_attributes[ATTR_POSITION];
+        uint32_t* indices = occ->mesh->cpu_indices;
+        for (size_t t = 0; t < occ->mesh->cpu_index_count; t += 3) {
+            vec3 v [3];
+            bool valid = true;
+            for (int k = 0; k < 3; k++) {
+                valid &= sProject(m, &positions[indices[t + k] * 3], v[k]);
+            }
+            if (valid) {
+                sRasterizeReference(v[0], v[1], v[2], occ->cullBackFaces);
+            }
+        }
+    }
+}
+
+static void sRenderOcclusion (OcclusionBuffer* ob, BenchScene* scene) {
+    ClearOcclusionBuffer(ob, &scene->cam);
+    for (size_t i = 0; i < scene->occluderCount; i++) {
+        BenchOccluder* occ = &scene->occluders[i];
+        AddOccluder(ob, occ->world, occ->mesh, occ->cullBackFaces);
+    }
+    FinishOcclusionBuffer(ob);
+}
+
+// Returns the number of violations. Counts boxes that are hidden in the reference and those the buffer culls.
+static size_t sCheckScene (OcclusionBuffer* ob, BenchScene* scene, size_t* hidden, size_t* culled) {
+    sRenderOcclusion(ob, scene);
+    sRenderReference(scene, ob->viewProj);
+    size_t violations = 0;
+    const int s = OCCLUSIONBENCH_SUBSAMPLES;
+
+    for (int y = 0; y < OCCLUSION_HEIGHT; y++) {
+        for (int x = 0; x < OCCLUSION_WIDTH; x++) {
+            float refMin = FLT_MAX;
+            for (int sy = 0; sy < s; sy++) {
+                for (int sx = 0; sx < s; sx++) {
+                    refMin = vxMin(refMin, sReference[y * s + sy][x * s + sx]);
+                }
+            }
+            if (ob->depth[y][x] > refMin + 1e-5f) {
+                if (violations < 8) {
+                    vxLog("Pixel %d, %d is nearer than the reference (%f > %f)", x, y, ob->depth[y][x], refMin);
+                }
+                violations++;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < scene->boxCount; i++) {
+        BenchBox* b = &scene->boxes[i];
+        bool occluded = IsAABBOccluded(ob, b->min, b->max);
+        // Hidden in the reference if every sample of every pixel the box touches is nearer than the box:
+        float rect [4] = {FLT_MAX, FLT_MAX, -FLT_MAX, -FLT_MAX};
+        float nearZ = 0.0f;
+        bool projected = true;
+        for (int c = 0; c < 8; c++) {
+            vec3 corner = {(c & 1) ? b->max[0] : b->min[0], (c & 2) ? b->max[1] : b->min[1],
+                           (c & 4) ? b->max[2] : b->min[2]};
+            vec3 p;
+            projected &= sProject(ob->viewProj, corner, p);
+            rect[0] = vxMin(rect[0], p[0]);
+            rect[1] = vxMin(rect[1], p[1]);
+            rect[2] = vxMax(rect[2], p[0]);
+            rect[3] = vxMax(rect[3], p[1]);
+            nearZ = vxMax(nearZ, p[2]);
+        }
+        bool onScreen = projected && rect[2] >= 0.0f && rect[3] >= 0.0f &&
+            rect[0] <= OCCLUSION_WIDTH && rect[1] <= OCCLUSION_HEIGHT;
+        bool refHidden = onScreen;
+        if (onScreen) {
+            int x0 = (int) floorf(vxClamp(rect[0], 0.0f, (float)(OCCLUSION_WIDTH - 1)));
+            int y0 = (int) floorf(vxClamp(rect[1], 0.0f, (float)(OCCLUSION_HEIGHT - 1)));
+            int x1 = (int) floorf(vxClamp(rect[2], 0.0f, (float)(OCCLUSION_WIDTH - 1)));
+            int y1 = (int) floorf(vxClamp(rect[3], 0.0f, (float)(OCCLUSION_HEIGHT - 1)));
+            for (int y = y0 * s; y < (y1 + 1) * s && refHidden; y++) {
+                for (int x = x0 * s; x < (x1 + 1) * s && refHidden; x++) {
+                    refHidden = (sReference[y][x] > nearZ - 1e-5f);
+                }
+            }
+        }
+        if (occluded && !refHidden) {
+            if (violations < 8) {
+                vxLog("Box %ju is culled but visible in the reference", i);
+            }
+            violations++;
+        }
+        *hidden += refHidden;
+        *culled += occluded && refHidden;
+    }
+    return violations;
+}
+
+static void sRunBenchmark (OcclusionBuffer* ob, BenchScene* scene, int frames, int threads) {
+    if (threads > 1) {
+        vxStartJobs(threads - 1);
+    }
+    double tRasterize = 0.0, tTest = 0.0;
+    size_t culled = 0;
+    for (int f = 0; f < frames; f++) {
+        double t0 = sTime();
+        sRenderOcclusion(ob, scene);
+        double t1 = sTime();
+        for (size_t i = 0; i < scene->boxCount; i++) {
+            culled += IsAABBOccluded(ob, scene->boxes[i].min, scene->boxes[i].max);
+        }
+        double t2 = sTime();
+        tRasterize += t1 - t0;
+        tTest += t2 - t1;
+    }
+    vxStopJobs();
+    vxLog("%7d  %13.3lf  %12.1lf  %8ju", threads, tRasterize * 1e3 / frames,
+        tTest * 1e9 / ((double) frames * scene->boxCount), culled / frames);
+}
+
+int main (int argc, char** argv) {
+    vxEnableSignalHandlers();
+    vxConfigureLogging();
+    size_t occluderCount = (argc > 1) ? (size_t) atoll(argv[1]) : 200;
+    size_t boxCount = (argc > 2) ? (size_t) atoll(argv[2]) : 10000;
+    int sceneCount = (argc > 3) ? atoi(argv[3]) : 8;
+    int frames = (argc > 4) ? atoi(argv[4]) : 200;
+    int maxThreads = (argc > 5) ? atoi(argv[5]) : vxCoreCount();
+    if (occluderCount == 0 || boxCount == 0 || sceneCount < 1 || frames < 0) {
+        vxLog("Usage: OcclusionBench [occluders = 200] [test boxes = 10000] [scenes = 8] [frames = 200] "
+            "[max threads = all cores]");
+        return 1;
+    }
+    maxThreads = vxClamp(maxThreads, 1, 256);
+
+    static Mesh box, wall;
+    static OcclusionBuffer ob;
+    static BenchScene scenes [64];
+    sceneCount = vxMin(sceneCount, (int) vxSize(scenes));
+    sMakeMeshes(&box, &wall);
+
+    size_t violations = 0, hidden = 0, culled = 0;
+    for (int i = 0; i < sceneCount; i++) {
+        sMakeScene(&scenes[i], occluderCount, boxCount, &box, &wall, (uint64_t) i + 1);
+        violations += sCheckScene(&ob, &scenes[i], &hidden, &culled);
+    }
+    vxLog("%d scenes of %ju occluders and %ju test boxes: %ju violations, %ju of %ju boxes hidden in the reference "
+        "culled (%.1lf%%)", sceneCount, occluderCount, boxCount, violations, culled, hidden,
+        hidden ? 100.0 * culled / hidden : 100.0);
+
+    if (frames > 0) {
+        vxLog("Times are per frame (rasterizing) and per box (testing), wall clock.");
+        vxLog("%7s  %13s  %12s  %8s", "threads", "rasterize ms", "test ns/box", "culled");
+        for (int threads = 1; threads <= maxThreads; threads *= 2) {
+            sRunBenchmark(&ob, &scenes[0], frames, threads);
+            if (threads < maxThreads && threads * 2 > maxThreads) {
+                sRunBenchmark(&ob, &scenes[0], frames, maxThreads);
+            }
+        }
+    }
+
+    for (int i = 0; i < sceneCount; i++) {
+        sDeleteScene(&scenes[i]);
+    }
+    DeleteOcclusionBuffer(&ob);
+    return (violations == 0) ? 0 : 1;
+}
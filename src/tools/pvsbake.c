@@ -0,0 +1,330 @@
+// PVSBake: offline baking of potentially visible sets (see scene/pvs.h).
+//
+// Divides the bounds of a scene into a grid of view cells and casts random rays from inside each cell against a BVH
+// of the scene's triangles. Every object hit by a ray is visible from the cell, as is every object whose bounds
+// overlap the cell. Blended and alpha-masked triangles don't stop rays, since they can be seen through. Cells are
+// baked in parallel on the job system, then compressed into a .vxpvs file next to the scene.
+//
+// Runs without a window or GL context. Usage, from the run directory (so asset paths resolve like in the game):
+//
+//     PVSBake <scene.vxscene> [cell size = 4] [rays per cell = 4096] [threads = all cores]
+
+#include "common.h"
+#include "data/model.h"
+#include "render/program.h"
+#include "scene/core.h"
+#include "scene/save.h"
+#include "scene/pvs.h"
+#include <time.h>
+
+// Grids with more cells than this are almost certainly a mistake (a cell size that's too small for the scene).
+#define PVSBAKE_MAX_CELLS (1 << 20)
+// Hits on see-through triangles recorded per ray, beyond this they're marked visible right away.
+#define PVSBAKE_MAX_TRANSPARENT_HITS 32
+// Hits closer than this to the ray origin are ignored, so rays starting on a surface don't hit it.
+static const float PVSBake_MinHitDistance = 1e-4f;
+
+typedef struct BakeTriangle {
+    vec3 v [3];
+    int32_t object;
+    bool occluder; // stops rays
+} BakeTriangle;
+
+typedef struct Bake {
+    Scene* scene;
+    PVS* pvs;
+    BVH bvh;                  // leaf data is an index into triangles
+    BakeTriangle* triangles;  // stb_ds array
+    int raysPerCell;
+    float maxDistance;
+    size_t words;             // bitset size per cell
+    uint64_t* cellBits;       // uncompressed bitsets of all cells
+    volatile int32_t cellsDone; // updated atomically, for progress reports
+} Bake;
+
+typedef struct BakeRay {
+    Bake* bake;
+    uint64_t* bits;
+    float tmax;
+    int32_t hitObject;
+    int transparentCount;
+    int32_t transparentObjects [PVSBAKE_MAX_TRANSPARENT_HITS];
+    float transparentT [PVSBAKE_MAX_TRANSPARENT_HITS];
+} BakeRay;
+
+static double sTime () {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+static int sPopcount (uint64_t x) {
+    int n = 0;
+    for (; x != 0; x &= x - 1) { n++; }
+    return n;
+}
+
+static inline void sSetBit (uint64_t* bits, int32_t i) {
+    bits[i / 64] |= (uint64_t) 1 << (i % 64);
+}
+
+// xorshift64*, seeded per cell.
+static inline float sRandom (uint64_t* state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return (float)((*state * 0x2545F4914F6CDD1DULL) >> 40) / (float)(1 << 24);
+}
+
+// Moller-Trumbore, without backface culling.
+static bool sRayTriangle (vec3 origin, vec3 dir, BakeTriangle* tri, float* outT) {
+    vec3 e1, e2, p, s, q;
+    glm_vec3_sub(tri->v[1], tri->v[0], e1);
+    glm_vec3_sub(tri->v[2], tri->v[0], e2);
+    glm_vec3_cross(dir, e2, p);
+    float det = glm_vec3_dot(e1, p);
+    if (fabsf(det) < 1e-12f) { return false; }
+    float invDet = 1.0f / det;
+    glm_vec3_sub(origin, tri->v[0], s);
+    float u = glm_vec3_dot(s, p) * invDet;
+    if (u < 0.0f || u > 1.0f) { return false; }
+    glm_vec3_cross(s, e1, q);
+    float v = glm_vec3_dot(dir, q) * invDet;
+    if (v < 0.0f || u + v > 1.0f) { return false; }
+    *outT = glm_vec3_dot(e2, q) * invDet;
+    return true;
+}
+
+static float sRayCallback (void* user, int32_t proxy, int32_t data, vec3 origin, vec3 dir, float tmax) {
+    BakeRay* ray = (BakeRay*) user;
+    BakeTriangle* tri = &ray->bake->triangles[data];
+    float t;
+    if (!sRayTriangle(origin, dir, tri, &t) || t < PVSBake_MinHitDistance || t > tmax) {
+        return tmax;
+    }
+    if (tri->occluder) {
+        ray->hitObject = tri->object;
+        ray->tmax = t;
+        return t;
+    }
+    if (ray->transparentCount < PVSBAKE_MAX_TRANSPARENT_HITS) {
+        ray->transparentObjects[ray->transparentCount] = tri->object;
+        ray->transparentT[ray->transparentCount] = t;
+        ray->transparentCount++;
+    } else {
+        sSetBit(ray->bits, tri->object);
+    }
+    return tmax;
+}
+
+static void sBakeCell (Bake* b, int64_t cell, uint64_t* bits, uint64_t* rng) {
+    PVS* pvs = b->pvs;
+    int32_t coords [3] = {
+        (int32_t)(cell % pvs->dims[0]),
+        (int32_t)((cell / pvs->dims[0]) % pvs->dims[1]),
+        (int32_t)(cell / ((int64_t) pvs->dims[0] * pvs->dims[1])),
+    };
+    vec3 cellMin, cellMax;
+    for (int i = 0; i < 3; i++) {
+        cellMin[i] = pvs->min[i] + coords[i] * pvs->cellSize;
+        cellMax[i] = cellMin[i] + pvs->cellSize;
+    }
+
+    // Objects overlapping the cell can be arbitrarily close to the camera, and objects without triangles (lights)
+    // can't be hit, so both are always visible:
+    for (size_t i = 0; i < pvs->objectCount; i++) {
+        float* bounds = &pvs->objectBounds[i * 6];
+        bool overlaps = bounds[0] <= cellMax[0] && bounds[1] <= cellMax[1] && bounds[2] <= cellMax[2] &&
+                        bounds[3] >= cellMin[0] && bounds[4] >= cellMin[1] && bounds[5] >= cellMin[2];
+        if (overlaps || b->scene->objects[i].type != GAMEOBJECT_MODEL) {
+            sSetBit(bits, (int32_t) i);
+        }
+    }
+
+    for (int r = 0; r < b->raysPerCell; r++) {
+        vec3 origin, dir;
+        for (int i = 0; i < 3; i++) {
+            origin[i] = cellMin[i] + sRandom(rng) * pvs->cellSize;
+        }
+        // Uniformly distributed direction:
+        float z = 2.0f * sRandom(rng) - 1.0f;
+        float phi = 2.0f * (float) M_PI * sRandom(rng);
+        float rxy = sqrtf(vxMax(1.0f - z * z, 0.0f));
+        dir[0] = rxy * cosf(phi);
+        dir[1] = rxy * sinf(phi);
+        dir[2] = z;
+
+        BakeRay ray = {0};
+        ray.bake = b;
+        ray.bits = bits;
+        ray.tmax = b->maxDistance;
+        ray.hitObject = -1;
+        BVHQueryRay(&b->bvh, origin, dir, b->maxDistance, sRayCallback, &ray);
+        if (ray.hitObject >= 0) {
+            sSetBit(bits, ray.hitObject);
+        }
+        for (int i = 0; i < ray.transparentCount; i++) {
+            if (ray.transparentT[i] <= ray.tmax) {
+                sSetBit(bits, ray.transparentObjects[i]);
+            }
+        }
+    }
+}
+
+// Bakes a range of cells, called by vxParallelFor. Each cell seeds its own random numbers, so the result doesn't
+// depend on how cells are spread over the threads.
+static void sBakeCells (void* user, size_t begin, size_t end) {
+    Bake* b = (Bake*) user;
+    int32_t cellCount = b->pvs->dims[0] * b->pvs->dims[1] * b->pvs->dims[2];
+    int32_t reportEvery = vxMax(cellCount / 20, 1);
+    for (size_t cell = begin; cell < end; cell++) {
+        uint64_t rng = 0x9E3779B97F4A7C15ULL * (uint64_t)(cell + 1);
+        sBakeCell(b, (int64_t) cell, &b->cellBits[cell * b->words], &rng);
+        int32_t done = vxAtomicAdd32(&b->cellsDone, 1);
+        if (done % reportEvery == 0) {
+            vxLog("Baked %d/%d cells", done, cellCount);
+        }
+    }
+}
+
+// Collects the triangles of all models in world space and builds the BVH over them.
+static void sCollectTriangles (Bake* b) {
+    Scene* scene = b->scene;
+    for (size_t i = 0; i < scene->size; i++) {
+        GameObject* obj = &scene->objects[i];
+        if (obj->type != GAMEOBJECT_MODEL || obj->model.model == NULL) { continue; }
+        Model* model = obj->model.model;
+        for (size_t imesh = 0; imesh < model->meshCount; imesh++) {
+            Mesh* mesh = &model->meshes[imesh];
+            Material* material = model->meshMaterials[imesh];
+            float* positions = mesh->cpu_attributes[ATTR_POSITION];
+            if (mesh->type != GL_TRIANGLES || positions == NULL || mesh->cpu_indices == NULL) { continue; }
+            uint8_t components = mesh->cpu_attribute_components[ATTR_POSITION];
+            mat4 m;
+            glm_mat4_mul(obj->worldMatrix, model->meshTransforms[imesh], m);
+            bool occluder = material != NULL && !material->blend && !material->stipple;
+            for (size_t k = 0; k + 2 < mesh->cpu_index_count; k += 3) {
+                BakeTriangle tri;
+                tri.object = (int32_t) i;
+                tri.occluder = occluder;
+                for (int v = 0; v < 3; v++) {
+                    float* p = &positions[(size_t) mesh->cpu_indices[k + v] * components];
+                    glm_mat4_mulv3(m, (vec3){p[0], p[1], p[2]}, 1.0f, tri.v[v]);
+                }
+                stbds_arrput(b->triangles, tri);
+            }
+        }
+    }
+
+    InitBVH(&b->bvh, 0.0f);
+    for (ptrdiff_t i = 0; i < stbds_arrlen(b->triangles); i++) {
+        BakeTriangle* tri = &b->triangles[i];
+        vec3 min, max;
+        glm_vec3_minv(tri->v[0], tri->v[1], min);
+        glm_vec3_minv(min, tri->v[2], min);
+        glm_vec3_maxv(tri->v[0], tri->v[1], max);
+        glm_vec3_maxv(max, tri->v[2], max);
+        BVHInsert(&b->bvh, min, max, (int32_t) i);
+    }
+}
+
+int main (int argc, char** argv) {
+    vxEnableSignalHandlers();
+    vxConfigureLogging();
+    if (argc < 2) {
+        vxLog("Usage: PVSBake <scene.vxscene> [cell size = 4] [rays per cell = 4096] [threads = all cores]");
+        return 1;
+    }
+    const char* sceneFilename = argv[1];
+    float cellSize = (argc > 2) ? (float) atof(argv[2]) : 4.0f;
+    int raysPerCell = (argc > 3) ? atoi(argv[3]) : 4096;
+    int threadCount = (argc > 4) ? atoi(argv[4]) : vxCoreCount();
+    if (!(cellSize > 0.0f) || raysPerCell <= 0) {
+        vxLog("Cell size and ray count must be positive.");
+        return 1;
+    }
+    threadCount = vxClamp(threadCount, 1, 256);
+
+    double tStart = sTime();
+    ModelGeometryOnly = true;
+    LoadModels();
+    static Scene scene = {0};
+    LoadScene(&scene, sceneFilename);
+    if (scene.size == 0) {
+        vxLog("Scene %s is empty or couldn't be read.", sceneFilename);
+        return 1;
+    }
+    UpdateScene(&scene);
+
+    // The grid covers the bounds of every model in the scene:
+    static PVS pvs = {0};
+    vec3 sceneMin = {FLT_MAX, FLT_MAX, FLT_MAX};
+    vec3 sceneMax = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+    for (size_t i = 0; i < scene.size; i++) {
+        if (scene.objects[i].type != GAMEOBJECT_MODEL) { continue; }
+        vec3 min, max;
+        GetPVSObjectBounds(&scene.objects[i], min, max);
+        glm_vec3_minv(sceneMin, min, sceneMin);
+        glm_vec3_maxv(sceneMax, max, sceneMax);
+    }
+    if (sceneMin[0] > sceneMax[0]) {
+        vxLog("Scene %s doesn't contain any models.", sceneFilename);
+        return 1;
+    }
+    int32_t dims [3];
+    for (int i = 0; i < 3; i++) {
+        dims[i] = vxMax((int32_t) ceilf((sceneMax[i] - sceneMin[i]) / cellSize), 1);
+    }
+    int64_t cellCount = (int64_t) dims[0] * dims[1] * dims[2];
+    if (cellCount > PVSBAKE_MAX_CELLS) {
+        vxLog("%d x %d x %d cells is too many, use a larger cell size.", dims[0], dims[1], dims[2]);
+        return 1;
+    }
+    InitPVS(&pvs, sceneMin, cellSize, dims, scene.size);
+    for (size_t i = 0; i < scene.size; i++) {
+        GetPVSObjectBounds(&scene.objects[i], &pvs.objectBounds[i * 6], &pvs.objectBounds[i * 6 + 3]);
+    }
+
+    static Bake bake = {0};
+    bake.scene = &scene;
+    bake.pvs = &pvs;
+    bake.raysPerCell = raysPerCell;
+    bake.maxDistance = glm_vec3_distance(sceneMin, sceneMax);
+    bake.words = PVSWordCount(scene.size);
+    sCollectTriangles(&bake);
+    vxLog("Built BVH over %jd triangles in %.02lf s", (intmax_t) stbds_arrlen(bake.triangles), sTime() - tStart);
+
+    bake.cellBits = vxAlloc((size_t) cellCount * bake.words, uint64_t);
+    memset(bake.cellBits, 0, (size_t) cellCount * bake.words * sizeof(uint64_t));
+    vxLog("Baking %d x %d x %d cells with %d rays each on %d threads...", dims[0], dims[1], dims[2], raysPerCell,
+        threadCount);
+    double tBake = sTime();
+    vxStartJobs(threadCount - 1);
+    vxParallelFor("Bake PVS Cells", (size_t) cellCount, 1, sBakeCells, &bake);
+    vxStopJobs();
+
+    // Compress in cell order, and report how much of the scene an average cell sees:
+    size_t visibleTotal = 0;
+    for (int64_t cell = 0; cell < cellCount; cell++) {
+        uint64_t* bits = &bake.cellBits[cell * bake.words];
+        for (size_t w = 0; w < bake.words; w++) {
+            visibleTotal += (size_t) sPopcount(bits[w]);
+        }
+        AddPVSCell(&pvs, bits);
+    }
+
+    static char pvsFilename [4096];
+    GetSceneSiblingFilename(sceneFilename, ".vxpvs", pvsFilename, sizeof(pvsFilename));
+    if (!SavePVS(&pvs, pvsFilename)) {
+        return 1;
+    }
+    vxLog("Baked %jd cells in %.02lf s, %.01f%% of %ju objects visible per cell on average, %ju bytes written to %s",
+        cellCount, sTime() - tBake, 100.0 * visibleTotal / ((double) cellCount * scene.size), scene.size,
+        pvs.dataSize, pvsFilename);
+
+    vxFree(bake.cellBits);
+    stbds_arrfree(bake.triangles);
+    DeleteBVH(&bake.bvh);
+    DeletePVS(&pvs);
+    return 0;
+}
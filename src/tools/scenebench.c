@@ -0,0 +1,234 @@
+// SceneBench: benchmarks scene updates on synthetic scenes (see scene/stress.h).
+//
+// Generates a stress scene and runs AnimateStressScene, UpdateScene and UpdateRenderList on it for a number of frames,
+// reporting the time per object of each step. The run is repeated with 1, 2, 4, ... threads, each updating its own copy
+// of the scene at the same time. Ideally each thread keeps its single-threaded speed, anything below that is memory
+// bandwidth and cache space shared between cores. Then a single scene is updated with the job system running on 1, 2,
+// 4, ... threads, which shows how much of UpdateScene is spread over the pool. Deleting objects one at a time with
+// DeleteObjectFromScene is timed on its own at the end.
+//
+// Models are synthetic (a few meshes with unit bounds), so no assets and no window or GL context are needed. Usage:
+//
+//     SceneBench [objects = 100000] [hierarchy depth = 4] [point lights = 256] [motion fraction = 0.1]
+//                [frames = 100] [max threads = all cores]
+
+#include "common.h"
+#include "data/model.h"
+#include "scene/core.h"
+#include "scene/stress.h"
+#include <time.h>
+
+#define SCENEBENCH_MODELS 8
+#define SCENEBENCH_MAX_MESHES 4
+
+typedef struct BenchWorker {
+    StressSceneDesc* desc;
+    int frames;
+    Scene scene;
+    RenderList rl;
+    double tAnimate; // seconds, summed over all frames
+    double tUpdate;
+    double tRenderList;
+} BenchWorker;
+
+static double sTime () {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+// Sets up models with 1 to SCENEBENCH_MAX_MESHES meshes each. Meshes have bounds and a material but no geometry, which
+// is all that scene updates and render lists look at.
+static void sMakeModels (Model* models, Material* material) {
+    for (int i = 0; i < SCENEBENCH_MODELS; i++) {
+        Model* mdl = &models[i];
+        memset(mdl, 0, sizeof(Model));
+        char name [32];
+        stbsp_snprintf(name, (int) sizeof(name), "MDL_SYNTHETIC_%d", i);
+        mdl->name = strdup(name);
+        mdl->meshCount = 1 + i % SCENEBENCH_MAX_MESHES;
+        mdl->meshes = vxAlloc(mdl->meshCount, Mesh);
+        mdl->meshTransforms = vxAlloc(mdl->meshCount, mat4);
+        mdl->meshMaterials = vxAlloc(mdl->meshCount, Material*);
+        memset(mdl->meshes, 0, mdl->meshCount * sizeof(Mesh));
+        for (size_t k = 0; k < mdl->meshCount; k++) {
+            mdl->meshes[k].type = GL_TRIANGLES;
+            glm_vec3_broadcast(-1.0f, mdl->meshes[k].aabbMin);
+            glm_vec3_broadcast(+1.0f, mdl->meshes[k].aabbMax);
+            glm_mat4_identity(mdl->meshTransforms[k]);
+            mdl->meshMaterials[k] = material;
+        }
+        glm_vec3_broadcast(-1.0f, mdl->aabbMin);
+        glm_vec3_broadcast(+1.0f, mdl->aabbMax);
+        mdl->resident = true;
+    }
+}
+
+static void sFreeRenderList (RenderList* rl) {
+    if (rl->meshes != NULL) { vxFree(rl->meshes); }
+    if (rl->directionalLights != NULL) { vxFree(rl->directionalLights); }
+    if (rl->pointLights != NULL) { vxFree(rl->pointLights); }
+    if (rl->lightProbes != NULL) { vxFree(rl->lightProbes); }
+    memset(rl, 0, sizeof(RenderList));
+}
+
+static void sWorkerThread (void* user) {
+    BenchWorker* w = (BenchWorker*) user;
+    for (int f = 0; f < w->frames; f++) {
+        double t0 = sTime();
+        AnimateStressScene(&w->scene, w->desc, (float) f / 60.0f);
+        double t1 = sTime();
+        UpdateScene(&w->scene);
+        double t2 = sTime();
+        UpdateRenderList(&w->rl, &w->scene);
+        double t3 = sTime();
+        w->tAnimate += t1 - t0;
+        w->tUpdate += t2 - t1;
+        w->tRenderList += t3 - t2;
+    }
+}
+
+// Runs the frames on the given number of threads, each with its own scene, and returns the number of objects updated
+// per second. Job workers, if any, are started for the timed frames and shared by all threads.
+static double sRunThreads (StressSceneDesc* desc, int frames, int threadCount, int jobWorkers,
+    double singleThreadRate)
+{
+    BenchWorker* workers = vxAlloc(threadCount, BenchWorker);
+    vxThread* threads = vxAlloc(threadCount, vxThread);
+    memset(workers, 0, threadCount * sizeof(BenchWorker));
+    for (int i = 0; i < threadCount; i++) {
+        BenchWorker* w = &workers[i];
+        w->desc = desc;
+        w->frames = frames;
+        GenerateStressScene(&w->scene, desc);
+        // The first update builds the BVH and the whole render list, which isn't what's being measured:
+        UpdateScene(&w->scene);
+        UpdateRenderList(&w->rl, &w->scene);
+    }
+
+    if (jobWorkers > 0) {
+        vxStartJobs(jobWorkers);
+    }
+    double tStart = sTime();
+    for (int i = 1; i < threadCount; i++) {
+        vxCheck(vxStartThread(&threads[i], sWorkerThread, &workers[i]));
+    }
+    sWorkerThread(&workers[0]);
+    for (int i = 1; i < threadCount; i++) {
+        vxJoinThread(&threads[i]);
+    }
+    double tWall = sTime() - tStart;
+    vxStopJobs();
+
+    double tAnimate = 0.0, tUpdate = 0.0, tRenderList = 0.0;
+    for (int i = 0; i < threadCount; i++) {
+        tAnimate += workers[i].tAnimate;
+        tUpdate += workers[i].tUpdate;
+        tRenderList += workers[i].tRenderList;
+    }
+    double objectFrames = (double) threadCount * frames * workers[0].scene.size;
+    double rate = objectFrames / tWall;
+    double scaling = (singleThreadRate > 0.0) ? rate / singleThreadRate : 1.0;
+    int totalThreads = threadCount + jobWorkers;
+    vxLog("%7d  %13.2lf  %12.2lf  %16.2lf  %11.2lf  %14.2lf  %6.2lfx (%3.0lf%%)", totalThreads,
+        tAnimate * 1e9 / objectFrames, tUpdate * 1e9 / objectFrames, tRenderList * 1e9 / objectFrames,
+        (tAnimate + tUpdate + tRenderList) * 1e9 / objectFrames, rate * 1e-6, scaling, 100.0 * scaling / totalThreads);
+
+    for (int i = 0; i < threadCount; i++) {
+        DeleteScene(&workers[i].scene);
+        sFreeRenderList(&workers[i].rl);
+    }
+    vxFree(workers);
+    vxFree(threads);
+    return rate;
+}
+
+// Deletes random objects one at a time, updating the scene and render list after each batch of deletes like a frame
+// would.
+static void sRunDeletes (StressSceneDesc* desc, size_t deleteCount) {
+    static Scene scene;
+    static RenderList rl;
+    GenerateStressScene(&scene, desc);
+    UpdateScene(&scene);
+    UpdateRenderList(&rl, &scene);
+    size_t sizeBefore = scene.size;
+
+    uint64_t rng = 0x9E3779B97F4A7C15ULL;
+    double tStart = sTime();
+    for (size_t i = 0; i < deleteCount && scene.size > 0; i++) {
+        rng ^= rng >> 12;
+        rng ^= rng << 25;
+        rng ^= rng >> 27;
+        size_t index = (size_t)((rng * 0x2545F4914F6CDD1DULL) >> 11) % scene.size;
+        DeleteObjectFromScene(&scene, &scene.objects[index]);
+    }
+    double tDelete = sTime() - tStart;
+    tStart = sTime();
+    UpdateScene(&scene);
+    UpdateRenderList(&rl, &scene);
+    double tRebuild = sTime() - tStart;
+
+    vxLog("Deleted %ju of %ju objects: %.0lf ns per delete (%.3lf ns per delete per object), %.02lf ms to update the "
+        "scene and render list afterwards", deleteCount, sizeBefore, tDelete * 1e9 / deleteCount,
+        tDelete * 1e9 / deleteCount / sizeBefore, tRebuild * 1e3);
+    DeleteScene(&scene);
+    sFreeRenderList(&rl);
+}
+
+int main (int argc, char** argv) {
+    vxEnableSignalHandlers();
+    vxConfigureLogging();
+    StressSceneDesc desc = {0};
+    desc.objectCount = (argc > 1) ? (size_t) atoll(argv[1]) : 100000;
+    desc.hierarchyDepth = (argc > 2) ? atoi(argv[2]) : 4;
+    desc.pointLightCount = (argc > 3) ? (size_t) atoll(argv[3]) : 256;
+    desc.motionFraction = (argc > 4) ? (float) atof(argv[4]) : 0.1f;
+    int frames = (argc > 5) ? atoi(argv[5]) : 100;
+    int maxThreads = (argc > 6) ? atoi(argv[6]) : vxCoreCount();
+    if (desc.objectCount == 0 || desc.hierarchyDepth < 1 || frames < 1) {
+        vxLog("Usage: SceneBench [objects = 100000] [hierarchy depth = 4] [point lights = 256] "
+            "[motion fraction = 0.1] [frames = 100] [max threads = all cores]");
+        return 1;
+    }
+    maxThreads = vxClamp(maxThreads, 1, 256);
+
+    static Model models [SCENEBENCH_MODELS];
+    static Model* modelList [SCENEBENCH_MODELS];
+    static Material material;
+    InitMaterial(&material);
+    sMakeModels(models, &material);
+    for (int i = 0; i < SCENEBENCH_MODELS; i++) {
+        modelList[i] = &models[i];
+    }
+    desc.models = modelList;
+    desc.modelCount = SCENEBENCH_MODELS;
+    // Keeps the density the same for any object count, about one chain per 8x8x8 block:
+    desc.extent = 8.0f * cbrtf((float) desc.objectCount / (float) desc.hierarchyDepth);
+    desc.seed = 1;
+
+    vxLog("%ju model objects in chains of %d, %ju point lights, %.0f%% of the objects animated, %d frames",
+        desc.objectCount, desc.hierarchyDepth, desc.pointLightCount, desc.motionFraction * 100.0f, frames);
+    vxLog("Times are per object and frame, in ns. Each thread updates its own copy of the scene.");
+    vxLog("%7s  %13s  %12s  %16s  %11s  %14s  %s", "threads", "AnimateStress", "UpdateScene", "UpdateRenderList",
+        "total", "Mobjects/s", "scaling");
+    double singleThreadRate = 0.0;
+    for (int threads = 1; threads <= maxThreads; threads *= 2) {
+        double rate = sRunThreads(&desc, frames, threads, 0, singleThreadRate);
+        if (threads == 1) {
+            singleThreadRate = rate;
+        }
+        if (threads < maxThreads && threads * 2 > maxThreads) {
+            sRunThreads(&desc, frames, maxThreads, 0, singleThreadRate);
+        }
+    }
+    vxLog("One scene, updated with the job system. Times are wall clock, per object and frame.");
+    for (int threads = 2; threads <= maxThreads; threads *= 2) {
+        sRunThreads(&desc, frames, 1, threads - 1, singleThreadRate);
+        if (threads < maxThreads && threads * 2 > maxThreads) {
+            sRunThreads(&desc, frames, 1, maxThreads - 1, singleThreadRate);
+        }
+    }
+
+    sRunDeletes(&desc, vxClamp(desc.objectCount / 10, 1, 1000));
+    return 0;
+}